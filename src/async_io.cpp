@@ -0,0 +1,252 @@
+#include "async_io.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "saavi_exception.h"
+
+namespace {
+
+int ioUringSetup(unsigned entries, io_uring_params *params) {
+  return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete,
+                 unsigned flags) {
+  return static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit,
+                                    minComplete, flags, nullptr, 0));
+}
+
+// an fdatasync of the file
+void prepareSync(io_uring_sqe &sqe, int fd) {
+  sqe.opcode = IORING_OP_FSYNC;
+  sqe.fd = fd;
+  sqe.fsync_flags = IORING_FSYNC_DATASYNC;
+}
+
+// the operation behind a submission, which the kernel hands back in the
+// user data of its completion. The stop marker has none.
+struct Operation {
+  AsyncIo::Completion completion;
+};
+
+}  // namespace
+
+std::unique_ptr<AsyncIo> AsyncIo::create(unsigned queueDepth) {
+  io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  // the stop marker takes up a slot as well
+  int fd = ioUringSetup(queueDepth + 1, &params);
+  if (fd < 0) {
+    return nullptr;
+  }
+
+  std::unique_ptr<AsyncIo> io(new AsyncIo());
+  io->m_fd = fd;
+  io->m_capacity = queueDepth;
+
+  // map the submission and completion rings, which newer kernels place in
+  // a single mapping, and the submission entries
+  io->m_sqRingSize =
+      params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  io->m_cqRingSize =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  const bool singleMapping = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (singleMapping) {
+    io->m_sqRingSize = io->m_cqRingSize =
+        std::max(io->m_sqRingSize, io->m_cqRingSize);
+  }
+  void *sqRing = ::mmap(nullptr, io->m_sqRingSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (sqRing == MAP_FAILED) {
+    ::close(fd);
+    return nullptr;
+  }
+  io->m_sqRing = sqRing;
+  void *cqRing = sqRing;
+  if (!singleMapping) {
+    cqRing = ::mmap(nullptr, io->m_cqRingSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cqRing == MAP_FAILED) {
+      ::munmap(sqRing, io->m_sqRingSize);
+      ::close(fd);
+      return nullptr;
+    }
+  }
+  io->m_cqRing = cqRing;
+  io->m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+  void *sqes = ::mmap(nullptr, io->m_sqesSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    if (!singleMapping) {
+      ::munmap(cqRing, io->m_cqRingSize);
+    }
+    ::munmap(sqRing, io->m_sqRingSize);
+    ::close(fd);
+    return nullptr;
+  }
+  io->m_sqes = static_cast<io_uring_sqe *>(sqes);
+
+  char *sq = static_cast<char *>(sqRing);
+  io->m_sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  io->m_sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  io->m_sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+  char *cq = static_cast<char *>(cqRing);
+  io->m_cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  io->m_cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  io->m_cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  io->m_cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+  io->m_completionThread = std::thread(&AsyncIo::completionLoop, io.get());
+  return io;
+}
+
+AsyncIo::~AsyncIo() {
+  if (m_completionThread.joinable()) {
+    // the completion thread stops once it reaps the marker and everything
+    // submitted before it has completed
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_inflight++;
+    const unsigned tail = *m_sqTail;
+    const unsigned index = tail & m_sqMask;
+    io_uring_sqe &sqe = m_sqes[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_NOP;
+    sqe.user_data = 0;
+    m_sqArray[index] = index;
+    __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+    while (ioUringEnter(m_fd, 1, 0, 0) < 0 &&
+           (errno == EINTR || errno == EAGAIN || errno == EBUSY)) {
+    }
+    lock.unlock();
+    m_completionThread.join();
+  }
+
+  if (m_sqes != nullptr) {
+    ::munmap(m_sqes, m_sqesSize);
+  }
+  if (m_cqRing != nullptr && m_cqRing != m_sqRing) {
+    ::munmap(m_cqRing, m_cqRingSize);
+  }
+  if (m_sqRing != nullptr) {
+    ::munmap(m_sqRing, m_sqRingSize);
+  }
+  if (m_fd >= 0) {
+    ::close(m_fd);
+  }
+}
+
+void AsyncIo::read(int fd, char *buffer, size_t length, unsigned long offset,
+                   Completion completion) {
+  submit(
+      [&](io_uring_sqe &sqe) {
+        sqe.opcode = IORING_OP_READ;
+        sqe.fd = fd;
+        sqe.addr = reinterpret_cast<uint64_t>(buffer);
+        sqe.len = static_cast<uint32_t>(length);
+        sqe.off = offset;
+      },
+      std::move(completion));
+}
+
+void AsyncIo::sync(int fd, Completion completion) {
+  submit([fd](io_uring_sqe &sqe) { prepareSync(sqe, fd); },
+         std::move(completion));
+}
+
+bool AsyncIo::trySync(int fd, Completion completion) {
+  return submit([fd](io_uring_sqe &sqe) { prepareSync(sqe, fd); },
+                std::move(completion), false);
+}
+
+bool AsyncIo::submit(const std::function<void(io_uring_sqe &)> &prepare,
+                     Completion completion, bool wait) {
+  std::unique_ptr<Operation> operation(new Operation{std::move(completion)});
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  // the completion queue is twice the size of the submission queue, so
+  // capping the operations in flight keeps it from ever overflowing
+  if (!wait && m_inflight >= m_capacity) {
+    return false;
+  }
+  m_roomCondition.wait(lock, [this] { return m_inflight < m_capacity; });
+
+  // only submitters write the tail, and only under the lock
+  const unsigned tail = *m_sqTail;
+  const unsigned index = tail & m_sqMask;
+  io_uring_sqe &sqe = m_sqes[index];
+  std::memset(&sqe, 0, sizeof(sqe));
+  prepare(sqe);
+  sqe.user_data = reinterpret_cast<uint64_t>(operation.get());
+  m_sqArray[index] = index;
+  __atomic_store_n(m_sqTail, tail + 1, __ATOMIC_RELEASE);
+
+  int submitted;
+  while ((submitted = ioUringEnter(m_fd, 1, 0, 0)) < 0 &&
+         (errno == EINTR || errno == EAGAIN || errno == EBUSY)) {
+  }
+  if (submitted < 0) {
+    // take the entry back, the kernel never saw it
+    __atomic_store_n(m_sqTail, tail, __ATOMIC_RELEASE);
+    throw SaaviException(std::string("failed to submit to io_uring : ") +
+                         strerror(errno));
+  }
+  m_inflight++;
+  operation.release();
+  return true;
+}
+
+void AsyncIo::completionLoop() {
+  std::vector<std::pair<Operation *, int>> batch;
+  bool stopping = false;
+  while (true) {
+    ioUringEnter(m_fd, 0, 1, IORING_ENTER_GETEVENTS);
+
+    // reap everything that has completed so far in one go
+    unsigned head = *m_cqHead;
+    const unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      const io_uring_cqe &cqe = m_cqes[head & m_cqMask];
+      batch.emplace_back(reinterpret_cast<Operation *>(cqe.user_data),
+                         cqe.res);
+    }
+    __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+    if (batch.empty()) {
+      continue;
+    }
+    {
+      // an operation is only handed to the kernel with the lock held, so
+      // taking it makes everything the submitter did visible here as well
+      std::lock_guard<std::mutex> lock(m_mutex);
+    }
+
+    for (auto &completed : batch) {
+      std::unique_ptr<Operation> operation(completed.first);
+      if (operation == nullptr) {
+        stopping = true;
+        continue;
+      }
+      try {
+        operation->completion(completed.second);
+      } catch (std::exception &e) {
+        // the completions report their own errors
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_inflight -= batch.size();
+    batch.clear();
+    m_roomCondition.notify_all();
+    if (stopping && m_inflight == 0) {
+      return;
+    }
+  }
+}
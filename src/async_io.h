@@ -0,0 +1,87 @@
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// An io_uring instance, driven with the raw system calls. Operations are
+// queued on the submission ring and handed to the kernel right away, so
+// that many of them can be in flight at once, and a completion thread reaps
+// whatever has completed in one go each time it wakes up and runs the
+// completions of the whole batch.
+//
+// At most queueDepth operations are in flight; submitting more waits for
+// some of them to complete. AsyncIo is safe to use from multiple threads.
+class AsyncIo {
+ public:
+  // called on the completion thread with the result of the operation - the
+  // number of bytes transferred or a negated errno
+  using Completion = std::function<void(int result)>;
+
+  // set up a ring with room for queueDepth operations. Returns nullptr if
+  // the kernel doesn't support io_uring or doesn't allow its use.
+  static std::unique_ptr<AsyncIo> create(unsigned queueDepth);
+  // waits for the operations in flight to complete
+  ~AsyncIo();
+  AsyncIo(const AsyncIo &) = delete;
+  AsyncIo &operator=(const AsyncIo &) = delete;
+
+  // read length bytes at offset of the file into buffer, which has to stay
+  // valid until the completion has run
+  void read(int fd, char *buffer, size_t length, unsigned long offset,
+            Completion completion);
+  // make the data written to the file durable, like fdatasync
+  void sync(int fd, Completion completion);
+  // sync unless the ring is full, in which case it returns false rather
+  // than wait for room, so the completion thread may call it too
+  bool trySync(int fd, Completion completion);
+
+  // whether the caller is the completion thread, which must not submit
+  // anything as it might have to wait for room that only it can make
+  bool onCompletionThread() const {
+    return std::this_thread::get_id() == m_completionThread.get_id();
+  }
+
+ private:
+  AsyncIo() = default;
+
+  // queue an operation, filled in by prepare, and submit it. Waits for room
+  // in the ring unless told not to, returns false if there was none.
+  bool submit(const std::function<void(io_uring_sqe &)> &prepare,
+              Completion completion, bool wait = true);
+  void completionLoop();
+
+  int m_fd{-1};
+  unsigned m_capacity{0};
+
+  // the rings shared with the kernel
+  void *m_sqRing{nullptr};
+  size_t m_sqRingSize{0};
+  void *m_cqRing{nullptr};
+  size_t m_cqRingSize{0};
+  io_uring_sqe *m_sqes{nullptr};
+  size_t m_sqesSize{0};
+  unsigned *m_sqTail{nullptr};
+  unsigned m_sqMask{0};
+  unsigned *m_sqArray{nullptr};
+  unsigned *m_cqHead{nullptr};
+  unsigned *m_cqTail{nullptr};
+  unsigned m_cqMask{0};
+  io_uring_cqe *m_cqes{nullptr};
+
+  // serialises the submissions and counts the operations in flight
+  std::mutex m_mutex;
+  std::condition_variable m_roomCondition;
+  unsigned m_inflight{0};
+  std::thread m_completionThread;
+};
+
+#endif
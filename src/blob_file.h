@@ -0,0 +1,60 @@
+#ifndef BLOB_FILE_H
+#define BLOB_FILE_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "record.h"
+
+/*
+ * Large values are kept out of the log in blob files, so that neither
+ * compaction nor recovery has to read or copy them.
+ *
+ * A blob file is laid out like a segment of the log - the file header, with
+ * FILE_FLAG_BLOB_FILE set in its flags, followed by records - and is named
+ * after the data file with ".blob." and its id as suffix. Each record holds
+ * a key and its value, compressed like the values in the log, and has no
+ * sequence number. Blob files are only ever appended to, and the newest of
+ * them is the one new blobs go to.
+ *
+ * The log refers to a blob with a record that has RECORD_FLAG_BLOB set and
+ * a blob pointer as its value:
+ *   blob file id (4) | offset (8) | record size (8)
+ */
+
+constexpr uint32_t FILE_FLAG_BLOB_FILE = 1 << 1;
+constexpr size_t BLOB_POINTER_SIZE = 20;
+
+// the location of a blob record
+struct BlobPointer {
+  uint32_t fileId{0};
+  uint64_t offset{0};
+  uint64_t size{0};
+
+  bool operator==(const BlobPointer &other) const {
+    return fileId == other.fileId && offset == other.offset &&
+           size == other.size;
+  }
+};
+
+inline std::string encodeBlobPointer(const BlobPointer &pointer) {
+  std::string buf(BLOB_POINTER_SIZE, '\0');
+  encodeFixed32(&buf[0], pointer.fileId);
+  encodeFixed64(&buf[4], pointer.offset);
+  encodeFixed64(&buf[12], pointer.size);
+  return buf;
+}
+
+// returns false if the data is not a blob pointer
+inline bool decodeBlobPointer(std::string_view data, BlobPointer &pointer) {
+  if (data.length() != BLOB_POINTER_SIZE) {
+    return false;
+  }
+  pointer.fileId = decodeFixed32(data.data());
+  pointer.offset = decodeFixed64(data.data() + 4);
+  pointer.size = decodeFixed64(data.data() + 12);
+  return true;
+}
+
+#endif
@@ -0,0 +1,73 @@
+#include "bloom_filter.h"
+
+#include <algorithm>
+
+namespace {
+
+// the bits probed for a key, starting at the hash and stepping by a delta
+// derived from it
+struct Probes {
+  uint64_t position;
+  uint64_t delta;
+
+  explicit Probes(uint64_t hash)
+      : position(hash), delta((hash >> 17) | (hash << 47)) {}
+  uint64_t next(uint64_t bits) {
+    const uint64_t bit = position % bits;
+    position += delta;
+    return bit;
+  }
+};
+
+}  // namespace
+
+uint64_t BloomFilter::hash(std::string_view key) {
+  // FNV-1a followed by the murmur3 finaliser to spread the bits
+  uint64_t h = 14695981039346656037ULL;
+  for (char c : key) {
+    h = (h ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+std::string BloomFilter::build(const std::vector<uint64_t> &hashes,
+                               int bitsPerKey) {
+  // k = ln 2 * bits per key gives the lowest false positive rate
+  const int numProbes = std::clamp(bitsPerKey * 69 / 100, 1, 30);
+  // a minimum size keeps the false positive rate of tiny filters down
+  const uint64_t bytes =
+      std::max<uint64_t>((hashes.size() * bitsPerKey + 7) / 8, 8);
+  const uint64_t bits = bytes * 8;
+
+  std::string data(bytes + 1, '\0');
+  for (uint64_t hash : hashes) {
+    Probes probes(hash);
+    for (int i = 0; i < numProbes; i++) {
+      const uint64_t bit = probes.next(bits);
+      data[bit / 8] |= static_cast<char>(1 << (bit % 8));
+    }
+  }
+  data[bytes] = static_cast<char>(numProbes);
+  return data;
+}
+
+bool BloomFilter::mayContain(std::string_view key) const {
+  if (m_data.length() < 2) {
+    return true;
+  }
+  const uint64_t bits = (m_data.length() - 1) * 8;
+  const int numProbes = static_cast<unsigned char>(m_data.back());
+  Probes probes(hash(key));
+  for (int i = 0; i < numProbes; i++) {
+    const uint64_t bit = probes.next(bits);
+    if ((m_data[bit / 8] & (1 << (bit % 8))) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
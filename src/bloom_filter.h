@@ -0,0 +1,40 @@
+#ifndef BLOOM_FILTER_H
+#define BLOOM_FILTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// A Bloom filter over the keys of a sorted run, so that a lookup can skip
+// the runs that don't hold the key without reading any of their blocks.
+//
+// The filter is built once from the hashes of all the keys and then only
+// queried. Each key sets numProbes bits, derived from a single 64 bit hash by
+// double hashing. The encoded filter is the bit array followed by a byte
+// holding the number of probes, which is how it is stored in the run file.
+class BloomFilter {
+  std::string m_data;
+
+ public:
+  BloomFilter() = default;
+  // wrap an encoded filter, an empty one matches every key
+  explicit BloomFilter(std::string data) : m_data(std::move(data)) {}
+
+  // the hash of a key the filter is built from - stable across processes
+  // as filters are stored on disk
+  static uint64_t hash(std::string_view key);
+  // encode a filter over the keys with the given hashes
+  static std::string build(const std::vector<uint64_t> &hashes,
+                           int bitsPerKey);
+
+  // false if the key is definitely not in the filter
+  bool mayContain(std::string_view key) const;
+
+  const std::string &data() const { return m_data; }
+  size_t memoryUsage() const { return m_data.capacity(); }
+};
+
+#endif
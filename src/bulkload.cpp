@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "saavi.h"
+
+namespace {
+
+void usage(const char *program) {
+  std::cerr
+      << "Usage: " << program
+      << " [options] <path/to/file/name> <input> [<input> ...]\n"
+         "Loads the records of the inputs into the store in bulk, the last "
+         "record of a key\nwinning, and attaches them atomically.\n"
+         "  --format=csv|binary  key,value lines (default) or records of "
+         "key length (4),\n"
+         "                       value length (4), key and value, "
+         "little-endian\n"
+         "  --sort-memory=MB     memory the records are sorted in before "
+         "spilling runs to\n"
+         "                       disk (default 1024)\n"
+         "  --threads=N          threads sorting the runs (default one per "
+         "core)\n"
+         "  --tmp=DIR            directory the runs are spilled to (default "
+         "that of the\n"
+         "                       store)\n";
+}
+
+}  // namespace
+
+// Bulk loads CSV or binary dumps into a store with Saavi::IngestExternal
+int main(int argc, char *argv[]) {
+  IngestOptions options;
+  std::vector<std::string> paths;
+  try {
+    for (int i = 1; i < argc; i++) {
+      const std::string arg = argv[i];
+      if (arg == "--format=csv") {
+        options.format = IngestFormat::Csv;
+      } else if (arg == "--format=binary") {
+        options.format = IngestFormat::Binary;
+      } else if (arg.compare(0, 14, "--sort-memory=") == 0) {
+        options.sortMemory = std::stoul(arg.substr(14)) << 20;
+      } else if (arg.compare(0, 10, "--threads=") == 0) {
+        options.threads = std::stoul(arg.substr(10));
+      } else if (arg.compare(0, 6, "--tmp=") == 0) {
+        options.tmpDirectory = arg.substr(6);
+      } else if (arg.compare(0, 2, "--") == 0) {
+        throw std::invalid_argument(arg);
+      } else {
+        paths.push_back(arg);
+      }
+    }
+  } catch (std::exception &e) {
+    paths.clear();
+  }
+  if (paths.size() < 2 || options.sortMemory == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  try {
+    SaaviOptions saaviOptions;
+    saaviOptions.backgroundCompaction = false;
+    Saavi saavi(paths[0], saaviOptions);
+    const IngestStats stats = saavi.IngestExternal(
+        std::vector<std::string>(paths.begin() + 1, paths.end()), options);
+    const double seconds =
+        (stats.sortDuration + stats.writeDuration).count() / 1e6;
+    std::cout << "Read " << stats.recordsRead << " records, dropped "
+              << stats.duplicatesDropped << " duplicates and ingested "
+              << stats.recordsIngested << "\n"
+              << "Sorted in " << stats.sortDuration.count() / 1e6 << "s with "
+              << stats.runs << " runs spilled, wrote "
+              << stats.bytesWritten / double(1 << 20) << "MB in "
+              << stats.writeDuration.count() / 1e6 << "s\n"
+              << stats.recordsRead / std::max(seconds, 1e-6)
+              << " records per second\n";
+  } catch (std::exception &e) {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+  return 0;
+}
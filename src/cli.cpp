@@ -1,5 +1,8 @@
 #include "cli.h"
 
+#include <pthread.h>
+#include <signal.h>
+
 #include <algorithm>
 #include <cctype>
 #include <filesystem>
@@ -8,6 +11,8 @@
 #include <string>
 #include <vector>
 
+#include "resp_server.h"
+
 // initialize the commands map
 std::unordered_map<std::string, SimpleClient::CommandExecutor *>
     SimpleClient::supportedCommands = {
@@ -23,24 +28,55 @@ std::unordered_map<std::string, SimpleClient::CommandExecutor *>
                              .numberOfArgs = 2,
                              .requiresInitialisedSaavi = true,
                              .syntax = "put <key> <value>",
-                             .syntaxNote = "'key' can only be alphanumeric"}},
+                             .syntaxNote = "'key' cannot contain spaces"}},
         {"get",
          new CommandExecutor{
              .executorFunc = &SimpleClient::executeGet,
              .numberOfArgs = 1,
              .requiresInitialisedSaavi = true,
              .syntax = "get <key>",
-             .syntaxNote = "'key' can be alphanumeric or '*' which would then "
-                           "print all the entries"}},
+             .syntaxNote = "'key' cannot contain spaces, '*' would print all "
+                           "the entries"}},
         {"delete",
          new CommandExecutor{.executorFunc = &SimpleClient::executeDelete,
                              .numberOfArgs = 1,
                              .requiresInitialisedSaavi = true,
                              .syntax = "delete <key>",
-                             .syntaxNote = "'key' can only be alphanumeric"}},
+                             .syntaxNote = "'key' cannot contain spaces"}},
+        {"scan",
+         new CommandExecutor{
+             .executorFunc = &SimpleClient::executeScan,
+             .numberOfArgs = 2,
+             .requiresInitialisedSaavi = true,
+             .syntax = "scan <start> <end>",
+             .syntaxNote = "prints the entries with keys from 'start' upto but "
+                           "not including 'end', '*' as 'end' scans upto the "
+                           "last key"}},
+        {"scanprefix",
+         new CommandExecutor{.executorFunc = &SimpleClient::executeScanPrefix,
+                             .numberOfArgs = 1,
+                             .requiresInitialisedSaavi = true,
+                             .syntax = "scanprefix <prefix>",
+                             .syntaxNote = "prints the entries with keys "
+                                           "starting with 'prefix'"}},
+        {"stats",
+         new CommandExecutor{.executorFunc = &SimpleClient::executeStats,
+                             .numberOfArgs = 0,
+                             .requiresInitialisedSaavi = true,
+                             .syntax = "stats",
+                             .syntaxNote = "prints the statistics of the "
+                                           "store"}},
+        {"metrics",
+         new CommandExecutor{.executorFunc = &SimpleClient::executeMetrics,
+                             .numberOfArgs = 0,
+                             .requiresInitialisedSaavi = true,
+                             .syntax = "metrics",
+                             .syntaxNote = "prints the statistics in the "
+                                           "Prometheus text format"}},
         {"exit", new CommandExecutor{.executorFunc = &SimpleClient::executeExit,
                                      .numberOfArgs = 0,
-                                     .syntax = "exit"}},
+                                     .syntax = "exit",
+                                     .syntaxNote = ""}},
 };
 
 SimpleClient::SimpleClient(const std::string &_datadir) {
@@ -65,7 +101,12 @@ void SimpleClient::executeOpen(const std::vector<std::string> &args) {
     filepath = datadir + filepath;
   }
 
-  saavi.reset(new Saavi(filepath));
+  // keep the keys ordered for the scan commands, and time the operations
+  // for the stats commands
+  SaaviOptions options;
+  options.orderedIndex = true;
+  options.statistics = StatsLevel::Latencies;
+  saavi.reset(new Saavi(filepath, options));
 }
 
 // Put the key value into the kvs
@@ -80,8 +121,8 @@ void SimpleClient::executeGet(const std::vector<std::string> &args) {
     // iterate and print all the entries
     unsigned long numOfEntries = 0;
     for (auto it = saavi->begin(); it != saavi->end(); ++it) {
-      auto entry = *it;
-      std::cout << entry.first << " : " << entry.second << std::endl;
+      const auto &entry = *it;
+      std::cout << entry.first << " : " << entry.second << '\n';
       numOfEntries++;
     }
     std::cout << "Total number of entries returned = " << numOfEntries
@@ -89,9 +130,9 @@ void SimpleClient::executeGet(const std::vector<std::string> &args) {
   } else {
     const std::string &value = saavi->Get(args[0]);
     if (value.length() == 0) {
-      std::cout << "Key not found" << std::endl;
+      std::cout << "Key not found\n";
     } else {
-      std::cout << value << std::endl;
+      std::cout << value << '\n';
     }
   }
 }
@@ -101,9 +142,77 @@ void SimpleClient::executeDelete(const std::vector<std::string> &args) {
   saavi->Delete(args[0]);
 }
 
+// print all the entries returned by the scan iterator
+static void printScan(Saavi &saavi, ScanIterator it) {
+  unsigned long numOfEntries = 0;
+  for (; it != saavi.end(); ++it) {
+    const auto &entry = *it;
+    std::cout << entry.first << " : " << entry.second << '\n';
+    numOfEntries++;
+  }
+  std::cout << "Total number of entries returned = " << numOfEntries
+            << std::endl;
+}
+
+// Print the entries in the given key range
+void SimpleClient::executeScan(const std::vector<std::string> &args) {
+  printScan(*saavi, saavi->Scan(args[0], args[1] == "*" ? "" : args[1]));
+}
+
+// Print the entries whose keys start with the given prefix
+void SimpleClient::executeScanPrefix(const std::vector<std::string> &args) {
+  printScan(*saavi, saavi->ScanPrefix(args[0]));
+}
+
+// print a latency summary in microseconds
+static void printLatencies(const std::string &name,
+                           const LatencyStats &latencies) {
+  if (latencies.count == 0) {
+    return;
+  }
+  std::cout << name << " latency (us) : mean = " << latencies.mean / 1000
+            << ", p50 = " << latencies.p50 / 1000.0
+            << ", p99 = " << latencies.p99 / 1000.0
+            << ", p999 = " << latencies.p999 / 1000.0
+            << ", max = " << latencies.max / 1000.0 << '\n';
+}
+
+// Print the statistics of the store
+void SimpleClient::executeStats(const std::vector<std::string> &) {
+  const SaaviStats stats = saavi->GetStats();
+  std::cout << "gets = " << stats.gets << " (" << stats.getHits
+            << " found), puts = " << stats.puts
+            << ", deletes = " << stats.deletes
+            << ", batches = " << stats.batches << " ("
+            << stats.batchOperations << " operations), scans = "
+            << stats.scans << '\n';
+  std::cout << "bytes written = " << stats.bytesWritten
+            << ", bytes read = " << stats.bytesRead << '\n';
+  printLatencies("get", stats.getLatency);
+  printLatencies("multiget", stats.multiGetLatency);
+  printLatencies("put", stats.putLatency);
+  printLatencies("delete", stats.deleteLatency);
+  printLatencies("write", stats.writeLatency);
+  std::cout << "keys = " << stats.keys
+            << ", index memory = " << stats.indexMemory << " bytes\n";
+  std::cout << "log = " << stats.logBytes << " bytes ("
+            << stats.logLiveBytes << " live), blob files = "
+            << stats.blobBytes << " bytes (" << stats.blobLiveBytes
+            << " live)\n";
+  std::cout << "recovery took " << stats.recoveryDuration.count() / 1000.0
+            << " ms, compaction runs = " << stats.compaction.runs
+            << ", cache hits = " << stats.cache.hits
+            << ", cache misses = " << stats.cache.misses << std::endl;
+}
+
+// Print the statistics for Prometheus to scrape
+void SimpleClient::executeMetrics(const std::vector<std::string> &) {
+  std::cout << StatsToPrometheus(saavi->GetStats()) << std::flush;
+}
+
 // exit the application
-void SimpleClient::executeExit(const std::vector<std::string> &args) {
-  std::cout << "Bye!" << std::endl;
+void SimpleClient::executeExit(const std::vector<std::string> &) {
+  std::cout << "Bye!\n";
   exit(0);
 }
 
@@ -156,13 +265,70 @@ int SimpleClient::run() {
     try {
       executeCommand(input);
     } catch (std::exception &e) {
-      std::cout << e.what() << std::endl;
+      std::cout << e.what() << '\n';
     }
   } while (true);
   return 0;
 }
 
+// Serves the store over RESP until SIGINT or SIGTERM
+int serve(int argc, char *argv[]) {
+  std::string filepath;
+  std::string address = "127.0.0.1:6379";
+  unsigned numOfThreads = 0;
+  for (int i = 2; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg.compare(0, 9, "--listen=") == 0) {
+      address = arg.substr(9);
+    } else if (arg.compare(0, 10, "--threads=") == 0) {
+      numOfThreads = std::stoul(arg.substr(10));
+    } else if (filepath.empty() && arg.compare(0, 2, "--") != 0) {
+      filepath = arg;
+    } else {
+      filepath.clear();
+      break;
+    }
+  }
+  if (filepath.empty()) {
+    std::cerr << "Usage: " << argv[0]
+              << " --serve <path/to/file/name> [--listen=<host:port|"
+                 "unix:path>] [--threads=<count>]\n";
+    return 1;
+  }
+
+  // the signals are waited for here, not handled by the server threads,
+  // which inherit the mask
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  try {
+    SaaviOptions options;
+    options.orderedIndex = true;
+    Saavi saavi(filepath, options);
+    RespServer server(saavi, address, numOfThreads);
+    std::cout << "Serving " << filepath << " on " << address;
+    if (server.Port() != 0) {
+      std::cout << " (port " << server.Port() << ")";
+    }
+    std::cout << std::endl;
+    int signal = 0;
+    sigwait(&signals, &signal);
+    server.Stop();
+  } catch (std::exception &e) {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+  return 0;
+}
+
 int main(int argc, char *argv[]) {
+  if (argc > 1 && std::string(argv[1]) == "--serve") {
+    return serve(argc, argv);
+  }
+
   std::string datadir;
   if (argc > 1) {
     datadir = argv[1];
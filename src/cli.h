@@ -30,6 +30,10 @@ class SimpleClient {
   void executePut(const std::vector<std::string> &args);
   void executeGet(const std::vector<std::string> &args);
   void executeDelete(const std::vector<std::string> &args);
+  void executeScan(const std::vector<std::string> &args);
+  void executeScanPrefix(const std::vector<std::string> &args);
+  void executeStats(const std::vector<std::string> &args);
+  void executeMetrics(const std::vector<std::string> &args);
   void executeExit(const std::vector<std::string> &args);
 
   // map the command names to the executor methods
@@ -39,7 +43,7 @@ class SimpleClient {
     // The function that handles the given command
     ExecutorFuncPtr executorFunc;
     // number of required args
-    const int numberOfArgs;
+    const size_t numberOfArgs;
     // boolean indicating whether the command requires an initialised saavi
     // client
     bool requiresInitialisedSaavi{false};
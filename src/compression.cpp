@@ -0,0 +1,274 @@
+#include "compression.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#ifdef SAAVI_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+#include "saavi_exception.h"
+
+namespace {
+
+constexpr size_t LZ_MIN_MATCH = 4;
+constexpr size_t LZ_MAX_OFFSET = 65535;
+constexpr int LZ_MAX_HASH_BITS = 14;
+
+void corrupt() { throw SaaviException("corrupt compressed data"); }
+
+void appendVarint(std::string &out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<char>(value));
+}
+
+uint64_t readVarint(std::string_view data, size_t &position) {
+  uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (position >= data.length()) {
+      break;
+    }
+    const auto byte = static_cast<unsigned char>(data[position++]);
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (byte < 0x80) {
+      return value;
+    }
+  }
+  corrupt();
+  return 0;
+}
+
+uint32_t load32(const char *data) {
+  uint32_t value;
+  std::memcpy(&value, data, 4);
+  return value;
+}
+
+uint32_t lzHash(uint32_t value, int bits) {
+  return (value * 2654435761u) >> (32 - bits);
+}
+
+// the part of a length that doesn't fit into its 4 bits of the token
+void appendLength(std::string &out, size_t length) {
+  for (; length >= 255; length -= 255) {
+    out.push_back(static_cast<char>(255));
+  }
+  out.push_back(static_cast<char>(length));
+}
+
+size_t readLength(std::string_view data, size_t &position, size_t length) {
+  if (length < 15) {
+    return length;
+  }
+  while (true) {
+    if (position >= data.length()) {
+      corrupt();
+    }
+    const auto byte = static_cast<unsigned char>(data[position++]);
+    length += byte;
+    if (byte < 255) {
+      return length;
+    }
+  }
+}
+
+void appendSequence(std::string &out, std::string_view literals,
+                    size_t offset, size_t matchLength) {
+  const size_t extraMatch = matchLength - LZ_MIN_MATCH;
+  out.push_back(static_cast<char>(
+      (std::min<size_t>(literals.length(), 15) << 4) |
+      std::min<size_t>(extraMatch, 15)));
+  if (literals.length() >= 15) {
+    appendLength(out, literals.length() - 15);
+  }
+  out.append(literals);
+  out.push_back(static_cast<char>(offset));
+  out.push_back(static_cast<char>(offset >> 8));
+  if (extraMatch >= 15) {
+    appendLength(out, extraMatch - 15);
+  }
+}
+
+void lzCompress(std::string_view data, std::string &out) {
+  const char *in = data.data();
+  const size_t length = data.length();
+  // the latest position of each hashed 4 byte sequence. Small values get a
+  // small table, which would otherwise take longer to clear than to fill.
+  int hashBits = 8;
+  while (hashBits < LZ_MAX_HASH_BITS && (size_t(1) << hashBits) < length) {
+    hashBits++;
+  }
+  std::vector<uint32_t> table(size_t(1) << hashBits, 0);
+  size_t anchor = 0;
+  size_t position = 0;
+  while (position + LZ_MIN_MATCH <= length) {
+    const uint32_t sequence = load32(in + position);
+    uint32_t &slot = table[lzHash(sequence, hashBits)];
+    const size_t candidate = slot;
+    slot = static_cast<uint32_t>(position);
+    if (candidate >= position || position - candidate > LZ_MAX_OFFSET ||
+        load32(in + candidate) != sequence) {
+      // skip ahead faster the longer nothing matched
+      position += 1 + ((position - anchor) >> 6);
+      continue;
+    }
+
+    size_t matchLength = LZ_MIN_MATCH;
+    while (position + matchLength < length &&
+           in[candidate + matchLength] == in[position + matchLength]) {
+      matchLength++;
+    }
+    appendSequence(out, data.substr(anchor, position - anchor),
+                   position - candidate, matchLength);
+    position += matchLength;
+    anchor = position;
+  }
+
+  // the remaining literals end the data
+  const size_t literals = length - anchor;
+  out.push_back(static_cast<char>(std::min<size_t>(literals, 15) << 4));
+  if (literals >= 15) {
+    appendLength(out, literals - 15);
+  }
+  out.append(data.substr(anchor));
+}
+
+void lzDecompress(std::string_view data, size_t position, size_t length,
+                  std::string &out) {
+  const size_t start = out.length();
+  const size_t end = start + length;
+  out.reserve(end);
+  while (true) {
+    if (position >= data.length()) {
+      corrupt();
+    }
+    const auto token = static_cast<unsigned char>(data[position++]);
+    const size_t literals = readLength(data, position, token >> 4);
+    if (literals > data.length() - position ||
+        literals > end - out.length()) {
+      corrupt();
+    }
+    out.append(data.substr(position, literals));
+    position += literals;
+    if (position == data.length()) {
+      break;
+    }
+
+    if (data.length() - position < 2) {
+      corrupt();
+    }
+    const size_t offset = static_cast<unsigned char>(data[position]) |
+                          static_cast<unsigned char>(data[position + 1]) << 8;
+    position += 2;
+    const size_t matchLength =
+        readLength(data, position, token & 15) + LZ_MIN_MATCH;
+    if (offset == 0 || offset > out.length() - start ||
+        matchLength > end - out.length()) {
+      corrupt();
+    }
+    // the match may overlap the bytes it produces
+    size_t from = out.length() - offset;
+    for (size_t i = 0; i < matchLength; i++) {
+      out.push_back(out[from++]);
+    }
+  }
+  if (out.length() != end) {
+    corrupt();
+  }
+}
+
+#ifdef SAAVI_WITH_ZLIB
+void zlibCompress(std::string_view data, std::string &out) {
+  const size_t start = out.length();
+  uLongf size = compressBound(data.length());
+  out.resize(start + size);
+  if (compress2(reinterpret_cast<Bytef *>(&out[start]), &size,
+                reinterpret_cast<const Bytef *>(data.data()), data.length(),
+                Z_DEFAULT_COMPRESSION) != Z_OK) {
+    throw SaaviException("zlib compression failed");
+  }
+  out.resize(start + size);
+}
+
+void zlibDecompress(std::string_view data, size_t position, size_t length,
+                    std::string &out) {
+  const size_t start = out.length();
+  out.resize(start + length);
+  uLongf size = length;
+  if (uncompress(reinterpret_cast<Bytef *>(&out[start]), &size,
+                 reinterpret_cast<const Bytef *>(data.data() + position),
+                 data.length() - position) != Z_OK ||
+      size != length) {
+    out.resize(start);
+    corrupt();
+  }
+}
+#endif
+
+}  // namespace
+
+bool compressionSupported(Compression codec) {
+  switch (codec) {
+    case Compression::None:
+    case Compression::Lz:
+      return true;
+    case Compression::Zlib:
+#ifdef SAAVI_WITH_ZLIB
+      return true;
+#else
+      return false;
+#endif
+  }
+  return false;
+}
+
+bool compress(Compression codec, std::string_view data, std::string &out) {
+  const size_t start = out.length();
+  switch (codec) {
+    case Compression::None:
+      return false;
+    case Compression::Lz:
+      appendVarint(out, data.length());
+      lzCompress(data, out);
+      break;
+    case Compression::Zlib:
+#ifdef SAAVI_WITH_ZLIB
+      appendVarint(out, data.length());
+      zlibCompress(data, out);
+      break;
+#else
+      throw SaaviException("zlib compression is not supported by this build");
+#endif
+  }
+  if (out.length() - start >= data.length()) {
+    out.resize(start);
+    return false;
+  }
+  return true;
+}
+
+void decompress(Compression codec, std::string_view data, std::string &out) {
+  if (codec == Compression::None || !compressionSupported(codec)) {
+    throw SaaviException("unsupported compression codec " +
+                         std::to_string(static_cast<int>(codec)));
+  }
+  size_t position = 0;
+  const uint64_t length = readVarint(data, position);
+  // neither codec compresses by much more than a factor of 1000, which
+  // keeps a corrupt length from allocating a huge buffer
+  if (length / 2048 > data.length()) {
+    corrupt();
+  }
+  if (codec == Compression::Lz) {
+    lzDecompress(data, position, length, out);
+    return;
+  }
+#ifdef SAAVI_WITH_ZLIB
+  zlibDecompress(data, position, length, out);
+#endif
+}
@@ -0,0 +1,34 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <string>
+#include <string_view>
+
+#include "saavi_options.h"
+
+/*
+ * Compressed data starts with its uncompressed length as a varint, followed
+ * by the output of the codec.
+ *
+ * The Lz codec is a byte oriented LZ77 with a 64 KB window. Its output is a
+ * series of sequences, each a run of literals followed by a match:
+ *   token (1) : literal length (high 4 bits) | match length - 4 (low 4 bits)
+ *   [more literal length] | literals | match offset (2) |
+ *   [more match length]
+ * A length of 15 in the token continues in the bytes that follow, each
+ * adding upto 255 to it until one is less than 255. The last sequence has
+ * only literals and ends the data.
+ */
+
+// whether this build of saavi can use the codec
+bool compressionSupported(Compression codec);
+
+// append the data compressed with the codec to out. Returns false, leaving
+// out as it was, if the data doesn't get any smaller or the codec is None.
+bool compress(Compression codec, std::string_view data, std::string &out);
+
+// append the data compressed with the codec to out decompressed. Throws if
+// the data is corrupt or the codec is not supported.
+void decompress(Compression codec, std::string_view data, std::string &out);
+
+#endif
@@ -0,0 +1,176 @@
+#include "external_sort.h"
+
+#include <algorithm>
+#include <filesystem>
+
+#include "segment.h"
+
+ExternalSorter::ExternalSorter(const std::string &runPrefix, size_t runSize,
+                               unsigned threads)
+    : m_runPrefix(runPrefix),
+      m_runSize(std::max<size_t>(runSize, 1)),
+      m_threads(std::max(threads, 1u)) {}
+
+ExternalSorter::~ExternalSorter() {
+  for (auto &spill : m_spilling) {
+    spill->thread.join();
+  }
+  m_scanners.clear();
+  for (size_t run = 0; run < m_runs; run++) {
+    std::error_code ec;
+    std::filesystem::remove(runFilename(run), ec);
+  }
+}
+
+void ExternalSorter::Run::sort() {
+  std::sort(entries.begin(), entries.end(),
+            [this](const Entry &a, const Entry &b) {
+              if (a.prefix != b.prefix) {
+                return a.prefix < b.prefix;
+              }
+              const int order = key(a).compare(key(b));
+              return order < 0 || (order == 0 && a.ordinal < b.ordinal);
+            });
+}
+
+void ExternalSorter::add(std::string_view key, std::string_view value) {
+  uint64_t prefix = 0;
+  for (size_t i = 0; i < 8; i++) {
+    prefix = prefix << 8 |
+             (i < key.length() ? static_cast<unsigned char>(key[i]) : 0);
+  }
+  m_current.entries.push_back(Entry{prefix, m_current.data.size(),
+                                    static_cast<uint32_t>(key.length()),
+                                    static_cast<uint32_t>(value.length()),
+                                    m_count++});
+  m_current.data.append(key);
+  m_current.data.append(value);
+  m_bytes += key.length() + value.length();
+  if (m_current.memory() >= m_runSize) {
+    spill();
+  }
+}
+
+void ExternalSorter::spill() {
+  if (m_spilling.size() >= m_threads) {
+    joinSpill();
+  }
+  auto run = std::make_shared<Run>(std::move(m_current));
+  m_current = Run();
+  const std::string path = runFilename(m_runs++);
+  std::unique_ptr<Spill> spill(new Spill());
+  Spill *state = spill.get();
+  spill->thread = std::thread([this, run, path, state] {
+    try {
+      run->sort();
+      auto file = Segment::create(path, 0, FileHeader());
+      std::string record;
+      const auto &entries = run->entries;
+      for (size_t i = 0; i < entries.size(); i++) {
+        // the last of the pairs with the same key wins
+        if (i + 1 < entries.size() &&
+            run->key(entries[i]) == run->key(entries[i + 1])) {
+          m_duplicates++;
+          continue;
+        }
+        record.clear();
+        encodeRecord(record, 0, entries[i].ordinal, run->key(entries[i]),
+                     run->value(entries[i]));
+        file->append(record);
+      }
+      file->flush();
+    } catch (...) {
+      state->error = std::current_exception();
+    }
+  });
+  m_spilling.push_back(std::move(spill));
+}
+
+void ExternalSorter::joinSpill() {
+  std::unique_ptr<Spill> spill = std::move(m_spilling.front());
+  m_spilling.pop_front();
+  spill->thread.join();
+  if (spill->error) {
+    std::rethrow_exception(spill->error);
+  }
+}
+
+void ExternalSorter::finish() {
+  if (m_runs == 0) {
+    m_current.sort();
+    return;
+  }
+  if (!m_current.entries.empty()) {
+    spill();
+  }
+  while (!m_spilling.empty()) {
+    joinSpill();
+  }
+  m_current = Run();
+
+  for (size_t run = 0; run < m_runs; run++) {
+    std::unique_ptr<RecordScanner> scanner(
+        new RecordScanner(runFilename(run)));
+    if (scanner->next()) {
+      m_heap.push_back(m_scanners.size());
+    }
+    m_scanners.push_back(std::move(scanner));
+  }
+  auto after = [this](size_t a, size_t b) { return this->after(a, b); };
+  std::make_heap(m_heap.begin(), m_heap.end(), after);
+}
+
+bool ExternalSorter::after(size_t a, size_t b) const {
+  const RecordScanner &x = *m_scanners[a];
+  const RecordScanner &y = *m_scanners[b];
+  const int order = x.key().compare(y.key());
+  return order > 0 ||
+         (order == 0 && x.header().sequence > y.header().sequence);
+}
+
+bool ExternalSorter::next() {
+  if (m_scanners.empty()) {
+    const auto &entries = m_current.entries;
+    if (m_position == entries.size()) {
+      return false;
+    }
+    // skip to the last of the pairs with the same key
+    while (m_position + 1 < entries.size() &&
+           m_current.key(entries[m_position]) ==
+               m_current.key(entries[m_position + 1])) {
+      m_position++;
+      m_duplicates++;
+    }
+    m_key = m_current.key(entries[m_position]);
+    m_value = m_current.value(entries[m_position]);
+    m_position++;
+    return true;
+  }
+
+  auto after = [this](size_t a, size_t b) { return this->after(a, b); };
+  bool found = false;
+  while (!m_heap.empty()) {
+    RecordScanner &scanner = *m_scanners[m_heap.front()];
+    if (found && scanner.key() != m_keyBuffer) {
+      break;
+    }
+    // pairs with the same key come off the heap in input order, so each
+    // replaces the one found before it
+    if (found) {
+      m_duplicates++;
+    }
+    m_keyBuffer.assign(scanner.key());
+    m_valueBuffer.assign(scanner.value());
+    found = true;
+
+    std::pop_heap(m_heap.begin(), m_heap.end(), after);
+    if (scanner.next()) {
+      std::push_heap(m_heap.begin(), m_heap.end(), after);
+    } else {
+      m_heap.pop_back();
+    }
+  }
+  m_key = m_keyBuffer;
+  m_value = m_valueBuffer;
+  return found;
+}
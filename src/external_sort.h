@@ -0,0 +1,123 @@
+#ifndef EXTERNAL_SORT_H
+#define EXTERNAL_SORT_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "file_iterators.h"
+
+// Sorts key value pairs by key, however many of them there are. The pairs
+// are gathered in runs of about runSize bytes, and every full run is sorted
+// and spilled to a file of its own by a thread of its own while the next
+// one fills up, so reading the input, sorting and writing the runs overlap.
+// Upto threads runs are sorted at once. The spilled runs are then merged,
+// reading each of them forward in large blocks. Pairs that all fit in a
+// single run are sorted in memory and never spilled.
+//
+// Of the pairs with the same key, only the one added last is returned. The
+// runs are written in the record format of the data files, with the
+// position of a pair in the input as the sequence number of its record,
+// and removed along with the sorter.
+class ExternalSorter {
+ public:
+  ExternalSorter(const std::string &runPrefix, size_t runSize,
+                 unsigned threads);
+  ~ExternalSorter();
+  ExternalSorter(const ExternalSorter &) = delete;
+  ExternalSorter &operator=(const ExternalSorter &) = delete;
+
+  void add(std::string_view key, std::string_view value);
+  // sort what has been added, before reading the pairs back with next
+  void finish();
+
+  // move to the pair with the next key, returns false once all of them
+  // have been read
+  bool next();
+  // the key and value of the current pair - valid until next() is called
+  std::string_view key() const { return m_key; }
+  std::string_view value() const { return m_value; }
+
+  // pairs added, and the bytes of their keys and values
+  uint64_t count() const { return m_count; }
+  uint64_t bytes() const { return m_bytes; }
+  // pairs dropped for a later one with the same key, so far
+  uint64_t duplicates() const { return m_duplicates; }
+  // runs spilled to disk
+  size_t runs() const { return m_runs; }
+
+ private:
+  // a pair in the buffer of a run. Most comparisons are settled by the
+  // first bytes of the keys, kept big-endian in prefix, without following
+  // the offsets into the buffer.
+  struct Entry {
+    uint64_t prefix;
+    size_t offset;
+    uint32_t keyLength;
+    uint32_t valueLength;
+    uint64_t ordinal;
+  };
+  struct Run {
+    // the keys and values, each key followed by its value
+    std::string data;
+    std::vector<Entry> entries;
+
+    std::string_view key(const Entry &entry) const {
+      return std::string_view(data.data() + entry.offset, entry.keyLength);
+    }
+    std::string_view value(const Entry &entry) const {
+      return std::string_view(data.data() + entry.offset + entry.keyLength,
+                              entry.valueLength);
+    }
+    size_t memory() const {
+      return data.size() + entries.size() * sizeof(Entry);
+    }
+    // sort the entries by key and then by ordinal
+    void sort();
+  };
+  // a run being sorted and written by a thread
+  struct Spill {
+    std::thread thread;
+    std::exception_ptr error;
+  };
+
+  std::string m_runPrefix;
+  size_t m_runSize;
+  unsigned m_threads;
+  Run m_current;
+  std::deque<std::unique_ptr<Spill>> m_spilling;
+  size_t m_runs{0};
+  uint64_t m_count{0};
+  uint64_t m_bytes{0};
+  std::atomic<uint64_t> m_duplicates{0};
+
+  // the pairs sorted in memory and the next of them, if nothing was spilled
+  size_t m_position{0};
+  // the readers of the spilled runs, and a heap of those that have pairs
+  // left ordered by their current key and ordinal, smallest first
+  std::vector<std::unique_ptr<RecordScanner>> m_scanners;
+  std::vector<size_t> m_heap;
+  // copies of the current key and value, the scanners move past theirs
+  std::string m_keyBuffer;
+  std::string m_valueBuffer;
+  std::string_view m_key;
+  std::string_view m_value;
+
+  std::string runFilename(size_t run) const {
+    return m_runPrefix + std::to_string(run);
+  }
+  // hand the current run to a thread that sorts it and writes it out
+  void spill();
+  // wait for the oldest spill and rethrow its error, if any
+  void joinSpill();
+  // whether the scanner a comes after the scanner b in the merge
+  bool after(size_t a, size_t b) const;
+};
+
+#endif
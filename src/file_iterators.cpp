@@ -1,52 +1,316 @@
 #include "file_iterators.h"
 
-FileReverseIterator::FileReverseIterator(std::fstream &fs,
-                                         decodeEntryFunc decoder)
-    : m_fs(fs), decoder(decoder) {
-  // seek to end and skip the very last \n
-  m_fs.seekg(-2, std::ios_base::end);
-  read_offset = fs.tellg();
-  readline();
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "blob_file.h"
+#include "compression.h"
+#include "saavi_exception.h"
+
+namespace {
+
+// records of a segment at most this far apart are hinted as a single range
+constexpr unsigned long ADVISE_GAP = 16 << 10;
+
+// the segment with the given id among segments ordered by id, nullptr if
+// it is not one of them
+Segment *findSegment(const std::vector<std::shared_ptr<Segment>> &segments,
+                     uint32_t id) {
+  auto it = std::lower_bound(
+      segments.begin(), segments.end(), id,
+      [](const std::shared_ptr<Segment> &segment, uint32_t id) {
+        return segment->id() < id;
+      });
+  return (it != segments.end() && (*it)->id() == id) ? it->get() : nullptr;
 }
 
-FileReverseIterator &FileReverseIterator::operator++() {
-  readline();
-  return *this;
+}  // namespace
+
+RecordScanner::RecordScanner(const std::string &filename,
+                             unsigned long startOffset)
+    : m_offset(startOffset),
+      m_nextOffset(startOffset),
+      m_validEnd(startOffset),
+      m_bufferStart(startOffset),
+      m_bufferEnd(startOffset) {
+  m_fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (m_fd < 0) {
+    throw SaaviException("failed to open file '" + filename +
+                         "' : " + strerror(errno));
+  }
+  init();
 }
 
-void FileReverseIterator::readline() {
-  do {
-    if (read_offset <= 0) {
-      // done reading
-      read_offset = -1;
-      m_fs.clear();
-      return;
+RecordScanner::RecordScanner(int fd, unsigned long startOffset)
+    : m_offset(startOffset),
+      m_nextOffset(startOffset),
+      m_validEnd(startOffset),
+      m_bufferStart(startOffset),
+      m_bufferEnd(startOffset) {
+  m_fd = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+  if (m_fd < 0) {
+    throw SaaviException(std::string("failed to duplicate fd : ") +
+                         strerror(errno));
+  }
+  init();
+}
+
+void RecordScanner::init() {
+  struct stat st;
+  if (::fstat(m_fd, &st) == 0) {
+    m_fileSize = st.st_size;
+  }
+
+  // the whole file is read front to back exactly once
+  ::posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+RecordScanner::~RecordScanner() { ::close(m_fd); }
+
+bool RecordScanner::fill(size_t length) {
+  const unsigned long required = m_offset + length;
+  if (required <= m_bufferEnd) {
+    return true;
+  }
+  if (required > m_fileSize) {
+    // the record runs past the end of the file => it is torn
+    return false;
+  }
+
+  // read upto the next block boundary past the required bytes so that all
+  // but the first read of the scan are block aligned
+  unsigned long readEnd =
+      (required + SCAN_BLOCK_SIZE - 1) / SCAN_BLOCK_SIZE * SCAN_BLOCK_SIZE;
+  readEnd = std::min(readEnd, m_fileSize);
+
+  // keep the unconsumed tail of the buffer and grow it if a single record
+  // is larger than the buffer
+  const size_t keep = m_bufferEnd - m_offset;
+  const size_t capacity = readEnd - m_offset;
+  if (capacity > m_bufferCapacity) {
+    std::unique_ptr<char[]> buffer(new char[capacity]);
+    std::memcpy(buffer.get(), m_buffer.get() + (m_offset - m_bufferStart),
+                keep);
+    m_buffer = std::move(buffer);
+    m_bufferCapacity = capacity;
+  } else {
+    std::memmove(m_buffer.get(), m_buffer.get() + (m_offset - m_bufferStart),
+                 keep);
+  }
+  m_bufferStart = m_offset;
+
+  while (m_bufferEnd < readEnd) {
+    ssize_t bytesRead =
+        ::pread(m_fd, m_buffer.get() + (m_bufferEnd - m_bufferStart),
+                readEnd - m_bufferEnd, m_bufferEnd);
+    if (bytesRead < 0 && errno == EINTR) {
+      continue;
     }
+    if (bytesRead <= 0) {
+      return false;
+    }
+    m_bufferEnd += bytesRead;
+  }
+  return true;
+}
+
+bool RecordScanner::next() {
+  m_offset = m_nextOffset;
+  if (m_offset == m_batchEnd) {
+    // done with the records of the batch
+    m_batchEnd = 0;
+  }
 
-    // look for entry beginning
-    while (read_offset > 0 && m_fs.peek() != '\n') {
-      read_offset--;
-      m_fs.seekg(-1, m_fs.cur);
+  // read the fixed size header first to learn the record length
+  if (!fill(RECORD_HEADER_SIZE)) {
+    return false;
+  }
+  RecordHeader::decode(record(), m_header);
+
+  if (m_batchEnd != 0) {
+    // a record inside a batch is covered by the checksum of the batch
+    if (m_offset + m_header.recordSize() > m_batchEnd ||
+        (m_header.flags & RECORD_FLAG_BATCH)) {
+      return false;
     }
+    m_nextOffset = m_offset + m_header.recordSize();
+    return true;
+  }
+
+  // then make sure the whole record is available and intact
+  if (!fill(m_header.recordSize()) || !verifyRecord(m_header, record())) {
+    // torn or corrupt record - treat it as the end of the log
+    return false;
+  }
+  m_lastRecordOffset = m_offset;
+  m_lastRecordCrc = m_header.crc;
+  m_validEnd = m_offset + m_header.recordSize();
+
+  if (m_header.flags & RECORD_FLAG_BATCH) {
+    // step into the batch and return its first record
+    m_batchEnd = m_validEnd;
+    m_nextOffset = m_offset + RECORD_HEADER_SIZE;
+    return next();
+  }
 
-    if (read_offset != 0) {
-      // consume the peeked new line char and return
-      m_fs.get();
+  m_nextOffset = m_validEnd;
+  return true;
+}
+
+bool RecordScanner::tornTail() const {
+  if (m_fileSize < m_validEnd + RECORD_HEADER_SIZE) {
+    return true;
+  }
+  char buf[RECORD_HEADER_SIZE];
+  if (::pread(m_fd, buf, RECORD_HEADER_SIZE, m_validEnd) !=
+      static_cast<ssize_t>(RECORD_HEADER_SIZE)) {
+    return true;
+  }
+  RecordHeader header;
+  RecordHeader::decode(buf, header);
+  const unsigned long end = m_validEnd + header.recordSize();
+  if (end >= m_fileSize) {
+    return true;
+  }
+  RecordScanner rest(m_fd, end);
+  return !rest.next();
+}
+
+FileIterator::FileIterator(nextBatchFunc nextBatch)
+    : m_nextBatch(std::move(nextBatch)) {
+  readEntry();
+}
+
+FileIterator &FileIterator::operator++() {
+  readEntry();
+  return *this;
+}
+
+bool FileIterator::loadBatch() {
+  do {
+    m_batch.segments.clear();
+    m_batch.blobFiles.clear();
+    m_batch.entries.clear();
+    if (!m_nextBatch(m_batch)) {
+      return false;
     }
+  } while (m_batch.entries.empty());
+
+  std::sort(m_batch.entries.begin(), m_batch.entries.end(),
+            [](const IndexEntry &a, const IndexEntry &b) {
+              return std::make_pair(a.segmentId, a.offset) <
+                     std::make_pair(b.segmentId, b.offset);
+            });
+  m_position = 0;
+  m_advised = 0;
+  m_advisedBytes = 0;
+  return true;
+}
 
-    // read the entry
-    std::string entryStr;
-    std::getline(m_fs, entryStr);
-    // parse the entry and store it in m_entry
-    m_entry = decoder(entryStr);
+Segment *FileIterator::segmentAt(size_t position) const {
+  return findSegment(m_batch.segments, m_batch.entries[position].segmentId);
+}
+
+void FileIterator::adviseAhead() {
+  if (m_advisedBytes >= SCAN_BLOCK_SIZE / 2) {
+    return;
+  }
+
+  // hint the next block worth of records, merging the ranges of records
+  // that are close to each other in the same segment
+  Segment *segment = nullptr;
+  unsigned long start = 0;
+  unsigned long end = 0;
+  while (m_advised < m_batch.entries.size() &&
+         m_advisedBytes < SCAN_BLOCK_SIZE) {
+    const IndexEntry &entry = m_batch.entries[m_advised];
+    Segment *next = segmentAt(m_advised);
+    if (next != segment || entry.offset > end + ADVISE_GAP) {
+      if (segment != nullptr) {
+        ::posix_fadvise(segment->fd(), start, end - start,
+                        POSIX_FADV_WILLNEED);
+      }
+      segment = next;
+      start = entry.offset;
+    }
+    end = entry.offset + entry.size;
+    m_advisedBytes += entry.size;
+    m_advised++;
+  }
+  if (segment != nullptr) {
+    ::posix_fadvise(segment->fd(), start, end - start, POSIX_FADV_WILLNEED);
+  }
+}
 
-    if (read_offset != 0) {
-      // go back to the offset and move past the peeked '\n'
-      read_offset--;
-      m_fs.seekg(read_offset, std::ios_base::beg);
+void FileIterator::readEntry() {
+  while (true) {
+    if (m_position >= m_batch.entries.size() && !loadBatch()) {
+      m_done = true;
+      return;
     }
+    adviseAhead();
 
-    // continue if the key was not inserted => it exists already => we found the
-    // latest value already (OR) if the value is empty => key has been deleted
-  } while (!keys.insert(m_entry.first).second || m_entry.second.length() == 0);
+    const IndexEntry &entry = m_batch.entries[m_position];
+    Segment *segment = segmentAt(m_position);
+    m_position++;
+    m_advisedBytes -= entry.size;
+    // records written after the batch was taken may not be in the file yet,
+    // and compaction may have dropped their segment
+    if (segment == nullptr ||
+        entry.offset + entry.size > segment->flushedSize()) {
+      continue;
+    }
+    segment->read(entry.offset, entry.size, m_record);
+    RecordHeader header;
+    RecordHeader::decode(m_record.data(), header);
+    if (header.recordSize() != entry.size) {
+      throw SaaviException("corrupt record in file '" + segment->path() +
+                           "'");
+    }
+    m_entry.first.assign(m_record, RECORD_HEADER_SIZE, header.keyLength);
+    if (header.flags & RECORD_FLAG_MERGE) {
+      // the operands are folded by the store
+      if (!m_batch.merged || !m_batch.merged(m_entry.first, m_entry.second)) {
+        continue;
+      }
+      return;
+    }
+    std::string_view record = m_record;
+    if (header.flags & RECORD_FLAG_BLOB) {
+      // the value is in a blob file, which the batch holds on to
+      BlobPointer blob;
+      Segment *blobFile = nullptr;
+      if (decodeBlobPointer(
+              record.substr(RECORD_HEADER_SIZE + header.keyLength), blob)) {
+        blobFile = findSegment(m_batch.blobFiles, blob.fileId);
+      }
+      if (blobFile == nullptr) {
+        throw SaaviException("dangling blob pointer in file '" +
+                             segment->path() + "'");
+      }
+      blobFile->read(blob.offset, blob.size, m_blob);
+      RecordHeader::decode(m_blob.data(), header);
+      if (header.recordSize() != blob.size) {
+        throw SaaviException("corrupt record in file '" + blobFile->path() +
+                             "'");
+      }
+      record = m_blob;
+    }
+    if (header.codec == 0) {
+      m_entry.second.assign(record.substr(RECORD_HEADER_SIZE + header.keyLength,
+                                          header.valueLength));
+    } else {
+      m_entry.second.clear();
+      decompress(static_cast<Compression>(header.codec),
+                 record.substr(RECORD_HEADER_SIZE + header.keyLength,
+                               header.valueLength),
+                 m_entry.second);
+    }
+    return;
+  }
 }
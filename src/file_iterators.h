@@ -1,42 +1,149 @@
 #ifndef FILE_ITERATORS_H
 #define FILE_ITERATORS_H
 
-#include <fstream>
 #include <functional>
-#include <unordered_set>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
 
-class function;
+#include "flat_index.h"
+#include "record.h"
+#include "segment.h"
+
+// size of the blocks read by the scanner
+constexpr size_t SCAN_BLOCK_SIZE = 4 << 20;
+
+// Reads the records of a data file forward in log order. The file is read in
+// large block aligned chunks and the records are parsed straight out of the
+// buffer by jumping from header to header. Every record is checksummed as it
+// is read and the scan stops at the first torn or corrupt record; endOffset()
+// then points at the end of the last valid record. Batches are verified as a
+// whole and then their records are returned one by one.
+class RecordScanner {
+ public:
+  // the scan starts at startOffset, which must be the beginning of a record
+  RecordScanner(const std::string &filename,
+                unsigned long startOffset = FILE_HEADER_SIZE);
+  // scan an already open file, the scanner works on its own duplicate of fd
+  RecordScanner(int fd, unsigned long startOffset = FILE_HEADER_SIZE);
+  ~RecordScanner();
+  RecordScanner(const RecordScanner &) = delete;
+  RecordScanner &operator=(const RecordScanner &) = delete;
+
+  // move to the next valid record, returns false once the log ends
+  bool next();
+
+  const RecordHeader &header() const { return m_header; }
+  // offset of the current record in the file
+  unsigned long offset() const { return m_offset; }
+  // the key and value of the current record - valid until next() is called
+  std::string_view key() const {
+    return std::string_view(record() + RECORD_HEADER_SIZE, m_header.keyLength);
+  }
+  std::string_view value() const {
+    return std::string_view(record() + RECORD_HEADER_SIZE + m_header.keyLength,
+                            m_header.valueLength);
+  }
+  // the whole encoded record including the header
+  std::string_view data() const {
+    return std::string_view(record(), m_header.recordSize());
+  }
+  // offset just past the last valid record read so far
+  unsigned long endOffset() const { return m_validEnd; }
+  // offset and checksum of the last valid record in the file, which is the
+  // whole batch if the last record was part of one
+  unsigned long lastRecordOffset() const { return m_lastRecordOffset; }
+  uint32_t lastRecordCrc() const { return m_lastRecordCrc; }
+  // once next() has returned false, whether what follows the valid records
+  // is a torn tail left by a crash: the bad record runs to the end of the
+  // file, or no valid record comes after it. Anything else is corruption
+  // in the middle of the log.
+  bool tornTail() const;
+
+ private:
+  const char *record() const { return m_buffer.get() + (m_offset - m_bufferStart); }
+  // make sure length bytes from the current offset are in the buffer
+  bool fill(size_t length);
+  void init();
+
+  int m_fd;
+  unsigned long m_fileSize{0};
+  unsigned long m_offset;
+  unsigned long m_nextOffset;
+  unsigned long m_validEnd;
+  RecordHeader m_header;
+  // end of the batch whose records are being returned, 0 outside a batch
+  unsigned long m_batchEnd{0};
+  unsigned long m_lastRecordOffset{0};
+  uint32_t m_lastRecordCrc{0};
+
+  // the buffer holds the file contents in [m_bufferStart, m_bufferEnd)
+  std::unique_ptr<char[]> m_buffer;
+  size_t m_bufferCapacity{0};
+  unsigned long m_bufferStart;
+  unsigned long m_bufferEnd;
+};
 
 // Iterators for the file
-class FileReverseIteratorEnd {};
+class FileIteratorEnd {};
 
-using decodeEntryFunc = std::function<const std::pair<std::string, std::string>(
-    const std::string &entry)>;
-class FileReverseIterator {
+// number of index entries the iterator reads at a time
+constexpr size_t ITERATOR_BATCH_SIZE = 16384;
+
+// the locations of a batch of live records taken from the index, and the
+// segments and blob files they are in ordered by id
+struct IndexBatch {
+  std::vector<std::shared_ptr<Segment>> segments;
+  std::vector<std::shared_ptr<Segment>> blobFiles;
+  std::vector<IndexEntry> entries;
+  // puts the value of a key whose record is a merge operand, folded as the
+  // iteration sees it, into value. Returns false if the key is gone.
+  std::function<bool(const std::string &key, std::string &value)> merged;
+};
+
+// fills in the next batch, which may be empty, and returns false once the
+// whole index has been handed out
+using nextBatchFunc = std::function<bool(IndexBatch &batch)>;
+
+// Iterates the live entries in the order of their records on disk. The
+// locations are taken from the index a batch at a time and sorted by segment
+// and offset, so the records are read forward, and the kernel is told about
+// the records a little ahead of the one being read with posix_fadvise.
+// Besides the batch of locations, the iterator only keeps the current record
+// and entry, whose buffers are reused from one entry to the next.
+class FileIterator {
  public:
-  FileReverseIterator(std::fstream &fs, decodeEntryFunc decoder);
+  explicit FileIterator(nextBatchFunc nextBatch);
 
   const std::pair<std::string, std::string> &operator*() const {
     return m_entry;
   }
 
-  const std::pair<std::string, unsigned long> getKeyAndOffset() const {
-    // return the key and the offset at which it was
-    return std::make_pair(m_entry.first, read_offset + 2);
-  }
-
-  FileReverseIterator &operator++();
+  FileIterator &operator++();
 
-  bool operator!=(FileReverseIteratorEnd) const { return read_offset >= 0; }
+  bool operator!=(FileIteratorEnd) const { return !m_done; }
 
  private:
-  void readline();
+  // load the next non empty batch, returns false once there is none
+  bool loadBatch();
+  // the segment the entry at position points into, nullptr if it is gone
+  Segment *segmentAt(size_t position) const;
+  // hint the records after the current one to the kernel
+  void adviseAhead();
+  void readEntry();
 
-  std::fstream &m_fs;
+  nextBatchFunc m_nextBatch;
+  IndexBatch m_batch;
+  size_t m_position{0};
+  // the entries before m_advised have been hinted, m_advisedBytes of them
+  // at or after m_position
+  size_t m_advised{0};
+  unsigned long m_advisedBytes{0};
+  std::string m_record;
+  std::string m_blob;
   std::pair<std::string, std::string> m_entry;
-  std::streamoff read_offset;
-  std::unordered_set<std::string> keys;
-  decodeEntryFunc decoder;
+  bool m_done{false};
 };
 
 #endif
@@ -0,0 +1,277 @@
+#include "flat_index.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <limits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "record.h"
+#include "saavi_exception.h"
+
+namespace {
+
+// control byte of a slot that was never used - ends a probe sequence
+const int8_t CONTROL_EMPTY = -128;
+// control byte of a slot whose key was erased
+const int8_t CONTROL_DELETED = -2;
+
+// the table grows once more than 7/8th of the slots are taken
+size_t maxLoad(size_t capacity) { return capacity - capacity / 8; }
+
+// bit mask of the control bytes in the group equal to value
+uint32_t matchControl(const int8_t *group, int8_t value) {
+#if defined(__SSE2__)
+  const __m128i control =
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8(value)));
+#else
+  uint32_t mask = 0;
+  for (size_t i = 0; i < FlatIndex::GROUP_SIZE; i++) {
+    mask |= static_cast<uint32_t>(group[i] == value) << i;
+  }
+  return mask;
+#endif
+}
+
+// bit mask of the free - empty or deleted - slots in the group
+uint32_t matchFree(const int8_t *group) {
+#if defined(__SSE2__)
+  // free control bytes are the negative ones
+  return _mm_movemask_epi8(
+      _mm_loadu_si128(reinterpret_cast<const __m128i *>(group)));
+#else
+  uint32_t mask = 0;
+  for (size_t i = 0; i < FlatIndex::GROUP_SIZE; i++) {
+    mask |= static_cast<uint32_t>(group[i] < 0) << i;
+  }
+  return mask;
+#endif
+}
+
+size_t varintLength(uint64_t value) {
+  size_t length = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    length++;
+  }
+  return length;
+}
+
+// the 7 bits of the hash stored in the control byte
+int8_t controlOf(uint64_t hash) { return static_cast<int8_t>(hash & 0x7f); }
+
+}  // namespace
+
+FlatIndex::FlatIndex() = default;
+
+uint64_t FlatIndex::hash(std::string_view key) {
+  return std::hash<std::string_view>{}(key);
+}
+
+std::string_view FlatIndex::keyIn(const char *arena, uint64_t keyOffset) {
+  const char *data = arena + keyOffset;
+  uint64_t length = 0;
+  for (int shift = 0;; shift += 7) {
+    const uint8_t byte = static_cast<uint8_t>(*data++);
+    length |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (byte < 0x80) {
+      break;
+    }
+  }
+  return std::string_view(data, length);
+}
+
+uint64_t FlatIndex::storeKey(std::string_view key) {
+  const size_t needed = varintLength(key.length()) + key.length();
+  if (arenaSize + needed > arenaCapacity) {
+    // bump allocation - grow the arena by doubling it
+    const size_t newCapacity =
+        std::max(arenaSize + needed, std::max<size_t>(arenaCapacity * 2, 256));
+    std::unique_ptr<char[]> newArena(new char[newCapacity]);
+    if (arenaSize > 0) {
+      std::memcpy(newArena.get(), arena.get(), arenaSize);
+    }
+    arena = std::move(newArena);
+    arenaCapacity = newCapacity;
+  }
+
+  const uint64_t keyOffset = arenaSize;
+  char *data = arena.get() + arenaSize;
+  uint64_t length = key.length();
+  while (length >= 0x80) {
+    *data++ = static_cast<char>(length | 0x80);
+    length >>= 7;
+  }
+  *data++ = static_cast<char>(length);
+  std::memcpy(data, key.data(), key.length());
+  arenaSize += needed;
+  return keyOffset;
+}
+
+size_t FlatIndex::find(std::string_view key, uint64_t hash) const {
+  if (capacity == 0) {
+    return capacity;
+  }
+
+  // visit the groups in triangular steps, which covers them all
+  const size_t groupMask = capacity / GROUP_SIZE - 1;
+  size_t group = (hash >> 7) & groupMask;
+  for (size_t step = 1;; step++) {
+    const int8_t *groupControl = &control[group * GROUP_SIZE];
+    for (uint32_t match = matchControl(groupControl, controlOf(hash));
+         match != 0; match &= match - 1) {
+      const size_t position = group * GROUP_SIZE + __builtin_ctz(match);
+      if (keyAt(slots[position].keyOffset) == key) {
+        return position;
+      }
+    }
+    // an empty slot means the key was never inserted further along
+    if (matchControl(groupControl, CONTROL_EMPTY) != 0 || step > groupMask) {
+      return capacity;
+    }
+    group = (group + step) & groupMask;
+  }
+}
+
+size_t FlatIndex::findFree(uint64_t hash) const {
+  const size_t groupMask = capacity / GROUP_SIZE - 1;
+  size_t group = (hash >> 7) & groupMask;
+  for (size_t step = 1;; step++) {
+    const uint32_t match = matchFree(&control[group * GROUP_SIZE]);
+    if (match != 0) {
+      return group * GROUP_SIZE + __builtin_ctz(match);
+    }
+    group = (group + step) & groupMask;
+  }
+}
+
+void FlatIndex::rehash(size_t newCapacity) {
+  std::unique_ptr<int8_t[]> oldControl = std::move(control);
+  std::unique_ptr<Slot[]> oldSlots = std::move(slots);
+  std::unique_ptr<char[]> oldArena = std::move(arena);
+  const size_t oldCapacity = capacity;
+
+  control.reset(new int8_t[newCapacity]);
+  std::memset(control.get(), CONTROL_EMPTY, newCapacity);
+  slots.reset(new Slot[newCapacity]);
+  capacity = newCapacity;
+  deleted = 0;
+  generation++;
+
+  // copy the live keys into a new arena, leaving the garbage behind
+  arenaCapacity = std::max<size_t>(arenaSize - arenaGarbage, 256);
+  arena.reset(new char[arenaCapacity]);
+  arenaSize = 0;
+  arenaGarbage = 0;
+
+  for (size_t position = 0; position < oldCapacity; position++) {
+    if (oldControl[position] < 0) {
+      continue;
+    }
+    Slot slot = oldSlots[position];
+    const std::string_view key = keyIn(oldArena.get(), slot.keyOffset);
+    // copy the stored key along with its length prefix
+    const size_t storedLength = varintLength(key.length()) + key.length();
+    std::memcpy(arena.get() + arenaSize, oldArena.get() + slot.keyOffset,
+                storedLength);
+    slot.keyOffset = arenaSize;
+    arenaSize += storedLength;
+
+    const uint64_t keyHash = hash(key);
+    const size_t newPosition = findFree(keyHash);
+    control[newPosition] = controlOf(keyHash);
+    slots[newPosition] = slot;
+  }
+}
+
+IndexEntry FlatIndex::entryOf(const Slot &slot, size_t keyLength) {
+  return IndexEntry{slot.segmentId, static_cast<unsigned long>(slot.offset),
+                    RECORD_HEADER_SIZE + keyLength + slot.valueLength,
+                    slot.sequence};
+}
+
+void FlatIndex::setEntry(Slot &slot, size_t keyLength,
+                         const IndexEntry &entry) {
+  if (entry.size - RECORD_HEADER_SIZE - keyLength >
+      std::numeric_limits<uint32_t>::max()) {
+    throw SaaviException("record location is out of range for the index");
+  }
+  slot.sequence = entry.sequence;
+  slot.offset = entry.offset;
+  slot.segmentId = entry.segmentId;
+  slot.valueLength =
+      static_cast<uint32_t>(entry.size - RECORD_HEADER_SIZE - keyLength);
+}
+
+bool FlatIndex::put(std::string_view key, const IndexEntry &entry,
+                    IndexEntry *previous) {
+  const uint64_t keyHash = hash(key);
+  const size_t position = find(key, keyHash);
+  if (position != capacity) {
+    Slot &slot = slots[position];
+    if (previous != nullptr) {
+      *previous = entryOf(slot, key.length());
+    }
+    setEntry(slot, key.length(), entry);
+    return true;
+  }
+
+  if (count + deleted + 1 > maxLoad(capacity)) {
+    // grow, unless it is erased keys that fill up the table
+    const size_t newCapacity =
+        capacity == 0 ? GROUP_SIZE
+        : (count + 1) * 2 > maxLoad(capacity) ? capacity * 2
+                                              : capacity;
+    rehash(newCapacity);
+  }
+
+  Slot slot;
+  setEntry(slot, key.length(), entry);
+  slot.keyOffset = storeKey(key);
+  const size_t freePosition = findFree(keyHash);
+  if (control[freePosition] == CONTROL_DELETED) {
+    deleted--;
+  }
+  control[freePosition] = controlOf(keyHash);
+  slots[freePosition] = slot;
+  count++;
+  return false;
+}
+
+bool FlatIndex::get(std::string_view key, IndexEntry &entry) const {
+  const size_t position = find(key, hash(key));
+  if (position == capacity) {
+    return false;
+  }
+  entry = entryOf(slots[position], key.length());
+  return true;
+}
+
+bool FlatIndex::erase(std::string_view key) {
+  const size_t position = find(key, hash(key));
+  if (position == capacity) {
+    return false;
+  }
+  arenaGarbage += varintLength(key.length()) + key.length();
+  control[position] = CONTROL_DELETED;
+  count--;
+  deleted++;
+  return true;
+}
+
+void FlatIndex::clear() {
+  control.reset();
+  slots.reset();
+  arena.reset();
+  capacity = count = deleted = 0;
+  arenaSize = arenaCapacity = arenaGarbage = 0;
+  generation++;
+}
+
+size_t FlatIndex::memoryUsage() const {
+  return capacity * (sizeof(int8_t) + sizeof(Slot)) + arenaCapacity;
+}
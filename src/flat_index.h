@@ -0,0 +1,133 @@
+#ifndef FLAT_INDEX_H
+#define FLAT_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+// location of the latest record of a key in the log
+struct IndexEntry {
+  uint32_t segmentId;
+  unsigned long offset;
+  // size of the whole record including the header
+  unsigned long size;
+  // sequence number of the record
+  uint64_t sequence;
+};
+
+// An open addressing hash map from keys to IndexEntry, built to keep the
+// memory per key small. The keys are packed one after the other into a bump
+// allocated arena, and each slot of the table holds the arena offset of its
+// key and the packed location of the record - there is no allocation per
+// key.
+//
+// The table is split into groups of 16 slots. Every slot has a control byte
+// holding 7 bits of the hash of its key, so a lookup compares the control
+// bytes of a whole group against the hash at once (with SSE2 where
+// available) and only compares the keys of the slots that match.
+//
+// FlatIndex is not thread safe.
+class FlatIndex {
+ public:
+  static constexpr size_t GROUP_SIZE = 16;
+
+ private:
+  struct Slot {
+    // offset of the key in the arena
+    uint64_t keyOffset;
+    uint64_t sequence;
+    // offset of the record in its segment
+    uint64_t offset;
+    uint32_t segmentId;
+    // the record size is derived from the key and value lengths
+    uint32_t valueLength;
+  };
+
+  // a control byte for every slot - the 7 hash bits of its key, or a
+  // negative value if the slot is free
+  std::unique_ptr<int8_t[]> control;
+  std::unique_ptr<Slot[]> slots;
+  size_t capacity{0};
+  size_t count{0};
+  // slots of erased keys, which keep probe sequences going
+  size_t deleted{0};
+
+  // keys stored as a varint length followed by the key bytes
+  std::unique_ptr<char[]> arena;
+  size_t arenaSize{0};
+  size_t arenaCapacity{0};
+  // arena bytes of keys that have been erased or replaced
+  size_t arenaGarbage{0};
+  // bumped whenever the keys move to other slots
+  uint64_t generation{0};
+
+  static uint64_t hash(std::string_view key);
+  // the key stored at the given offset of an arena
+  static std::string_view keyIn(const char *arena, uint64_t keyOffset);
+  std::string_view keyAt(uint64_t keyOffset) const {
+    return keyIn(arena.get(), keyOffset);
+  }
+  uint64_t storeKey(std::string_view key);
+
+  // position of the slot holding the key, or capacity if it isn't present
+  size_t find(std::string_view key, uint64_t hash) const;
+  // position of the first free slot along the probe sequence of the hash
+  size_t findFree(uint64_t hash) const;
+  // rebuild the table with the given capacity, dropping erased keys from
+  // both the table and the arena
+  void rehash(size_t newCapacity);
+
+  static IndexEntry entryOf(const Slot &slot, size_t keyLength);
+  static void setEntry(Slot &slot, size_t keyLength, const IndexEntry &entry);
+
+ public:
+  FlatIndex();
+
+  // returns true and fills in previous if the key was already present
+  bool put(std::string_view key, const IndexEntry &entry,
+           IndexEntry *previous = nullptr);
+  bool get(std::string_view key, IndexEntry &entry) const;
+  bool erase(std::string_view key);
+  void clear();
+  size_t size() const { return count; }
+  size_t slotCount() const { return capacity; }
+  // changes whenever a rehash or clear moves the keys to other slots, which
+  // ends the walks of forEachFrom begun before
+  uint64_t layout() const { return generation; }
+
+  // bytes allocated for the table and the arena
+  size_t memoryUsage() const;
+
+  // call func with every key and its entry
+  template <typename Func>
+  void forEach(Func func) const {
+    for (size_t position = 0; position < capacity; position++) {
+      if (control[position] >= 0) {
+        const Slot &slot = slots[position];
+        const std::string_view key = keyAt(slot.keyOffset);
+        func(key, entryOf(slot, key.length()));
+      }
+    }
+  }
+
+  // call func with the keys of the slots from the position on, stopping
+  // after limit of them. Returns the position to carry on from, which is
+  // slotCount() once the walk is complete - as long as layout() stays the
+  // same in between.
+  template <typename Func>
+  size_t forEachFrom(size_t position, size_t limit, Func func) const {
+    for (; position < capacity && limit > 0; position++) {
+      if (control[position] >= 0) {
+        const Slot &slot = slots[position];
+        const std::string_view key = keyAt(slot.keyOffset);
+        func(key, entryOf(slot, key.length()));
+        limit--;
+      }
+    }
+    return position;
+  }
+};
+
+#endif
@@ -0,0 +1,307 @@
+#include "hint_file.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+#include "record.h"
+#include "saavi_exception.h"
+#include "segment.h"
+
+namespace {
+// entries are buffered and written out in large chunks
+const size_t WRITE_BUFFER_SIZE = 1 << 20;
+
+std::filesystem::path directoryOf(const std::string &filename) {
+  auto directory = std::filesystem::path(filename).parent_path();
+  return directory.empty() ? std::filesystem::path(".") : directory;
+}
+
+// write all of data at the offset, returns false on an error
+bool writeAt(int fd, const char *data, size_t length, off_t offset) {
+  size_t written = 0;
+  while (written < length) {
+    ssize_t n = ::pwrite(fd, data + written, length - written,
+                         offset + static_cast<off_t>(written));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      return false;
+    }
+    written += n;
+  }
+  return true;
+}
+}  // namespace
+
+HintFileWriter::HintFileWriter(const std::string &filename,
+                               const std::vector<HintSegment> &segments)
+    : filename(filename),
+      tmpFilename(filename + ".tmp"),
+      segmentCount(segments.size()) {
+  fd = ::open(tmpFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+              0644);
+  if (fd < 0) {
+    throw SaaviException("failed to create hint file '" + tmpFilename +
+                         "' : " + strerror(errno));
+  }
+
+  // reserve space for the header, it is written once all entries are known
+  buffer.assign(HINT_HEADER_SIZE, '\0');
+
+  // the segment table goes right after the header
+  for (const auto &segment : segments) {
+    char buf[HINT_SEGMENT_SIZE] = {};
+    encodeFixed32(buf, segment.id);
+    encodeFixed64(buf + 8, segment.size);
+    encodeFixed64(buf + 16, segment.createdAt);
+    buffer.append(buf, HINT_SEGMENT_SIZE);
+  }
+}
+
+HintFileWriter::~HintFileWriter() {
+  if (fd >= 0) {
+    ::close(fd);
+  }
+}
+
+void HintFileWriter::flushBuffer() {
+  // the header is checksummed last, only checksum the entries here
+  crc = crc32c(buffer.data() + checksumFrom, buffer.length() - checksumFrom,
+               crc);
+  checksumFrom = 0;
+  if (!writeAt(fd, buffer.data(), buffer.length(), written)) {
+    throw SaaviException("failed to write hint file '" + tmpFilename +
+                         "' : " + strerror(errno));
+  }
+  written += buffer.length();
+  buffer.clear();
+}
+
+void HintFileWriter::add(const HintEntry &hintEntry) {
+  const size_t start = buffer.length();
+  buffer.resize(start + HINT_ENTRY_HEADER_SIZE);
+  char *entry = &buffer[start];
+  encodeFixed32(entry, static_cast<uint32_t>(hintEntry.key.length()));
+  encodeFixed64(entry + 4, hintEntry.size);
+  encodeFixed64(entry + 12, hintEntry.offset);
+  encodeFixed64(entry + 20, hintEntry.sequence);
+  encodeFixed32(entry + 28, hintEntry.segmentId);
+  buffer.append(hintEntry.key);
+  entryCount++;
+
+  if (buffer.length() >= WRITE_BUFFER_SIZE) {
+    flushBuffer();
+  }
+}
+
+void HintFileWriter::addBlob(const HintBlob &hintBlob) {
+  const size_t start = buffer.length();
+  buffer.resize(start + HINT_BLOB_HEADER_SIZE);
+  char *blob = &buffer[start];
+  encodeFixed32(blob, static_cast<uint32_t>(hintBlob.key.length()));
+  encodeFixed32(blob + 4, hintBlob.pointer.fileId);
+  encodeFixed64(blob + 8, hintBlob.pointer.offset);
+  encodeFixed64(blob + 16, hintBlob.pointer.size);
+  buffer.append(hintBlob.key);
+  blobCount++;
+
+  if (buffer.length() >= WRITE_BUFFER_SIZE) {
+    flushBuffer();
+  }
+}
+
+void HintFileWriter::addChain(const HintChain &hintChain) {
+  const size_t start = buffer.length();
+  buffer.resize(start + HINT_CHAIN_HEADER_SIZE);
+  encodeFixed32(&buffer[start], static_cast<uint32_t>(hintChain.key.length()));
+  encodeFixed32(&buffer[start + 4],
+                static_cast<uint32_t>(hintChain.entries.size()));
+  buffer.append(hintChain.key);
+  for (const auto &chainEntry : hintChain.entries) {
+    char entry[HINT_CHAIN_ENTRY_SIZE];
+    encodeFixed64(entry, chainEntry.size);
+    encodeFixed64(entry + 8, chainEntry.offset);
+    encodeFixed64(entry + 16, chainEntry.sequence);
+    encodeFixed32(entry + 24, chainEntry.segmentId);
+    buffer.append(entry, HINT_CHAIN_ENTRY_SIZE);
+  }
+  chainCount++;
+
+  if (buffer.length() >= WRITE_BUFFER_SIZE) {
+    flushBuffer();
+  }
+}
+
+void HintFileWriter::finish(HintHeader header) {
+  header.entryCount = entryCount;
+  header.blobCount = blobCount;
+  header.chainCount = chainCount;
+
+  // write out the remaining entries
+  flushBuffer();
+
+  // encode the header and fold it into the checksum
+  char headerBuf[HINT_HEADER_SIZE] = {};
+  std::memcpy(headerBuf, HINT_MAGIC, sizeof(HINT_MAGIC));
+  encodeFixed32(headerBuf + 8, HINT_VERSION);
+  encodeFixed32(headerBuf + 12, header.lastRecordCrc);
+  encodeFixed64(headerBuf + 16, header.highWaterMark);
+  encodeFixed64(headerBuf + 24, header.lastRecordOffset);
+  encodeFixed64(headerBuf + 32, header.lastRecordSequence);
+  encodeFixed64(headerBuf + 40, header.entryCount);
+  encodeFixed32(headerBuf + 48, header.activeSegmentId);
+  encodeFixed32(headerBuf + 52, segmentCount);
+  encodeFixed64(headerBuf + 56, header.blobCount);
+  encodeFixed64(headerBuf + 64, header.chainCount);
+  crc = crc32c(headerBuf, HINT_HEADER_SIZE, crc);
+
+  char crcBuf[4];
+  encodeFixed32(crcBuf, crc);
+  // the hint has to be on disk before the rename makes it the current one
+  if (!writeAt(fd, crcBuf, sizeof(crcBuf), written) ||
+      !writeAt(fd, headerBuf, HINT_HEADER_SIZE, 0) || ::fdatasync(fd) != 0) {
+    throw SaaviException("failed to write hint file '" + tmpFilename +
+                         "' : " + strerror(errno));
+  }
+  ::close(fd);
+  fd = -1;
+
+  if (std::rename(tmpFilename.c_str(), filename.c_str()) != 0) {
+    throw SaaviException("failed to rename hint file '" + tmpFilename + "'");
+  }
+  syncDirectory(directoryOf(filename).string());
+}
+
+bool HintFileReader::open(const std::string &filename) {
+  std::ifstream in(filename, std::ios::in | std::ios::binary);
+  if (!in.is_open()) {
+    return false;
+  }
+
+  // read the whole file in one go
+  in.seekg(0, std::ios_base::end);
+  const auto size = in.tellg();
+  if (size < static_cast<std::streamoff>(HINT_HEADER_SIZE + 4)) {
+    return false;
+  }
+  data.resize(size);
+  in.seekg(0, std::ios_base::beg);
+  if (!in.read(&data[0], size)) {
+    return false;
+  }
+
+  const char *buf = data.data();
+  if (std::memcmp(buf, HINT_MAGIC, sizeof(HINT_MAGIC)) != 0 ||
+      decodeFixed32(buf + 8) != HINT_VERSION) {
+    return false;
+  }
+
+  // the entries are checksummed first and then the header
+  const size_t entriesEnd = data.length() - 4;
+  uint32_t crc = crc32c(buf + HINT_HEADER_SIZE, entriesEnd - HINT_HEADER_SIZE);
+  crc = crc32c(buf, HINT_HEADER_SIZE, crc);
+  if (crc != decodeFixed32(buf + entriesEnd)) {
+    return false;
+  }
+
+  header.lastRecordCrc = decodeFixed32(buf + 12);
+  header.highWaterMark = decodeFixed64(buf + 16);
+  header.lastRecordOffset = decodeFixed64(buf + 24);
+  header.lastRecordSequence = decodeFixed64(buf + 32);
+  header.entryCount = decodeFixed64(buf + 40);
+  header.activeSegmentId = decodeFixed32(buf + 48);
+  const uint32_t segmentCount = decodeFixed32(buf + 52);
+  header.blobCount = decodeFixed64(buf + 56);
+  header.chainCount = decodeFixed64(buf + 64);
+  if (HINT_HEADER_SIZE + segmentCount * HINT_SEGMENT_SIZE > entriesEnd) {
+    return false;
+  }
+  for (uint32_t i = 0; i < segmentCount; i++) {
+    const char *segment = buf + position;
+    segments.push_back(HintSegment{decodeFixed32(segment),
+                                   decodeFixed64(segment + 8),
+                                   decodeFixed64(segment + 16)});
+    position += HINT_SEGMENT_SIZE;
+  }
+  data.resize(entriesEnd);
+  return true;
+}
+
+bool HintFileReader::next(HintEntry &entry) {
+  if (entriesRead == header.entryCount ||
+      position + HINT_ENTRY_HEADER_SIZE > data.length()) {
+    return false;
+  }
+
+  const char *buf = data.data() + position;
+  const uint32_t keyLength = decodeFixed32(buf);
+  if (position + HINT_ENTRY_HEADER_SIZE + keyLength > data.length()) {
+    return false;
+  }
+  entry.size = decodeFixed64(buf + 4);
+  entry.offset = decodeFixed64(buf + 12);
+  entry.sequence = decodeFixed64(buf + 20);
+  entry.segmentId = decodeFixed32(buf + 28);
+  entry.key.assign(buf + HINT_ENTRY_HEADER_SIZE, keyLength);
+
+  position += HINT_ENTRY_HEADER_SIZE + keyLength;
+  entriesRead++;
+  return true;
+}
+
+bool HintFileReader::nextBlob(HintBlob &blob) {
+  if (entriesRead != header.entryCount || blobsRead == header.blobCount ||
+      position + HINT_BLOB_HEADER_SIZE > data.length()) {
+    return false;
+  }
+
+  const char *buf = data.data() + position;
+  const uint32_t keyLength = decodeFixed32(buf);
+  if (position + HINT_BLOB_HEADER_SIZE + keyLength > data.length()) {
+    return false;
+  }
+  blob.pointer.fileId = decodeFixed32(buf + 4);
+  blob.pointer.offset = decodeFixed64(buf + 8);
+  blob.pointer.size = decodeFixed64(buf + 16);
+  blob.key.assign(buf + HINT_BLOB_HEADER_SIZE, keyLength);
+
+  position += HINT_BLOB_HEADER_SIZE + keyLength;
+  blobsRead++;
+  return true;
+}
+
+bool HintFileReader::nextChain(HintChain &chain) {
+  if (blobsRead != header.blobCount || chainsRead == header.chainCount ||
+      position + HINT_CHAIN_HEADER_SIZE > data.length()) {
+    return false;
+  }
+
+  const char *buf = data.data() + position;
+  const uint32_t keyLength = decodeFixed32(buf);
+  const uint32_t length = decodeFixed32(buf + 4);
+  const size_t size = HINT_CHAIN_HEADER_SIZE + keyLength +
+                      static_cast<size_t>(length) * HINT_CHAIN_ENTRY_SIZE;
+  if (position + size > data.length()) {
+    return false;
+  }
+  chain.key.assign(buf + HINT_CHAIN_HEADER_SIZE, keyLength);
+  chain.entries.clear();
+  const char *entry = buf + HINT_CHAIN_HEADER_SIZE + keyLength;
+  for (uint32_t i = 0; i < length; i++, entry += HINT_CHAIN_ENTRY_SIZE) {
+    chain.entries.push_back(IndexEntry{decodeFixed32(entry + 24),
+                                       decodeFixed64(entry + 8),
+                                       decodeFixed64(entry),
+                                       decodeFixed64(entry + 16)});
+  }
+
+  position += size;
+  chainsRead++;
+  return true;
+}
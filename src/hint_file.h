@@ -0,0 +1,151 @@
+#ifndef HINT_FILE_H
+#define HINT_FILE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "blob_file.h"
+#include "flat_index.h"
+
+/*
+ * A hint file is a compact snapshot of the KeyIndex written next to the data
+ * files. Loading it lets Saavi rebuild the index without replaying the whole
+ * log - only the records appended after the hint's high-water mark need to be
+ * read from the data files.
+ *
+ * Layout (all integers little-endian):
+ *   magic "SAAVIHNT" (8) | version (4) | last record crc (4) |
+ *   high-water mark (8) | last record offset (8) | last record sequence (8) |
+ *   entry count (8) | active segment id (4) | segment count (4) |
+ *   blob count (8) | chain count (8)
+ *   segments : id (4) | reserved (4) | size (8) | created at (8)
+ *   entries  : key length (4) | record size (8) | offset (8) | sequence (8) |
+ *              segment id (4) | key
+ *   blobs    : key length (4) | blob file id (4) | offset (8) | size (8) |
+ *              key
+ *   chains   : key length (4) | length (4) | key |
+ *              length * (record size (8) | offset (8) | sequence (8) |
+ *                        segment id (4))
+ *   crc32c of everything above (4)
+ *
+ * The blobs are the blob pointers of the keys whose values are in blob
+ * files, which the index itself doesn't know about. The chains are those
+ * of the keys whose entry is a merge operand, oldest record first.
+ */
+
+constexpr char HINT_MAGIC[8] = {'S', 'A', 'A', 'V', 'I', 'H', 'N', 'T'};
+// hints before version 3 listed deleted keys, which the index no longer
+// holds, hints before version 4 had no blobs, hints before version 5 no
+// chains and hints before version 6 cut record sizes to 32 bits, so they are
+// ignored
+constexpr uint32_t HINT_VERSION = 6;
+constexpr size_t HINT_HEADER_SIZE = 72;
+constexpr size_t HINT_SEGMENT_SIZE = 24;
+constexpr size_t HINT_ENTRY_HEADER_SIZE = 32;
+constexpr size_t HINT_BLOB_HEADER_SIZE = 24;
+constexpr size_t HINT_CHAIN_HEADER_SIZE = 8;
+constexpr size_t HINT_CHAIN_ENTRY_SIZE = 28;
+
+struct HintHeader {
+  // offset in the active segment upto which the hint covers the log
+  uint64_t highWaterMark{0};
+  // offset, sequence and checksum of the last record before the high-water
+  // mark, used to verify that the hint still belongs to the data file
+  uint64_t lastRecordOffset{0};
+  uint64_t lastRecordSequence{0};
+  uint32_t lastRecordCrc{0};
+  uint64_t entryCount{0};
+  uint64_t blobCount{0};
+  uint64_t chainCount{0};
+  // segment that was being appended to when the hint was written
+  uint32_t activeSegmentId{0};
+};
+
+// a segment of the log as it was when the hint was written
+struct HintSegment {
+  uint32_t id;
+  uint64_t size;
+  uint64_t createdAt;
+};
+
+struct HintEntry {
+  std::string key;
+  uint32_t segmentId;
+  uint64_t offset;
+  uint64_t size;
+  uint64_t sequence;
+};
+
+struct HintBlob {
+  std::string key;
+  BlobPointer pointer;
+};
+
+struct HintChain {
+  std::string key;
+  std::vector<IndexEntry> entries;
+};
+
+// Streams the entries into a temporary file and renames it into place once
+// it is complete and durable, so readers only ever see a whole hint file.
+class HintFileWriter {
+  std::string filename;
+  std::string tmpFilename;
+  int fd{-1};
+  // bytes written to the file so far
+  uint64_t written{0};
+  std::string buffer;
+  uint32_t crc{0};
+  // the reserved header bytes at the start of the buffer are not checksummed
+  // along with the entries
+  size_t checksumFrom{HINT_HEADER_SIZE};
+  uint32_t segmentCount;
+  uint64_t entryCount{0};
+  uint64_t blobCount{0};
+  uint64_t chainCount{0};
+
+  void flushBuffer();
+
+ public:
+  HintFileWriter(const std::string &filename,
+                 const std::vector<HintSegment> &segments);
+  // closes the temporary file, which stays behind unless finish succeeded
+  ~HintFileWriter();
+  HintFileWriter(const HintFileWriter &) = delete;
+  HintFileWriter &operator=(const HintFileWriter &) = delete;
+  void add(const HintEntry &entry);
+  // add a blob pointer, once all the entries have been added
+  void addBlob(const HintBlob &blob);
+  // add a chain, once all the blob pointers have been added
+  void addChain(const HintChain &chain);
+  // write the header and atomically replace any existing hint file
+  void finish(HintHeader header);
+};
+
+// Reads and validates a complete hint file in one sequential read
+class HintFileReader {
+  std::string data;
+  size_t position{HINT_HEADER_SIZE};
+  HintHeader header;
+  std::vector<HintSegment> segments;
+  uint64_t entriesRead{0};
+  uint64_t blobsRead{0};
+  uint64_t chainsRead{0};
+
+ public:
+  // returns false if the file is missing, incomplete or corrupt
+  bool open(const std::string &filename);
+  const HintHeader &getHeader() const { return header; }
+  const std::vector<HintSegment> &getSegments() const { return segments; }
+  // read the next entry, returns false once all entries have been read
+  bool next(HintEntry &entry);
+  // read the next blob pointer once all the entries have been read, returns
+  // false once all of them have been read
+  bool nextBlob(HintBlob &blob);
+  // read the next chain once all the blob pointers have been read, returns
+  // false once all of them have been read
+  bool nextChain(HintChain &chain);
+};
+
+#endif
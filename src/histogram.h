@@ -0,0 +1,126 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+// A latency histogram in the style of HdrHistogram. Values, in nanoseconds,
+// are counted in buckets whose width doubles every power of two, and every
+// power of two is split in SUB_BUCKETS / 2 linear sub-buckets, so any value
+// is known to within 1/32 of itself whatever its magnitude. Recording is a
+// couple of instructions and histograms of different threads are merged by
+// adding up their counts.
+class LatencyHistogram {
+ public:
+  static constexpr unsigned SUB_BUCKET_BITS = 6;
+  static constexpr uint64_t SUB_BUCKETS = uint64_t(1) << SUB_BUCKET_BITS;
+  static constexpr uint64_t HALF_SUB_BUCKETS = SUB_BUCKETS / 2;
+  // values of more than 2^40ns, about 18 minutes, go into the last bucket
+  static constexpr unsigned MAX_VALUE_BITS = 40;
+  // values below SUB_BUCKETS are counted exactly, every power of two above
+  // adds half as many buckets
+  static constexpr size_t NUM_OF_BUCKETS =
+      SUB_BUCKETS + (MAX_VALUE_BITS - SUB_BUCKET_BITS) * HALF_SUB_BUCKETS;
+
+  static size_t bucketOf(uint64_t value) {
+    if (value < SUB_BUCKETS) {
+      return value;
+    }
+    if (value >> MAX_VALUE_BITS) {
+      return NUM_OF_BUCKETS - 1;
+    }
+    // the shift leaves the top SUB_BUCKET_BITS bits of the value
+    const unsigned shift = 63 - __builtin_clzll(value) - SUB_BUCKET_BITS + 1;
+    return SUB_BUCKETS + (shift - 1) * HALF_SUB_BUCKETS +
+           (value >> shift) - HALF_SUB_BUCKETS;
+  }
+
+  // the largest value that falls into the bucket
+  static uint64_t highestValueOf(size_t bucket) {
+    if (bucket < SUB_BUCKETS) {
+      return bucket;
+    }
+    const unsigned shift = (bucket - SUB_BUCKETS) / HALF_SUB_BUCKETS + 1;
+    const uint64_t subBucket =
+        (bucket - SUB_BUCKETS) % HALF_SUB_BUCKETS + HALF_SUB_BUCKETS;
+    return ((subBucket + 1) << shift) - 1;
+  }
+
+  void record(uint64_t value) {
+    counts[bucketOf(value)]++;
+    total++;
+    sum += value;
+    minValue = std::min(minValue, value);
+    maxValue = std::max(maxValue, value);
+  }
+
+  // add the values counted bucket by bucket elsewhere, given their sum and
+  // the largest of them. The smallest is taken as the start of its bucket.
+  void add(const uint64_t *bucketCounts, uint64_t valueSum,
+           uint64_t largest) {
+    bool first = true;
+    for (size_t i = 0; i < NUM_OF_BUCKETS; i++) {
+      if (bucketCounts[i] == 0) {
+        continue;
+      }
+      if (first) {
+        minValue = std::min(minValue, i > 0 ? highestValueOf(i - 1) + 1 : 0);
+        first = false;
+      }
+      counts[i] += bucketCounts[i];
+      total += bucketCounts[i];
+    }
+    sum += valueSum;
+    maxValue = std::max(maxValue, largest);
+  }
+
+  void merge(const LatencyHistogram &other) {
+    for (size_t i = 0; i < NUM_OF_BUCKETS; i++) {
+      counts[i] += other.counts[i];
+    }
+    total += other.total;
+    sum += other.sum;
+    minValue = std::min(minValue, other.minValue);
+    maxValue = std::max(maxValue, other.maxValue);
+  }
+
+  uint64_t count() const { return total; }
+
+  uint64_t min() const { return total > 0 ? minValue : 0; }
+
+  uint64_t max() const { return maxValue; }
+
+  double mean() const {
+    return total > 0 ? static_cast<double>(sum) / total : 0;
+  }
+
+  // the value below which the given percentage of the recorded values lie,
+  // rounded up to the end of its bucket like HdrHistogram does
+  uint64_t percentile(double percent) const {
+    if (total == 0) {
+      return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(percent / 100 * total + 0.5);
+    rank = std::max<uint64_t>(1, std::min(rank, total));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < NUM_OF_BUCKETS; i++) {
+      seen += counts[i];
+      if (seen >= rank) {
+        return std::min(highestValueOf(i), maxValue);
+      }
+    }
+    return maxValue;
+  }
+
+ private:
+  std::array<uint64_t, NUM_OF_BUCKETS> counts{};
+  uint64_t total{0};
+  uint64_t sum{0};
+  uint64_t minValue{std::numeric_limits<uint64_t>::max()};
+  uint64_t maxValue{0};
+};
+
+#endif
@@ -0,0 +1,108 @@
+#include "ingest_reader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "record.h"
+#include "saavi_exception.h"
+
+IngestReader::IngestReader(const std::string &path, IngestFormat format)
+    : m_path(path), m_format(format) {
+  m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (m_fd < 0) {
+    throw SaaviException("failed to open '" + path +
+                         "' : " + strerror(errno));
+  }
+  ::posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+IngestReader::~IngestReader() { ::close(m_fd); }
+
+bool IngestReader::fill(size_t length) {
+  if (m_buffer.length() - m_position >= length) {
+    return true;
+  }
+  m_buffer.erase(0, m_position);
+  m_position = 0;
+  while (m_buffer.length() < length && !m_ended) {
+    const size_t size = m_buffer.length();
+    m_buffer.resize(size + std::max(READ_SIZE, length - size));
+    const ssize_t bytes =
+        ::read(m_fd, &m_buffer[size], m_buffer.length() - size);
+    if (bytes < 0 && errno == EINTR) {
+      m_buffer.resize(size);
+      continue;
+    }
+    if (bytes < 0) {
+      throw SaaviException("failed to read '" + m_path +
+                           "' : " + strerror(errno));
+    }
+    m_buffer.resize(size + bytes);
+    m_ended = bytes == 0;
+  }
+  return m_buffer.length() >= length;
+}
+
+void IngestReader::invalid(const std::string &what) const {
+  throw SaaviException("invalid input '" + m_path + "' - " + what);
+}
+
+bool IngestReader::nextLine(std::string_view &key, std::string_view &value) {
+  while (true) {
+    size_t end;
+    while ((end = m_buffer.find('\n', m_position)) == std::string::npos) {
+      if (!fill(m_buffer.length() - m_position + 1)) {
+        // the last line may have no line break
+        end = m_buffer.length();
+        break;
+      }
+    }
+    if (m_position == m_buffer.length()) {
+      return false;
+    }
+    std::string_view line(m_buffer.data() + m_position, end - m_position);
+    m_position = std::min(end + 1, m_buffer.length());
+    m_lineNumber++;
+    if (!line.empty() && line.back() == '\r') {
+      line.remove_suffix(1);
+    }
+    if (line.empty()) {
+      continue;
+    }
+    const size_t comma = line.find(',');
+    if (comma == std::string_view::npos || comma == 0) {
+      invalid("line " + std::to_string(m_lineNumber) +
+              " is not a key,value pair");
+    }
+    key = line.substr(0, comma);
+    value = line.substr(comma + 1);
+    return true;
+  }
+}
+
+bool IngestReader::nextRecord(std::string_view &key,
+                              std::string_view &value) {
+  if (!fill(8)) {
+    if (m_buffer.length() > m_position) {
+      invalid("the last record is truncated");
+    }
+    return false;
+  }
+  const uint32_t keyLength = decodeFixed32(&m_buffer[m_position]);
+  const uint32_t valueLength = decodeFixed32(&m_buffer[m_position + 4]);
+  if (keyLength == 0) {
+    invalid("a record has an empty key");
+  }
+  if (!fill(8ul + keyLength + valueLength)) {
+    invalid("the last record is truncated");
+  }
+  key = std::string_view(&m_buffer[m_position + 8], keyLength);
+  value =
+      std::string_view(&m_buffer[m_position + 8 + keyLength], valueLength);
+  m_position += 8ul + keyLength + valueLength;
+  return true;
+}
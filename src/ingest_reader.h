@@ -0,0 +1,50 @@
+#ifndef INGEST_READER_H
+#define INGEST_READER_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "saavi_options.h"
+
+// Reads the key value pairs of an input of IngestExternal forward in large
+// blocks, in either of the formats of IngestFormat. Csv lines may end with
+// CRLF, the last one may have no line break and blank lines are skipped.
+// An input that isn't laid out as its format says throws a SaaviException
+// naming the input.
+class IngestReader {
+ public:
+  // inputs are read this many bytes at a time
+  static constexpr size_t READ_SIZE = 4 << 20;
+
+  IngestReader(const std::string &path, IngestFormat format);
+  ~IngestReader();
+  IngestReader(const IngestReader &) = delete;
+  IngestReader &operator=(const IngestReader &) = delete;
+
+  // the next pair, valid until the next call. Returns false once the input
+  // ends.
+  bool next(std::string_view &key, std::string_view &value) {
+    return m_format == IngestFormat::Csv ? nextLine(key, value)
+                                         : nextRecord(key, value);
+  }
+
+ private:
+  std::string m_path;
+  IngestFormat m_format;
+  int m_fd;
+  std::string m_buffer;
+  // start of the next pair in the buffer
+  size_t m_position{0};
+  bool m_ended{false};
+  uint64_t m_lineNumber{0};
+
+  // make sure length bytes from the position are buffered, returns false
+  // if the input ends before
+  bool fill(size_t length);
+  [[noreturn]] void invalid(const std::string &what) const;
+  bool nextLine(std::string_view &key, std::string_view &value);
+  bool nextRecord(std::string_view &key, std::string_view &value);
+};
+
+#endif
@@ -1,28 +1,588 @@
 #ifndef KEY_INDEX_H
 #define KEY_INDEX_H
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+#include "flat_index.h"
+
+// KeyIndex is safe to use from multiple threads. The keys are spread over
+// independently locked shards so that concurrent readers, and readers and
+// the writer, rarely touch the same lock.
+//
+// The index is versioned for the sake of snapshots: when a key is replaced or
+// erased while a snapshot that sees its current version is alive, that
+// version is kept aside in the shard of the key, under the same lock, so a
+// reader finds a key in either place but never in both.
+//
+// A key whose current version is a merge operand also has a chain: the
+// records the operand stacks on, oldest first, which are the value the
+// operands apply to, unless the key had none, and the operands written
+// before it. The chain goes along with the operand when it is replaced,
+// kept aside if a snapshot sees any of them. Snapshots find the versions in
+// a chain as they find the kept ones.
 class KeyIndex {
-  // KeyIndex uses a unordered_map to store the keys and offsets
-  std::unordered_map<std::string, unsigned long> keyOffsetMap;
+  static constexpr size_t NUM_SHARDS = 64;
+
+  // an older version of a key
+  struct OldVersion {
+    IndexEntry entry;
+    // sequence number of the write that replaced or erased it
+    uint64_t supersededAt;
+    // the chain of the version if it is a merge operand
+    std::vector<IndexEntry> chain;
+
+    bool visibleAt(uint64_t sequence) const {
+      return entry.sequence <= sequence && sequence < supersededAt;
+    }
+    // sequence number of the oldest version it or its chain hold
+    uint64_t firstSequence() const {
+      return chain.empty() ? entry.sequence : chain.front().sequence;
+    }
+  };
+
+  struct alignas(64) Shard {
+    mutable std::shared_mutex mutex;
+    // each shard uses a compact hash table to store the keys and their
+    // locations
+    FlatIndex keyOffsetMap;
+    // the older versions snapshots still see, usually none
+    std::unordered_map<std::string, std::vector<OldVersion>> versions;
+    // the chains of the keys whose current version is a merge operand
+    std::unordered_map<std::string, std::vector<IndexEntry>> chains;
+  };
+  std::array<Shard, NUM_SHARDS> shards;
+
+  // the shards are picked with the high bits of the hash, the tables of the
+  // shards use the low bits
+  Shard &shardFor(std::string_view key) {
+    return shards[(std::hash<std::string_view>{}(key) >> 58) % NUM_SHARDS];
+  }
+  const Shard &shardFor(std::string_view key) const {
+    return shards[(std::hash<std::string_view>{}(key) >> 58) % NUM_SHARDS];
+  }
+
+  // the newest version in the chain a snapshot taken at the sequence sees
+  static bool findInChain(const std::vector<IndexEntry> &chain,
+                          uint64_t sequence, IndexEntry &entry) {
+    for (auto version = chain.rbegin(); version != chain.rend(); ++version) {
+      if (version->sequence <= sequence) {
+        entry = *version;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static bool isAt(const IndexEntry &entry, uint32_t segmentId,
+                   unsigned long offset) {
+    return entry.segmentId == segmentId && entry.offset == offset;
+  }
+
+  // whether the entry is of the given record. Compaction writes its output
+  // under the id of an input, so while it repoints the versions of a key a
+  // moved one may be at the old location of one still to move, but not
+  // with the same sequence number.
+  static bool isRecord(const IndexEntry &entry, const IndexEntry &record) {
+    return isAt(entry, record.segmentId, record.offset) &&
+           entry.sequence == record.sequence;
+  }
+
+  // set aside the version of the key superseded by the given sequence
+  // number, along with its chain, if a snapshot taken upto keepUpto might
+  // see either of them. Otherwise they are added to dropped.
+  static void retire(Shard &shard, std::string_view key,
+                     const IndexEntry &old, uint64_t supersededAt,
+                     uint64_t keepUpto, std::vector<IndexEntry> *dropped) {
+    OldVersion version{old, supersededAt, {}};
+    if (!shard.chains.empty()) {
+      auto chain = shard.chains.find(std::string(key));
+      if (chain != shard.chains.end()) {
+        version.chain = std::move(chain->second);
+        shard.chains.erase(chain);
+      }
+    }
+    if (version.firstSequence() <= keepUpto) {
+      shard.versions[std::string(key)].push_back(std::move(version));
+    } else if (dropped != nullptr) {
+      dropped->push_back(old);
+      dropped->insert(dropped->end(), version.chain.begin(),
+                      version.chain.end());
+    }
+  }
+
+  // returns true and fills in previous if the key was already indexed. The
+  // previous version is kept if it or its chain might be seen by a snapshot
+  // taken upto keepUpto, or else added to dropped along with its chain.
+  bool putKeyOffset(std::string_view key, const IndexEntry &entry,
+                    IndexEntry *previous = nullptr, uint64_t keepUpto = 0,
+                    std::vector<IndexEntry> *dropped = nullptr) {
+    Shard &shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    IndexEntry old;
+    if (!shard.keyOffsetMap.put(key, entry, &old)) {
+      return false;
+    }
+    retire(shard, key, old, entry.sequence, keepUpto, dropped);
+    if (previous != nullptr) {
+      *previous = old;
+    }
+    return true;
+  }
+
+  // point the key at a merge operand, which stacks on the version the key
+  // had, if any. Returns true if the key was already indexed.
+  bool mergeKeyOffset(std::string_view key, const IndexEntry &entry) {
+    Shard &shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    IndexEntry old;
+    const bool replaced = shard.keyOffsetMap.put(key, entry, &old);
+    auto &chain = shard.chains[std::string(key)];
+    if (replaced) {
+      chain.push_back(old);
+    }
+    return replaced;
+  }
+
+  // set the chain of a key indexed with a merge operand, when loading the
+  // index
+  void putChain(std::string_view key, std::vector<IndexEntry> chain) {
+    Shard &shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    shard.chains[std::string(key)] = std::move(chain);
+  }
+
+  // put base under the operands of the key from the sequence on, in place
+  // of the versions they stacked on, as if it had been written just before
+  // them. The versions set aside are kept or dropped like putKeyOffset
+  // does. Returns false if the key has no chain.
+  bool rebaseChain(std::string_view key, const IndexEntry &base,
+                   uint64_t sequence, uint64_t keepUpto,
+                   std::vector<IndexEntry> *dropped) {
+    Shard &shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto found = shard.chains.find(std::string(key));
+    if (found == shard.chains.end()) {
+      return false;
+    }
+    auto &chain = found->second;
+    auto since = std::find_if(chain.begin(), chain.end(),
+                              [sequence](const IndexEntry &entry) {
+                                return entry.sequence >= sequence;
+                              });
+    if (since != chain.begin()) {
+      OldVersion version{*(since - 1), base.sequence,
+                         std::vector<IndexEntry>(chain.begin(), since - 1)};
+      if (version.firstSequence() <= keepUpto) {
+        shard.versions[std::string(key)].push_back(std::move(version));
+      } else if (dropped != nullptr) {
+        dropped->push_back(version.entry);
+        dropped->insert(dropped->end(), version.chain.begin(),
+                        version.chain.end());
+      }
+    }
+    chain.erase(chain.begin(), since);
+    chain.insert(chain.begin(), base);
+    return true;
+  }
+
+  // the chain of the merge operand of the key at the location, current or
+  // seen by a snapshot. Returns false if the operand isn't there anymore -
+  // compaction moved it or folded it, or it was replaced and no snapshot
+  // sees it.
+  bool getChain(std::string_view key, const IndexEntry &operand,
+                std::vector<IndexEntry> &chain) const {
+    auto stacked = [&operand, &chain](const std::vector<IndexEntry> &on) {
+      for (size_t i = 0; i < on.size(); i++) {
+        if (isAt(on[i], operand.segmentId, operand.offset)) {
+          chain.assign(on.begin(), on.begin() + i);
+          return true;
+        }
+      }
+      return false;
+    };
+    const Shard &shard = shardFor(key);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto current = shard.chains.find(std::string(key));
+    if (current != shard.chains.end()) {
+      IndexEntry head;
+      if (shard.keyOffsetMap.get(key, head) &&
+          isAt(head, operand.segmentId, operand.offset)) {
+        chain = current->second;
+        return true;
+      }
+      if (stacked(current->second)) {
+        return true;
+      }
+    }
+    auto versions = shard.versions.find(std::string(key));
+    if (versions == shard.versions.end()) {
+      return false;
+    }
+    for (const auto &version : versions->second) {
+      if (isAt(version.entry, operand.segmentId, operand.offset)) {
+        chain = version.chain;
+        return true;
+      }
+      if (stacked(version.chain)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // replace the merge operand of the key at from, wherever it is, and the
+  // chain it stacks on with the record folding them, which takes over its
+  // sequence number. Returns false if the operand isn't there anymore.
+  bool foldChain(std::string_view key, const IndexEntry &from,
+                 const IndexEntry &folded) {
+    // the versions the operand stacks on go, and the fold starts the chain
+    auto fold = [&from, &folded](std::vector<IndexEntry> &chain) {
+      for (size_t i = 0; i < chain.size(); i++) {
+        if (isRecord(chain[i], from)) {
+          chain.erase(chain.begin(), chain.begin() + i);
+          chain.front() = folded;
+          return true;
+        }
+      }
+      return false;
+    };
+    Shard &shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto current = shard.chains.find(std::string(key));
+    if (current != shard.chains.end()) {
+      IndexEntry head;
+      if (shard.keyOffsetMap.get(key, head) &&
+          isRecord(head, from)) {
+        shard.keyOffsetMap.put(key, folded);
+        shard.chains.erase(current);
+        return true;
+      }
+      if (fold(current->second)) {
+        return true;
+      }
+    }
+    auto versions = shard.versions.find(std::string(key));
+    if (versions == shard.versions.end()) {
+      return false;
+    }
+    for (auto &version : versions->second) {
+      if (isRecord(version.entry, from)) {
+        version.entry = folded;
+        version.chain.clear();
+        return true;
+      }
+      if (fold(version.chain)) {
+        return true;
+      }
+    }
+    return false;
+  }
 
-  void putKeyOffset(const std::string &key, unsigned long offset) {
-    keyOffsetMap[key] = offset;
+  bool getKeyOffset(std::string_view key, IndexEntry &entry) const {
+    const Shard &shard = shardFor(key);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    return shard.keyOffsetMap.get(key, entry);
   }
 
-  bool getKeyOffset(const std::string &key, unsigned long &offset) const {
-    auto entry = keyOffsetMap.find(key);
-    if (entry == keyOffsetMap.end()) {
+  // the version of the key a snapshot taken at the sequence sees
+  bool getKeyOffset(std::string_view key, uint64_t sequence,
+                    IndexEntry &entry) const {
+    const Shard &shard = shardFor(key);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    if (shard.keyOffsetMap.get(key, entry) && entry.sequence <= sequence) {
+      return true;
+    }
+    if (!shard.chains.empty()) {
+      auto chain = shard.chains.find(std::string(key));
+      if (chain != shard.chains.end() &&
+          findInChain(chain->second, sequence, entry)) {
+        return true;
+      }
+    }
+    if (shard.versions.empty()) {
+      return false;
+    }
+    auto versions = shard.versions.find(std::string(key));
+    if (versions == shard.versions.end()) {
+      return false;
+    }
+    for (const auto &version : versions->second) {
+      if (version.visibleAt(sequence)) {
+        entry = version.entry;
+        return true;
+      }
+      if (sequence < version.entry.sequence &&
+          findInChain(version.chain, sequence, entry)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // returns true and fills in previous if the key was indexed. The erased
+  // version is kept, as superseded by the given sequence number, like
+  // putKeyOffset keeps the version it replaces.
+  bool eraseKey(std::string_view key, IndexEntry *previous = nullptr,
+                uint64_t sequence = 0, uint64_t keepUpto = 0,
+                std::vector<IndexEntry> *dropped = nullptr) {
+    Shard &shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    IndexEntry old;
+    if (!shard.keyOffsetMap.get(key, old)) {
+      return false;
+    }
+    shard.keyOffsetMap.erase(key);
+    retire(shard, key, old, sequence, keepUpto, dropped);
+    if (previous != nullptr) {
+      *previous = old;
+    }
+    return true;
+  }
+
+  // whether older versions of the key are kept
+  bool hasVersions(std::string_view key) const {
+    const Shard &shard = shardFor(key);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    return !shard.versions.empty() &&
+           shard.versions.count(std::string(key)) > 0;
+  }
+
+  // whether a version of the key in a chain or kept aside is at the
+  // location
+  bool hasVersionAt(std::string_view key, uint32_t segmentId,
+                    unsigned long offset) const {
+    auto inChain = [segmentId, offset](const std::vector<IndexEntry> &chain) {
+      return std::any_of(chain.begin(), chain.end(),
+                         [segmentId, offset](const IndexEntry &entry) {
+                           return isAt(entry, segmentId, offset);
+                         });
+    };
+    const Shard &shard = shardFor(key);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    if (!shard.chains.empty()) {
+      auto chain = shard.chains.find(std::string(key));
+      if (chain != shard.chains.end() && inChain(chain->second)) {
+        return true;
+      }
+    }
+    if (shard.versions.empty()) {
+      return false;
+    }
+    auto versions = shard.versions.find(std::string(key));
+    if (versions == shard.versions.end()) {
       return false;
     }
+    for (const auto &version : versions->second) {
+      if (isAt(version.entry, segmentId, offset) || inChain(version.chain)) {
+        return true;
+      }
+    }
+    return false;
+  }
 
-    offset = (*entry).second;
+  // point the version of the key at from, the current one, one in a chain
+  // or one kept aside, to its new location. Returns false if the version
+  // is gone.
+  bool moveVersion(std::string_view key, const IndexEntry &from,
+                   uint32_t segmentId, unsigned long offset) {
+    auto move = [&from, segmentId, offset](IndexEntry &entry) {
+      if (!isRecord(entry, from)) {
+        return false;
+      }
+      entry.segmentId = segmentId;
+      entry.offset = offset;
+      return true;
+    };
+    auto moveInChain = [&move](std::vector<IndexEntry> &chain) {
+      return std::any_of(chain.begin(), chain.end(), move);
+    };
+    Shard &shard = shardFor(key);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    IndexEntry entry;
+    if (shard.keyOffsetMap.get(key, entry) && move(entry)) {
+      shard.keyOffsetMap.put(key, entry);
+      return true;
+    }
+    if (!shard.chains.empty()) {
+      auto chain = shard.chains.find(std::string(key));
+      if (chain != shard.chains.end() && moveInChain(chain->second)) {
+        return true;
+      }
+    }
+    auto versions = shard.versions.find(std::string(key));
+    if (versions == shard.versions.end()) {
+      return false;
+    }
+    for (auto &version : versions->second) {
+      if (move(version.entry) || moveInChain(version.chain)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // drop the kept versions none of the snapshots taken at the given
+  // sequence numbers see, calling dropped with each of them
+  template <typename Func>
+  void pruneVersions(const std::multiset<uint64_t> &snapshots, Func dropped) {
+    for (auto &shard : shards) {
+      std::unique_lock<std::shared_mutex> lock(shard.mutex);
+      for (auto it = shard.versions.begin(); it != shard.versions.end();) {
+        auto &versions = it->second;
+        auto seen = [&snapshots](const OldVersion &version) {
+          auto snapshot = snapshots.lower_bound(version.firstSequence());
+          return snapshot != snapshots.end() &&
+                 *snapshot < version.supersededAt;
+        };
+        auto end = std::partition(versions.begin(), versions.end(), seen);
+        for (auto version = end; version != versions.end(); ++version) {
+          dropped(version->entry);
+          for (const auto &entry : version->chain) {
+            dropped(entry);
+          }
+        }
+        versions.erase(end, versions.end());
+        it = versions.empty() ? shard.versions.erase(it) : std::next(it);
+      }
+    }
+  }
+
+  void clear() {
+    for (auto &shard : shards) {
+      std::unique_lock<std::shared_mutex> lock(shard.mutex);
+      shard.keyOffsetMap.clear();
+      shard.versions.clear();
+      shard.chains.clear();
+    }
+  }
+
+  size_t size() const {
+    size_t size = 0;
+    for (const auto &shard : shards) {
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      size += shard.keyOffsetMap.size();
+    }
+    return size;
+  }
+
+  // bytes allocated by the index
+  size_t memoryUsage() const {
+    size_t bytes = sizeof(*this);
+    for (const auto &shard : shards) {
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      bytes += shard.keyOffsetMap.memoryUsage();
+    }
+    return bytes;
+  }
+
+  // call func with every key and its entry, one shard at a time
+  template <typename Func>
+  void forEach(Func func) const {
+    for (const auto &shard : shards) {
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      shard.keyOffsetMap.forEach(func);
+    }
+  }
+
+  // call func with every key whose current version is a merge operand,
+  // along with that version and its chain, one shard at a time
+  template <typename Func>
+  void forEachChain(Func func) const {
+    for (const auto &shard : shards) {
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      for (const auto &chain : shard.chains) {
+        IndexEntry head;
+        if (shard.keyOffsetMap.get(chain.first, head)) {
+          func(chain.first, head, chain.second);
+        }
+      }
+    }
+  }
+
+  // position of a walk over the whole index in batches
+  struct Cursor {
+    size_t shard{0};
+    // next slot of the shard, in the layout of its table it was taken in
+    size_t slot{0};
+    uint64_t layout{0};
+    // keys of the shard handed out so far
+    std::unordered_set<std::string> emitted;
+  };
+
+  // append the entries of the next batch of about limit keys, as seen by a
+  // snapshot taken at the sequence. The index is walked one shard at a time
+  // in the order of its slots, and what the snapshot sees of the keys
+  // replaced or erased since is added once the slots of a shard are done.
+  // The keys handed out are remembered until then, so a walk that has to
+  // start the shard over because its table was rehashed skips them, and
+  // every key present throughout the walk is in exactly one batch. Returns
+  // false once the walk is complete.
+  bool nextBatch(Cursor &cursor, size_t limit, std::vector<IndexEntry> &entries,
+                 uint64_t sequence = UINT64_MAX) const {
+    if (cursor.shard >= NUM_SHARDS) {
+      return false;
+    }
+    const Shard &shard = shards[cursor.shard];
+    {
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      const FlatIndex &map = shard.keyOffsetMap;
+      if (cursor.layout != map.layout()) {
+        cursor.slot = 0;
+        cursor.layout = map.layout();
+      }
+      cursor.slot = map.forEachFrom(
+          cursor.slot, limit,
+          [&](std::string_view key, const IndexEntry &entry) {
+            if (entry.sequence <= sequence &&
+                cursor.emitted.emplace(key).second) {
+              entries.push_back(entry);
+            }
+          });
+      if (cursor.slot < map.slotCount()) {
+        return true;
+      }
+      IndexEntry entry;
+      for (const auto &chain : shard.chains) {
+        if (!cursor.emitted.count(chain.first) &&
+            map.get(chain.first, entry) && entry.sequence > sequence &&
+            findInChain(chain.second, sequence, entry)) {
+          cursor.emitted.insert(chain.first);
+          entries.push_back(entry);
+        }
+      }
+      for (const auto &versions : shard.versions) {
+        if (cursor.emitted.count(versions.first)) {
+          continue;
+        }
+        for (const auto &version : versions.second) {
+          if (version.visibleAt(sequence)) {
+            entries.push_back(version.entry);
+          } else if (sequence < version.entry.sequence &&
+                     findInChain(version.chain, sequence, entry)) {
+            entries.push_back(entry);
+          }
+        }
+      }
+    }
+    cursor.shard++;
+    cursor.slot = 0;
+    cursor.emitted.clear();
     return true;
   }
 
   friend class Saavi;
 };
 
-#endif
\ No newline at end of file
+#endif
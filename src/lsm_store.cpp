@@ -0,0 +1,872 @@
+#include "lsm_store.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+#include "file_iterators.h"
+#include "record.h"
+#include "saavi_exception.h"
+
+namespace {
+
+/*
+ * Manifest layout (all integers little-endian):
+ *   magic "SAAVILSM" (8) | version (4) | run count (4) |
+ *   flushed sequence (8)
+ *   runs : level (4) | id (4)
+ *   crc32c of everything above (4)
+ *
+ * Level 0 runs are listed from the newest to the oldest.
+ */
+constexpr char MANIFEST_MAGIC[8] = {'S', 'A', 'A', 'V', 'I', 'L', 'S', 'M'};
+constexpr uint32_t MANIFEST_VERSION = 1;
+constexpr size_t MANIFEST_HEADER_SIZE = 24;
+
+// approximate memory taken up by an entry of the memtable on top of its key
+// and value
+const size_t MEMTABLE_ENTRY_OVERHEAD = 96;
+
+std::filesystem::path directoryOf(const std::string &filename) {
+  auto directory = std::filesystem::path(filename).parent_path();
+  return directory.empty() ? std::filesystem::path(".") : directory;
+}
+
+uint64_t currentTimeNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// prefix of the names of the run files of a store
+std::string runPrefix(const std::string &filename) {
+  return std::filesystem::path(filename).filename().string() + ".run.";
+}
+
+// write the file aside, make it durable and rename it into place
+void replaceFile(const std::string &path, const std::string &data) {
+  const std::string tmpPath = path + ".tmp";
+  int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+  if (fd < 0) {
+    throw SaaviException("failed to create file '" + tmpPath +
+                         "' : " + strerror(errno));
+  }
+  size_t written = 0;
+  while (written < data.length()) {
+    ssize_t n = ::write(fd, data.data() + written, data.length() - written);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0) {
+      break;
+    }
+    written += n;
+  }
+  const bool failed = written < data.length() || ::fdatasync(fd) != 0;
+  ::close(fd);
+  if (failed || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+    throw SaaviException("failed to write file '" + path + "'");
+  }
+  syncDirectory(directoryOf(path).string());
+}
+
+bool bySmallestKey(const std::shared_ptr<SortedRun> &a,
+                   const std::shared_ptr<SortedRun> &b) {
+  return a->smallest() < b->smallest();
+}
+
+// the first run of a level ordered by key whose last key is not less than
+// key
+std::vector<std::shared_ptr<SortedRun>>::const_iterator findRun(
+    const std::vector<std::shared_ptr<SortedRun>> &runs,
+    std::string_view key) {
+  return std::lower_bound(
+      runs.begin(), runs.end(), key,
+      [](const std::shared_ptr<SortedRun> &run, std::string_view key) {
+        return run->largest() < key;
+      });
+}
+
+}  // namespace
+
+LsmStore::LsmStore(const std::string &filename, const SaaviOptions &options)
+    : filename(filename), options(options), compactPointers(MAX_LEVELS) {
+  recover();
+  if (options.backgroundCompaction) {
+    compactionThread = std::thread(&LsmStore::compactionLoop, this);
+  }
+}
+
+LsmStore::~LsmStore() {
+  {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    stopping = true;
+  }
+  compactionCondition.notify_all();
+  if (compactionThread.joinable()) {
+    compactionThread.join();
+  }
+
+  try {
+    // the memtable is rebuilt from the log on the next open
+    wal->flush();
+    if (options.durability != DurabilityMode::None &&
+        options.durability != DurabilityMode::FlushPerWrite) {
+      wal->sync();
+    }
+  } catch (std::exception &e) {
+    // nothing more can be done from a destructor
+  }
+}
+
+std::string LsmStore::runFilename(uint32_t id) const {
+  char suffix[16];
+  snprintf(suffix, sizeof(suffix), "%06u", id);
+  return (directoryOf(filename) / runPrefix(filename)).string() + suffix;
+}
+
+std::string LsmStore::manifestFilename() const {
+  return filename + ".manifest";
+}
+
+std::string LsmStore::immutableLogFilename() const {
+  return filename + ".imm";
+}
+
+bool LsmStore::Exists(const std::string &filename) {
+  std::error_code ec;
+  return std::filesystem::exists(filename + ".manifest", ec);
+}
+
+void LsmStore::Destroy(const std::string &filename) {
+  const std::string prefix = runPrefix(filename);
+  for (const auto &file :
+       std::filesystem::directory_iterator(directoryOf(filename))) {
+    if (file.path().filename().string().compare(0, prefix.length(), prefix) ==
+        0) {
+      std::filesystem::remove(file.path());
+    }
+  }
+  std::filesystem::remove(filename + ".manifest");
+  std::filesystem::remove(filename + ".manifest.tmp");
+  std::filesystem::remove(filename + ".imm");
+}
+
+void LsmStore::recover() {
+  auto version = std::make_shared<Version>();
+  std::vector<uint32_t> liveRuns;
+
+  std::ifstream in(manifestFilename(), std::ios::in | std::ios::binary);
+  if (in.is_open()) {
+    const std::string data((std::istreambuf_iterator<char>(in)),
+                           std::istreambuf_iterator<char>());
+    const std::string corrupt =
+        "corrupt manifest '" + manifestFilename() + "'";
+    if (data.length() < MANIFEST_HEADER_SIZE + 4 ||
+        std::memcmp(data.data(), MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC)) !=
+            0 ||
+        crc32c(data.data(), data.length() - 4) !=
+            decodeFixed32(&data[data.length() - 4])) {
+      throw SaaviException(corrupt);
+    }
+    if (decodeFixed32(&data[8]) > MANIFEST_VERSION) {
+      throw SaaviException("unsupported manifest version in '" +
+                           manifestFilename() + "'");
+    }
+    const uint32_t runCount = decodeFixed32(&data[12]);
+    if (data.length() != MANIFEST_HEADER_SIZE + runCount * 8 + 4) {
+      throw SaaviException(corrupt);
+    }
+    flushedSequence = decodeFixed64(&data[16]);
+    for (uint32_t i = 0; i < runCount; i++) {
+      const char *run = &data[MANIFEST_HEADER_SIZE + i * 8];
+      const uint32_t level = decodeFixed32(run);
+      const uint32_t id = decodeFixed32(run + 4);
+      if (level >= MAX_LEVELS) {
+        throw SaaviException(corrupt);
+      }
+      version->levels[level].push_back(SortedRun::open(runFilename(id), id));
+      liveRuns.push_back(id);
+      nextRunId = std::max<uint32_t>(nextRunId, id + 1);
+    }
+  }
+  for (size_t level = 1; level < MAX_LEVELS; level++) {
+    std::sort(version->levels[level].begin(), version->levels[level].end(),
+              bySmallestKey);
+  }
+  current = version;
+
+  // drop the runs an interrupted flush or compaction left behind
+  const std::string prefix = runPrefix(filename);
+  for (const auto &file :
+       std::filesystem::directory_iterator(directoryOf(filename))) {
+    const std::string name = file.path().filename().string();
+    if (name.compare(0, prefix.length(), prefix) != 0) {
+      continue;
+    }
+    const std::string suffix = name.substr(prefix.length());
+    const bool isRun =
+        !suffix.empty() && suffix.length() <= 9 &&
+        std::all_of(suffix.begin(), suffix.end(), ::isdigit);
+    if (!isRun || std::find(liveRuns.begin(), liveRuns.end(),
+                            std::stoul(suffix)) == liveRuns.end()) {
+      std::filesystem::remove(file.path());
+    }
+  }
+  if (!in.is_open()) {
+    // the manifest marks the data file as belonging to this engine
+    writeManifest(*version);
+  }
+
+  // rebuild the memtable from the writes logged since the last flush. The
+  // log of an immutable memtable that was not written out holds the older
+  // ones.
+  nextSequence = flushedSequence + 1;
+  auto replay = [this](const Segment &log) {
+    RecordScanner scanner(log.fd());
+    while (scanner.next()) {
+      const RecordHeader &header = scanner.header();
+      nextSequence = std::max(nextSequence, header.sequence + 1);
+      if (header.sequence <= flushedSequence) {
+        // a flush wrote it out, but died before the log was reset
+        continue;
+      }
+      apply(scanner.key(), scanner.value(),
+            isDeletion(header, log.header().version));
+    }
+    return scanner.endOffset();
+  };
+  std::error_code ec;
+  const bool immutableLogExists =
+      std::filesystem::exists(immutableLogFilename(), ec);
+  if (immutableLogExists) {
+    replay(*Segment::open(immutableLogFilename(), 0));
+  }
+  if (std::filesystem::exists(filename, ec) &&
+      std::filesystem::file_size(filename, ec) > 0) {
+    wal = Segment::open(filename, 0);
+  } else {
+    FileHeader header;
+    header.createdAt = currentTimeNanos();
+    wal = Segment::create(filename, 0, header);
+  }
+  const unsigned long endOffset = replay(*wal);
+  // drop a torn record left behind by a crash
+  if (wal->size() > endOffset) {
+    wal->truncate(endOffset);
+  }
+
+  if (immutableLogExists || wal->header().version < FORMAT_VERSION) {
+    // move what the logs hold into a run and start a new log. Records of the
+    // current format never go into a log of an older one.
+    if (!memtable.empty()) {
+      auto next = std::make_shared<Version>(*current);
+      next->levels[0].insert(next->levels[0].begin(), writeRun(memtable));
+      flushedSequence = nextSequence - 1;
+      writeManifest(*next);
+      current = next;
+      memtable.clear();
+      memtableBytes = 0;
+    }
+    FileHeader header;
+    header.createdAt = currentTimeNanos();
+    wal = Segment::create(filename, 0, header);
+    std::filesystem::remove(immutableLogFilename());
+  }
+}
+
+void LsmStore::apply(std::string_view key, std::string_view value,
+                     bool deleted) {
+  auto it = memtable.find(key);
+  if (it == memtable.end()) {
+    memtableBytes += key.length() + value.length() + MEMTABLE_ENTRY_OVERHEAD;
+    it = memtable.emplace(key, std::nullopt).first;
+  } else if (it->second) {
+    memtableBytes -= it->second->length();
+  }
+  if (deleted) {
+    it->second.reset();
+  } else {
+    memtableBytes += value.length();
+    it->second.emplace(value);
+  }
+}
+
+void LsmStore::writeManifest(const Version &version) {
+  std::string data(MANIFEST_HEADER_SIZE, '\0');
+  std::memcpy(&data[0], MANIFEST_MAGIC, sizeof(MANIFEST_MAGIC));
+  encodeFixed32(&data[8], MANIFEST_VERSION);
+  encodeFixed64(&data[16], flushedSequence);
+  uint32_t runCount = 0;
+  for (size_t level = 0; level < MAX_LEVELS; level++) {
+    for (const auto &run : version.levels[level]) {
+      char buf[8];
+      encodeFixed32(buf, static_cast<uint32_t>(level));
+      encodeFixed32(buf + 4, run->id());
+      data.append(buf, sizeof(buf));
+      runCount++;
+    }
+  }
+  encodeFixed32(&data[12], runCount);
+  char crc[4];
+  encodeFixed32(crc, crc32c(data.data(), data.length()));
+  data.append(crc, sizeof(crc));
+  replaceFile(manifestFilename(), data);
+}
+
+void LsmStore::commit() {
+  switch (options.durability) {
+    case DurabilityMode::None:
+      break;
+    case DurabilityMode::FlushPerWrite:
+      wal->flush();
+      break;
+    case DurabilityMode::FsyncPerWrite:
+    case DurabilityMode::GroupCommit:
+      wal->flush();
+      wal->sync();
+      break;
+  }
+}
+
+void LsmStore::write(std::string &entry) {
+  std::unique_lock<std::mutex> lock(writeMutex);
+
+  // stamp the records with their sequence numbers, the container of a batch
+  // takes the sequence of its last record
+  RecordHeader header;
+  RecordHeader::decode(entry.data(), header);
+  struct Update {
+    std::string_view key;
+    std::string_view value;
+    bool deleted;
+  };
+  std::vector<Update> updates;
+  if (header.flags & RECORD_FLAG_BATCH) {
+    for (size_t position = RECORD_HEADER_SIZE; position < entry.length();
+         position += header.recordSize()) {
+      sealRecord(&entry[position], nextSequence++);
+      RecordHeader::decode(&entry[position], header);
+      updates.push_back(Update{
+          std::string_view(entry).substr(position + RECORD_HEADER_SIZE,
+                                         header.keyLength),
+          std::string_view(entry).substr(
+              position + RECORD_HEADER_SIZE + header.keyLength,
+              header.valueLength),
+          (header.flags & RECORD_FLAG_DELETION) != 0});
+    }
+  } else {
+    updates.push_back(Update{
+        std::string_view(entry).substr(RECORD_HEADER_SIZE, header.keyLength),
+        std::string_view(entry).substr(RECORD_HEADER_SIZE + header.keyLength),
+        (header.flags & RECORD_FLAG_DELETION) != 0});
+    nextSequence++;
+  }
+  sealRecord(&entry[0], nextSequence - 1);
+
+  wal->append(entry);
+  {
+    std::unique_lock<std::shared_mutex> stateLock(stateMutex);
+    for (const auto &update : updates) {
+      apply(update.key, update.value, update.deleted);
+    }
+  }
+  commit();
+
+  if (memtableBytes < options.memtableSize) {
+    return;
+  }
+  // the writers wait for the previous memtable to be written out before
+  // the next one takes its place
+  waitForFlush(lock);
+  if (memtableBytes < options.memtableSize) {
+    // another writer switched the memtable meanwhile
+    return;
+  }
+  switchMemtable();
+  lock.unlock();
+  if (options.backgroundCompaction) {
+    compactionCondition.notify_all();
+  } else {
+    flushImmutable();
+  }
+}
+
+std::shared_ptr<SortedRun> LsmStore::writeRun(const Memtable &table) {
+  const uint32_t id = nextRunId++;
+  SortedRunWriter writer(runFilename(id), id, options.bloomBitsPerKey,
+                         options.compression);
+  for (const auto &entry : table) {
+    writer.add(entry.first, entry.second.value_or(""), !entry.second);
+  }
+  return writer.finish();
+}
+
+void LsmStore::switchMemtable() {
+  if (memtable.empty()) {
+    return;
+  }
+
+  // the log stays with the memtable until its run is in the manifest
+  wal->flush();
+  wal->rename(immutableLogFilename());
+  FileHeader header;
+  header.createdAt = currentTimeNanos();
+  std::shared_ptr<Segment> log;
+  try {
+    log = Segment::create(filename, 0, header);
+  } catch (std::exception &e) {
+    wal->rename(filename);
+    throw;
+  }
+  {
+    std::unique_lock<std::shared_mutex> stateLock(stateMutex);
+    immutable = std::make_shared<const Memtable>(std::move(memtable));
+    immutableBytes = memtableBytes;
+    memtable.clear();
+    memtableBytes = 0;
+  }
+  immutableWal = std::move(wal);
+  wal = std::move(log);
+  immutableSequence = nextSequence - 1;
+  syncDirectory(directoryOf(filename).string());
+}
+
+void LsmStore::waitForFlush(std::unique_lock<std::mutex> &lock) {
+  while (immutable) {
+    lock.unlock();
+    flushImmutable();
+    lock.lock();
+  }
+}
+
+void LsmStore::flushImmutable() {
+  std::lock_guard<std::mutex> flushLock(flushMutex);
+  std::shared_ptr<const Memtable> table;
+  {
+    std::shared_lock<std::shared_mutex> lock(stateMutex);
+    table = immutable;
+  }
+  if (!table) {
+    return;
+  }
+
+  // the writers go on with the new memtable meanwhile
+  auto run = writeRun(*table);
+
+  std::lock_guard<std::mutex> lock(writeMutex);
+  auto next = std::make_shared<Version>(*current);
+  next->levels[0].insert(next->levels[0].begin(), run);
+  const uint64_t previousSequence = flushedSequence;
+  flushedSequence = immutableSequence;
+  try {
+    writeManifest(*next);
+  } catch (std::exception &e) {
+    // the run is dropped as a leftover on the next open
+    flushedSequence = previousSequence;
+    throw;
+  }
+  {
+    std::unique_lock<std::shared_mutex> stateLock(stateMutex);
+    current = next;
+    immutable.reset();
+    immutableBytes = 0;
+  }
+
+  // the run covers the log now. It goes while the lock keeps the next
+  // switch from renaming the log of the memtable into its place.
+  std::filesystem::remove(immutableWal->path());
+  immutableWal.reset();
+  compactionCondition.notify_all();
+}
+
+bool LsmStore::get(std::string_view key, std::shared_ptr<const void> &pin,
+                   std::string_view &value) {
+  std::shared_ptr<const Version> version;
+  {
+    std::shared_lock<std::shared_mutex> lock(stateMutex);
+    // the memtable shadows the immutable one
+    const Memtable *tables[] = {&memtable, immutable.get()};
+    for (const Memtable *table : tables) {
+      if (table == nullptr) {
+        continue;
+      }
+      auto it = table->find(key);
+      if (it != table->end()) {
+        if (!it->second) {
+          return false;
+        }
+        auto copy = std::make_shared<const std::string>(*it->second);
+        value = *copy;
+        pin = std::move(copy);
+        return true;
+      }
+    }
+    version = current;
+  }
+
+  // the newer runs shadow the older ones
+  std::shared_ptr<const std::string> block;
+  auto lookup = [&](const SortedRun &run) {
+    const auto result = run.get(key, block, value);
+    if (result == SortedRun::Lookup::Found) {
+      pin = std::move(block);
+    }
+    return result;
+  };
+  for (const auto &run : version->levels[0]) {
+    const auto result = lookup(*run);
+    if (result != SortedRun::Lookup::NotFound) {
+      return result == SortedRun::Lookup::Found;
+    }
+  }
+  for (size_t level = 1; level < MAX_LEVELS; level++) {
+    const auto &runs = version->levels[level];
+    auto run = findRun(runs, key);
+    if (run == runs.end()) {
+      continue;
+    }
+    const auto result = lookup(**run);
+    if (result != SortedRun::Lookup::NotFound) {
+      return result == SortedRun::Lookup::Found;
+    }
+  }
+  return false;
+}
+
+bool LsmStore::scanBatch(
+    std::string &start, const std::string &end, size_t limit,
+    std::vector<std::pair<std::string, std::string>> &entries) {
+  // the first limit keys of every source from the newest to the oldest. The
+  // first value seen for a key is its latest, none at all a deletion.
+  std::map<std::string, std::optional<std::string>> merged;
+  auto inRange = [&end](std::string_view key) {
+    return end.empty() || key < end;
+  };
+  std::shared_ptr<const Version> version;
+  {
+    std::shared_lock<std::shared_mutex> lock(stateMutex);
+    const Memtable *tables[] = {&memtable, immutable.get()};
+    for (const Memtable *table : tables) {
+      if (table == nullptr) {
+        continue;
+      }
+      size_t count = 0;
+      for (auto it = table->lower_bound(start);
+           it != table->end() && count < limit && inRange(it->first);
+           ++it, count++) {
+        merged.emplace(it->first, it->second);
+      }
+    }
+    version = current;
+  }
+
+  // read the runs of a level, which are ordered by key after level 0
+  auto collect = [&](const std::shared_ptr<SortedRun> &run, size_t &count) {
+    SortedRunIterator it(run);
+    it.seek(start);
+    for (; it.valid() && count < limit && inRange(it.key()); it.next()) {
+      if (it.deleted()) {
+        merged.try_emplace(std::string(it.key()), std::nullopt);
+      } else {
+        merged.try_emplace(std::string(it.key()), it.value());
+      }
+      count++;
+    }
+  };
+  for (const auto &run : version->levels[0]) {
+    size_t count = 0;
+    if (run->largest() >= start) {
+      collect(run, count);
+    }
+  }
+  for (size_t level = 1; level < MAX_LEVELS; level++) {
+    const auto &runs = version->levels[level];
+    size_t count = 0;
+    for (auto run = findRun(runs, start);
+         run != runs.end() && count < limit && inRange((*run)->smallest());
+         ++run) {
+      collect(*run, count);
+    }
+  }
+
+  // a source that had more keys in the range filled the whole batch, so
+  // the first limit keys merged are the first limit keys of the range
+  const bool exhausted = merged.size() < limit;
+  size_t count = 0;
+  for (auto &entry : merged) {
+    if (count++ == limit) {
+      break;
+    }
+    if (!exhausted && count == limit) {
+      start = entry.first + '\0';
+    }
+    if (entry.second) {
+      entries.emplace_back(entry.first, std::move(*entry.second));
+    }
+  }
+  return !exhausted;
+}
+
+bool LsmStore::pickCompaction(const Version &version, CompactionJob &job) {
+  const auto &levels = version.levels;
+  if (!levels[0].empty() &&
+      levels[0].size() >= std::max<size_t>(options.level0Runs, 1)) {
+    job.level = 0;
+    job.inputs = levels[0];
+  } else {
+    bool found = false;
+    unsigned long maxBytes = options.levelBaseSize;
+    for (size_t level = 1; level + 1 < MAX_LEVELS && !found;
+         level++, maxBytes *= 10) {
+      unsigned long bytes = 0;
+      for (const auto &run : levels[level]) {
+        bytes += run->fileSize();
+      }
+      if (bytes <= maxBytes) {
+        continue;
+      }
+      // take turns over the key space of the level
+      const auto &runs = levels[level];
+      auto run = std::find_if(runs.begin(), runs.end(),
+                              [&](const std::shared_ptr<SortedRun> &run) {
+                                return run->smallest() >
+                                       compactPointers[level];
+                              });
+      job.level = level;
+      job.inputs = {run == runs.end() ? runs.front() : *run};
+      found = true;
+    }
+    if (!found) {
+      return false;
+    }
+  }
+
+  std::string smallest = job.inputs.front()->smallest();
+  std::string largest = job.inputs.front()->largest();
+  for (const auto &run : job.inputs) {
+    smallest = std::min(smallest, run->smallest());
+    largest = std::max(largest, run->largest());
+  }
+  job.overlapping.clear();
+  for (const auto &run : levels[job.level + 1]) {
+    if (run->overlaps(smallest, largest)) {
+      job.overlapping.push_back(run);
+    }
+  }
+  // a deletion only has to be kept while an older value may be below it
+  job.dropDeletions = true;
+  for (size_t level = job.level + 2; level < MAX_LEVELS; level++) {
+    job.dropDeletions = job.dropDeletions && levels[level].empty();
+  }
+  return true;
+}
+
+bool LsmStore::compactOnce() {
+  const auto start = std::chrono::steady_clock::now();
+  std::shared_ptr<const Version> version;
+  {
+    std::shared_lock<std::shared_mutex> lock(stateMutex);
+    version = current;
+  }
+  CompactionJob job;
+  if (!pickCompaction(*version, job)) {
+    return false;
+  }
+
+  CompactionStats runStats;
+  std::vector<std::shared_ptr<SortedRun>> outputs;
+  if (job.inputs.size() == 1 && job.overlapping.empty()) {
+    // nothing to merge with, the run moves down as it is
+    outputs = job.inputs;
+  } else {
+    // merge the runs, the first iterator holding a key has its latest value
+    std::vector<SortedRunIterator> iterators;
+    for (const auto &runs : {job.inputs, job.overlapping}) {
+      for (const auto &run : runs) {
+        iterators.emplace_back(run);
+        iterators.back().seekToFirst();
+        runStats.bytesRead += run->fileSize();
+      }
+    }
+
+    std::unique_ptr<SortedRunWriter> writer;
+    std::string key;
+    while (true) {
+      size_t newest = iterators.size();
+      for (size_t i = 0; i < iterators.size(); i++) {
+        if (iterators[i].valid() &&
+            (newest == iterators.size() ||
+             iterators[i].key() < iterators[newest].key())) {
+          newest = i;
+        }
+      }
+      if (newest == iterators.size()) {
+        break;
+      }
+
+      const SortedRunIterator &latest = iterators[newest];
+      key.assign(latest.key());
+      if (latest.deleted() && job.dropDeletions) {
+        runStats.recordsDropped++;
+      } else {
+        if (!writer) {
+          const uint32_t id = nextRunId++;
+          writer.reset(new SortedRunWriter(runFilename(id), id,
+                                           options.bloomBitsPerKey,
+                                           options.compression));
+        }
+        writer->add(key, latest.value(), latest.deleted());
+        runStats.recordsKept++;
+        if (writer->size() >= options.memtableSize) {
+          outputs.push_back(writer->finish());
+          writer.reset();
+        }
+      }
+
+      // skip the older values of the key
+      for (size_t i = 0; i < iterators.size(); i++) {
+        while (iterators[i].valid() && iterators[i].key() == key) {
+          runStats.recordsDropped += i != newest;
+          iterators[i].next();
+        }
+      }
+    }
+    if (writer) {
+      outputs.push_back(writer->finish());
+    }
+    for (const auto &run : outputs) {
+      runStats.bytesWritten += run->fileSize();
+    }
+  }
+
+  auto replaced = [&](const std::shared_ptr<SortedRun> &run) {
+    return std::find(job.inputs.begin(), job.inputs.end(), run) !=
+               job.inputs.end() ||
+           std::find(job.overlapping.begin(), job.overlapping.end(), run) !=
+               job.overlapping.end();
+  };
+  {
+    // runs flushed meanwhile only ever went into level 0 in front of the
+    // inputs, so they are kept as they are
+    std::lock_guard<std::mutex> lock(writeMutex);
+    auto next = std::make_shared<Version>(*current);
+    for (size_t level : {job.level, job.level + 1}) {
+      auto &runs = next->levels[level];
+      runs.erase(std::remove_if(runs.begin(), runs.end(), replaced),
+                 runs.end());
+    }
+    auto &target = next->levels[job.level + 1];
+    target.insert(target.end(), outputs.begin(), outputs.end());
+    std::sort(target.begin(), target.end(), bySmallestKey);
+    writeManifest(*next);
+    {
+      std::unique_lock<std::shared_mutex> stateLock(stateMutex);
+      current = next;
+    }
+
+    compactPointers[job.level] = job.inputs.back()->largest();
+    compactionStats.runs++;
+    compactionStats.segmentsCompacted +=
+        job.inputs.size() + job.overlapping.size();
+    compactionStats.bytesRead += runStats.bytesRead;
+    compactionStats.bytesWritten += runStats.bytesWritten;
+    compactionStats.recordsKept += runStats.recordsKept;
+    compactionStats.recordsDropped += runStats.recordsDropped;
+    compactionStats.lastRunDuration =
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start);
+  }
+
+  // readers still holding the replaced runs keep their files open
+  for (const auto &runs : {job.inputs, job.overlapping}) {
+    for (const auto &run : runs) {
+      if (std::find(outputs.begin(), outputs.end(), run) == outputs.end()) {
+        std::filesystem::remove(run->path());
+      }
+    }
+  }
+  return true;
+}
+
+void LsmStore::compact() {
+  {
+    std::unique_lock<std::mutex> lock(writeMutex);
+    waitForFlush(lock);
+    switchMemtable();
+  }
+  flushImmutable();
+  std::lock_guard<std::mutex> compactionLock(compactionMutex);
+  try {
+    while (compactOnce()) {
+    }
+  } catch (std::exception &e) {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    compactionStats.failures++;
+    throw;
+  }
+}
+
+void LsmStore::compactionLoop() {
+  std::unique_lock<std::mutex> lock(writeMutex);
+  // keep going without waiting while there is more to flush or compact,
+  // unless the last round failed
+  bool compacted = false;
+  bool failed = false;
+  while (!stopping) {
+    if (!compacted && (failed || !immutable)) {
+      compactionCondition.wait_for(lock, options.compactionInterval);
+    }
+    if (stopping) {
+      break;
+    }
+
+    lock.unlock();
+    failed = false;
+    try {
+      flushImmutable();
+      std::lock_guard<std::mutex> compactionLock(compactionMutex);
+      compacted = compactOnce();
+    } catch (std::exception &e) {
+      // counted in the stats, the next round tries again
+      compacted = false;
+      failed = true;
+    }
+    lock.lock();
+    compactionStats.failures += failed;
+  }
+}
+
+CompactionStats LsmStore::getCompactionStats() {
+  std::lock_guard<std::mutex> lock(writeMutex);
+  return compactionStats;
+}
+
+LsmStats LsmStore::getStats() {
+  LsmStats stats;
+  std::shared_ptr<const Version> version;
+  {
+    std::shared_lock<std::shared_mutex> lock(stateMutex);
+    stats.memtableBytes = memtableBytes + immutableBytes;
+    version = current;
+  }
+  for (const auto &runs : version->levels) {
+    stats.runsPerLevel.push_back(runs.size());
+    stats.bytesPerLevel.push_back(0);
+    for (const auto &run : runs) {
+      stats.bytesPerLevel.back() += run->fileSize();
+      stats.indexMemory += run->indexMemoryUsage();
+      stats.filterMemory += run->filterMemoryUsage();
+    }
+  }
+  return stats;
+}
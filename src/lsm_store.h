@@ -0,0 +1,167 @@
+#ifndef LSM_STORE_H
+#define LSM_STORE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "saavi_options.h"
+#include "segment.h"
+#include "sorted_run.h"
+
+// The storage engine behind Saavi when options.engine is StorageEngine::Lsm.
+//
+// Writes are appended to a write ahead log, which is the data file itself,
+// and applied to the memtable - a sorted map of the latest writes. A full
+// memtable becomes immutable and a new one and a new log take over, while
+// the background thread, or the writer once it let go of the lock, writes
+// the immutable memtable out as a sorted run into level 0. Level 0 runs may overlap each other, while every later level is a
+// set of runs with disjoint key ranges. In the background, compaction merges
+// level 0 into level 1 once it has level0Runs runs, and a run of any other
+// level into the next one once the level grows past its size limit.
+//
+// A lookup checks the memtable, the immutable memtable and then the runs from the newest to the
+// oldest, skipping the runs whose key range or Bloom filter rule the key
+// out, so most lookups read a single block from disk.
+//
+// The runs of every level are listed in the manifest, which is rewritten
+// atomically whenever they change. Run files that are not listed in it were
+// left behind by an interrupted flush or compaction and are removed on open.
+class LsmStore {
+  static constexpr size_t MAX_LEVELS = 7;
+
+  // the runs making up the store at some point in time. Versions are
+  // immutable, a flush or a compaction installs a new one.
+  struct Version {
+    // level 0 ordered from the newest run to the oldest, the others by key
+    std::vector<std::vector<std::shared_ptr<SortedRun>>> levels;
+
+    Version() : levels(MAX_LEVELS) {}
+  };
+
+  // a compaction - the inputs from level and the runs of the next level
+  // they overlap with
+  // the latest writes, a key without a value was deleted
+  using Memtable =
+      std::map<std::string, std::optional<std::string>, std::less<>>;
+
+  struct CompactionJob {
+    size_t level;
+    std::vector<std::shared_ptr<SortedRun>> inputs;
+    std::vector<std::shared_ptr<SortedRun>> overlapping;
+    bool dropDeletions;
+  };
+
+  std::string filename;
+  SaaviOptions options;
+
+  // serialises the writers, memtable switches and the installation of new
+  // versions
+  std::mutex writeMutex;
+  // serialises the flushes of the immutable memtable, taken before
+  // writeMutex
+  std::mutex flushMutex;
+  // guards the memtables and the current version against the readers. Only
+  // held exclusively while the writer changes any of them.
+  std::shared_mutex stateMutex;
+
+  Memtable memtable;
+  size_t memtableBytes{0};
+  // the previous memtable while it is being written out
+  std::shared_ptr<const Memtable> immutable;
+  size_t immutableBytes{0};
+  std::shared_ptr<const Version> current;
+
+  // the write ahead logs of the memtable and of the immutable memtable
+  std::shared_ptr<Segment> wal;
+  std::shared_ptr<Segment> immutableWal;
+  // sequence number of the last write in the immutable memtable
+  uint64_t immutableSequence{0};
+  uint64_t nextSequence{1};
+  // sequence number of the last write that is in the runs
+  uint64_t flushedSequence{0};
+  std::atomic<uint32_t> nextRunId{1};
+
+  // background compaction state
+  std::thread compactionThread;
+  std::condition_variable compactionCondition;
+  bool stopping{false};
+  // serialises compaction runs
+  std::mutex compactionMutex;
+  CompactionStats compactionStats;
+  // the largest key compacted out of each level, so that the next
+  // compaction of the level picks the run after it
+  std::vector<std::string> compactPointers;
+
+  std::string runFilename(uint32_t id) const;
+  std::string manifestFilename() const;
+  std::string immutableLogFilename() const;
+
+  // load the manifest and replay the write ahead log
+  void recover();
+  // set the key in the memtable, called with stateMutex held exclusively
+  // unless the store is still being opened
+  void apply(std::string_view key, std::string_view value, bool deleted);
+  // atomically replace the manifest with one listing the version
+  void writeManifest(const Version &version);
+
+  // make the last write as durable as the options ask for
+  void commit();
+  // write a memtable out as a level 0 run that no version has yet
+  std::shared_ptr<SortedRun> writeRun(const Memtable &table);
+  // make the memtable immutable and start a new one with a new log, called
+  // with writeMutex held
+  void switchMemtable();
+  // write out the immutable memtable, if any, first letting go of the lock
+  // on writeMutex
+  void waitForFlush(std::unique_lock<std::mutex> &lock);
+  // write the immutable memtable out and install its run, called without
+  // holding writeMutex
+  void flushImmutable();
+
+  // pick the most urgent compaction, returns false if none is due
+  bool pickCompaction(const Version &version, CompactionJob &job);
+  // run a single compaction, returns false if none was due
+  bool compactOnce();
+  void compactionLoop();
+
+ public:
+  LsmStore(const std::string &filename, const SaaviOptions &options);
+  // stops the background compaction and writes out the log
+  ~LsmStore();
+  LsmStore(const LsmStore &) = delete;
+  LsmStore &operator=(const LsmStore &) = delete;
+
+  // remove the manifest, the runs and the immutable log of the store with the given data file
+  static void Destroy(const std::string &filename);
+  // whether the data file belongs to a store of this engine
+  static bool Exists(const std::string &filename);
+
+  // apply an encoded record, or a batch of them, as a single write. The
+  // records are stamped with their sequence numbers here.
+  void write(std::string &entry);
+  // look up the latest value of the key. The value points into pin.
+  bool get(std::string_view key, std::shared_ptr<const void> &pin,
+           std::string_view &value);
+  // read the live entries of upto limit keys from [start, end) and move
+  // start past them. Returns false once the range has been read entirely.
+  bool scanBatch(std::string &start, const std::string &end, size_t limit,
+                 std::vector<std::pair<std::string, std::string>> &entries);
+
+  // flush the memtables and run compactions until none is due
+  void compact();
+  CompactionStats getCompactionStats();
+  LsmStats getStats();
+};
+
+#endif
@@ -0,0 +1,74 @@
+#include "merge_operator.h"
+
+#include <charconv>
+#include <cstdint>
+
+namespace {
+
+// parses all of the text as a decimal integer
+bool parseInteger(std::string_view text, int64_t &value) {
+  const char *end = text.data() + text.length();
+  const auto parsed = std::from_chars(text.data(), end, value);
+  return parsed.ec == std::errc() && parsed.ptr == end;
+}
+
+class CounterOperator : public MergeOperator {
+ public:
+  bool Merge(std::string_view, const std::string_view *existing,
+             const std::vector<std::string_view> &operands,
+             std::string &result) const override {
+    int64_t sum = 0;
+    if (existing != nullptr && !parseInteger(*existing, sum)) {
+      return false;
+    }
+    for (const auto &operand : operands) {
+      int64_t delta;
+      if (!parseInteger(operand, delta) ||
+          __builtin_add_overflow(sum, delta, &sum)) {
+        return false;
+      }
+    }
+    result = std::to_string(sum);
+    return true;
+  }
+};
+
+class AppendOperator : public MergeOperator {
+  std::string delimiter;
+
+ public:
+  explicit AppendOperator(const std::string &delimiter)
+      : delimiter(delimiter) {}
+
+  bool Merge(std::string_view, const std::string_view *existing,
+             const std::vector<std::string_view> &operands,
+             std::string &result) const override {
+    size_t length = existing != nullptr ? existing->length() : 0;
+    for (const auto &operand : operands) {
+      length += delimiter.length() + operand.length();
+    }
+    result.clear();
+    result.reserve(length);
+    if (existing != nullptr) {
+      result.append(*existing);
+    }
+    for (const auto &operand : operands) {
+      if (existing != nullptr || &operand != &operands.front()) {
+        result.append(delimiter);
+      }
+      result.append(operand);
+    }
+    return true;
+  }
+};
+
+}  // namespace
+
+std::shared_ptr<const MergeOperator> CounterMergeOperator() {
+  return std::make_shared<CounterOperator>();
+}
+
+std::shared_ptr<const MergeOperator> AppendMergeOperator(
+    const std::string &delimiter) {
+  return std::make_shared<AppendOperator>(delimiter);
+}
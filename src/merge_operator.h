@@ -0,0 +1,36 @@
+#ifndef MERGE_OPERATOR_H
+#define MERGE_OPERATOR_H
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Folds the operands written by Saavi::Merge into the value of their key.
+// The store calls it whenever it needs the value of a key with operands,
+// on a Get or when compaction folds them for good, from any thread and
+// possibly with a value an earlier call folded. Folding has to be
+// associative for that to work: merging operands a and b into a value and
+// then c into the result must give the same value as merging all three at
+// once.
+class MergeOperator {
+ public:
+  virtual ~MergeOperator() = default;
+
+  // put into result the value the operands, oldest first, turn the
+  // existing value of the key into. existing is nullptr if the key had no
+  // value before the operands. Returns false if the operands can't be
+  // folded, which fails the read.
+  virtual bool Merge(std::string_view key, const std::string_view *existing,
+                     const std::vector<std::string_view> &operands,
+                     std::string &result) const = 0;
+};
+
+// Adds up signed 64 bit integers in decimal, a missing value counting as 0
+std::shared_ptr<const MergeOperator> CounterMergeOperator();
+
+// Appends the operands to the value, separated by the delimiter
+std::shared_ptr<const MergeOperator> AppendMergeOperator(
+    const std::string &delimiter = ",");
+
+#endif
@@ -0,0 +1,195 @@
+#include "ordered_index.h"
+
+#include <algorithm>
+
+namespace {
+
+bool keyLess(const std::string &a, std::string_view b) {
+  return std::string_view(a) < b;
+}
+
+bool keyGreater(std::string_view a, const std::string &b) {
+  return a < std::string_view(b);
+}
+
+}  // namespace
+
+OrderedIndex::OrderedIndex() = default;
+
+std::unique_ptr<OrderedIndex::Node> OrderedIndex::insert(
+    Node *node, const std::string &key, std::string &separator,
+    bool &inserted) {
+  if (node->leaf) {
+    auto it = std::lower_bound(node->keys.begin(), node->keys.end(), key,
+                               keyLess);
+    if (it != node->keys.end() && *it == key) {
+      inserted = false;
+      return nullptr;
+    }
+    node->keys.insert(it, key);
+    inserted = true;
+    if (node->keys.size() <= MAX_KEYS) {
+      return nullptr;
+    }
+
+    // move the upper half of the keys into a new leaf right after this one
+    std::unique_ptr<Node> right(new Node(true));
+    const size_t middle = node->keys.size() / 2;
+    right->keys.assign(std::make_move_iterator(node->keys.begin() + middle),
+                       std::make_move_iterator(node->keys.end()));
+    node->keys.resize(middle);
+    right->next = node->next;
+    right->prev = node;
+    if (node->next != nullptr) {
+      node->next->prev = right.get();
+    }
+    node->next = right.get();
+    separator = right->keys.front();
+    return right;
+  }
+
+  const size_t child =
+      std::upper_bound(node->keys.begin(), node->keys.end(), key, keyGreater) -
+      node->keys.begin();
+  std::string childSeparator;
+  std::unique_ptr<Node> newChild =
+      insert(node->children[child].get(), key, childSeparator, inserted);
+  if (newChild == nullptr) {
+    return nullptr;
+  }
+  node->keys.insert(node->keys.begin() + child, std::move(childSeparator));
+  node->children.insert(node->children.begin() + child + 1,
+                        std::move(newChild));
+  if (node->keys.size() <= MAX_KEYS) {
+    return nullptr;
+  }
+
+  // the middle separator moves up, the ones after it go to the new node
+  std::unique_ptr<Node> right(new Node(false));
+  const size_t middle = node->keys.size() / 2;
+  separator = std::move(node->keys[middle]);
+  right->keys.assign(std::make_move_iterator(node->keys.begin() + middle + 1),
+                     std::make_move_iterator(node->keys.end()));
+  right->children.assign(
+      std::make_move_iterator(node->children.begin() + middle + 1),
+      std::make_move_iterator(node->children.end()));
+  node->keys.resize(middle);
+  node->children.resize(middle + 1);
+  return right;
+}
+
+bool OrderedIndex::insert(const std::string &key) {
+  if (root == nullptr) {
+    root.reset(new Node(true));
+  }
+
+  std::string separator;
+  bool inserted = false;
+  std::unique_ptr<Node> right = insert(root.get(), key, separator, inserted);
+  if (right != nullptr) {
+    // the root was split - grow the tree by a level
+    std::unique_ptr<Node> newRoot(new Node(false));
+    newRoot->keys.push_back(std::move(separator));
+    newRoot->children.push_back(std::move(root));
+    newRoot->children.push_back(std::move(right));
+    root = std::move(newRoot);
+  }
+  count += inserted;
+  return inserted;
+}
+
+bool OrderedIndex::erase(Node *node, std::string_view key, bool &erased) {
+  if (node->leaf) {
+    auto it = std::lower_bound(node->keys.begin(), node->keys.end(), key,
+                               keyLess);
+    if (it != node->keys.end() && *it == key) {
+      node->keys.erase(it);
+      erased = true;
+    }
+    return node->keys.empty();
+  }
+
+  const size_t child =
+      std::upper_bound(node->keys.begin(), node->keys.end(), key, keyGreater) -
+      node->keys.begin();
+  Node *childNode = node->children[child].get();
+  if (!erase(childNode, key, erased)) {
+    return false;
+  }
+
+  // drop the empty child along with one of the separators around it
+  if (childNode->leaf) {
+    if (childNode->prev != nullptr) {
+      childNode->prev->next = childNode->next;
+    }
+    if (childNode->next != nullptr) {
+      childNode->next->prev = childNode->prev;
+    }
+  }
+  node->children.erase(node->children.begin() + child);
+  if (!node->keys.empty()) {
+    node->keys.erase(node->keys.begin() + (child > 0 ? child - 1 : 0));
+  }
+  return node->children.empty();
+}
+
+bool OrderedIndex::erase(std::string_view key) {
+  if (root == nullptr) {
+    return false;
+  }
+
+  bool erased = false;
+  if (erase(root.get(), key, erased)) {
+    root.reset();
+  }
+  // shrink the tree while the root has a single child
+  while (root != nullptr && !root->leaf && root->children.size() == 1) {
+    std::unique_ptr<Node> child = std::move(root->children.front());
+    root = std::move(child);
+  }
+  count -= erased;
+  return erased;
+}
+
+void OrderedIndex::clear() {
+  root.reset();
+  count = 0;
+}
+
+const OrderedIndex::Node *OrderedIndex::lowerBoundLeaf(
+    std::string_view key) const {
+  const Node *node = root.get();
+  while (node != nullptr && !node->leaf) {
+    const size_t child =
+        std::upper_bound(node->keys.begin(), node->keys.end(), key,
+                         keyGreater) -
+        node->keys.begin();
+    node = node->children[child].get();
+  }
+  return node;
+}
+
+void OrderedIndex::scan(std::string_view start, std::string_view end,
+                        size_t limit, std::vector<std::string> &keys) const {
+  const Node *leaf = lowerBoundLeaf(start);
+  if (leaf == nullptr) {
+    return;
+  }
+
+  size_t position =
+      std::lower_bound(leaf->keys.begin(), leaf->keys.end(), start, keyLess) -
+      leaf->keys.begin();
+  for (size_t found = 0; leaf != nullptr && found < limit;) {
+    if (position == leaf->keys.size()) {
+      leaf = leaf->next;
+      position = 0;
+      continue;
+    }
+    const std::string &key = leaf->keys[position++];
+    if (!end.empty() && std::string_view(key) >= end) {
+      break;
+    }
+    keys.push_back(key);
+    found++;
+  }
+}
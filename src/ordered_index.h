@@ -0,0 +1,65 @@
+#ifndef ORDERED_INDEX_H
+#define ORDERED_INDEX_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// The keys of the store in sorted order, kept in a B+tree so that range and
+// prefix scans don't have to look at every key. The tree only holds the
+// keys - the locations of their records stay in the KeyIndex.
+//
+// The nodes hold up to MAX_KEYS keys in contiguous arrays, and the leaves
+// are linked so that a scan walks from one leaf to the next without going
+// back up the tree. Nodes are split when they overflow but only removed
+// once they are empty, as the keys of a log structured store are rarely
+// erased in bulk.
+//
+// OrderedIndex is not thread safe.
+class OrderedIndex {
+  static constexpr size_t MAX_KEYS = 64;
+
+  struct Node {
+    bool leaf;
+    // the keys of a leaf, or the separators of an internal node where
+    // keys[i] is the smallest key under children[i + 1]
+    std::vector<std::string> keys;
+    std::vector<std::unique_ptr<Node>> children;
+    // neighbouring leaves
+    Node *prev{nullptr};
+    Node *next{nullptr};
+
+    explicit Node(bool leaf) : leaf(leaf) {}
+  };
+
+  std::unique_ptr<Node> root;
+  size_t count{0};
+
+  // insert into the subtree, returning the new right sibling and its
+  // separator if the node had to be split
+  std::unique_ptr<Node> insert(Node *node, const std::string &key,
+                               std::string &separator, bool &inserted);
+  // erase from the subtree, returning whether the node is now empty
+  bool erase(Node *node, std::string_view key, bool &erased);
+  // the leaf where the keys not less than key start
+  const Node *lowerBoundLeaf(std::string_view key) const;
+
+ public:
+  OrderedIndex();
+
+  // returns false if the key was already present
+  bool insert(const std::string &key);
+  // returns false if the key was not present
+  bool erase(std::string_view key);
+  void clear();
+  size_t size() const { return count; }
+
+  // append upto limit keys from the range [start, end) to keys. An empty end
+  // means there is no upper bound.
+  void scan(std::string_view start, std::string_view end, size_t limit,
+            std::vector<std::string> &keys) const;
+};
+
+#endif
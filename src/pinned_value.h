@@ -0,0 +1,31 @@
+#ifndef PINNED_VALUE_H
+#define PINNED_VALUE_H
+
+#include <memory>
+#include <string_view>
+
+// A value returned by Saavi::Get without copying it. The view points straight
+// into the mapped data file, and stays valid for as long as the PinnedValue
+// (or a copy of it) is alive - even if the key is overwritten or the segment
+// holding it is compacted away meanwhile.
+class PinnedValue {
+  // keeps the memory the view points into alive
+  std::shared_ptr<const void> pin;
+  std::string_view value;
+
+ public:
+  std::string_view view() const { return value; }
+  size_t size() const { return value.size(); }
+  bool empty() const { return value.empty(); }
+  std::string ToString() const { return std::string(value); }
+
+  // release the memory held by the value
+  void Reset() {
+    pin.reset();
+    value = std::string_view();
+  }
+
+  friend class Saavi;
+};
+
+#endif
@@ -0,0 +1,132 @@
+#include "record.h"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+namespace {
+
+// lookup table for the software crc32c implementation
+const std::array<uint32_t, 256> crcTable = [] {
+  std::array<uint32_t, 256> table{};
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int j = 0; j < 8; j++) {
+      crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78 : 0);
+    }
+    table[i] = crc;
+  }
+  return table;
+}();
+
+uint32_t crc32cSoftware(const char *data, size_t length, uint32_t crc) {
+  for (size_t i = 0; i < length; i++) {
+    crc = crcTable[(crc ^ static_cast<unsigned char>(data[i])) & 0xff] ^
+          (crc >> 8);
+  }
+  return crc;
+}
+
+#if defined(__x86_64__)
+// use the SSE4.2 crc32 instruction when the cpu supports it
+__attribute__((target("sse4.2"))) uint32_t crc32cHardware(const char *data,
+                                                          size_t length,
+                                                          uint32_t crc) {
+  uint64_t crc64 = crc;
+  while (length >= 8) {
+    uint64_t word;
+    std::memcpy(&word, data, 8);
+    crc64 = _mm_crc32_u64(crc64, word);
+    data += 8;
+    length -= 8;
+  }
+  crc = static_cast<uint32_t>(crc64);
+  while (length > 0) {
+    crc = _mm_crc32_u8(crc, static_cast<unsigned char>(*data));
+    data++;
+    length--;
+  }
+  return crc;
+}
+
+const bool hasHardwareCrc = __builtin_cpu_supports("sse4.2");
+#endif
+
+}  // namespace
+
+uint32_t crc32c(const char *data, size_t length, uint32_t crc) {
+  crc = ~crc;
+#if defined(__x86_64__)
+  if (hasHardwareCrc) {
+    return ~crc32cHardware(data, length, crc);
+  }
+#endif
+  return ~crc32cSoftware(data, length, crc);
+}
+
+void FileHeader::encode(char *buf) const {
+  std::memset(buf, 0, FILE_HEADER_SIZE);
+  std::memcpy(buf, FILE_MAGIC, sizeof(FILE_MAGIC));
+  encodeFixed32(buf + 8, version);
+  encodeFixed32(buf + 12, flags);
+  encodeFixed64(buf + 16, createdAt);
+  encodeFixed32(buf + 24, compactedFrom);
+}
+
+bool FileHeader::decode(const char *buf, FileHeader &header) {
+  if (std::memcmp(buf, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0) {
+    return false;
+  }
+  header.version = decodeFixed32(buf + 8);
+  header.flags = decodeFixed32(buf + 12);
+  header.createdAt = decodeFixed64(buf + 16);
+  header.compactedFrom = decodeFixed32(buf + 24);
+  return true;
+}
+
+void RecordHeader::decode(const char *buf, RecordHeader &header) {
+  header.crc = decodeFixed32(buf);
+  header.flags = static_cast<uint8_t>(buf[4]);
+  header.codec = static_cast<uint8_t>(buf[5]);
+  header.keyLength = decodeFixed32(buf + 8);
+  header.valueLength = decodeFixed32(buf + 12);
+  header.sequence = decodeFixed64(buf + 16);
+}
+
+void appendRecord(std::string &out, uint8_t flags, std::string_view key,
+                  std::string_view value, uint8_t codec) {
+  const size_t start = out.size();
+  out.resize(start + RECORD_HEADER_SIZE);
+  char *header = &out[start];
+  std::memset(header, 0, RECORD_HEADER_SIZE);
+  header[4] = static_cast<char>(flags);
+  header[5] = static_cast<char>(codec);
+  encodeFixed32(header + 8, static_cast<uint32_t>(key.length()));
+  encodeFixed32(header + 12, static_cast<uint32_t>(value.length()));
+  out.append(key);
+  out.append(value);
+}
+
+void sealRecord(char *record, uint64_t sequence) {
+  encodeFixed64(record + 16, sequence);
+
+  // checksum everything after the crc field
+  RecordHeader header;
+  RecordHeader::decode(record, header);
+  encodeFixed32(record, crc32c(record + 4, header.recordSize() - 4));
+}
+
+void encodeRecord(std::string &out, uint8_t flags, uint64_t sequence,
+                  std::string_view key, std::string_view value,
+                  uint8_t codec) {
+  const size_t start = out.size();
+  appendRecord(out, flags, key, value, codec);
+  sealRecord(&out[start], sequence);
+}
+
+bool verifyRecord(const RecordHeader &header, const char *buf) {
+  return crc32c(buf + 4, header.recordSize() - 4) == header.crc;
+}
@@ -0,0 +1,153 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/*
+ * On-disk layout of a saavi data file.
+ *
+ * A data file starts with a fixed size file header followed by the records
+ * appended in log order. All integers are stored little-endian.
+ *
+ * File header (32 bytes):
+ *   magic "SAAVIDB\0" (8) | version (4) | flags (4) | created at (8) |
+ *   compacted from (4) | reserved (4)
+ *
+ * Created at is the creation time of the file in nanoseconds, which
+ * identifies a segment file across renames. A segment written by compaction
+ * records the lowest id of the segments it replaced in compacted from, which
+ * is zero otherwise.
+ *
+ * Record (24 byte header followed by the raw key and value bytes):
+ *   crc32c (4) | flags (1) | codec (1) | reserved (2) | key length (4) |
+ *   value length (4) | sequence (8) | key | value
+ *
+ * The checksum covers everything in the record after the crc field itself,
+ * so a torn or corrupted record is detected before it is ever returned.
+ *
+ * A deletion record carries the deleted key and no value. Files of version
+ * 1 had no deletion flag and marked a deletion with an empty value instead,
+ * so an empty value only means a deletion in those files.
+ *
+ * A value may be stored compressed, in which case codec is the Compression
+ * it was compressed with and the value length is that of the compressed
+ * bytes. Files before version 3 never have compressed values.
+ *
+ * A blob record keeps its value in a blob file and carries a pointer to it
+ * as its value instead (see blob_file.h). Files before version 4 never have
+ * blob records.
+ *
+ * A merge record carries an operand of Saavi::Merge as its value, which the
+ * merge operator folds into the value of the key when it is read. Files
+ * before version 5 never have merge records.
+ *
+ * A batch record has an empty key and carries the complete records of a
+ * WriteBatch as its value. Its checksum covers all of them, so a batch is
+ * either recovered whole or not at all. The records inside keep their own
+ * headers and checksums and are read on their own once recovered.
+ */
+
+constexpr char FILE_MAGIC[8] = {'S', 'A', 'A', 'V', 'I', 'D', 'B', '\0'};
+constexpr uint32_t FORMAT_VERSION = 5;
+constexpr size_t FILE_HEADER_SIZE = 32;
+constexpr size_t RECORD_HEADER_SIZE = 24;
+
+// flags of a record
+enum RecordFlag : uint8_t {
+  // the record is a batch of records
+  RECORD_FLAG_BATCH = 1 << 0,
+  // the record deletes its key
+  RECORD_FLAG_DELETION = 1 << 1,
+  // the value of the record is a pointer to the value in a blob file
+  RECORD_FLAG_BLOB = 1 << 2,
+  // the value of the record is a merge operand
+  RECORD_FLAG_MERGE = 1 << 3,
+};
+
+struct FileHeader {
+  uint32_t version{FORMAT_VERSION};
+  uint32_t flags{0};
+  uint64_t createdAt{0};
+  uint32_t compactedFrom{0};
+
+  void encode(char *buf) const;
+  // returns false if the buffer doesn't start with a saavi file header
+  static bool decode(const char *buf, FileHeader &header);
+};
+
+struct RecordHeader {
+  uint32_t crc;
+  uint8_t flags;
+  uint8_t codec;
+  uint32_t keyLength;
+  uint32_t valueLength;
+  uint64_t sequence;
+
+  // total length of the record including the header
+  size_t recordSize() const {
+    return RECORD_HEADER_SIZE + keyLength + valueLength;
+  }
+
+  static void decode(const char *buf, RecordHeader &header);
+};
+
+// whether the record, read from a file of the given format version, deletes
+// its key
+inline bool isDeletion(const RecordHeader &header, uint32_t fileVersion) {
+  return (header.flags & RECORD_FLAG_DELETION) != 0 ||
+         (fileVersion < 2 && header.valueLength == 0);
+}
+
+// CRC32C (Castagnoli) of the given bytes, continuing from crc
+uint32_t crc32c(const char *data, size_t length, uint32_t crc = 0);
+
+// append an encoded record to the given buffer. A value compressed with
+// a codec other than 0 is passed compressed.
+void encodeRecord(std::string &out, uint8_t flags, uint64_t sequence,
+                  std::string_view key, std::string_view value,
+                  uint8_t codec = 0);
+// append a record without its sequence number and checksum, which are
+// filled in later by sealRecord
+void appendRecord(std::string &out, uint8_t flags, std::string_view key,
+                  std::string_view value, uint8_t codec = 0);
+// set the sequence number of an appended record and checksum it
+void sealRecord(char *record, uint64_t sequence);
+
+// verify the checksum of a complete record starting at buf
+bool verifyRecord(const RecordHeader &header, const char *buf);
+
+// little-endian helpers shared by the file formats
+inline void encodeFixed32(char *buf, uint32_t value) {
+  for (int i = 0; i < 4; i++) {
+    buf[i] = static_cast<char>(value >> (8 * i));
+  }
+}
+
+inline void encodeFixed64(char *buf, uint64_t value) {
+  for (int i = 0; i < 8; i++) {
+    buf[i] = static_cast<char>(value >> (8 * i));
+  }
+}
+
+inline uint32_t decodeFixed32(const char *buf) {
+  uint32_t value = 0;
+  for (int i = 0; i < 4; i++) {
+    value |= static_cast<uint32_t>(static_cast<unsigned char>(buf[i]))
+             << (8 * i);
+  }
+  return value;
+}
+
+inline uint64_t decodeFixed64(const char *buf) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; i++) {
+    value |= static_cast<uint64_t>(static_cast<unsigned char>(buf[i]))
+             << (8 * i);
+  }
+  return value;
+}
+
+#endif
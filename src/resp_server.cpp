@@ -0,0 +1,706 @@
+#include "resp_server.h"
+
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+
+#include "saavi.h"
+#include "saavi_exception.h"
+
+namespace {
+
+// bytes read from a connection at a time, and reads per wake up so that a
+// busy connection doesn't starve the others of its loop
+const size_t READ_SIZE = 64 << 10;
+const int READS_PER_EVENT = 16;
+// a connection isn't read from while this many bytes of responses wait to
+// be sent to it
+const size_t MAX_PENDING_OUTPUT = 4 << 20;
+// limits of a command, as Redis has them
+const long MAX_BULK_LENGTH = 512L << 20;
+const long MAX_ARGUMENTS = 1 << 20;
+const size_t MAX_INLINE_LENGTH = 64 << 10;
+// keys a SCAN looks at unless told otherwise
+const long DEFAULT_SCAN_COUNT = 10;
+const int MAX_EVENTS = 256;
+
+class ProtocolError : public SaaviException {
+ public:
+  using SaaviException::SaaviException;
+};
+
+void appendSimple(std::string &out, std::string_view value) {
+  out += '+';
+  out.append(value);
+  out += "\r\n";
+}
+
+void appendError(std::string &out, std::string_view message) {
+  out += "-ERR ";
+  out.append(message);
+  out += "\r\n";
+}
+
+void appendInteger(std::string &out, char type, long value) {
+  out += type;
+  out += std::to_string(value);
+  out += "\r\n";
+}
+
+void appendBulk(std::string &out, std::string_view value) {
+  appendInteger(out, '$', static_cast<long>(value.length()));
+  out.append(value);
+  out += "\r\n";
+}
+
+void appendNull(std::string &out) { out += "$-1\r\n"; }
+
+// the number on the line of a multi bulk or bulk header
+long parseNumber(std::string_view line) {
+  if (line.empty() || line.length() > 18) {
+    throw ProtocolError("invalid number");
+  }
+  long value = 0;
+  for (char c : line) {
+    if (c < '0' || c > '9') {
+      throw ProtocolError("invalid number");
+    }
+    value = value * 10 + (c - '0');
+  }
+  return value;
+}
+
+// Parses the command at pos of the data into args and moves pos past it.
+// Returns false, leaving pos where it was, if the command hasn't arrived in
+// full yet. Commands are either multi bulk - an array of bulk strings - as
+// clients send them, or inline - the arguments separated by spaces on a
+// line - as typed into telnet.
+bool parseCommand(std::string_view data, size_t &pos,
+                  std::vector<std::string> &args) {
+  args.clear();
+  size_t next = pos;
+  // the line starting at next without its \r\n, moving next past it
+  auto line = [&data, &next](std::string_view &value) {
+    const size_t end = data.find("\r\n", next);
+    if (end == std::string_view::npos) {
+      return false;
+    }
+    value = data.substr(next, end - next);
+    next = end + 2;
+    return true;
+  };
+
+  if (data[next] != '*') {
+    const size_t end = data.find('\n', next);
+    if (end == std::string_view::npos) {
+      if (data.length() - next > MAX_INLINE_LENGTH) {
+        throw ProtocolError("too big inline request");
+      }
+      return false;
+    }
+    std::string_view rest = data.substr(next, end - next);
+    while (!rest.empty()) {
+      const size_t start = rest.find_first_not_of(" \t\r");
+      if (start == std::string_view::npos) {
+        break;
+      }
+      rest.remove_prefix(start);
+      const size_t length = std::min(rest.find_first_of(" \t\r"),
+                                     rest.length());
+      args.emplace_back(rest.substr(0, length));
+      rest.remove_prefix(length);
+    }
+    pos = end + 1;
+    return true;
+  }
+
+  std::string_view header;
+  next++;
+  if (!line(header)) {
+    return false;
+  }
+  const long count = parseNumber(header);
+  if (count > MAX_ARGUMENTS) {
+    throw ProtocolError("invalid multibulk length");
+  }
+  for (long i = 0; i < count; i++) {
+    if (next >= data.length()) {
+      return false;
+    }
+    if (data[next] != '$') {
+      throw ProtocolError("expected '$'");
+    }
+    next++;
+    if (!line(header)) {
+      return false;
+    }
+    const long length = parseNumber(header);
+    if (length > MAX_BULK_LENGTH) {
+      throw ProtocolError("invalid bulk length");
+    }
+    if (data.length() - next < static_cast<size_t>(length) + 2) {
+      return false;
+    }
+    if (data.compare(next + length, 2, "\r\n") != 0) {
+      throw ProtocolError("expected CRLF after the bulk string");
+    }
+    args.emplace_back(data.substr(next, length));
+    next += length + 2;
+  }
+  pos = next;
+  return true;
+}
+
+// SCAN cursors are the hex encoded key the next scan starts from
+std::string encodeCursor(const std::string &key) {
+  static const char digits[] = "0123456789abcdef";
+  std::string cursor;
+  for (unsigned char c : key) {
+    cursor += digits[c >> 4];
+    cursor += digits[c & 0xf];
+  }
+  return cursor;
+}
+
+std::string decodeCursor(const std::string &cursor) {
+  auto digit = [](char c) {
+    if (c >= '0' && c <= '9') {
+      return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+      return c - 'a' + 10;
+    }
+    throw SaaviException("invalid cursor");
+  };
+  if (cursor.length() % 2 != 0) {
+    throw SaaviException("invalid cursor");
+  }
+  std::string key;
+  for (size_t i = 0; i < cursor.length(); i += 2) {
+    key += static_cast<char>(digit(cursor[i]) << 4 | digit(cursor[i + 1]));
+  }
+  return key;
+}
+
+// the smallest string greater than every string starting with the prefix,
+// empty if there is none
+std::string prefixEnd(std::string prefix) {
+  while (!prefix.empty() && static_cast<unsigned char>(prefix.back()) == 0xff) {
+    prefix.pop_back();
+  }
+  if (!prefix.empty()) {
+    prefix.back()++;
+  }
+  return prefix;
+}
+
+// a client connection and the data waiting to be parsed and sent
+struct Connection {
+  explicit Connection(int fd) : fd(fd) {}
+
+  int fd;
+  std::string input;
+  std::string output;
+  // bytes of the output that have been sent
+  size_t written{0};
+  // the events the connection is registered for
+  uint32_t events{EPOLLIN};
+  // QUIT was sent, close once the responses are sent
+  bool closing{false};
+};
+
+}  // namespace
+
+class RespServer::EventLoop {
+  RespServer &server;
+  int epollFd;
+  std::unordered_map<int, std::unique_ptr<Connection>> connections;
+  // arguments of the command being run, kept to reuse their memory
+  std::vector<std::string> args;
+  std::vector<std::string> keys;
+  std::vector<PinnedValue> values;
+
+  void accept();
+  void close(Connection &connection);
+  // read what has arrived, run the commands and send their responses
+  void handleReadable(Connection &connection);
+  // send what can be sent and wait for the rest as needed
+  void flush(Connection &connection);
+  void execute(std::string &out, bool &closing);
+  void scan(std::string &out);
+
+ public:
+  explicit EventLoop(RespServer &server);
+  ~EventLoop();
+  void run();
+};
+
+RespServer::EventLoop::EventLoop(RespServer &server) : server(server) {
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  if (epollFd < 0) {
+    throw SaaviException(std::string("failed to create an epoll instance : ") +
+                         strerror(errno));
+  }
+  // every loop waits on the listening socket, but only one of them is woken
+  // up for a new connection
+  epoll_event event{};
+  event.events = EPOLLIN | EPOLLEXCLUSIVE;
+  event.data.fd = server.listenFd;
+  epoll_event stop{};
+  stop.events = EPOLLIN;
+  stop.data.fd = server.stopFd;
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, server.listenFd, &event) < 0 ||
+      epoll_ctl(epollFd, EPOLL_CTL_ADD, server.stopFd, &stop) < 0) {
+    const int error = errno;
+    ::close(epollFd);
+    throw SaaviException(std::string("failed to set up epoll : ") +
+                         strerror(error));
+  }
+}
+
+RespServer::EventLoop::~EventLoop() {
+  for (const auto &connection : connections) {
+    ::close(connection.first);
+  }
+  ::close(epollFd);
+}
+
+void RespServer::EventLoop::run() {
+  epoll_event events[MAX_EVENTS];
+  while (true) {
+    const int ready = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+    if (ready < 0 && errno == EINTR) {
+      continue;
+    }
+    if (ready < 0) {
+      return;
+    }
+    for (int i = 0; i < ready; i++) {
+      const int fd = events[i].data.fd;
+      if (fd == server.stopFd) {
+        return;
+      }
+      if (fd == server.listenFd) {
+        accept();
+        continue;
+      }
+      auto it = connections.find(fd);
+      if (it == connections.end()) {
+        continue;
+      }
+      Connection &connection = *it->second;
+      // what arrived before a hang up is still answered, the read that
+      // finds the end of the stream closes the connection
+      if (events[i].events & EPOLLIN) {
+        handleReadable(connection);
+      } else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+        close(connection);
+      } else if (events[i].events & EPOLLOUT) {
+        flush(connection);
+      }
+    }
+  }
+}
+
+void RespServer::EventLoop::accept() {
+  // a single connection per wake up, the next one may go to another loop
+  const int fd =
+      accept4(server.listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (fd < 0) {
+    return;
+  }
+  if (server.port != 0) {
+    const int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  }
+  epoll_event event{};
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+  if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+    ::close(fd);
+    return;
+  }
+  connections[fd].reset(new Connection(fd));
+}
+
+void RespServer::EventLoop::close(Connection &connection) {
+  const int fd = connection.fd;
+  epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+  ::close(fd);
+  connections.erase(fd);
+}
+
+void RespServer::EventLoop::handleReadable(Connection &connection) {
+  bool eof = false;
+  for (int i = 0; i < READS_PER_EVENT; i++) {
+    const size_t size = connection.input.size();
+    connection.input.resize(size + READ_SIZE);
+    const ssize_t bytes = ::read(connection.fd, &connection.input[size],
+                                 READ_SIZE);
+    connection.input.resize(size + std::max<ssize_t>(bytes, 0));
+    if (bytes == 0 || (bytes < 0 && errno != EAGAIN && errno != EINTR)) {
+      eof = true;
+      break;
+    }
+    if (bytes < static_cast<ssize_t>(READ_SIZE)) {
+      break;
+    }
+  }
+
+  // run every command that has arrived in full, in order
+  size_t pos = 0;
+  try {
+    while (pos < connection.input.size() && !connection.closing &&
+           parseCommand(connection.input, pos, args)) {
+      if (!args.empty()) {
+        execute(connection.output, connection.closing);
+      }
+    }
+  } catch (ProtocolError &e) {
+    appendError(connection.output,
+                std::string("Protocol error: ") + e.what());
+    connection.closing = true;
+  }
+  connection.input.erase(0, pos);
+  if (eof) {
+    connection.closing = true;
+  }
+  flush(connection);
+}
+
+void RespServer::EventLoop::flush(Connection &connection) {
+  while (connection.written < connection.output.size()) {
+    const ssize_t bytes =
+        send(connection.fd, connection.output.data() + connection.written,
+             connection.output.size() - connection.written, MSG_NOSIGNAL);
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes < 0 && errno == EAGAIN) {
+      break;
+    }
+    if (bytes < 0) {
+      close(connection);
+      return;
+    }
+    connection.written += bytes;
+  }
+  const size_t pending = connection.output.size() - connection.written;
+  if (pending == 0) {
+    connection.output.clear();
+    connection.written = 0;
+    if (connection.closing) {
+      close(connection);
+      return;
+    }
+  }
+
+  // wait for room to send the rest, and stop reading while too much of it
+  // is waiting
+  uint32_t events = 0;
+  if (pending > 0) {
+    events |= EPOLLOUT;
+  }
+  if (pending < MAX_PENDING_OUTPUT && !connection.closing) {
+    events |= EPOLLIN;
+  }
+  if (events != connection.events) {
+    epoll_event event{};
+    event.events = events;
+    event.data.fd = connection.fd;
+    epoll_ctl(epollFd, EPOLL_CTL_MOD, connection.fd, &event);
+    connection.events = events;
+  }
+}
+
+void RespServer::EventLoop::execute(std::string &out, bool &closing) {
+  const std::string &command = args[0];
+  auto is = [&command](const char *name) {
+    return strcasecmp(command.c_str(), name) == 0;
+  };
+  auto wrongArguments = [&out, &command] {
+    appendError(out, "wrong number of arguments for '" + command +
+                         "' command");
+  };
+  Saavi &saavi = server.saavi;
+  try {
+    if (is("GET")) {
+      if (args.size() != 2) {
+        return wrongArguments();
+      }
+      values.resize(1);
+      if (saavi.Get(args[1], values[0])) {
+        appendBulk(out, values[0].view());
+      } else {
+        appendNull(out);
+      }
+    } else if (is("SET")) {
+      if (args.size() != 3) {
+        return wrongArguments();
+      }
+      saavi.Put(args[1], args[2]);
+      appendSimple(out, "OK");
+    } else if (is("DEL")) {
+      if (args.size() < 2) {
+        return wrongArguments();
+      }
+      // the reply is the number of keys that were there to delete, which
+      // only DEL needs, so it is looked up here rather than by every Delete
+      long deleted = 0;
+      values.resize(1);
+      for (size_t i = 1; i < args.size(); i++) {
+        if (saavi.Get(args[i], values[0])) {
+          deleted++;
+        }
+        saavi.Delete(args[i]);
+      }
+      appendInteger(out, ':', deleted);
+    } else if (is("MGET")) {
+      if (args.size() < 2) {
+        return wrongArguments();
+      }
+      keys.assign(std::make_move_iterator(args.begin() + 1),
+                  std::make_move_iterator(args.end()));
+      const std::vector<bool> found = saavi.MultiGet(keys, values);
+      appendInteger(out, '*', static_cast<long>(keys.size()));
+      for (size_t i = 0; i < keys.size(); i++) {
+        if (found[i]) {
+          appendBulk(out, values[i].view());
+        } else {
+          appendNull(out);
+        }
+      }
+    } else if (is("SCAN")) {
+      if (args.size() < 2 || args.size() % 2 != 0) {
+        return wrongArguments();
+      }
+      scan(out);
+    } else if (is("PING")) {
+      if (args.size() > 2) {
+        return wrongArguments();
+      }
+      if (args.size() == 2) {
+        appendBulk(out, args[1]);
+      } else {
+        appendSimple(out, "PONG");
+      }
+    } else if (is("QUIT")) {
+      appendSimple(out, "OK");
+      closing = true;
+    } else if (is("COMMAND")) {
+      // clients ask for the commands when they connect, none are described
+      appendInteger(out, '*', 0);
+    } else {
+      appendError(out, "unknown command '" + command + "'");
+    }
+  } catch (std::exception &e) {
+    appendError(out, e.what());
+  }
+}
+
+void RespServer::EventLoop::scan(std::string &out) {
+  std::string start = args[1] == "0" ? "" : decodeCursor(args[1]);
+  std::string pattern;
+  long count = DEFAULT_SCAN_COUNT;
+  for (size_t i = 2; i < args.size(); i += 2) {
+    if (strcasecmp(args[i].c_str(), "MATCH") == 0) {
+      pattern = args[i + 1];
+    } else if (strcasecmp(args[i].c_str(), "COUNT") == 0) {
+      count = parseNumber(args[i + 1]);
+      if (count < 1) {
+        throw SaaviException("COUNT must be positive");
+      }
+    } else {
+      throw SaaviException("syntax error");
+    }
+  }
+
+  // only the keys starting with the literal part of the pattern can match
+  std::string end;
+  const std::string prefix =
+      pattern.substr(0, pattern.find_first_of("*?[\\"));
+  if (!prefix.empty()) {
+    start = std::max(start, prefix);
+    end = prefixEnd(prefix);
+  }
+
+  // look at upto count keys, and start the next scan at the one after them
+  std::vector<std::string> matches;
+  std::string next;
+  long examined = 0;
+  for (auto it = server.saavi.Scan(start, end); it != server.saavi.end();
+       ++it) {
+    const std::string &key = (*it).first;
+    if (examined++ == count) {
+      next = encodeCursor(key);
+      break;
+    }
+    if (pattern.empty() || fnmatch(pattern.c_str(), key.c_str(), 0) == 0) {
+      matches.push_back(key);
+    }
+  }
+  appendInteger(out, '*', 2);
+  appendBulk(out, next.empty() ? "0" : next);
+  appendInteger(out, '*', static_cast<long>(matches.size()));
+  for (const auto &key : matches) {
+    appendBulk(out, key);
+  }
+}
+
+RespServer::RespServer(Saavi &saavi, const std::string &address,
+                       unsigned numOfThreads)
+    : saavi(saavi) {
+  if (numOfThreads == 0) {
+    numOfThreads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  listen(address);
+  stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  try {
+    if (stopFd < 0) {
+      throw SaaviException(std::string("failed to create an eventfd : ") +
+                           strerror(errno));
+    }
+    for (unsigned i = 0; i < numOfThreads; i++) {
+      loops.emplace_back(new EventLoop(*this));
+    }
+  } catch (...) {
+    loops.clear();
+    Stop();
+    throw;
+  }
+  for (auto &loop : loops) {
+    threads.emplace_back(&EventLoop::run, loop.get());
+  }
+}
+
+RespServer::~RespServer() { Stop(); }
+
+void RespServer::listen(const std::string &address) {
+  auto fail = [&address](const std::string &what) {
+    throw SaaviException("failed to " + what + " '" + address +
+                         "' : " + strerror(errno));
+  };
+
+  if (address.compare(0, 5, "unix:") == 0) {
+    unixPath = address.substr(5);
+    sockaddr_un un{};
+    un.sun_family = AF_UNIX;
+    if (unixPath.empty() || unixPath.length() >= sizeof(un.sun_path)) {
+      throw SaaviException("invalid Unix socket path '" + unixPath + "'");
+    }
+    memcpy(un.sun_path, unixPath.c_str(), unixPath.length() + 1);
+    // a socket left behind by a server that didn't shut down is replaced
+    struct stat st;
+    if (stat(unixPath.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+      unlink(unixPath.c_str());
+    }
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd < 0) {
+      fail("create a socket for");
+    }
+    if (bind(listenFd, reinterpret_cast<sockaddr *>(&un), sizeof(un)) < 0) {
+      const int error = errno;
+      ::close(listenFd);
+      listenFd = -1;
+      errno = error;
+      unixPath.clear();
+      fail("bind to");
+    }
+  } else {
+    const size_t colon = address.rfind(':');
+    if (colon == std::string::npos) {
+      throw SaaviException("invalid address '" + address +
+                           "', expected host:port or unix:path");
+    }
+    std::string host = address.substr(0, colon);
+    if (host.length() >= 2 && host.front() == '[' && host.back() == ']') {
+      host = host.substr(1, host.length() - 2);
+    }
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo *result = nullptr;
+    const int status =
+        getaddrinfo(host.empty() ? nullptr : host.c_str(),
+                    address.substr(colon + 1).c_str(), &hints, &result);
+    if (status != 0) {
+      throw SaaviException("failed to resolve '" + address +
+                           "' : " + gai_strerror(status));
+    }
+    for (addrinfo *ai = result; ai != nullptr; ai = ai->ai_next) {
+      listenFd = socket(ai->ai_family,
+                        ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if (listenFd < 0) {
+        continue;
+      }
+      const int on = 1;
+      setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+      if (bind(listenFd, ai->ai_addr, ai->ai_addrlen) == 0) {
+        break;
+      }
+      const int error = errno;
+      ::close(listenFd);
+      listenFd = -1;
+      errno = error;
+    }
+    freeaddrinfo(result);
+    if (listenFd < 0) {
+      fail("bind to");
+    }
+    sockaddr_storage bound{};
+    socklen_t length = sizeof(bound);
+    getsockname(listenFd, reinterpret_cast<sockaddr *>(&bound), &length);
+    port = ntohs(bound.ss_family == AF_INET6
+                     ? reinterpret_cast<sockaddr_in6 *>(&bound)->sin6_port
+                     : reinterpret_cast<sockaddr_in *>(&bound)->sin_port);
+  }
+
+  if (::listen(listenFd, SOMAXCONN) < 0) {
+    const int error = errno;
+    Stop();
+    errno = error;
+    fail("listen on");
+  }
+}
+
+void RespServer::Stop() {
+  if (stopFd >= 0) {
+    const uint64_t one = 1;
+    if (write(stopFd, &one, sizeof(one)) < 0) {
+      // the loops are already stopping
+    }
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  threads.clear();
+  loops.clear();
+  if (stopFd >= 0) {
+    close(stopFd);
+    stopFd = -1;
+  }
+  if (listenFd >= 0) {
+    close(listenFd);
+    listenFd = -1;
+  }
+  if (!unixPath.empty()) {
+    unlink(unixPath.c_str());
+    unixPath.clear();
+  }
+}
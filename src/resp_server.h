@@ -0,0 +1,60 @@
+#ifndef RESP_SERVER_H
+#define RESP_SERVER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Saavi;
+
+// Serves a store over the network with a subset of the Redis protocol
+// (RESP), so that clients speaking it can share one store:
+//   GET key, SET key value, DEL key [key ...], MGET key [key ...],
+//   SCAN cursor [MATCH pattern] [COUNT count], PING and QUIT
+// SCAN walks the keys in key order and needs the store to keep them
+// ordered. Its cursor is "0" to start with and once the scan is done; in
+// between it is an opaque token.
+//
+// Every thread runs an event loop of its own on an epoll instance, and the
+// threads take turns accepting new connections from the shared listening
+// socket. A connection stays on the loop that accepted it. Each time a
+// connection is readable, all of the commands that have arrived on it are
+// run and their responses are sent back together, so pipelined commands
+// are answered with as few writes as they were sent with.
+class RespServer {
+ public:
+  // listen on address - "unix:" and a path for a Unix socket, or a host and
+  // a port, like "127.0.0.1:6379" or ":6379" for every interface, for TCP.
+  // Port 0 picks a free port. Serves with numOfThreads event loops, one per
+  // core if 0, until stopped or destroyed.
+  RespServer(Saavi &saavi, const std::string &address,
+             unsigned numOfThreads = 0);
+  ~RespServer();
+  RespServer(const RespServer &) = delete;
+  RespServer &operator=(const RespServer &) = delete;
+
+  // the TCP port listened on, 0 for a Unix socket
+  uint16_t Port() const { return port; }
+
+  // close the listening socket and every connection, and wait for the event
+  // loops to finish
+  void Stop();
+
+ private:
+  class EventLoop;
+
+  Saavi &saavi;
+  std::string unixPath;
+  uint16_t port{0};
+  int listenFd{-1};
+  // written to by Stop to wake up the event loops
+  int stopFd{-1};
+  std::vector<std::unique_ptr<EventLoop>> loops;
+  std::vector<std::thread> threads;
+
+  void listen(const std::string &address);
+};
+
+#endif
@@ -2,90 +2,2712 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <functional>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <unordered_set>
+#include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "compression.h"
+#include "external_sort.h"
+#include "hint_file.h"
+#include "ingest_reader.h"
 #include "saavi_exception.h"
 
-Saavi::Saavi(const std::string &filename) {
-  fs.open(filename, std::ios::in | std::ios::out | std::ios::app);
-  if (!fs.is_open()) {
-    // failed to open file
+namespace {
+
+// Rewrite a data file written in the legacy "key,value\n" format into the
+// binary record format. The upgraded file is written aside and then renamed
+// over the original so that a crash never leaves a half converted file.
+void upgradeLegacyFile(const std::string &filename) {
+  std::ifstream legacy(filename, std::ios::in | std::ios::binary);
+  if (!legacy.is_open()) {
     throw SaaviException("failed to open file '" + filename + "'");
   }
 
+  const std::string upgradedFilename = filename + ".upgrade";
+  std::ofstream upgraded(upgradedFilename,
+                         std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!upgraded.is_open()) {
+    throw SaaviException("failed to create file '" + upgradedFilename + "'");
+  }
+
+  char header[FILE_HEADER_SIZE];
+  FileHeader{}.encode(header);
+  upgraded.write(header, FILE_HEADER_SIZE);
+
+  // read the old file in large blocks and split it into lines with memchr,
+  // which scans many bytes at a time. Entries are replayed in log order so
+  // the latest value still wins.
+  uint64_t sequence = 1;
+  std::string block;
+  std::string record;
+  size_t blockStart = 0;
+  std::unique_ptr<char[]> readBuffer(new char[SCAN_BLOCK_SIZE]);
+  while (legacy.read(readBuffer.get(), SCAN_BLOCK_SIZE) ||
+         legacy.gcount() > 0) {
+    // keep the partial line left over from the previous block
+    block.erase(0, blockStart);
+    block.append(readBuffer.get(), legacy.gcount());
+    blockStart = 0;
+
+    const char *data = block.data();
+    while (const char *lineEnd = static_cast<const char *>(std::memchr(
+               data + blockStart, '\n', block.length() - blockStart))) {
+      const char *line = data + blockStart;
+      const char *comma = static_cast<const char *>(
+          std::memchr(line, ',', lineEnd - line));
+      if (comma == nullptr) {
+        throw SaaviException("failed to upgrade file '" + filename +
+                             "' - malformed entry");
+      }
+      // an empty value was how the old format deleted a key
+      record.clear();
+      encodeRecord(record, comma + 1 == lineEnd ? RECORD_FLAG_DELETION : 0,
+                   sequence++, std::string(line, comma),
+                   std::string(comma + 1, lineEnd));
+      upgraded.write(record.data(), record.length());
+      blockStart = lineEnd - data + 1;
+    }
+  }
+  // anything left after the last newline is a partially written entry
+
+  upgraded.flush();
+  if (!upgraded) {
+    throw SaaviException("failed to write file '" + upgradedFilename + "'");
+  }
+  upgraded.close();
+  std::filesystem::rename(upgradedFilename, filename);
+}
+
+std::string hintFilename(const std::string &filename) {
+  return filename + ".hint";
+}
+
+// sealed segments are named after the data file with their id as suffix
+std::string segmentFilename(const std::string &filename, uint32_t id) {
+  char suffix[16];
+  snprintf(suffix, sizeof(suffix), ".%06u", id);
+  return filename + suffix;
+}
+
+// suffix of the file a compaction writes before it is renamed into place
+const std::string COMPACTION_SUFFIX = ".compact";
+
+// blob files are named after the data file with ".blob." and their id
+const std::string BLOB_SUFFIX = ".blob.";
+
+std::string blobFilename(const std::string &filename, uint32_t id) {
+  char suffix[16];
+  snprintf(suffix, sizeof(suffix), "%06u", id);
+  return filename + BLOB_SUFFIX + suffix;
+}
+
+// MultiGet reads records of a segment that are at most MULTIGET_GAP bytes
+// apart with a single read of upto MULTIGET_MAX_READ bytes
+constexpr unsigned long MULTIGET_GAP = 4 << 10;
+constexpr unsigned long MULTIGET_MAX_READ = 1 << 20;
+
+// garbage collection moves this many bytes of blobs at a time before
+// pointing their keys at them
+constexpr size_t BLOB_COLLECTION_CHUNK_SIZE = 16 << 20;
+
+std::filesystem::path directoryOf(const std::string &filename) {
+  auto directory = std::filesystem::path(filename).parent_path();
+  return directory.empty() ? std::filesystem::path(".") : directory;
+}
+
+// list the sealed segments of the data file ordered by id, along with any
+// files left behind by an interrupted compaction
+std::map<uint32_t, std::string> listSegmentFiles(
+    const std::string &filename, std::vector<std::string> *leftovers) {
+  std::map<uint32_t, std::string> segmentFiles;
+  const std::string prefix = std::filesystem::path(filename).filename().string() + ".";
+  for (const auto &file :
+       std::filesystem::directory_iterator(directoryOf(filename))) {
+    const std::string name = file.path().filename().string();
+    if (name.compare(0, prefix.length(), prefix) != 0) {
+      continue;
+    }
+
+    std::string suffix = name.substr(prefix.length());
+    const bool isLeftover =
+        suffix.length() > COMPACTION_SUFFIX.length() &&
+        suffix.compare(suffix.length() - COMPACTION_SUFFIX.length(),
+                       COMPACTION_SUFFIX.length(), COMPACTION_SUFFIX) == 0;
+    if (isLeftover) {
+      suffix.resize(suffix.length() - COMPACTION_SUFFIX.length());
+    }
+    if (suffix.empty() || suffix.length() > 9 ||
+        std::find_if(suffix.begin(), suffix.end(),
+                     [](char c) { return !isdigit(c); }) != suffix.end()) {
+      continue;
+    }
+
+    if (isLeftover) {
+      if (leftovers != nullptr) {
+        leftovers->push_back(file.path().string());
+      }
+    } else {
+      segmentFiles[std::stoul(suffix)] = file.path().string();
+    }
+  }
+  return segmentFiles;
+}
+
+// list the blob files of the data file ordered by id
+std::map<uint32_t, std::string> listBlobFiles(const std::string &filename) {
+  std::map<uint32_t, std::string> blobFiles;
+  const std::string prefix =
+      std::filesystem::path(filename).filename().string() + BLOB_SUFFIX;
+  for (const auto &file :
+       std::filesystem::directory_iterator(directoryOf(filename))) {
+    const std::string name = file.path().filename().string();
+    if (name.compare(0, prefix.length(), prefix) != 0) {
+      continue;
+    }
+    const std::string suffix = name.substr(prefix.length());
+    if (suffix.empty() || suffix.length() > 9 ||
+        std::find_if(suffix.begin(), suffix.end(),
+                     [](char c) { return !isdigit(c); }) != suffix.end()) {
+      continue;
+    }
+    blobFiles[std::stoul(suffix)] = file.path().string();
+  }
+  return blobFiles;
+}
+
+// whether no more than the given fraction of a blob file is live
+bool isCollectable(const Segment &blobFile, double liveRatio) {
+  return blobFile.liveBytes() <=
+         (blobFile.size() - FILE_HEADER_SIZE) * liveRatio;
+}
+
+uint64_t currentTimeNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+void validateKey(const std::string &key) {
+  if (key.empty()) {
+    throw SaaviException("invalid key - key cannot be empty");
+  }
+  if (key.length() > std::numeric_limits<uint32_t>::max()) {
+    throw SaaviException("invalid key - key is too long");
+  }
+}
+
+void validateEntry(const std::string &key, std::string_view value) {
+  validateKey(key);
+  if (value.length() > std::numeric_limits<uint32_t>::max()) {
+    throw SaaviException("invalid value - value is too long");
+  }
+}
+
+// record the latency of an operation that completes after its call
+// returned, timed from start
+void recordSince(StatsRecorder *stats, TimedOperation operation,
+                 std::chrono::steady_clock::time_point start) {
+  if (stats != nullptr && stats->timed()) {
+    stats->recordLatency(
+        operation, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now() - start)
+                       .count());
+  }
+}
+
+}  // namespace
+
+Saavi::Saavi(const std::string &filename, const SaaviOptions &options)
+    : filename(filename), options(options) {
+  if (!compressionSupported(options.compression)) {
+    throw SaaviException("the compression codec is not supported");
+  }
+#ifdef SAAVI_WITH_STATS
+  if (options.statistics != StatsLevel::None) {
+    stats.reset(
+        new StatsRecorder(options.statistics == StatsLevel::Latencies));
+  }
+#endif
+  const auto start = std::chrono::steady_clock::now();
+  if (options.engine == StorageEngine::Lsm) {
+    std::error_code ec;
+    if (!LsmStore::Exists(filename) && std::filesystem::exists(filename, ec)) {
+      throw SaaviException("'" + filename +
+                           "' was written by the log engine");
+    }
+    lsm.reset(new LsmStore(filename, options));
+    recoveryDuration = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    return;
+  }
+  if (LsmStore::Exists(filename)) {
+    throw SaaviException("'" + filename + "' was written by the lsm engine");
+  }
+
+  if (options.cacheCapacity > 0) {
+    cache.reset(new ValueCache(options.cacheCapacity));
+  }
+  if (options.orderedIndex) {
+    ordered.reset(new OrderedIndex());
+  }
+  openSegments();
   rebuildIndexes();
+  if (active->header().version < FORMAT_VERSION) {
+    // records of the current format never go into a file of an older one
+    rollover();
+  }
+  recoveryDuration = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
+
+  if (options.backgroundCompaction) {
+    compactionThread = std::thread(&Saavi::compactionLoop, this);
+  }
 }
 
-bool string_is_valid_key(const std::string &str) {
-  return std::find_if(str.begin(), str.end(),
-                      [](char c) { return !isalnum(c); }) == str.end();
+Saavi::~Saavi() {
+  // wait for the asynchronous operations in flight
+  asyncIo.reset();
+
+  if (lsm) {
+    // the lsm engine shuts itself down
+    return;
+  }
+
+  // stop the background compaction
+  {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    stopping = true;
+  }
+  compactionCondition.notify_all();
+  if (compactionThread.joinable()) {
+    compactionThread.join();
+  }
+
+  try {
+    // write out the buffered records before anything else
+    active->flush();
+    if (options.durability != DurabilityMode::None &&
+        options.durability != DurabilityMode::FlushPerWrite) {
+      active->sync();
+    }
+  } catch (std::exception &e) {
+    // nothing more can be done from a destructor
+  }
+
+  try {
+    writeHintFile();
+  } catch (std::exception &e) {
+    // the hint is only an optimisation - the next open replays the log
+  }
 }
 
-const std::string Saavi::encode_entry(const std::string &key,
-                                      const std::string &value) {
-  if (!string_is_valid_key(key)) {
-    throw SaaviException("invalid key - only alphanumeric key supported");
+void Saavi::Destroy(const std::string &filename) {
+  std::vector<std::string> leftovers;
+  for (const auto &segmentFile : listSegmentFiles(filename, &leftovers)) {
+    std::filesystem::remove(segmentFile.second);
   }
+  for (const auto &leftover : leftovers) {
+    std::filesystem::remove(leftover);
+  }
+  for (const auto &blobFile : listBlobFiles(filename)) {
+    std::filesystem::remove(blobFile.second);
+  }
+  std::filesystem::remove(filename);
+  std::filesystem::remove(hintFilename(filename));
+  LsmStore::Destroy(filename);
+}
 
-  // encode the string and key
-  // for now we simply treat as a csv
-  return key + "," + value + "\n";
+void Saavi::openSegments() {
+  // detect the format of an existing data file
+  std::error_code ec;
+  const bool activeExists = std::filesystem::exists(filename, ec) &&
+                            std::filesystem::file_size(filename, ec) > 0;
+  if (activeExists) {
+    char header[FILE_HEADER_SIZE] = {};
+    std::ifstream(filename, std::ios::in | std::ios::binary)
+        .read(header, FILE_HEADER_SIZE);
+    FileHeader fileHeader;
+    if (!FileHeader::decode(header, fileHeader)) {
+      // no magic => a file written by an older version of saavi
+      upgradeLegacyFile(filename);
+    }
+  }
+
+  // open the sealed segments and drop whatever an interrupted compaction
+  // left behind - its output replaces every segment from compactedFrom upto
+  // its own id, so any such segment that still exists is stale
+  std::vector<std::string> leftovers;
+  for (const auto &segmentFile : listSegmentFiles(filename, &leftovers)) {
+    segments[segmentFile.first] =
+        Segment::open(segmentFile.second, segmentFile.first);
+  }
+  for (const auto &leftover : leftovers) {
+    std::filesystem::remove(leftover);
+  }
+  for (const auto &segment : segments) {
+    const uint32_t compactedFrom = segment.second->header().compactedFrom;
+    if (compactedFrom == 0) {
+      continue;
+    }
+    for (auto stale = segments.lower_bound(compactedFrom);
+         stale->first < segment.first;) {
+      std::filesystem::remove(stale->second->path());
+      stale = segments.erase(stale);
+    }
+  }
+
+  // blobs are only ever appended to a new blob file after opening
+  for (const auto &blobFile : listBlobFiles(filename)) {
+    auto segment = Segment::open(blobFile.second, blobFile.first);
+    if ((segment->header().flags & FILE_FLAG_BLOB_FILE) == 0) {
+      throw SaaviException("invalid blob file '" + blobFile.second + "'");
+    }
+    blobFiles[blobFile.first] = segment;
+  }
+
+  // the active segment always comes after the sealed ones
+  const uint32_t activeId = segments.empty() ? 1 : segments.rbegin()->first + 1;
+  if (activeExists) {
+    active = Segment::open(filename, activeId);
+  } else {
+    FileHeader header;
+    header.createdAt = currentTimeNanos();
+    active = Segment::create(filename, activeId, header);
+  }
 }
 
-const std::pair<std::string, std::string> Saavi::decode_entry(
-    const std::string &entry) {
-  // decode the comma separated string and key
-  std::string::size_type pos = entry.find(',');
-  assert(pos != std::string::npos);
-  return std::make_pair(entry.substr(0, pos), entry.substr(pos + 1));
+const std::shared_ptr<Segment> &Saavi::segmentFor(uint32_t id) const {
+  if (id == active->id()) {
+    return active;
+  }
+  return segments.at(id);
+}
+
+void Saavi::rollover(uint32_t reservedIds) {
+  // a sealed segment is never written again, so write out everything and
+  // make it durable if the writes are expected to be
+  flushActive();
+  if (options.durability == DurabilityMode::FsyncPerWrite ||
+      options.durability == DurabilityMode::GroupCommit) {
+    active->sync();
+  }
+
+  // seal the active segment by giving it its numbered name
+  const uint32_t id = active->id();
+  active->rename(segmentFilename(filename, id));
+  FileHeader header;
+  header.createdAt = currentTimeNanos();
+  auto next = Segment::create(filename, id + 1 + reservedIds, header);
+  {
+    std::lock_guard<ShardedSharedMutex> lock(segmentsMutex);
+    segments[id] = active;
+    active = next;
+  }
+  lastRecordOffset = 0;
+  lastRecordCrc = 0;
+
+  // a newly sealed segment might make compaction worthwhile
+  compactionCondition.notify_all();
+}
+
+void Saavi::appendActive(const std::string &entry) {
+  try {
+    active->append(entry);
+  } catch (std::exception &e) {
+    forgetUnflushed();
+    throw;
+  }
+}
+
+void Saavi::flushActive() {
+  try {
+    active->flush();
+  } catch (std::exception &e) {
+    forgetUnflushed();
+    throw;
+  }
+}
+
+void Saavi::forgetUnflushed() {
+  const uint32_t id = active->id();
+  const unsigned long end = active->size();
+  std::vector<std::string> lost;
+  idx.forEach([&](std::string_view key, const IndexEntry &entry) {
+    if (entry.segmentId == id && entry.offset >= end) {
+      lost.emplace_back(key);
+    }
+  });
+  // the writes never made it, so the keys go as if deleted
+  for (const auto &key : lost) {
+    updateIndex(key, IndexEntry{id, end, 0, nextSequence},
+                RECORD_FLAG_DELETION);
+    if (cache) {
+      cache->invalidate(key);
+    }
+  }
+  hintIsCurrent = false;
+}
+
+void Saavi::updateIndex(const std::string &key, const IndexEntry &entry,
+                        uint8_t flags, const BlobPointer *blob) {
+  // a deleted key leaves the index right away, so lookups of it are
+  // answered without reading the log. The deletion record itself is dead
+  // from the start and goes with the next compaction.
+  const uint64_t keepUpto = newestSnapshot;
+  IndexEntry previous;
+  // the old records that are dead now, unless a snapshot still sees them
+  std::vector<IndexEntry> dropped;
+  bool replaced;
+  if (flags & RECORD_FLAG_DELETION) {
+    replaced =
+        idx.eraseKey(key, &previous, entry.sequence, keepUpto, &dropped);
+    if (replaced) {
+      if (ordered) {
+        std::unique_lock<std::shared_mutex> lock(orderedMutex);
+        ordered->erase(key);
+      }
+    }
+  } else {
+    // a merge operand stacks on the old record, which stays live
+    replaced = (flags & RECORD_FLAG_MERGE)
+                   ? idx.mergeKeyOffset(key, entry)
+                   : idx.putKeyOffset(key, entry, &previous, keepUpto,
+                                      &dropped);
+    if (!replaced && ordered) {
+      std::unique_lock<std::shared_mutex> lock(orderedMutex);
+      ordered->insert(key);
+    }
+    segmentFor(entry.segmentId)->addLiveBytes(entry.size);
+  }
+  if (ingestWrites && (flags & RECORD_FLAG_MERGE) == 0) {
+    ingestWrites->insert(key);
+  }
+  for (const auto &record : dropped) {
+    segmentFor(record.segmentId)->addLiveBytes(-record.size);
+  }
+  if (options.mergeOperator && (flags & RECORD_FLAG_MERGE) == 0) {
+    // the operands folded so far are gone
+    std::lock_guard<std::mutex> lock(foldsMutex);
+    folds.erase(key);
+  }
+
+  // a blob is live for as long as the latest record of its key points to
+  // it. Those a snapshot still sees are kept by deferring the deletion of
+  // their blob file instead.
+  auto addBlobBytes = [this](const BlobPointer &pointer, long bytes) {
+    auto blobFile = blobFiles.find(pointer.fileId);
+    if (blobFile != blobFiles.end()) {
+      blobFile->second->addLiveBytes(bytes);
+    }
+  };
+  auto oldBlob = blobPointers.find(key);
+  if (oldBlob != blobPointers.end()) {
+    addBlobBytes(oldBlob->second, -static_cast<long>(oldBlob->second.size));
+    if (blob == nullptr) {
+      blobPointers.erase(oldBlob);
+    } else {
+      oldBlob->second = *blob;
+    }
+  } else if (blob != nullptr) {
+    blobPointers.emplace(key, *blob);
+  }
+  if (blob != nullptr) {
+    addBlobBytes(*blob, blob->size);
+  }
+}
+
+const std::string Saavi::encode_entry(uint64_t sequence, uint8_t flags,
+                                      const std::string &key,
+                                      std::string_view value,
+                                      Compression codec) {
+  validateEntry(key, value);
+
+  // encode the key and value into a checksummed binary record
+  std::string entry;
+  encodeRecord(entry, flags, sequence, key, value,
+               static_cast<uint8_t>(codec));
+  return entry;
+}
+
+const std::pair<std::string_view, std::string_view> Saavi::decode_entry(
+    std::string_view entry) {
+  // decode the record header and verify the record is intact
+  if (entry.length() < RECORD_HEADER_SIZE) {
+    throw SaaviException("corrupt entry - record is truncated");
+  }
+  RecordHeader header;
+  RecordHeader::decode(entry.data(), header);
+  if (header.recordSize() != entry.length() ||
+      !verifyRecord(header, entry.data())) {
+    throw SaaviException("corrupt entry - checksum mismatch");
+  }
+  return std::make_pair(entry.substr(RECORD_HEADER_SIZE, header.keyLength),
+                        entry.substr(RECORD_HEADER_SIZE + header.keyLength));
+}
+
+void Saavi::decode_value(std::string_view entry,
+                         std::shared_ptr<const void> pin, PinnedValue &value) {
+  const std::string_view stored = decode_entry(entry).second;
+  const auto codec = static_cast<Compression>(entry[5]);
+  if (codec == Compression::None) {
+    value.value = stored;
+    value.pin = std::move(pin);
+    return;
+  }
+  auto decompressed = std::make_shared<std::string>();
+  decompress(codec, stored, *decompressed);
+  value.value = *decompressed;
+  value.pin = std::move(decompressed);
+}
+
+Compression Saavi::compressValue(std::string_view value,
+                                 std::string &compressed) const {
+  if (value.length() < std::max<size_t>(options.compressionMinSize, 1) ||
+      !compress(options.compression, value, compressed)) {
+    return Compression::None;
+  }
+  return options.compression;
+}
+
+std::pair<uint32_t, unsigned long> Saavi::loadHintFile() {
+  // no usable hint - replay the whole log
+  const auto replayAll = std::make_pair(uint32_t(0), FILE_HEADER_SIZE);
+
+  HintFileReader reader;
+  if (!reader.open(hintFilename(filename))) {
+    return replayAll;
+  }
+  const HintHeader &header = reader.getHeader();
+
+  // make sure the hint still describes the segments on disk. Segments that
+  // were sealed when the hint was written must be unchanged and the segment
+  // that was active must still end with the record the hint was written
+  // after.
+  size_t coveredSegments = 0;
+  for (const auto &segment : segments) {
+    coveredSegments += segment.first <= header.activeSegmentId;
+  }
+  coveredSegments += active->id() <= header.activeSegmentId;
+  if (coveredSegments != reader.getSegments().size()) {
+    return replayAll;
+  }
+
+  for (const auto &hintSegment : reader.getSegments()) {
+    std::shared_ptr<Segment> segment;
+    if (hintSegment.id == active->id()) {
+      segment = active;
+    } else if (segments.count(hintSegment.id) > 0) {
+      segment = segments[hintSegment.id];
+    }
+    if (segment == nullptr ||
+        segment->header().createdAt != hintSegment.createdAt) {
+      return replayAll;
+    }
+
+    if (hintSegment.id != header.activeSegmentId) {
+      if (segment->size() != hintSegment.size) {
+        return replayAll;
+      }
+      continue;
+    }
+
+    if (segment->size() < header.highWaterMark) {
+      return replayAll;
+    }
+    if (header.highWaterMark > FILE_HEADER_SIZE) {
+      std::string lastRecord;
+      RecordHeader recordHeader;
+      if (header.highWaterMark - header.lastRecordOffset < RECORD_HEADER_SIZE) {
+        return replayAll;
+      }
+      segment->read(header.lastRecordOffset,
+                    header.highWaterMark - header.lastRecordOffset, lastRecord);
+      RecordHeader::decode(lastRecord.data(), recordHeader);
+      if (recordHeader.recordSize() != lastRecord.length() ||
+          recordHeader.sequence != header.lastRecordSequence ||
+          recordHeader.crc != header.lastRecordCrc ||
+          !verifyRecord(recordHeader, lastRecord.data())) {
+        return replayAll;
+      }
+    }
+  }
+
+  HintEntry entry;
+  uint64_t entriesLoaded = 0;
+  while (reader.next(entry)) {
+    idx.putKeyOffset(entry.key, IndexEntry{entry.segmentId, entry.offset,
+                                           entry.size, entry.sequence});
+    entriesLoaded++;
+  }
+  HintBlob blob;
+  uint64_t blobsLoaded = 0;
+  while (reader.nextBlob(blob)) {
+    blobPointers[blob.key] = blob.pointer;
+    blobsLoaded++;
+  }
+  HintChain chain;
+  uint64_t chainsLoaded = 0;
+  while (reader.nextChain(chain)) {
+    idx.putChain(chain.key, std::move(chain.entries));
+    chainsLoaded++;
+  }
+  if (entriesLoaded != header.entryCount || blobsLoaded != header.blobCount ||
+      chainsLoaded != header.chainCount) {
+    // should not happen with a valid checksum - fall back to a full replay
+    idx.clear();
+    blobPointers.clear();
+    return replayAll;
+  }
+
+  if (header.activeSegmentId == active->id()) {
+    lastRecordOffset = header.lastRecordOffset;
+    lastRecordCrc = header.lastRecordCrc;
+  }
+  nextSequence = header.lastRecordSequence + 1;
+  return std::make_pair(header.activeSegmentId, header.highWaterMark);
+}
+
+void Saavi::writeHintFile() {
+  std::vector<HintSegment> hintSegments;
+  std::vector<HintEntry> entries;
+  std::vector<HintBlob> blobs;
+  std::vector<HintChain> chains;
+  HintHeader header;
+  {
+    // take a consistent copy of the index and write it out without blocking
+    // the foreground operations. Holding the write lock keeps writers and
+    // compaction from changing the index meanwhile.
+    std::lock_guard<std::mutex> lock(writeMutex);
+    if (hintIsCurrent) {
+      // the hint on disk is already up to date
+      return;
+    }
+    // the hint must only cover records that are in the file
+    flushActive();
+
+    for (const auto &segment : segments) {
+      hintSegments.push_back(HintSegment{segment.first,
+                                         segment.second->size(),
+                                         segment.second->header().createdAt});
+    }
+    hintSegments.push_back(
+        HintSegment{active->id(), active->size(), active->header().createdAt});
+
+    entries.reserve(idx.size());
+    idx.forEach([&entries](std::string_view key, const IndexEntry &entry) {
+      entries.push_back(HintEntry{std::string(key), entry.segmentId,
+                                  entry.offset, entry.size, entry.sequence});
+    });
+    blobs.reserve(blobPointers.size());
+    for (const auto &blob : blobPointers) {
+      blobs.push_back(HintBlob{blob.first, blob.second});
+    }
+    idx.forEachChain([&chains](std::string_view key, const IndexEntry &,
+                               const std::vector<IndexEntry> &chain) {
+      chains.push_back(HintChain{std::string(key), chain});
+    });
+
+    header.highWaterMark = active->size();
+    header.lastRecordOffset = lastRecordOffset;
+    header.lastRecordSequence = nextSequence - 1;
+    header.lastRecordCrc = lastRecordCrc;
+    header.activeSegmentId = active->id();
+    // set along with the copy, so writes made while it is written out
+    // clear it again
+    hintIsCurrent = true;
+  }
+
+  try {
+    HintFileWriter writer(hintFilename(filename), hintSegments);
+    for (const auto &entry : entries) {
+      writer.add(entry);
+    }
+    for (const auto &blob : blobs) {
+      writer.addBlob(blob);
+    }
+    for (const auto &chain : chains) {
+      writer.addChain(chain);
+    }
+    writer.finish(header);
+  } catch (...) {
+    // the hint on disk is whatever was there before
+    std::lock_guard<std::mutex> lock(writeMutex);
+    hintIsCurrent = false;
+    throw;
+  }
 }
 
 void Saavi::rebuildIndexes() {
-  // build the index
-  for (auto it = begin(); it != end(); ++it) {
-    auto entry = it.getKeyAndOffset();
-    idx.putKeyOffset(entry.first, entry.second);
+  if (lsm) {
+    // the lsm engine has no index to rebuild
+    return;
+  }
+
+  // load the bulk of the index from the hint file and replay only the part of
+  // the log written after it. The segments are read forward in large blocks
+  // and replayed in order so that the latest value of a key wins.
+  const auto replayFrom = loadHintFile();
+  hintIsCurrent = replayFrom.first != 0;
+
+  std::vector<std::shared_ptr<Segment>> log;
+  for (const auto &segment : segments) {
+    log.push_back(segment.second);
+  }
+  log.push_back(active);
+
+  std::string key;
+  for (const auto &segment : log) {
+    if (segment->id() < replayFrom.first) {
+      continue;
+    }
+
+    RecordScanner scanner(segment->fd(), segment->id() == replayFrom.first
+                                             ? replayFrom.second
+                                             : FILE_HEADER_SIZE);
+    while (scanner.next()) {
+      const RecordHeader &header = scanner.header();
+      key.assign(scanner.key());
+      BlobPointer blob;
+      if (isDeletion(header, segment->header().version)) {
+        idx.eraseKey(key);
+        blobPointers.erase(key);
+      } else if (header.flags & RECORD_FLAG_MERGE) {
+        // the operands stack on the value, which stays where it is
+        idx.mergeKeyOffset(key, IndexEntry{segment->id(), scanner.offset(),
+                                           header.recordSize(),
+                                           header.sequence});
+      } else {
+        idx.putKeyOffset(key, IndexEntry{segment->id(), scanner.offset(),
+                                         header.recordSize(),
+                                         header.sequence});
+        // only the pointer is read, never the blob itself
+        if ((header.flags & RECORD_FLAG_BLOB) &&
+            decodeBlobPointer(scanner.value(), blob)) {
+          blobPointers[key] = blob;
+        } else if (!blobPointers.empty()) {
+          blobPointers.erase(key);
+        }
+      }
+      nextSequence = std::max(nextSequence, header.sequence + 1);
+      hintIsCurrent = false;
+    }
+    if (segment == active && scanner.endOffset() > FILE_HEADER_SIZE) {
+      lastRecordOffset = scanner.lastRecordOffset();
+      lastRecordCrc = scanner.lastRecordCrc();
+    }
+
+    if (segment->size() > scanner.endOffset()) {
+      // a bad record with valid ones after it wasn't left by a crash, and
+      // dropping the log from there would lose them
+      if (!scanner.tornTail()) {
+        throw SaaviException("corrupt record in file '" + segment->path() +
+                             "' at offset " +
+                             std::to_string(scanner.endOffset()));
+      }
+      // drop a torn record left behind by a crash so that new records are
+      // appended right after the last valid one
+      if (segment == active) {
+        active->truncate(scanner.endOffset());
+      }
+    }
+  }
+
+  // account the records the index points to against their segments
+  idx.forEach([this](std::string_view, const IndexEntry &entry) {
+    segmentFor(entry.segmentId)->addLiveBytes(entry.size);
+  });
+  // and the records merge operands stack on
+  idx.forEachChain([this](std::string_view, const IndexEntry &,
+                          const std::vector<IndexEntry> &chain) {
+    for (const auto &entry : chain) {
+      segmentFor(entry.segmentId)->addLiveBytes(entry.size);
+    }
+  });
+  // and the blobs they point to against their blob files
+  for (const auto &blob : blobPointers) {
+    auto blobFile = blobFiles.find(blob.second.fileId);
+    if (blobFile != blobFiles.end()) {
+      blobFile->second->addLiveBytes(blob.second.size);
+    }
+  }
+
+  if (ordered) {
+    // sorting first fills the leaves of the tree from left to right
+    std::vector<std::string> keys;
+    keys.reserve(idx.size());
+    idx.forEach([&keys](std::string_view key, const IndexEntry &) {
+      keys.emplace_back(key);
+    });
+    std::sort(keys.begin(), keys.end());
+    ordered->clear();
+    for (const auto &key : keys) {
+      ordered->insert(key);
+    }
   }
 }
 
+FileIterator Saavi::begin() { return begin(nullptr); }
+
+FileIterator Saavi::begin(std::shared_ptr<const Snapshot> snapshot) {
+  if (lsm) {
+    throw SaaviException("the lsm engine iterates with Scan");
+  }
+  if (snapshot != nullptr && snapshot->saavi != this) {
+    throw SaaviException("the snapshot was taken of another store");
+  }
+
+  // every batch returns the keys of a part of the index as they were when
+  // the batch was taken, or as the snapshot sees them
+  auto cursor = std::make_shared<KeyIndex::Cursor>();
+  return FileIterator([this, cursor, snapshot](IndexBatch &batch) {
+    {
+      std::lock_guard<std::mutex> lock(writeMutex);
+      flushActive();
+    }
+    std::shared_lock<ShardedSharedMutex> lock(segmentsMutex);
+    for (const auto &segment : segments) {
+      batch.segments.push_back(segment.second);
+    }
+    batch.segments.push_back(active);
+    for (const auto &blobFile : blobFiles) {
+      batch.blobFiles.push_back(blobFile.second);
+    }
+    const uint64_t sequence = snapshot ? snapshot->sequence : UINT64_MAX;
+    if (!batch.merged) {
+      // the chain of an operand is looked up along with the key
+      batch.merged = [this, sequence](const std::string &key,
+                                      std::string &value) {
+        PinnedValue folded;
+        IndexEntry location;
+        std::shared_ptr<Segment> segment;
+        do {
+          segment = locate(key, location, sequence);
+          if (segment == nullptr) {
+            return false;
+          }
+        } while (!readValue(segment, location, folded));
+        value.assign(folded.value);
+        return true;
+      };
+    }
+    return idx.nextBatch(*cursor, ITERATOR_BATCH_SIZE, batch.entries,
+                         sequence);
+  });
+}
+
 void Saavi::Put(const std::string &key, const std::string &value) {
-  // seek to end of file and write the entry
-  fs.seekg(0, std::ios_base::end);
+  StatsTimer timer(stats.get(), TimedOperation::Put);
+  append(key, value, 0);
+  if (stats) {
+    stats->count(Ticker::Puts);
+    stats->count(Ticker::BytesWritten, key.length() + value.length());
+  }
+}
+
+void Saavi::append(const std::string &key, const std::string &value,
+                   uint8_t flags) {
+  if (lsm) {
+    std::string entry = encode_entry(0, flags, key, value);
+    lsm->write(entry);
+    return;
+  }
+
+  if ((flags & RECORD_FLAG_DELETION) == 0 && isBlob(value.length())) {
+    // write the blob first, so the record never points to a blob that
+    // isn't there
+    std::unique_lock<std::mutex> blobLock(blobMutex);
+    const BlobPointer blob = writeBlob(key, value);
+    flushBlobs(options.durability == DurabilityMode::FsyncPerWrite ||
+               options.durability == DurabilityMode::GroupCommit);
+    std::unique_lock<std::mutex> lock(writeMutex);
+    const uint64_t sequence = appendRecord(key, value, flags, &blob);
+    blobLock.unlock();
+    commit(lock, sequence);
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(writeMutex);
+  commit(lock, appendRecord(key, value, flags));
+}
+
+uint64_t Saavi::appendRecord(const std::string &key, const std::string &value,
+                             uint8_t flags, const BlobPointer *blob) {
+  pruneVersions();
 
   // note down the location to update the index
-  auto offset = fs.tellp();
+  const unsigned long offset = active->size();
+  const uint64_t sequence = nextSequence;
 
-  // append entry to file
-  fs << encode_entry(key, value);
-  fs.flush();
+  // append entry to the active segment
+  std::string compressed;
+  Compression codec = Compression::None;
+  if (blob != nullptr) {
+    flags |= RECORD_FLAG_BLOB;
+    compressed = encodeBlobPointer(*blob);
+  } else if ((flags & RECORD_FLAG_DELETION) == 0) {
+    codec = compressValue(value, compressed);
+  }
+  const std::string entry = encode_entry(
+      sequence, flags, key,
+      compressed.empty() ? std::string_view(value) : compressed, codec);
+  appendActive(entry);
 
   // update index;
-  idx.putKeyOffset(key, offset);
+  updateIndex(key, IndexEntry{active->id(), offset, entry.length(), sequence},
+              flags, blob);
+  // the value of an operand is only known once it is folded
+  if (cache && ((flags & (RECORD_FLAG_DELETION | RECORD_FLAG_MERGE)) ||
+                (blob != nullptr && value.empty()))) {
+    cache->invalidate(key);
+  } else if (cache) {
+    cache->update(key, value, sequence);
+  }
+  nextSequence++;
+  lastRecordOffset = offset;
+  lastRecordCrc = decodeFixed32(entry.data());
+  hintIsCurrent = false;
+
+  if (active->size() >= options.segmentSize) {
+    rollover();
+  }
+  return sequence;
+}
+
+BlobPointer Saavi::writeBlob(const std::string &key, std::string_view value) {
+  // an invalid entry fails before its blob is written, not after
+  validateEntry(key, value);
+  std::string compressed;
+  const Compression codec = compressValue(value, compressed);
+  std::string record;
+  encodeRecord(record, 0, 0, key,
+               codec == Compression::None ? value : compressed,
+               static_cast<uint8_t>(codec));
+  return appendBlob(record);
+}
+
+BlobPointer Saavi::appendBlob(std::string_view record) {
+  if (!activeBlob) {
+    FileHeader header;
+    header.flags = FILE_FLAG_BLOB_FILE;
+    header.createdAt = currentTimeNanos();
+    std::lock_guard<std::mutex> lock(writeMutex);
+    const uint32_t id = blobFiles.empty() ? 1 : blobFiles.rbegin()->first + 1;
+    auto blobFile = Segment::create(blobFilename(filename, id), id, header);
+    std::lock_guard<ShardedSharedMutex> segmentsLock(segmentsMutex);
+    blobFiles[id] = blobFile;
+    activeBlob = std::move(blobFile);
+  }
+
+  const BlobPointer blob{activeBlob->id(), activeBlob->size(),
+                         record.length()};
+  activeBlob->append(record.data(), record.length());
+  if (activeBlob->size() >= options.blobFileSize) {
+    // a sealed blob file is never written again, and might be deleted by
+    // garbage collection only once it's durable
+    activeBlob->flush();
+    activeBlob->sync();
+    activeBlob.reset();
+  }
+  return blob;
+}
+
+void Saavi::flushBlobs(bool sync) {
+  if (activeBlob) {
+    activeBlob->flush();
+    if (sync) {
+      activeBlob->sync();
+    }
+  }
+}
+
+void Saavi::Write(const WriteBatch &batch) {
+  if (batch.Count() == 0) {
+    return;
+  }
+  if (batch.rep.length() > std::numeric_limits<uint32_t>::max()) {
+    throw SaaviException("invalid batch - batch is too large");
+  }
+  StatsTimer timer(stats.get(), TimedOperation::Write);
+  if (stats) {
+    stats->count(Ticker::Batches);
+    stats->count(Ticker::BatchOperations, batch.Count());
+    stats->count(Ticker::BytesWritten,
+                 batch.rep.length() - batch.Count() * RECORD_HEADER_SIZE);
+  }
+
+  // the batch goes into the log as a single record holding the records of
+  // the batch
+  std::string entry(RECORD_HEADER_SIZE, '\0');
+  entry[4] = static_cast<char>(RECORD_FLAG_BATCH);
+  if (lsm) {
+    encodeFixed32(&entry[12], static_cast<uint32_t>(batch.rep.length()));
+    entry.append(batch.rep);
+    lsm->write(entry);
+    return;
+  }
+
+  // copy the records into the batch record, compressing the values that
+  // are worth it before taking the lock
+  struct Update {
+    std::string key;
+    IndexEntry entry;
+    bool deleted;
+    // the uncompressed value, for the cache
+    std::string_view value;
+    bool hasBlob;
+    BlobPointer blob;
+  };
+  std::vector<Update> updates;
+  updates.reserve(batch.Count());
+  entry.reserve(RECORD_HEADER_SIZE + batch.rep.length());
+  // the large values go into blob files first, which are held on to until
+  // the batch is in the log
+  std::unique_lock<std::mutex> blobLock(blobMutex, std::defer_lock);
+  RecordHeader header;
+  for (size_t position = 0; position < batch.rep.length();
+       position += header.recordSize()) {
+    RecordHeader::decode(&batch.rep[position], header);
+    const std::string_view record =
+        std::string_view(batch.rep).substr(position, header.recordSize());
+    const std::string_view key =
+        record.substr(RECORD_HEADER_SIZE, header.keyLength);
+    const std::string_view value =
+        record.substr(RECORD_HEADER_SIZE + header.keyLength);
+    const bool deleted = header.flags & RECORD_FLAG_DELETION;
+
+    const size_t start = entry.length();
+    Update update{std::string(key), IndexEntry(), deleted, value, false,
+                  BlobPointer()};
+    if (!deleted && isBlob(value.length())) {
+      if (!blobLock.owns_lock()) {
+        blobLock.lock();
+      }
+      update.hasBlob = true;
+      update.blob = writeBlob(update.key, value);
+      ::appendRecord(entry, header.flags | RECORD_FLAG_BLOB, key,
+                     encodeBlobPointer(update.blob));
+    } else {
+      std::string compressed;
+      const Compression codec =
+          deleted ? Compression::None : compressValue(value, compressed);
+      if (codec == Compression::None) {
+        entry.append(record);
+      } else {
+        ::appendRecord(entry, header.flags, key, compressed,
+                       static_cast<uint8_t>(codec));
+      }
+    }
+    update.entry = IndexEntry{0, start, entry.length() - start, 0};
+    updates.push_back(std::move(update));
+  }
+  if (blobLock.owns_lock()) {
+    flushBlobs(options.durability == DurabilityMode::FsyncPerWrite ||
+               options.durability == DurabilityMode::GroupCommit);
+  }
+  encodeFixed32(&entry[12],
+                static_cast<uint32_t>(entry.length() - RECORD_HEADER_SIZE));
+
+  std::unique_lock<std::mutex> lock(writeMutex);
+  pruneVersions();
+
+  // stamp the records with their sequence numbers and note down where they
+  // will be in the log
+  const unsigned long offset = active->size();
+  for (auto &update : updates) {
+    sealRecord(&entry[update.entry.offset], nextSequence);
+    update.entry = IndexEntry{active->id(), offset + update.entry.offset,
+                              update.entry.size, nextSequence};
+    nextSequence++;
+  }
+  const uint64_t sequence = nextSequence - 1;
+  sealRecord(&entry[0], sequence);
+
+  // append the whole batch with a single write
+  appendActive(entry);
+  for (const auto &update : updates) {
+    updateIndex(update.key, update.entry,
+                update.deleted ? RECORD_FLAG_DELETION : 0,
+                update.hasBlob ? &update.blob : nullptr);
+    if (cache && update.deleted) {
+      cache->invalidate(update.key);
+    } else if (cache) {
+      cache->update(update.key, update.value, update.entry.sequence);
+    }
+  }
+  lastRecordOffset = offset;
+  lastRecordCrc = decodeFixed32(entry.data());
+  hintIsCurrent = false;
+
+  if (active->size() >= options.segmentSize) {
+    rollover();
+  }
+  if (blobLock.owns_lock()) {
+    blobLock.unlock();
+  }
+
+  commit(lock, sequence);
+}
+
+void Saavi::commit(std::unique_lock<std::mutex> &lock, uint64_t sequence) {
+  switch (options.durability) {
+    case DurabilityMode::None:
+      // the segment writes the data out once enough of it is pending
+      break;
+    case DurabilityMode::FlushPerWrite:
+      flushActive();
+      break;
+    case DurabilityMode::FsyncPerWrite:
+      flushActive();
+      active->sync();
+      break;
+    case DurabilityMode::GroupCommit:
+      groupCommit(lock, sequence);
+      break;
+  }
+}
+
+void Saavi::groupCommit(std::unique_lock<std::mutex> &lock,
+                        uint64_t sequence) {
+  if (active->pendingBytes() >= options.groupCommitBytes) {
+    // wake up the leader waiting for the group to fill up
+    commitCondition.notify_all();
+  }
+
+  while (syncedSequence < sequence) {
+    if (failedSequence >= sequence) {
+      throw SaaviException("failed to sync the log to disk");
+    }
+    if (commitInProgress) {
+      // another writer is leading a group commit, wait for it to finish
+      commitCondition.wait(lock);
+      continue;
+    }
+
+    // lead the next group - give the other writers some time to join in
+    commitInProgress = true;
+    if (options.groupCommitInterval.count() > 0) {
+      commitCondition.wait_for(lock, options.groupCommitInterval, [this] {
+        return active->pendingBytes() >= options.groupCommitBytes;
+      });
+    }
+
+    // write the whole group under the lock with a single write and sync it
+    // without holding the lock so that the next group can form meanwhile.
+    // Records in segments sealed since were synced by the rollover.
+    const uint64_t target = nextSequence - 1;
+    std::shared_ptr<Segment> segment = active;
+    bool synced = true;
+    try {
+      flushActive();
+      lock.unlock();
+      segment->sync();
+      lock.lock();
+    } catch (std::exception &e) {
+      if (!lock.owns_lock()) {
+        lock.lock();
+      }
+      synced = false;
+    }
+
+    commitInProgress = false;
+    if (synced) {
+      syncedSequence = std::max(syncedSequence, target);
+    } else {
+      failedSequence = std::max(failedSequence, target);
+    }
+    commitCondition.notify_all();
+  }
 }
 
 const std::string Saavi::Get(const std::string &key) {
-  if (!string_is_valid_key(key)) {
-    throw SaaviException("invalid key - only alphanumeric key supported");
+  PinnedValue value;
+  if (!Get(key, value)) {
+    return "";
   }
+  return value.ToString();
+}
+
+bool Saavi::Get(const std::string &key, PinnedValue &value) {
+  StatsTimer timer(stats.get(), TimedOperation::Get);
+  const bool found = getLatest(key, value);
+  countGet(found, value);
+  return found;
+}
+
+bool Saavi::getLatest(const std::string &key, PinnedValue &value) {
+  validateKey(key);
+  value.Reset();
+
+  if (lsm) {
+    return lsm->get(key, value.pin, value.value);
+  }
+
+  if (cache) {
+    if (auto cached = cache->get(key)) {
+      value.value = *cached;
+      value.pin = std::move(cached);
+      return true;
+    }
+  }
+
+  IndexEntry location;
+  std::shared_ptr<Segment> segment;
+  do {
+    segment = locate(key, location);
+    if (segment == nullptr) {
+      // key not present
+      return false;
+    }
+  } while (!readValue(segment, location, value));
+  cacheValue(key, location, value);
+  return true;
+}
+
+const std::vector<std::string> Saavi::MultiGet(
+    const std::vector<std::string> &keys) {
+  std::vector<PinnedValue> values;
+  MultiGet(keys, values);
+  std::vector<std::string> result;
+  result.reserve(values.size());
+  for (const auto &value : values) {
+    result.push_back(value.ToString());
+  }
+  return result;
+}
+
+std::vector<bool> Saavi::MultiGet(const std::vector<std::string> &keys,
+                                  std::vector<PinnedValue> &values) {
+  StatsTimer timer(stats.get(), TimedOperation::MultiGet);
+  std::vector<bool> found = multiGetLatest(keys, values);
+  for (size_t i = 0; stats && i < keys.size(); i++) {
+    countGet(found[i], values[i]);
+  }
+  return found;
+}
+
+std::vector<bool> Saavi::multiGetLatest(const std::vector<std::string> &keys,
+                                        std::vector<PinnedValue> &values) {
+  for (const auto &key : keys) {
+    validateKey(key);
+  }
+  values.assign(keys.size(), PinnedValue());
+  std::vector<bool> found(keys.size(), false);
+
+  if (lsm) {
+    for (size_t i = 0; i < keys.size(); i++) {
+      found[i] = lsm->get(keys[i], values[i].pin, values[i].value);
+    }
+    return found;
+  }
+
+  // look up all the keys the cache doesn't have first
+  struct Location {
+    size_t key;
+    IndexEntry entry;
+    std::shared_ptr<Segment> segment;
+  };
+  std::vector<Location> locations;
+  locations.reserve(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (cache) {
+      if (auto cached = cache->get(keys[i])) {
+        values[i].value = *cached;
+        values[i].pin = std::move(cached);
+        found[i] = true;
+        continue;
+      }
+    }
+    Location location{i, IndexEntry(), nullptr};
+    location.segment = locate(keys[i], location.entry);
+    if (location.segment != nullptr) {
+      locations.push_back(std::move(location));
+    }
+  }
+  std::sort(locations.begin(), locations.end(),
+            [](const Location &a, const Location &b) {
+              return std::make_pair(a.entry.segmentId, a.entry.offset) <
+                     std::make_pair(b.entry.segmentId, b.entry.offset);
+            });
+
+  // and merge the records that are close to each other into ranges. The
+  // locations [first, last) of a range are all within it.
+  struct Range {
+    Segment *segment;
+    unsigned long offset;
+    unsigned long end;
+    size_t first;
+    size_t last;
+  };
+  std::vector<Range> ranges;
+  for (size_t i = 0; i < locations.size(); i++) {
+    const IndexEntry &entry = locations[i].entry;
+    const unsigned long end = entry.offset + entry.size;
+    if (!ranges.empty()) {
+      Range &range = ranges.back();
+      if (range.segment == locations[i].segment.get() &&
+          entry.offset <= range.end + MULTIGET_GAP &&
+          std::max(end, range.end) - range.offset <= MULTIGET_MAX_READ) {
+        range.end = std::max(end, range.end);
+        range.last = i + 1;
+        continue;
+      }
+    }
+    ranges.push_back(
+        Range{locations[i].segment.get(), entry.offset, end, i, i + 1});
+  }
+
+  // the bytes of each range and what keeps them alive
+  std::vector<const char *> data(ranges.size());
+  std::vector<std::shared_ptr<const void>> pins(ranges.size());
+  if (options.mmapReads) {
+    // have the kernel read all the ranges at once before touching them
+    const auto pageMask = ~static_cast<uintptr_t>(sysconf(_SC_PAGESIZE) - 1);
+    for (size_t r = 0; r < ranges.size(); r++) {
+      auto mapping = ranges[r].segment->map(ranges[r].end);
+      data[r] = mapping->data() + ranges[r].offset;
+      const uintptr_t start = reinterpret_cast<uintptr_t>(data[r]) & pageMask;
+      ::madvise(reinterpret_cast<void *>(start),
+                reinterpret_cast<uintptr_t>(mapping->data() + ranges[r].end) -
+                    start,
+                MADV_WILLNEED);
+      pins[r] = std::move(mapping);
+    }
+  } else {
+    std::vector<std::shared_ptr<std::string>> buffers(ranges.size());
+    for (size_t r = 0; r < ranges.size(); r++) {
+      buffers[r] = std::make_shared<std::string>(
+          ranges[r].end - ranges[r].offset, '\0');
+    }
+
+    // with io_uring the ranges that aren't in the page cache are all read
+    // at once. Those that are are copied right away, which is much cheaper
+    // than a trip through the ring. The reads that come back short or
+    // failed are done again like any other.
+    std::vector<int> results(ranges.size(), -1);
+    if (AsyncIo *io = ranges.size() > 1 ? getAsyncIo() : nullptr) {
+      std::vector<size_t> misses;
+      for (size_t r = 0; r < ranges.size(); r++) {
+#ifdef RWF_NOWAIT
+        iovec buffer{&(*buffers[r])[0], buffers[r]->length()};
+        results[r] = static_cast<int>(::preadv2(
+            ranges[r].segment->fd(), &buffer, 1, ranges[r].offset,
+            RWF_NOWAIT));
+        if (results[r] == static_cast<int>(buffers[r]->length())) {
+          continue;
+        }
+#endif
+        misses.push_back(r);
+      }
+
+      std::mutex mutex;
+      std::condition_variable done;
+      size_t pending = misses.size();
+      size_t submitted = 0;
+      try {
+        for (; submitted < misses.size(); submitted++) {
+          const size_t r = misses[submitted];
+          io->read(ranges[r].segment->fd(), &(*buffers[r])[0],
+                   buffers[r]->length(), ranges[r].offset,
+                   [&, r](int result) {
+                     std::lock_guard<std::mutex> lock(mutex);
+                     results[r] = result;
+                     if (--pending == 0) {
+                       done.notify_all();
+                     }
+                   });
+        }
+      } catch (std::exception &e) {
+        // the rest are read below
+      }
+      std::unique_lock<std::mutex> lock(mutex);
+      pending -= misses.size() - submitted;
+      done.wait(lock, [&pending] { return pending == 0; });
+    }
 
-  unsigned long offset;
-  if (!idx.getKeyOffset(key, offset)) {
-    // key not present
+    for (size_t r = 0; r < ranges.size(); r++) {
+      const unsigned long length = ranges[r].end - ranges[r].offset;
+      if (results[r] < 0 || static_cast<unsigned long>(results[r]) < length) {
+        ranges[r].segment->read(ranges[r].offset, length, *buffers[r]);
+      }
+      data[r] = buffers[r]->data();
+      pins[r] = std::move(buffers[r]);
+    }
+  }
+
+  // hand out the values, which point into the ranges unless they are blobs
+  for (size_t r = 0; r < ranges.size(); r++) {
+    for (size_t i = ranges[r].first; i < ranges[r].last; i++) {
+      const Location &location = locations[i];
+      const std::string_view entry(
+          data[r] + (location.entry.offset - ranges[r].offset),
+          location.entry.size);
+      PinnedValue &value = values[location.key];
+      if (resolveValue(entry, location.entry, pins[r], value)) {
+        found[location.key] = true;
+        cacheValue(keys[location.key], location.entry, value);
+      } else {
+        // the blob or the operands were moved meanwhile
+        found[location.key] = getLatest(keys[location.key], value);
+      }
+    }
+  }
+  return found;
+}
+
+void Saavi::cacheValue(const std::string &key, const IndexEntry &location,
+                       PinnedValue &value) {
+  if (!cache) {
+    return;
+  }
+  auto cached = std::make_shared<const std::string>(value.value);
+  cache->insert(key, cached, location.sequence);
+  // a write racing with the read might have updated the index without
+  // finding the key in the cache - drop what was just cached if so
+  IndexEntry latest;
+  if (!idx.getKeyOffset(key, latest) || latest.sequence != location.sequence) {
+    cache->erase(key, location.sequence);
+  }
+  value.value = *cached;
+  value.pin = std::move(cached);
+}
+
+AsyncIo *Saavi::getAsyncIo() {
+  if (lsm || options.asyncQueueDepth == 0) {
+    return nullptr;
+  }
+  std::call_once(asyncIoCreated, [this] {
+    asyncIo = AsyncIo::create(options.asyncQueueDepth);
+  });
+  // a callback submitting more could wait on itself for room in the ring
+  if (asyncIo && asyncIo->onCompletionThread()) {
+    return nullptr;
+  }
+  return asyncIo.get();
+}
+
+void Saavi::GetAsync(const std::string &key, GetCallback callback) {
+  AsyncIo *io = getAsyncIo();
+  const auto start = std::chrono::steady_clock::now();
+  PinnedValue value;
+  IndexEntry location;
+  std::shared_ptr<Segment> segment;
+  bool done = false;
+  bool found = false;
+  try {
+    if (io == nullptr) {
+      found = Get(key, value);
+      done = true;
+    } else {
+      validateKey(key);
+      if (cache) {
+        if (auto cached = cache->get(key)) {
+          value.value = *cached;
+          value.pin = std::move(cached);
+          found = done = true;
+        }
+      }
+      if (!done) {
+        segment = locate(key, location);
+        done = segment == nullptr;
+      }
+    }
+  } catch (std::exception &e) {
+    callback(std::current_exception(), false, PinnedValue());
+    return;
+  }
+  if (done) {
+    // answered without any I/O
+    if (io != nullptr) {
+      countGet(found, value);
+      recordSince(stats.get(), TimedOperation::Get, start);
+    }
+    callback(nullptr, found, std::move(value));
+    return;
+  }
+
+  // read exactly the entry, holding on to the segment to keep its file open
+  auto entry = std::make_shared<std::string>(location.size, '\0');
+  auto completion = [this, key, location, segment, entry, start,
+                     callback](int result) {
+    PinnedValue value;
+    bool found = true;
+    try {
+      if (result < 0) {
+        throw SaaviException("failed to read from '" + segment->path() +
+                             "' : " + strerror(-result));
+      }
+      if (static_cast<size_t>(result) < location.size) {
+        // a short read, which the blocking read retries until it's done
+        segment->read(location.offset, location.size, *entry);
+      }
+      // a blob is read right here, its pointer had to be read first
+      if (resolveValue(*entry, location, entry, value)) {
+        cacheValue(key, location, value);
+        countGet(true, value);
+        recordSince(stats.get(), TimedOperation::Get, start);
+      } else {
+        // the blob or the operands were moved meanwhile, and Get times
+        // itself
+        found = Get(key, value);
+      }
+    } catch (std::exception &e) {
+      callback(std::current_exception(), false, PinnedValue());
+      return;
+    }
+    callback(nullptr, found, std::move(value));
+  };
+  try {
+    io->read(segment->fd(), &(*entry)[0], location.size, location.offset,
+             std::move(completion));
+  } catch (std::exception &e) {
+    callback(std::current_exception(), false, PinnedValue());
+  }
+}
+
+void Saavi::PutAsync(const std::string &key, const std::string &value,
+                     PutCallback callback) {
+  AsyncIo *io = getAsyncIo();
+  if (io == nullptr || options.durability == DurabilityMode::None ||
+      options.durability == DurabilityMode::FlushPerWrite) {
+    // nothing to wait for on the disk
+    try {
+      Put(key, value);
+    } catch (std::exception &e) {
+      callback(std::current_exception());
+      return;
+    }
+    callback(nullptr);
+    return;
+  }
+
+  // append the record and write it out under the lock, and have it synced
+  // along with the other puts waiting for a sync. The sync of the active
+  // segment also covers the records of the segments sealed since, which
+  // the rollover synced.
+  const auto start = std::chrono::steady_clock::now();
+  auto complete = [this, start, callback](std::exception_ptr error) {
+    recordSince(stats.get(), TimedOperation::Put, start);
+    callback(error);
+  };
+  std::shared_ptr<Segment> segment;
+  uint64_t target = 0;
+  bool synced;
+  try {
+    std::unique_lock<std::mutex> blobLock(blobMutex, std::defer_lock);
+    BlobPointer blob;
+    const bool hasBlob = isBlob(value.length());
+    if (hasBlob) {
+      // the blob is synced right away, only the log is synced through the
+      // ring
+      blobLock.lock();
+      blob = writeBlob(key, value);
+      flushBlobs(true);
+    }
+    std::lock_guard<std::mutex> lock(writeMutex);
+    const uint64_t sequence = appendRecord(key, value, 0,
+                                           hasBlob ? &blob : nullptr);
+    flushActive();
+    // a rollover or a group commit might have synced it already
+    synced = syncedSequence >= sequence;
+    if (!synced) {
+      asyncPuts.push_back(AsyncPut{sequence, complete});
+      if (!asyncSyncInFlight) {
+        asyncSyncInFlight = true;
+        segment = active;
+        target = sequence;
+      }
+    }
+  } catch (std::exception &e) {
+    complete(std::current_exception());
+    return;
+  }
+  if (stats) {
+    stats->count(Ticker::Puts);
+    stats->count(Ticker::BytesWritten, key.length() + value.length());
+  }
+  if (synced) {
+    complete(nullptr);
+  } else if (segment != nullptr) {
+    syncAsyncPuts(io, std::move(segment), target, false);
+  }
+}
+
+void Saavi::syncAsyncPuts(AsyncIo *io, std::shared_ptr<Segment> segment,
+                          uint64_t target, bool fromCompletion) {
+  // the segment is held onto to keep its file open
+  auto completion = [this, io, segment, target](int result) {
+    std::exception_ptr error;
+    if (result < 0) {
+      error = std::make_exception_ptr(
+          SaaviException("failed to sync '" + segment->path() +
+                         "' : " + strerror(-result)));
+    }
+    finishAsyncSync(io, target, error);
+  };
+  std::exception_ptr error;
+  try {
+    if (!fromCompletion) {
+      io->sync(segment->fd(), std::move(completion));
+      return;
+    }
+    // the completion thread can't wait for room in the ring, so with a
+    // full ring it syncs right here
+    if (io->trySync(segment->fd(), completion)) {
+      return;
+    }
+    segment->sync();
+  } catch (std::exception &e) {
+    error = std::current_exception();
+  }
+  finishAsyncSync(io, target, error);
+}
+
+void Saavi::finishAsyncSync(AsyncIo *io, uint64_t target,
+                            std::exception_ptr error) {
+  std::vector<AsyncPut> done;
+  std::shared_ptr<Segment> next;
+  uint64_t nextTarget = 0;
+  {
+    // let the writers waiting on a group commit know about the sync
+    std::lock_guard<std::mutex> lock(writeMutex);
+    if (error) {
+      failedSequence = std::max(failedSequence, target);
+    } else {
+      syncedSequence = std::max(syncedSequence, target);
+    }
+    auto covered = std::find_if(
+        asyncPuts.begin(), asyncPuts.end(),
+        [target](const AsyncPut &put) { return put.sequence > target; });
+    done.assign(std::make_move_iterator(asyncPuts.begin()),
+                std::make_move_iterator(covered));
+    asyncPuts.erase(asyncPuts.begin(), covered);
+    // the puts appended while the sync was in flight are all written out,
+    // one more sync of the active segment takes them all in
+    asyncSyncInFlight = !asyncPuts.empty();
+    if (asyncSyncInFlight) {
+      next = active;
+      nextTarget = asyncPuts.back().sequence;
+    }
+  }
+  commitCondition.notify_all();
+  for (auto &put : done) {
+    put.complete(error);
+  }
+  if (next != nullptr) {
+    syncAsyncPuts(io, std::move(next), nextTarget, true);
+  }
+}
+
+const std::string Saavi::Get(const std::string &key,
+                             const Snapshot &snapshot) {
+  PinnedValue value;
+  if (!Get(key, value, snapshot)) {
     return "";
   }
+  return value.ToString();
+}
+
+bool Saavi::Get(const std::string &key, PinnedValue &value,
+                const Snapshot &snapshot) {
+  StatsTimer timer(stats.get(), TimedOperation::Get);
+  validateKey(key);
+  value.Reset();
+  if (snapshot.saavi != this) {
+    throw SaaviException("the snapshot was taken of another store");
+  }
 
-  // move to offset
-  fs.seekg(offset, std::ios_base::beg);
-  // read the entry
-  std::string entryStr;
-  std::getline(fs, entryStr);
-  // decode the entry and return
-  return decode_entry(entryStr).second;
+  // the cache only has the latest values, so it is of no use here
+  IndexEntry location;
+  std::shared_ptr<Segment> segment;
+  do {
+    segment = locate(key, location, snapshot.sequence);
+    if (segment == nullptr) {
+      countGet(false, value);
+      return false;
+    }
+  } while (!readValue(segment, location, value));
+  countGet(true, value);
+  return true;
+}
+
+std::shared_ptr<Segment> Saavi::locate(const std::string &key,
+                                       IndexEntry &location,
+                                       uint64_t sequence) {
+  std::shared_ptr<Segment> segment;
+  {
+    // the shared lock keeps the segment the entry points to from being
+    // swapped out between the two lookups
+    std::shared_lock<ShardedSharedMutex> lock(segmentsMutex);
+    if (!idx.getKeyOffset(key, sequence, location)) {
+      return nullptr;
+    }
+    segment = segmentFor(location.segmentId);
+  }
+  if (location.offset + location.size > segment->flushedSize()) {
+    // the record is still buffered - only the writer can write it out
+    std::lock_guard<std::mutex> lock(writeMutex);
+    if (location.offset + location.size > segment->flushedSize()) {
+      flushActive();
+    }
+  }
+  return segment;
+}
+
+void Saavi::readRecord(Segment &segment, unsigned long offset, size_t size,
+                       std::string_view &record,
+                       std::shared_ptr<const void> &pin) const {
+  // Records are never modified once written, and holding on to the segment
+  // (or its mapping) keeps its file readable even if a compaction replaces
+  // it meanwhile.
+  if (options.mmapReads) {
+    // point the value straight into the mapped file
+    auto mapping = segment.map(offset + size);
+    record = std::string_view(mapping->data() + offset, size);
+    pin = std::move(mapping);
+  } else {
+    // read exactly the record in a single read
+    auto buffer = std::make_shared<std::string>();
+    segment.read(offset, size, *buffer);
+    record = *buffer;
+    pin = std::move(buffer);
+  }
+}
+
+bool Saavi::readValue(const std::shared_ptr<Segment> &segment,
+                      const IndexEntry &location, PinnedValue &value) {
+  std::string_view entry;
+  std::shared_ptr<const void> pin;
+  readRecord(*segment, location.offset, location.size, entry, pin);
+  return resolveValue(entry, location, std::move(pin), value);
+}
+
+bool Saavi::resolveValue(std::string_view entry, const IndexEntry &location,
+                         std::shared_ptr<const void> pin, PinnedValue &value) {
+  if (entry[4] & RECORD_FLAG_MERGE) {
+    return foldOperands(entry, location, std::move(pin), value);
+  }
+  if ((entry[4] & RECORD_FLAG_BLOB) == 0) {
+    decode_value(entry, std::move(pin), value);
+    return true;
+  }
+
+  BlobPointer blob;
+  if (!decodeBlobPointer(decode_entry(entry).second, blob)) {
+    throw SaaviException("corrupt blob pointer");
+  }
+  std::shared_ptr<Segment> blobFile;
+  {
+    std::shared_lock<ShardedSharedMutex> lock(segmentsMutex);
+    auto found = blobFiles.find(blob.fileId);
+    if (found == blobFiles.end()) {
+      return false;
+    }
+    blobFile = found->second;
+  }
+  std::string_view record;
+  readRecord(*blobFile, blob.offset, blob.size, record, pin);
+  decode_value(record, std::move(pin), value);
+  return true;
+}
+
+bool Saavi::foldOperands(std::string_view entry, const IndexEntry &location,
+                         std::shared_ptr<const void> pin, PinnedValue &value,
+                         bool *unfoldable) {
+  if (!options.mergeOperator) {
+    throw SaaviException("reading merge operands needs a merge operator");
+  }
+  const std::string key(decode_entry(entry).first);
+
+  // the operands folded by an earlier read, if they are still of use
+  Fold fold{0, nullptr};
+  {
+    std::lock_guard<std::mutex> lock(foldsMutex);
+    auto cached = folds.find(key);
+    if (cached != folds.end()) {
+      fold = cached->second;
+    }
+  }
+  if (fold.value != nullptr && fold.sequence == location.sequence) {
+    value.value = *fold.value;
+    value.pin = std::move(fold.value);
+    return true;
+  }
+
+  // the chain and the segments it is in are taken together, so compaction
+  // can't swap them out in between
+  std::vector<IndexEntry> chain;
+  std::vector<std::shared_ptr<Segment>> chainSegments;
+  {
+    std::shared_lock<ShardedSharedMutex> lock(segmentsMutex);
+    if (!idx.getChain(key, location, chain)) {
+      return false;
+    }
+    for (const auto &record : chain) {
+      chainSegments.push_back(segmentFor(record.segmentId));
+    }
+  }
+  // continue after the newest operand of the chain the fold covers
+  size_t first = 0;
+  if (fold.value != nullptr) {
+    auto covered = std::find_if(chain.rbegin(), chain.rend(),
+                                [&fold](const IndexEntry &record) {
+                                  return record.sequence == fold.sequence;
+                                });
+    if (covered != chain.rend()) {
+      first = chain.rend() - covered;
+    } else {
+      fold.value.reset();
+    }
+  }
+
+  // the records of the chain are older than the operand, so they are all
+  // written out already
+  PinnedValue existing;
+  bool exists = fold.value != nullptr;
+  if (exists) {
+    existing.value = *fold.value;
+    existing.pin = std::move(fold.value);
+  }
+  std::vector<PinnedValue> operands;
+  operands.reserve(chain.size() - first + 1);
+  for (size_t i = first; i < chain.size(); i++) {
+    std::string_view record;
+    std::shared_ptr<const void> recordPin;
+    readRecord(*chainSegments[i], chain[i].offset, chain[i].size, record,
+               recordPin);
+    if ((record[4] & RECORD_FLAG_MERGE) == 0) {
+      // only the oldest record of a chain is a value
+      if (!resolveValue(record, chain[i], std::move(recordPin), existing)) {
+        return false;
+      }
+      exists = true;
+      continue;
+    }
+    operands.emplace_back();
+    decode_value(record, std::move(recordPin), operands.back());
+  }
+  operands.emplace_back();
+  decode_value(entry, std::move(pin), operands.back());
+  std::vector<std::string_view> views;
+  views.reserve(operands.size());
+  for (const auto &operand : operands) {
+    views.push_back(operand.value);
+  }
+
+  auto folded = std::make_shared<std::string>();
+  if (!options.mergeOperator->Merge(key, exists ? &existing.value : nullptr,
+                                    views, *folded)) {
+    if (unfoldable != nullptr) {
+      *unfoldable = true;
+      return false;
+    }
+    throw SaaviException("failed to merge the operands of key '" + key +
+                         "'");
+  }
+  {
+    // a snapshot read folds fewer operands than the latest one
+    std::lock_guard<std::mutex> lock(foldsMutex);
+    Fold &cached = folds[key];
+    if (cached.value == nullptr || cached.sequence < location.sequence) {
+      cached = Fold{location.sequence, folded};
+    }
+  }
+  value.value = *folded;
+  value.pin = std::move(folded);
+  return true;
+}
+
+bool Saavi::scanBatch(
+    std::string &start, const std::string &end, size_t limit,
+    std::vector<std::pair<std::string, std::string>> &entries) {
+  if (lsm) {
+    return lsm->scanBatch(start, end, limit, entries);
+  }
+
+  std::vector<std::string> keys;
+  {
+    std::shared_lock<std::shared_mutex> lock(orderedMutex);
+    ordered->scan(start, end, limit, keys);
+  }
+  const bool exhausted = keys.size() < limit;
+  if (!exhausted) {
+    // continue from the smallest key after the last one
+    start = keys.back() + '\0';
+  }
+
+  // read the values in the order of their records in the log
+  struct Location {
+    size_t key;
+    IndexEntry entry;
+    std::shared_ptr<Segment> segment;
+  };
+  std::vector<Location> locations;
+  locations.reserve(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    Location location{i, IndexEntry(), nullptr};
+    location.segment = locate(keys[i], location.entry);
+    if (location.segment != nullptr) {
+      locations.push_back(std::move(location));
+    }
+  }
+  std::sort(locations.begin(), locations.end(),
+            [](const Location &a, const Location &b) {
+              return std::make_pair(a.entry.segmentId, a.entry.offset) <
+                     std::make_pair(b.entry.segmentId, b.entry.offset);
+            });
+  std::vector<PinnedValue> values(keys.size());
+  for (const auto &location : locations) {
+    if (readValue(location.segment, location.entry, values[location.key])) {
+      continue;
+    }
+    // the blob or the operands were moved meanwhile, look the key up again
+    IndexEntry entry;
+    std::shared_ptr<Segment> segment;
+    do {
+      segment = locate(keys[location.key], entry);
+    } while (segment != nullptr &&
+             !readValue(segment, entry, values[location.key]));
+  }
+
+  // and hand them out in key order. Keys deleted meanwhile have no value.
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (values[i].pin != nullptr) {
+      entries.emplace_back(std::move(keys[i]), values[i].ToString());
+    }
+  }
+  return !exhausted;
+}
+
+ScanIterator Saavi::Scan(const std::string &start, const std::string &end) {
+  if (!ordered && !lsm) {
+    throw SaaviException("scans need the ordered index to be enabled");
+  }
+  if (stats) {
+    stats->count(Ticker::Scans);
+  }
+  return ScanIterator(this, start, end);
+}
+
+ScanIterator Saavi::ScanPrefix(const std::string &prefix) {
+  // the keys with the prefix end before the smallest string that is greater
+  // than every one of them - the prefix with its last byte incremented,
+  // after dropping any trailing 0xff bytes
+  std::string end = prefix;
+  while (!end.empty() && static_cast<unsigned char>(end.back()) == 0xff) {
+    end.pop_back();
+  }
+  if (!end.empty()) {
+    end.back()++;
+  }
+  return Scan(prefix, end);
 }
 
 void Saavi::Delete(const std::string &key) {
-  // since we maintain a append only file, we can only append new value - so
-  // append empty string to denote deletion
-  Put(key, "");
+  // since we maintain a append only file, we can only append a record that
+  // marks the key as deleted
+  StatsTimer timer(stats.get(), TimedOperation::Delete);
+  append(key, "", RECORD_FLAG_DELETION);
+  if (stats) {
+    stats->count(Ticker::Deletes);
+    stats->count(Ticker::BytesWritten, key.length());
+  }
+}
+
+void Saavi::Merge(const std::string &key, const std::string &operand) {
+  if (lsm) {
+    throw SaaviException("merges are not supported by the lsm engine");
+  }
+  if (!options.mergeOperator) {
+    throw SaaviException("merging needs a merge operator in the options");
+  }
+  StatsTimer timer(stats.get(), TimedOperation::Merge);
+  {
+    std::unique_lock<std::mutex> lock(writeMutex);
+    if (!blobPointers.empty() && blobPointers.count(key) > 0) {
+      throw SaaviException("can't merge into a value kept in a blob file");
+    }
+    commit(lock, appendRecord(key, operand, RECORD_FLAG_MERGE));
+  }
+  if (stats) {
+    stats->count(Ticker::Merges);
+    stats->count(Ticker::BytesWritten, key.length() + operand.length());
+  }
+}
+
+std::shared_ptr<const Snapshot> Saavi::GetSnapshot() {
+  if (lsm) {
+    throw SaaviException("snapshots are not supported by the lsm engine");
+  }
+
+  // no write is half applied while writeMutex is held
+  std::lock_guard<std::mutex> lock(writeMutex);
+  const uint64_t sequence = nextSequence - 1;
+  std::lock_guard<std::mutex> snapshotsLock(snapshotsMutex);
+  snapshots.insert(sequence);
+  newestSnapshot = *snapshots.rbegin();
+  return std::shared_ptr<const Snapshot>(new Snapshot(this, sequence));
+}
+
+Snapshot::~Snapshot() { saavi->releaseSnapshot(sequence); }
+
+void Saavi::releaseSnapshot(uint64_t sequence) {
+  // the versions only this snapshot saw are dropped by the next writer
+  std::lock_guard<std::mutex> lock(snapshotsMutex);
+  snapshots.erase(snapshots.find(sequence));
+  newestSnapshot = snapshots.empty() ? 0 : *snapshots.rbegin();
+  snapshotReleased = true;
+}
+
+void Saavi::pruneVersions() {
+  if (!snapshotReleased.exchange(false)) {
+    return;
+  }
+  std::multiset<uint64_t> live;
+  {
+    std::lock_guard<std::mutex> lock(snapshotsMutex);
+    live = snapshots;
+  }
+  idx.pruneVersions(live, [this](const IndexEntry &entry) {
+    segmentFor(entry.segmentId)->addLiveBytes(-entry.size);
+  });
+}
+
+bool Saavi::needsCompaction() const {
+  unsigned long totalBytes = 0;
+  unsigned long deadBytes = 0;
+  for (const auto &segment : segments) {
+    totalBytes += segment.second->size() - FILE_HEADER_SIZE;
+    deadBytes += segment.second->deadBytes();
+  }
+  return deadBytes > 0 && deadBytes >= totalBytes * options.compactionDeadRatio;
+}
+
+void Saavi::compactSegments() {
+  const auto start = std::chrono::steady_clock::now();
+
+  // compaction always merges every sealed segment, so all the older versions
+  // of a key are among the inputs and the deletion records can be dropped
+  // along with them
+  std::vector<std::shared_ptr<Segment>> inputs;
+  // the merge operands to fold along with their chains, by key
+  std::unordered_map<std::string, IndexEntry> foldable;
+  {
+    std::lock_guard<std::mutex> writeLock(writeMutex);
+    pruneVersions();
+    std::shared_lock<ShardedSharedMutex> lock(segmentsMutex);
+    for (const auto &segment : segments) {
+      inputs.push_back(segment.second);
+    }
+
+    // an operand is folded if it and its chain are all in the inputs,
+    // unless a snapshot might see the chain part way. Snapshots taken from
+    // now on see the operand or a later version.
+    bool snapshotsLive;
+    {
+      std::lock_guard<std::mutex> snapshotsLock(snapshotsMutex);
+      snapshotsLive = !snapshots.empty();
+    }
+    auto isInput = [this](const IndexEntry &entry) {
+      return segments.count(entry.segmentId) > 0;
+    };
+    if (options.mergeOperator && !snapshotsLive) {
+      idx.forEachChain([&](std::string_view key, const IndexEntry &operand,
+                           const std::vector<IndexEntry> &chain) {
+        if (isInput(operand) &&
+            std::all_of(chain.begin(), chain.end(), isInput)) {
+          foldable.emplace(key, operand);
+        }
+      });
+    }
+  }
+  if (inputs.empty()) {
+    return;
+  }
+
+  // the merged segment takes the place of the newest input
+  const uint32_t outputId = inputs.back()->id();
+  const std::string outputPath = segmentFilename(filename, outputId);
+  FileHeader header;
+  header.createdAt = currentTimeNanos();
+  header.compactedFrom = inputs.front()->id();
+  auto output =
+      Segment::create(outputPath + COMPACTION_SUFFIX, outputId, header);
+
+  // records copied to the output, to be pointed at their new location once
+  // the output is complete
+  struct MovedRecord {
+    std::string key;
+    IndexEntry from;
+    unsigned long offset;
+  };
+  std::vector<MovedRecord> moved;
+  // operands written to the output as the record folding their chains
+  struct FoldedRecord {
+    std::string key;
+    IndexEntry from;
+    IndexEntry to;
+  };
+  std::vector<FoldedRecord> folded;
+  // keys with older versions copied for the snapshots. Their deletion
+  // records have to be copied too, or the versions would come back when
+  // the log is replayed.
+  std::unordered_set<std::string> keptVersions;
+  CompactionStats runStats;
+  std::chrono::microseconds throttledTime{0};
+  for (const auto &input : inputs) {
+    RecordScanner scanner(input->fd());
+    while (scanner.next()) {
+      const RecordHeader &record = scanner.header();
+      runStats.bytesRead += record.recordSize();
+
+      if (options.compactionBytesPerSecond > 0) {
+        // sleep for as long as we are ahead of the allowed rate
+        const std::chrono::microseconds allowed(
+            runStats.bytesRead * 1000000 / options.compactionBytesPerSecond);
+        const auto elapsed =
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start);
+        if (allowed > elapsed) {
+          std::this_thread::sleep_for(allowed - elapsed);
+          throttledTime += allowed - elapsed;
+        }
+      }
+
+      std::string key(scanner.key());
+      auto fold = foldable.empty() ? foldable.end() : foldable.find(key);
+      if (fold != foldable.end()) {
+        // the chain goes into the record written in place of the operand,
+        // which drops out if the key was replaced meanwhile
+        PinnedValue value;
+        bool unfoldable = false;
+        if (input->id() != fold->second.segmentId ||
+            scanner.offset() != fold->second.offset ||
+            !foldOperands(scanner.data(), fold->second, nullptr, value,
+                          &unfoldable)) {
+          std::vector<IndexEntry> chain;
+          if (!unfoldable || !idx.getChain(key, fold->second, chain)) {
+            runStats.recordsDropped++;
+            continue;
+          }
+          // the operands are left for the reads to fail on. Their chain was
+          // skipped on the way here, so it is copied ahead of them.
+          chain.push_back(fold->second);
+          foldable.erase(fold);
+          runStats.recordsDropped -= chain.size() - 1;
+          for (const auto &member : chain) {
+            std::shared_ptr<Segment> segment;
+            {
+              std::shared_lock<ShardedSharedMutex> lock(segmentsMutex);
+              segment = segmentFor(member.segmentId);
+            }
+            std::string_view data;
+            std::shared_ptr<const void> pin;
+            readRecord(*segment, member.offset, member.size, data, pin);
+            moved.push_back(MovedRecord{key, member, output->size()});
+            output->append(data.data(), data.length());
+            runStats.recordsKept++;
+          }
+          continue;
+        }
+        std::string compressed;
+        const Compression codec = compressValue(value.view(), compressed);
+        std::string entry;
+        encodeRecord(entry, 0, record.sequence, key,
+                     codec == Compression::None ? value.view() : compressed,
+                     static_cast<uint8_t>(codec));
+        const IndexEntry to{outputId, output->size(), entry.length(),
+                            record.sequence};
+        output->append(entry);
+        folded.push_back(FoldedRecord{std::move(key), fold->second, to});
+        runStats.recordsKept++;
+        continue;
+      }
+      if (isDeletion(record, input->header().version)) {
+        if (keptVersions.count(key) > 0) {
+          output->append(scanner.data().data(), scanner.data().length());
+          runStats.recordsKept++;
+        } else {
+          // nothing older than the deletion survives this compaction
+          runStats.recordsDropped++;
+          runStats.tombstonesDropped++;
+        }
+        continue;
+      }
+
+      // only the records the index points to, or a snapshot still sees,
+      // are live
+      IndexEntry entry;
+      if (!idx.getKeyOffset(key, entry) || entry.segmentId != input->id() ||
+          entry.offset != scanner.offset()) {
+        if (!idx.hasVersionAt(key, input->id(), scanner.offset())) {
+          runStats.recordsDropped++;
+          continue;
+        }
+        keptVersions.insert(key);
+        entry = IndexEntry{input->id(), scanner.offset(),
+                           record.recordSize(), record.sequence};
+      }
+
+      // copy the record verbatim, the checksum stays valid
+      const unsigned long offset = output->size();
+      output->append(scanner.data().data(), scanner.data().length());
+      moved.push_back(MovedRecord{std::move(key), entry, offset});
+      runStats.recordsKept++;
+    }
+  }
+  output->flush();
+  output->sync();
+  runStats.bytesWritten = output->size();
+
+  {
+    // swap in the merged segment. Keys written while the compaction ran
+    // already point past the inputs and are left alone. Readers are only
+    // held off while the index is repointed.
+    std::lock_guard<std::mutex> lock(writeMutex);
+    std::lock_guard<ShardedSharedMutex> segmentsLock(segmentsMutex);
+    for (const auto &record : moved) {
+      // the key may have been replaced meanwhile while a snapshot sees the
+      // copied version
+      if (idx.moveVersion(record.key, record.from, outputId,
+                          record.offset)) {
+        output->addLiveBytes(record.from.size);
+      }
+    }
+    for (const auto &record : folded) {
+      if (idx.foldChain(record.key, record.from, record.to)) {
+        output->addLiveBytes(record.to.size);
+      }
+    }
+
+    // the rename atomically replaces the newest input
+    output->rename(outputPath);
+    for (const auto &input : inputs) {
+      segments.erase(input->id());
+    }
+    segments[outputId] = output;
+    hintIsCurrent = false;
+  }
+
+  if (!folded.empty()) {
+    // the values of the folded keys are plain records now
+    std::lock_guard<std::mutex> lock(foldsMutex);
+    for (const auto &record : folded) {
+      folds.erase(record.key);
+    }
+  }
+
+  // the remaining inputs can go once the rename is durable
+  syncDirectory(directoryOf(filename).string());
+  for (const auto &input : inputs) {
+    if (input->id() != outputId) {
+      std::filesystem::remove(input->path());
+    }
+  }
+
+  // persist the new layout so the next open doesn't replay the log
+  writeHintFile();
+
+  std::lock_guard<std::mutex> lock(writeMutex);
+  compactionStats.runs++;
+  compactionStats.segmentsCompacted += inputs.size();
+  compactionStats.bytesRead += runStats.bytesRead;
+  compactionStats.bytesWritten += runStats.bytesWritten;
+  compactionStats.recordsKept += runStats.recordsKept;
+  compactionStats.recordsDropped += runStats.recordsDropped;
+  compactionStats.tombstonesDropped += runStats.tombstonesDropped;
+  compactionStats.throttledTime += throttledTime;
+  compactionStats.lastRunDuration =
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start);
+}
+
+bool Saavi::needsBlobCollection() const {
+  // the newest blob file is still being appended to
+  for (const auto &blobFile : blobFiles) {
+    if (blobFile.first != blobFiles.rbegin()->first &&
+        isCollectable(*blobFile.second, options.blobGcLiveRatio)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void Saavi::collectBlobs() {
+  // the blob files dead enough to collect and the blobs still live in them
+  std::map<uint32_t, std::shared_ptr<Segment>> collected;
+  std::vector<std::pair<std::string, BlobPointer>> live;
+  {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    if (!needsBlobCollection()) {
+      return;
+    }
+    for (const auto &blobFile : blobFiles) {
+      if (blobFile.first != blobFiles.rbegin()->first &&
+          isCollectable(*blobFile.second, options.blobGcLiveRatio)) {
+        collected.insert(blobFile);
+      }
+    }
+    for (const auto &blob : blobPointers) {
+      if (collected.count(blob.second.fileId) > 0) {
+        live.push_back(blob);
+      }
+    }
+  }
+  // read the blobs of each file front to back
+  std::sort(live.begin(), live.end(),
+            [](const std::pair<std::string, BlobPointer> &a,
+               const std::pair<std::string, BlobPointer> &b) {
+              return std::make_pair(a.second.fileId, a.second.offset) <
+                     std::make_pair(b.second.fileId, b.second.offset);
+            });
+
+  // copy the live blobs verbatim to the newest blob file a chunk at a time,
+  // and point their keys at the copies unless they were overwritten
+  // meanwhile. The segments the records go to are synced along with them
+  // before any blob file is deleted, whatever the durability mode.
+  uint32_t firstSegment = 0;
+  uint64_t bytesMoved = 0;
+  std::string record;
+  std::vector<BlobPointer> copies;
+  for (size_t next = 0; next < live.size();) {
+    std::lock_guard<std::mutex> blobLock(blobMutex);
+    const size_t first = next;
+    size_t chunkBytes = 0;
+    copies.clear();
+    for (; next < live.size() && chunkBytes < BLOB_COLLECTION_CHUNK_SIZE;
+         next++) {
+      const BlobPointer &blob = live[next].second;
+      collected.at(blob.fileId)->read(blob.offset, blob.size, record);
+      copies.push_back(appendBlob(record));
+      chunkBytes += blob.size;
+    }
+    flushBlobs(true);
+
+    std::lock_guard<std::mutex> lock(writeMutex);
+    if (firstSegment == 0) {
+      firstSegment = active->id();
+    }
+    for (size_t i = first; i < next; i++) {
+      auto blob = blobPointers.find(live[i].first);
+      if (blob == blobPointers.end() || !(blob->second == live[i].second)) {
+        continue;
+      }
+      appendRecord(live[i].first, std::string(), 0, &copies[i - first]);
+      bytesMoved += live[i].second.size;
+    }
+  }
+
+  std::vector<std::shared_ptr<Segment>> deleted;
+  {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    if (firstSegment != 0) {
+      flushActive();
+      for (auto segment = segments.lower_bound(firstSegment);
+           segment != segments.end(); ++segment) {
+        segment->second->sync();
+      }
+      active->sync();
+    }
+
+    // a snapshot might still see the blobs left behind, so the files stay
+    // until none is left and a later run deletes them
+    pruneVersions();
+    bool snapshotsLive;
+    {
+      std::lock_guard<std::mutex> snapshotsLock(snapshotsMutex);
+      snapshotsLive = !snapshots.empty();
+    }
+    if (!snapshotsLive) {
+      std::lock_guard<ShardedSharedMutex> segmentsLock(segmentsMutex);
+      for (const auto &blobFile : collected) {
+        if (blobFile.second->liveBytes() == 0) {
+          blobFiles.erase(blobFile.first);
+          deleted.push_back(blobFile.second);
+        }
+      }
+    }
+    hintIsCurrent = hintIsCurrent && firstSegment == 0 && deleted.empty();
+
+    compactionStats.blobFilesCollected += deleted.size();
+    compactionStats.blobBytesMoved += bytesMoved;
+    for (const auto &blobFile : deleted) {
+      compactionStats.blobBytesReclaimed += blobFile->size();
+    }
+  }
+
+  // readers still holding on to a deleted file can read it until they let
+  // go of it
+  for (const auto &blobFile : deleted) {
+    std::filesystem::remove(blobFile->path());
+  }
+  if (!deleted.empty()) {
+    writeHintFile();
+  }
+}
+
+IngestStats Saavi::IngestExternal(const std::vector<std::string> &inputs,
+                                  const IngestOptions &ingestOptions) {
+  if (lsm) {
+    throw SaaviException("the lsm engine doesn't support IngestExternal");
+  }
+  IngestStats result;
+  auto start = std::chrono::steady_clock::now();
+
+  // read and sort the inputs without holding up the store. A bad input
+  // fails the ingestion before the store is touched.
+  const unsigned threads =
+      ingestOptions.threads > 0
+          ? ingestOptions.threads
+          : std::max(1u, std::thread::hardware_concurrency());
+  const std::filesystem::path directory =
+      ingestOptions.tmpDirectory.empty()
+          ? directoryOf(filename)
+          : std::filesystem::path(ingestOptions.tmpDirectory);
+  const std::string runPrefix =
+      (directory / (std::filesystem::path(filename).filename().string() +
+                    ".sort." + std::to_string(currentTimeNanos()) + "."))
+          .string();
+  ExternalSorter sorter(runPrefix, ingestOptions.sortMemory / threads,
+                        threads);
+  for (const auto &input : inputs) {
+    IngestReader reader(input, ingestOptions.format);
+    std::string_view key;
+    std::string_view value;
+    while (reader.next(key, value)) {
+      sorter.add(key, value);
+    }
+  }
+  sorter.finish();
+  result.recordsRead = sorter.count();
+  result.runs = sorter.runs();
+  result.sortDuration = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start);
+  if (sorter.count() == 0) {
+    return result;
+  }
+  start = std::chrono::steady_clock::now();
+
+  // The records go into a single new segment, which a rename attaches as a
+  // whole. It takes the id after the active segment, which is sealed so
+  // that the records written meanwhile go to a segment after it and stay
+  // newer on replay, and the records take sequence numbers before theirs.
+  // Compaction is held off until the segment is attached, as its output
+  // would otherwise take an id past the segment and have it removed as
+  // stale on the next open.
+  std::lock_guard<std::mutex> compactionLock(compactionMutex);
+  uint32_t id;
+  uint64_t firstSequence;
+  {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    firstSequence = nextSequence;
+    nextSequence += sorter.count();
+    id = active->id() + 1;
+    rollover(1);
+    hintIsCurrent = false;
+    ingestWrites.reset(new std::unordered_set<std::string>());
+  }
+
+  const std::string path = segmentFilename(filename, id);
+  try {
+    FileHeader header;
+    header.createdAt = currentTimeNanos();
+    auto segment = Segment::create(path + COMPACTION_SUFFIX, id, header);
+    ::posix_fadvise(segment->fd(), 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // the keys one after the other, and where their records went
+    struct IngestedRecord {
+      size_t keyEnd;
+      unsigned long offset;
+      size_t size;
+    };
+    std::string keys;
+    std::vector<IngestedRecord> records;
+    std::string record;
+    std::string compressed;
+    while (sorter.next()) {
+      compressed.clear();
+      const Compression codec = compressValue(sorter.value(), compressed);
+      record.clear();
+      encodeRecord(record, 0, firstSequence + records.size(), sorter.key(),
+                   codec == Compression::None ? sorter.value() : compressed,
+                   static_cast<uint8_t>(codec));
+      keys.append(sorter.key());
+      records.push_back(
+          IngestedRecord{keys.length(), segment->size(), record.length()});
+      segment->append(record);
+    }
+    segment->flush();
+    segment->sync();
+    result.duplicatesDropped = sorter.duplicates();
+    result.recordsIngested = records.size();
+    result.bytesWritten = segment->size();
+
+    std::lock_guard<std::mutex> lock(writeMutex);
+    {
+      std::lock_guard<ShardedSharedMutex> segmentsLock(segmentsMutex);
+      segment->rename(path);
+      segments[id] = segment;
+    }
+    // done with noting writes down before indexing the records
+    const auto written = std::move(ingestWrites);
+    size_t keyStart = 0;
+    for (size_t i = 0; i < records.size(); i++) {
+      const std::string key(keys, keyStart, records[i].keyEnd - keyStart);
+      keyStart = records[i].keyEnd;
+      // keys written or deleted since the ingestion began keep those writes
+      if (written->count(key) > 0) {
+        continue;
+      }
+      const IndexEntry ingested{id, records[i].offset, records[i].size,
+                                firstSequence + i};
+      IndexEntry current;
+      if (idx.getKeyOffset(key, current) &&
+          current.sequence >= firstSequence) {
+        // the operands merged meanwhile stack on the ingested record, as
+        // they do when the log is replayed
+        std::vector<IndexEntry> dropped;
+        idx.rebaseChain(key, ingested, firstSequence, newestSnapshot,
+                        &dropped);
+        segment->addLiveBytes(ingested.size);
+        for (const auto &record : dropped) {
+          segmentFor(record.segmentId)->addLiveBytes(-record.size);
+        }
+        std::lock_guard<std::mutex> foldsLock(foldsMutex);
+        folds.erase(key);
+      } else {
+        updateIndex(key, ingested, 0);
+      }
+      if (cache) {
+        cache->invalidate(key);
+      }
+    }
+    hintIsCurrent = false;
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    ingestWrites.reset();
+    std::error_code ec;
+    std::filesystem::remove(path + COMPACTION_SUFFIX, ec);
+    throw;
+  }
+
+  // persist the index of the new records so the next open doesn't replay
+  // them
+  syncDirectory(directoryOf(filename).string());
+  writeHintFile();
+  result.writeDuration =
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - start);
+  return result;
+}
+
+void Saavi::Compact() {
+  if (lsm) {
+    lsm->compact();
+    return;
+  }
+  compact(true);
+}
+
+void Saavi::compact(bool mergeSegments) {
+  std::lock_guard<std::mutex> compactionLock(compactionMutex);
+  try {
+    if (mergeSegments) {
+      compactSegments();
+    }
+    collectBlobs();
+  } catch (std::exception &e) {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    compactionStats.failures++;
+    throw;
+  }
+}
+
+void Saavi::compactionLoop() {
+  std::unique_lock<std::mutex> lock(writeMutex);
+  while (!stopping) {
+    compactionCondition.wait_for(lock, options.compactionInterval);
+    const bool mergeSegments = needsCompaction();
+    if (stopping || (!mergeSegments && !needsBlobCollection())) {
+      continue;
+    }
+
+    lock.unlock();
+    try {
+      compact(mergeSegments);
+    } catch (std::exception &e) {
+      // counted in the stats, the next round tries again
+    }
+    lock.lock();
+  }
+}
+
+CompactionStats Saavi::GetCompactionStats() {
+  if (lsm) {
+    return lsm->getCompactionStats();
+  }
+  std::lock_guard<std::mutex> lock(writeMutex);
+  return compactionStats;
+}
+
+CacheStats Saavi::GetCacheStats() {
+  if (!cache) {
+    return CacheStats();
+  }
+  return cache->getStats();
+}
+
+LsmStats Saavi::GetLsmStats() {
+  if (!lsm) {
+    return LsmStats();
+  }
+  return lsm->getStats();
+}
+
+SaaviStats Saavi::GetStats() {
+  SaaviStats result;
+  if (stats) {
+    stats->collect(result);
+  }
+  result.recoveryDuration = recoveryDuration;
+  result.compaction = GetCompactionStats();
+  result.cache = GetCacheStats();
+  if (lsm) {
+    const LsmStats lsmStats = lsm->getStats();
+    result.indexMemory = lsmStats.indexMemory + lsmStats.filterMemory;
+    for (uint64_t bytes : lsmStats.bytesPerLevel) {
+      result.logBytes += bytes;
+    }
+    return result;
+  }
+
+  result.keys = idx.size();
+  result.indexMemory = idx.memoryUsage();
+  std::shared_lock<ShardedSharedMutex> lock(segmentsMutex);
+  for (const auto &segment : segments) {
+    result.logBytes += segment.second->size();
+    result.logLiveBytes += segment.second->liveBytes();
+  }
+  result.logBytes += active->size();
+  result.logLiveBytes += active->liveBytes();
+  for (const auto &blobFile : blobFiles) {
+    result.blobBytes += blobFile.second->size();
+    result.blobLiveBytes += blobFile.second->liveBytes();
+  }
+  return result;
 }
@@ -1,45 +1,427 @@
 #ifndef SAAVI_H
 #define SAAVI_H
 
-#include <fstream>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
+#include "async_io.h"
+#include "blob_file.h"
 #include "file_iterators.h"
 #include "key_index.h"
+#include "lsm_store.h"
+#include "merge_operator.h"
+#include "ordered_index.h"
+#include "pinned_value.h"
+#include "saavi_options.h"
+#include "scan_iterator.h"
+#include "segment.h"
+#include "sharded_lock.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "value_cache.h"
+#include "write_batch.h"
 
 class Saavi {
-  std::fstream fs;
+  std::string filename;
+  SaaviOptions options;
+
+  // Saavi has a single writer at a time - writeMutex serialises the writers
+  // and guards the state of the log tail below. Readers never take it unless
+  // the record they want is still buffered. The set of segments can only
+  // change with both writeMutex and segmentsMutex held, so readers only need
+  // a shared lock on segmentsMutex to find the segment an entry points to.
+  // The locks are always taken in the order writeMutex, segmentsMutex and
+  // then the lock of an index shard.
+  std::mutex writeMutex;
+  ShardedSharedMutex segmentsMutex;
+
+  // sealed segments of the log ordered by id
+  std::map<uint32_t, std::shared_ptr<Segment>> segments;
+  // the segment new records are appended to
+  std::shared_ptr<Segment> active;
+
+  // blob files ordered by id, which like the segments only change with
+  // both writeMutex and segmentsMutex held. Blobs are appended to the
+  // newest of them, which garbage collection leaves alone. blobMutex
+  // serialises the appends. It is taken before writeMutex and held until
+  // the records pointing to the new blobs are in the log, so garbage
+  // collection never finds a blob whose pointer is still to come.
+  std::mutex blobMutex;
+  std::map<uint32_t, std::shared_ptr<Segment>> blobFiles;
+  // the blob file being appended to, nullptr until the first blob after
+  // opening or after the last one was sealed. Guarded by blobMutex.
+  std::shared_ptr<Segment> activeBlob;
+  // the blobs of the keys whose latest value is in a blob file, guarded by
+  // writeMutex
+  std::unordered_map<std::string, BlobPointer> blobPointers;
+
+  // sequence number to be assigned to the next record
+  uint64_t nextSequence{1};
+  // offset and checksum of the last record in the active segment
+  unsigned long lastRecordOffset{0};
+  uint32_t lastRecordCrc{0};
+  // whether the hint file on disk describes the current index
+  bool hintIsCurrent{false};
+
+  // group commit state - the sequence numbers upto which the log has been
+  // synced, or failed to sync, and whether a writer is syncing right now
+  std::condition_variable commitCondition;
+  bool commitInProgress{false};
+  uint64_t syncedSequence{0};
+  uint64_t failedSequence{0};
+
+  // background compaction state
+  std::thread compactionThread;
+  std::condition_variable compactionCondition;
+  bool stopping{false};
+  // serialises compaction runs
+  std::mutex compactionMutex;
+  CompactionStats compactionStats;
+  // the keys written or deleted since an ingestion began, other than by
+  // merges, which keep those writes. nullptr unless an ingestion is writing
+  // its segment. Guarded by writeMutex.
+  std::unique_ptr<std::unordered_set<std::string>> ingestWrites;
+
+  // the sequence numbers of the live snapshots. The newest of them is also
+  // kept atomically for the writer, which keeps the versions it replaces
+  // if a snapshot sees them.
+  std::mutex snapshotsMutex;
+  std::multiset<uint64_t> snapshots;
+  std::atomic<uint64_t> newestSnapshot{0};
+  // whether a snapshot was released since the kept versions were pruned
+  std::atomic<bool> snapshotReleased{false};
 
   // encodes the given key value into a desired format
-  static const std::string encode_entry(const std::string &key,
-                                        const std::string &value);
-  // decodes the entry into key and value
-  static const std::pair<std::string, std::string> decode_entry(
-      const std::string &entry);
+  static const std::string encode_entry(
+      uint64_t sequence, uint8_t flags, const std::string &key,
+      std::string_view value, Compression codec = Compression::None);
+  // decodes the entry into key and value, which point into the entry
+  static const std::pair<std::string_view, std::string_view> decode_entry(
+      std::string_view entry);
+  // point the value at the value of the entry, which the pin keeps alive,
+  // or at a decompressed copy of it if it is compressed
+  static void decode_value(std::string_view entry,
+                           std::shared_ptr<const void> pin,
+                           PinnedValue &value);
+  // compress the value with the configured codec if it is worth it.
+  // Returns the codec used, None if the value is to be stored as it is.
+  Compression compressValue(std::string_view value,
+                            std::string &compressed) const;
+
+  // open the segment files, creating or upgrading the data file as required
+  void openSegments();
+  // the segment with the given id, sealed or active
+  const std::shared_ptr<Segment> &segmentFor(uint32_t id) const;
+  // seal the active segment and start a new one, leaving the given number
+  // of ids in between for segments to be attached
+  void rollover(uint32_t reservedIds = 0);
+  // append to or write out the active segment, called with writeMutex
+  // held. If the write fails, the records that were only buffered are lost
+  // with it and leave the index through forgetUnflushed.
+  void appendActive(const std::string &entry);
+  void flushActive();
+  // drop the keys whose latest record is past the end of the active
+  // segment
+  void forgetUnflushed();
+
+  // make the record with the given sequence as durable as the options ask
+  // for, called with writeMutex held right after appending the record
+  void commit(std::unique_lock<std::mutex> &lock, uint64_t sequence);
+  void groupCommit(std::unique_lock<std::mutex> &lock, uint64_t sequence);
+
+  // point the key at a new record with the given flags, or drop it if the
+  // record deletes it, and keep the live bytes of the segments and blob
+  // files up to date. blob is the blob the record points to, if any.
+  void updateIndex(const std::string &key, const IndexEntry &entry,
+                   uint8_t flags, const BlobPointer *blob = nullptr);
+  // append a single record and apply it
+  void append(const std::string &key, const std::string &value,
+              uint8_t flags);
+  // append a single record and apply it without committing it, called
+  // with writeMutex held. Returns the sequence number of the record. With
+  // a blob the record points to it instead of holding the value, which is
+  // only needed for the cache - a blob moved by garbage collection comes
+  // without it.
+  uint64_t appendRecord(const std::string &key, const std::string &value,
+                        uint8_t flags, const BlobPointer *blob = nullptr);
+
+  // whether a value of the given length goes into a blob file
+  bool isBlob(size_t valueLength) const {
+    return !lsm && options.blobThreshold > 0 &&
+           valueLength >= options.blobThreshold;
+  }
+  // append the value to the newest blob file, compressed if it is worth
+  // it, and return where it went. Called with blobMutex held.
+  BlobPointer writeBlob(const std::string &key, std::string_view value);
+  // append an encoded blob record, starting a new blob file if there is
+  // none to append to. Called with blobMutex held.
+  BlobPointer appendBlob(std::string_view record);
+  // write out the blobs appended so far and sync them if asked to, before
+  // the records pointing to them are appended. Called with blobMutex held.
+  void flushBlobs(bool sync);
+  // whether a sealed blob file is dead enough to be collected, called with
+  // writeMutex held
+  bool needsBlobCollection() const;
+  // move the live blobs out of the blob files that are dead enough and
+  // delete the files once no snapshot can see the blobs left in them
+  void collectBlobs();
+
+  void releaseSnapshot(uint64_t sequence);
+  // drop the versions of keys no snapshot sees anymore, called with
+  // writeMutex held
+  void pruneVersions();
+  friend class Snapshot;
+
+  // load the index from the hint file if there is a valid one and return
+  // the segment and the offset from which the log has to be replayed
+  std::pair<uint32_t, unsigned long> loadHintFile();
+  // write the current index out to the hint file
+  void writeHintFile();
+
+  // whether enough of the sealed segments is dead to be worth compacting
+  bool needsCompaction() const;
+  // merge all the sealed segments into one, keeping only the live records
+  void compactSegments();
+  // merge the segments if asked to and collect the blob files, one run at
+  // a time
+  void compact(bool mergeSegments);
+  void compactionLoop();
 
-  // index struct
+  // index struct, safe to read without any of the locks above
   KeyIndex idx;
+  // recently read values, if enabled in the options
+  std::unique_ptr<ValueCache> cache;
+  // the keys in sorted order, if enabled in the options. Only new and
+  // dropped keys change it, under an exclusive lock of orderedMutex.
+  std::unique_ptr<OrderedIndex> ordered;
+  std::shared_mutex orderedMutex;
+
+  // the lsm engine, which takes over all of the above if enabled in the
+  // options
+  std::unique_ptr<LsmStore> lsm;
+
+  // counts and times the operations, nullptr if the options or the build
+  // leave statistics out
+  std::unique_ptr<StatsRecorder> stats;
+  std::chrono::microseconds recoveryDuration{0};
+  // count a key looked up by one of the Gets
+  void countGet(bool found, const PinnedValue &value) {
+    if (stats) {
+      stats->count(Ticker::Gets);
+      if (found) {
+        stats->count(Ticker::GetHits);
+        stats->count(Ticker::BytesRead, value.size());
+      }
+    }
+  }
+  // Get and MultiGet without the statistics
+  bool getLatest(const std::string &key, PinnedValue &value);
+  std::vector<bool> multiGetLatest(const std::vector<std::string> &keys,
+                                   std::vector<PinnedValue> &values);
+
+  // find the record of the key as seen by a snapshot taken at the sequence,
+  // making sure it has been written out to its segment. Returns nullptr if
+  // the key is not present.
+  std::shared_ptr<Segment> locate(const std::string &key,
+                                  IndexEntry &location,
+                                  uint64_t sequence = UINT64_MAX);
+  // read the size bytes at offset of the segment, pinned by pin
+  void readRecord(Segment &segment, unsigned long offset, size_t size,
+                  std::string_view &record,
+                  std::shared_ptr<const void> &pin) const;
+  // read the value of the record at the given location. Returns false if
+  // the value was in a blob file garbage collection has deleted meanwhile,
+  // in which case the key has to be located again.
+  bool readValue(const std::shared_ptr<Segment> &segment,
+                 const IndexEntry &location, PinnedValue &value);
+  // point the value at the value of the entry read from the location,
+  // reading it from its blob file if the entry is a blob record and folding
+  // its chain if it is a merge operand. Returns false like readValue, or if
+  // the chain was folded or moved by compaction meanwhile.
+  bool resolveValue(std::string_view entry, const IndexEntry &location,
+                    std::shared_ptr<const void> pin, PinnedValue &value);
+  // fold the merge operand of the entry, read from the location, and the
+  // chain it stacks on into the value, continuing from the cached fold of
+  // the key if it covers part of the chain. Returns false like
+  // resolveValue. Throws if the merge operator fails, unless unfoldable is
+  // given, which is set instead.
+  bool foldOperands(std::string_view entry, const IndexEntry &location,
+                    std::shared_ptr<const void> pin, PinnedValue &value,
+                    bool *unfoldable = nullptr);
+  // put the value just read from the location in the cache and point the
+  // value at the cached copy
+  void cacheValue(const std::string &key, const IndexEntry &location,
+                  PinnedValue &value);
+
+  // the latest fold of the operands of each key read, along with the
+  // sequence number of the newest operand it covers. Guarded by foldsMutex,
+  // which is never held while taking another lock. Only the keys whose
+  // values are merge operands are in it.
+  struct Fold {
+    uint64_t sequence;
+    std::shared_ptr<const std::string> value;
+  };
+  std::mutex foldsMutex;
+  std::unordered_map<std::string, Fold> folds;
+
+  // the puts of PutAsync waiting for the log to be synced upto their
+  // sequence number, in order, and whether a sync of the log is in flight
+  // for them. There is at most one, which takes in every put appended
+  // before it is submitted. Guarded by writeMutex.
+  struct AsyncPut {
+    uint64_t sequence;
+    std::function<void(std::exception_ptr error)> complete;
+  };
+  std::vector<AsyncPut> asyncPuts;
+  bool asyncSyncInFlight{false};
+
+  // the io_uring instance behind GetAsync and PutAsync, set up on first use.
+  // nullptr if the operations have to run synchronously.
+  std::unique_ptr<AsyncIo> asyncIo;
+  std::once_flag asyncIoCreated;
+  AsyncIo *getAsyncIo();
+  // sync the segment for the puts waiting upto target, from the completion
+  // thread of the ring if asked to
+  void syncAsyncPuts(AsyncIo *io, std::shared_ptr<Segment> segment,
+                     uint64_t target, bool fromCompletion);
+  // note down how the sync upto target went, complete the puts it covers
+  // and start the sync of those appended meanwhile
+  void finishAsyncSync(AsyncIo *io, uint64_t target,
+                       std::exception_ptr error);
+  // read the live entries of upto limit keys from [start, end) and move
+  // start past them. Returns false once the range has been read entirely.
+  bool scanBatch(std::string &start, const std::string &end, size_t limit,
+                 std::vector<std::pair<std::string, std::string>> &entries);
+  friend class ScanIterator;
 
  public:
   // Iterators to loop through all entries in the database.
   // Note that old values are ignored and only the latest values are returned.
-  auto begin() {
-    // Pass the decode_entry member function as the decoder to be used by the
-    // iterator
-    return FileReverseIterator{fs, &Saavi::decode_entry};
-  }
-  auto end() const { return FileReverseIteratorEnd{}; }
+  // The entries come in the order of their records on disk, and every key
+  // present throughout the iteration is returned exactly once.
+  // Not supported by the lsm engine, which iterates with Scan instead.
+  FileIterator begin();
+  // Iterate the entries as seen by the snapshot, which is held onto until
+  // the iteration is done
+  FileIterator begin(std::shared_ptr<const Snapshot> snapshot);
+  auto end() const { return FileIteratorEnd{}; }
 
   void rebuildIndexes();
 
   // Open the file if it exists or else, create new
-  Saavi(const std::string &filename);
+  Saavi(const std::string &filename,
+        const SaaviOptions &options = SaaviOptions());
+  // Writes a hint file for the next open on a clean close
+  ~Saavi();
+
+  // Remove the data file and all the files that belong to it
+  static void Destroy(const std::string &filename);
 
   // Append an entry to the file
   void Put(const std::string &key, const std::string &value);
   // Retrieve the latest value of the key
   const std::string Get(const std::string &key);
+  // Retrieve the latest value of the key without copying it. Returns false
+  // if the key is not present.
+  bool Get(const std::string &key, PinnedValue &value);
+  // Retrieve the latest values of many keys at once, in the order of the
+  // keys. Values of keys that are not present are empty, found tells them
+  // apart from empty values.
+  //
+  // The records are read in the order they are on disk rather than in the
+  // order of the keys, and records of a segment that are close to each
+  // other are read together. The reads are in flight at once on io_uring,
+  // or read ahead by the kernel with mmapReads, when the store can.
+  const std::vector<std::string> MultiGet(
+      const std::vector<std::string> &keys);
+  std::vector<bool> MultiGet(const std::vector<std::string> &keys,
+                             std::vector<PinnedValue> &values);
+  // Retrieve the value of the key as seen by the snapshot
+  const std::string Get(const std::string &key, const Snapshot &snapshot);
+  bool Get(const std::string &key, PinnedValue &value,
+           const Snapshot &snapshot);
   // Delete the entry with the given key
   void Delete(const std::string &key);
+  // Append an operand to the value of the key without reading it. The
+  // operands are folded into the value by options.mergeOperator when the
+  // key is read, and the fold is cached so the next read only folds the
+  // operands written since. Compaction folds them for good, unless a
+  // snapshot is alive. Merging into a value kept in a blob file is not
+  // supported, nor is the lsm engine.
+  void Merge(const std::string &key, const std::string &operand);
+
+  // Completion based versions of Get and Put, for callers that can't block
+  // on the disk. The callback runs once the operation is done, either on the
+  // completion thread of the store or right away on the calling thread if
+  // no I/O was needed. An operation that failed passes its exception; a Get
+  // that found nothing passes found as false.
+  //
+  // The reads of GetAsync and the syncs of PutAsync are submitted to an
+  // io_uring instance, so that upto options.asyncQueueDepth of them are in
+  // flight at once. PutAsync only needs a sync with the durability modes
+  // that sync every write; with the others it is as fast as Put. Without
+  // io_uring, with the lsm engine or when called from a callback, the
+  // operations run synchronously before the call returns.
+  using GetCallback =
+      std::function<void(std::exception_ptr error, bool found,
+                         PinnedValue value)>;
+  using PutCallback = std::function<void(std::exception_ptr error)>;
+  void GetAsync(const std::string &key, GetCallback callback);
+  void PutAsync(const std::string &key, const std::string &value,
+                PutCallback callback);
+  // Apply all the operations of the batch atomically
+  void Write(const WriteBatch &batch);
+
+  // Take a consistent read view of the store as of now. Neither readers nor
+  // writers are held up by it, and compaction keeps every record it sees.
+  // Not supported by the lsm engine.
+  std::shared_ptr<const Snapshot> GetSnapshot();
+
+  // Iterate over the entries with keys in [start, end) in key order. An
+  // empty end scans upto the last key. Needs options.orderedIndex with the
+  // log engine.
+  ScanIterator Scan(const std::string &start, const std::string &end);
+  // Iterate over the entries whose keys start with the prefix in key order
+  ScanIterator ScanPrefix(const std::string &prefix);
+
+  // Load the records of the inputs, laid out as options.format says, in
+  // bulk. The inputs are sorted and deduplicated, the last record of a key
+  // winning, with an external sort that spills to disk what doesn't fit in
+  // options.sortMemory. The records are then written out in key order to a
+  // single new segment in large sequential writes, which is synced and
+  // attached atomically - after a crash either all of the records are
+  // there or none are. Ingested records replace the values the keys had
+  // before the ingestion began; writes made while it runs win over them.
+  // The index of the new records is persisted in the hint file.
+  //
+  // Snapshots taken while an ingestion runs see its records once they are
+  // attached. Values are kept in the segment whatever their size, blob
+  // files are left alone. Not supported by the lsm engine.
+  IngestStats IngestExternal(const std::vector<std::string> &inputs,
+                             const IngestOptions &options = IngestOptions());
+
+  // Compact the sealed segments right away
+  void Compact();
+  CompactionStats GetCompactionStats();
+  CacheStats GetCacheStats();
+  LsmStats GetLsmStats();
+  // Counters and latencies of the operations along with the state of the
+  // store, see SaaviStats. StatsToPrometheus formats them for scraping.
+  SaaviStats GetStats();
 };
 
 #endif
@@ -0,0 +1,287 @@
+#ifndef SAAVI_OPTIONS_H
+#define SAAVI_OPTIONS_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/* options that can be set when opening a saavi database */
+
+class MergeOperator;
+
+// when the writes are made durable
+enum class DurabilityMode {
+  // writes are buffered and handed to the OS in large chunks
+  None,
+  // every write is handed to the OS before Put returns
+  FlushPerWrite,
+  // every write is synced to the disk before Put returns
+  FsyncPerWrite,
+  // concurrent writes are synced to the disk together, Put returns once the
+  // sync covering its record is done
+  GroupCommit,
+};
+
+// how the data is laid out on disk
+enum class StorageEngine {
+  // a log of records with every key held in an in memory index
+  Log,
+  // a log structured merge tree - writes go to an in memory memtable that
+  // is flushed to immutable sorted runs, which are merged level by level in
+  // the background. Only the sparse indexes and the Bloom filters of the
+  // runs are kept in memory, so the keys don't have to fit in memory.
+  Lsm,
+};
+
+// how values are compressed on disk. The codec is recorded with the data,
+// so these values must never change.
+enum class Compression : uint8_t {
+  None = 0,
+  // a fast LZ77 codec built into saavi
+  Lz = 1,
+  // zlib's deflate - slower but compresses better. Only available if saavi
+  // was built with zlib.
+  Zlib = 2,
+};
+
+// what the store keeps track of about its operations, see Saavi::GetStats
+enum class StatsLevel {
+  // nothing, the operations aren't counted at all
+  None,
+  // the number of operations and of the bytes they read and wrote, which
+  // costs a few uncontended atomic adds per operation
+  Counters,
+  // the counters and a latency histogram of each kind of operation, which
+  // takes two clock reads per operation more
+  Latencies,
+};
+
+struct SaaviOptions {
+  StorageEngine engine{StorageEngine::Log};
+
+  DurabilityMode durability{DurabilityMode::FlushPerWrite};
+  // a group commit syncs after waiting this long for more writers to join,
+  // or as soon as groupCommitBytes are waiting to be synced. With no wait a
+  // group is made of the writes that arrived while the previous sync ran,
+  // which is usually the better trade off on fast disks.
+  std::chrono::microseconds groupCommitInterval{0};
+  unsigned long groupCommitBytes{1 << 20};
+
+  // the active segment is sealed and a new one started once it grows past
+  // this size
+  unsigned long segmentSize{64 << 20};
+
+  // read values through a memory mapping of the data files instead of
+  // reading each one into a buffer
+  bool mmapReads{true};
+
+  // run compaction in a background thread
+  bool backgroundCompaction{true};
+  // how often the background thread checks whether compaction is due
+  std::chrono::milliseconds compactionInterval{1000};
+  // compact once this fraction of the sealed segments is dead records
+  double compactionDeadRatio{0.5};
+  // maximum bytes per second read by compaction, 0 means unthrottled
+  unsigned long compactionBytesPerSecond{0};
+
+  // keep the keys in sorted order as well, which Scan and ScanPrefix need
+  bool orderedIndex{false};
+
+  // how values are compressed. The log engine compresses every value of at
+  // least compressionMinSize bytes on its own, the lsm engine compresses the
+  // blocks of its runs. Data that doesn't get smaller is stored as it is.
+  // What was written with one codec stays readable after reopening with
+  // another, which only applies to new writes and compactions.
+  Compression compression{Compression::None};
+  size_t compressionMinSize{128};
+
+  // values of at least blobThreshold bytes are written to blob files next
+  // to the log, which then only holds a small pointer to them, so neither
+  // compaction nor recovery has to copy or read them. 0 keeps every value
+  // in the log. Only applies to the log engine.
+  size_t blobThreshold{0};
+  // a blob file is sealed once it grows past this size
+  unsigned long blobFileSize{256 << 20};
+  // the live values of a sealed blob file are moved to the newest one, and
+  // the file deleted, once less than this fraction of it is live
+  double blobGcLiveRatio{0.5};
+
+  // capacity of the in memory cache of recently read values in bytes, 0
+  // disables the cache
+  size_t cacheCapacity{0};
+
+  // number of reads and syncs GetAsync and PutAsync can have in flight on
+  // the io_uring instance of the store. 0 runs them synchronously, as does
+  // a kernel without io_uring.
+  unsigned asyncQueueDepth{64};
+
+  // folds the operands written by Saavi::Merge into the values of their
+  // keys, see merge_operator.h. Keys with operands can't be read without
+  // it, so a store is always opened with the operator it was written with.
+  // Only applies to the log engine.
+  std::shared_ptr<const MergeOperator> mergeOperator;
+
+  // the lsm engine flushes the memtable to a new run once it holds this
+  // many bytes, and compaction writes runs of about the same size. The
+  // options above that deal with segments, the index and the cache only
+  // apply to the log engine, and group commit syncs every write.
+  size_t memtableSize{4 << 20};
+  // bits per key of the Bloom filter of each run
+  int bloomBitsPerKey{10};
+  // level 0 holds the freshly flushed runs, whose keys overlap. They are
+  // merged into level 1 once there are this many of them.
+  size_t level0Runs{4};
+  // maximum size of level 1, every level after it can be ten times larger
+  // than the one before
+  unsigned long levelBaseSize{32 << 20};
+
+  // what the store keeps track of about its operations. Statistics can
+  // also be left out of the build altogether with SAAVI_WITH_STATS off.
+  StatsLevel statistics{StatsLevel::Counters};
+};
+
+// statistics of the compactions run so far
+struct CompactionStats {
+  uint64_t runs{0};
+  uint64_t failures{0};
+  uint64_t segmentsCompacted{0};
+  uint64_t bytesRead{0};
+  uint64_t bytesWritten{0};
+  // records copied into the compacted segment
+  uint64_t recordsKept{0};
+  // overwritten and deleted records that were reclaimed
+  uint64_t recordsDropped{0};
+  // deletion records dropped once no older value of their key was left
+  uint64_t tombstonesDropped{0};
+  // time spent sleeping to honour compactionBytesPerSecond
+  std::chrono::microseconds throttledTime{0};
+  std::chrono::microseconds lastRunDuration{0};
+  // blob files collected, the bytes of live blobs moved out of them and
+  // the bytes of the deleted files
+  uint64_t blobFilesCollected{0};
+  uint64_t blobBytesMoved{0};
+  uint64_t blobBytesReclaimed{0};
+};
+
+// statistics of the value cache
+struct CacheStats {
+  uint64_t hits{0};
+  uint64_t misses{0};
+  uint64_t evictions{0};
+  // bytes taken up by the cached entries and the configured capacity
+  size_t usedBytes{0};
+  size_t capacity{0};
+};
+
+// state of the lsm engine
+struct LsmStats {
+  size_t memtableBytes{0};
+  // number of runs and their bytes on disk at each level
+  std::vector<size_t> runsPerLevel;
+  std::vector<uint64_t> bytesPerLevel;
+  // memory taken up by the sparse indexes and the Bloom filters of the runs
+  size_t indexMemory{0};
+  size_t filterMemory{0};
+};
+
+// latencies of one kind of operation in nanoseconds. The percentiles are
+// accurate to within 1/16 of their value.
+struct LatencyStats {
+  uint64_t count{0};
+  double mean{0};
+  uint64_t p50{0};
+  uint64_t p99{0};
+  uint64_t p999{0};
+  uint64_t max{0};
+};
+
+// what a store has done since it was opened and the state it is in. The
+// operations are counted and timed as options.statistics asks for, the
+// rest is always there.
+struct SaaviStats {
+  // keys looked up by Get, MultiGet and GetAsync, and how many were found
+  uint64_t gets{0};
+  uint64_t getHits{0};
+  // keys written by Put and PutAsync, and deleted by Delete
+  uint64_t puts{0};
+  uint64_t deletes{0};
+  // operands written by Merge
+  uint64_t merges{0};
+  // batches applied by Write and the operations in them
+  uint64_t batches{0};
+  uint64_t batchOperations{0};
+  uint64_t scans{0};
+  // bytes of the keys and values written, and of the values read
+  uint64_t bytesWritten{0};
+  uint64_t bytesRead{0};
+
+  LatencyStats getLatency;
+  LatencyStats multiGetLatency;
+  LatencyStats putLatency;
+  LatencyStats deleteLatency;
+  LatencyStats writeLatency;
+  LatencyStats mergeLatency;
+
+  // the keys in the index and the memory it takes up. The lsm engine
+  // doesn't know its number of keys, its index memory is that of the sparse
+  // indexes and the Bloom filters of the runs.
+  uint64_t keys{0};
+  size_t indexMemory{0};
+  // bytes of the log on disk, or of the runs with the lsm engine, and of
+  // the blob files, along with how many of them are live. The lsm engine
+  // doesn't know its live bytes.
+  uint64_t logBytes{0};
+  uint64_t logLiveBytes{0};
+  uint64_t blobBytes{0};
+  uint64_t blobLiveBytes{0};
+  // time it took to open the store, reading the hint file and replaying
+  // the log
+  std::chrono::microseconds recoveryDuration{0};
+
+  CompactionStats compaction;
+  CacheStats cache;
+};
+
+// how the records of the inputs of Saavi::IngestExternal are laid out
+enum class IngestFormat {
+  // a "key,value" line per record, the key ending at the first comma, as
+  // data files were written before the binary log
+  Csv,
+  // key length (4) | value length (4) | key | value, little-endian
+  Binary,
+};
+
+// options of Saavi::IngestExternal
+struct IngestOptions {
+  IngestFormat format{IngestFormat::Csv};
+  // memory the records are sorted in. Inputs larger than that are sorted
+  // in runs of sortMemory / threads bytes, which are spilled to disk and
+  // merged.
+  size_t sortMemory{1ul << 30};
+  // threads sorting and spilling the runs while the inputs are read, one
+  // per core if 0
+  unsigned threads{0};
+  // directory the runs are spilled to, the one of the data file if empty
+  std::string tmpDirectory;
+};
+
+// what an ingestion did
+struct IngestStats {
+  uint64_t recordsRead{0};
+  // records dropped because a later one in the inputs had the same key
+  uint64_t duplicatesDropped{0};
+  uint64_t recordsIngested{0};
+  // sorted runs spilled to disk, 0 if the inputs were sorted in memory
+  uint64_t runs{0};
+  // bytes of the segment the records were written to
+  uint64_t bytesWritten{0};
+  // time spent reading and sorting the inputs, and merging them into the
+  // segment and attaching it
+  std::chrono::microseconds sortDuration{0};
+  std::chrono::microseconds writeDuration{0};
+};
+
+#endif
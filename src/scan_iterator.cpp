@@ -0,0 +1,31 @@
+#include "scan_iterator.h"
+
+#include "saavi.h"
+
+namespace {
+
+// number of keys read from the ordered index at a time
+const size_t SCAN_BATCH_SIZE = 256;
+
+}  // namespace
+
+ScanIterator::ScanIterator(Saavi *saavi, std::string start, std::string end)
+    : m_saavi(saavi), m_start(std::move(start)), m_end(std::move(end)) {
+  fill();
+}
+
+ScanIterator &ScanIterator::operator++() {
+  m_position++;
+  fill();
+  return *this;
+}
+
+void ScanIterator::fill() {
+  // a batch can come back empty if all its keys were deleted
+  while (m_position == m_batch.size() && !m_exhausted) {
+    m_batch.clear();
+    m_position = 0;
+    m_exhausted =
+        !m_saavi->scanBatch(m_start, m_end, SCAN_BATCH_SIZE, m_batch);
+  }
+}
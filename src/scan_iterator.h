@@ -0,0 +1,44 @@
+#ifndef SCAN_ITERATOR_H
+#define SCAN_ITERATOR_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "file_iterators.h"
+
+class Saavi;
+
+// Iterates over the live entries of a key range in key order. The keys are
+// read from the ordered index a batch at a time and the values of a batch
+// are read in the order they are laid out in the log, which keeps the reads
+// sequential.
+class ScanIterator {
+ public:
+  // iterate over the keys in [start, end), an empty end has no upper bound
+  ScanIterator(Saavi *saavi, std::string start, std::string end);
+
+  const std::pair<std::string, std::string> &operator*() const {
+    return m_batch[m_position];
+  }
+
+  ScanIterator &operator++();
+
+  bool operator!=(FileIteratorEnd) const {
+    return m_position < m_batch.size();
+  }
+
+ private:
+  // read the next batch of entries once the current one is used up
+  void fill();
+
+  Saavi *m_saavi;
+  // the keys that are still to be scanned are in [m_start, m_end)
+  std::string m_start;
+  std::string m_end;
+  bool m_exhausted{false};
+  std::vector<std::pair<std::string, std::string>> m_batch;
+  size_t m_position{0};
+};
+
+#endif
@@ -0,0 +1,203 @@
+#include "segment.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#include "saavi_exception.h"
+
+namespace {
+
+// appends are written out once this much data is pending
+const size_t SEGMENT_WRITE_BUFFER_SIZE = 1 << 20;
+// the smallest mapping of a segment - a growing segment is remapped at
+// twice the size each time, so it is only remapped a handful of times
+const size_t MIN_MAPPING_SIZE = 1 << 20;
+
+std::string errorString(const std::string &what, const std::string &path) {
+  return what + " '" + path + "' : " + strerror(errno);
+}
+
+}  // namespace
+
+SegmentMapping::SegmentMapping(int fd, size_t length, const std::string &path)
+    : m_length(length) {
+  void *data = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    throw SaaviException(errorString("failed to map file", path));
+  }
+  // the mapping serves point lookups, don't read ahead around them
+  ::madvise(data, length, MADV_RANDOM);
+  m_data = static_cast<char *>(data);
+}
+
+SegmentMapping::~SegmentMapping() { ::munmap(m_data, m_length); }
+
+Segment::Segment(uint32_t id, const std::string &path, int fd,
+                 const FileHeader &header, unsigned long size)
+    : m_id(id),
+      m_path(path),
+      m_fd(fd),
+      m_header(header),
+      m_size(size),
+      m_flushedSize(size) {}
+
+std::shared_ptr<Segment> Segment::create(const std::string &path, uint32_t id,
+                                         const FileHeader &header) {
+  int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    throw SaaviException(errorString("failed to create file", path));
+  }
+
+  std::shared_ptr<Segment> segment(
+      new Segment(id, path, fd, header, 0));
+  char buf[FILE_HEADER_SIZE];
+  header.encode(buf);
+  segment->append(buf, FILE_HEADER_SIZE);
+  segment->flush();
+  return segment;
+}
+
+std::shared_ptr<Segment> Segment::open(const std::string &path, uint32_t id) {
+  int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    throw SaaviException(errorString("failed to open file", path));
+  }
+
+  struct stat st;
+  char buf[FILE_HEADER_SIZE];
+  FileHeader header;
+  if (::fstat(fd, &st) != 0 || st.st_size < 0 ||
+      static_cast<uint64_t>(st.st_size) < FILE_HEADER_SIZE ||
+      ::pread(fd, buf, FILE_HEADER_SIZE, 0) != FILE_HEADER_SIZE ||
+      !FileHeader::decode(buf, header)) {
+    ::close(fd);
+    throw SaaviException("invalid data file '" + path + "'");
+  }
+  if (header.version > FORMAT_VERSION) {
+    ::close(fd);
+    throw SaaviException("unsupported format version in file '" + path + "'");
+  }
+
+  return std::shared_ptr<Segment>(new Segment(id, path, fd, header, st.st_size));
+}
+
+Segment::~Segment() { ::close(m_fd); }
+
+void Segment::append(const char *data, size_t length) {
+  m_pending.append(data, length);
+  m_size += length;
+  if (m_pending.length() >= SEGMENT_WRITE_BUFFER_SIZE) {
+    flush();
+  }
+}
+
+void Segment::flush() {
+  const char *data = m_pending.data();
+  size_t length = m_pending.length();
+  unsigned long offset = m_flushedSize;
+  while (length > 0) {
+    ssize_t written = ::pwrite(m_fd, data, length, offset);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // drop the partially written data so that the log stays consistent
+      const std::string error = errorString("failed to write file", path());
+      if (::ftruncate(m_fd, m_flushedSize) != 0) {
+        // nothing more to do - recovery will drop the torn record
+      }
+      m_pending.clear();
+      m_size.store(m_flushedSize);
+      throw SaaviException(error);
+    }
+    data += written;
+    length -= written;
+    offset += written;
+  }
+  m_flushedSize = offset;
+  m_pending.clear();
+}
+
+void Segment::read(unsigned long offset, size_t length,
+                   std::string &out) const {
+  out.resize(length);
+  size_t bytesRead = 0;
+  while (bytesRead < length) {
+    ssize_t n = ::pread(m_fd, &out[bytesRead], length - bytesRead,
+                        offset + bytesRead);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      throw SaaviException(errorString("failed to read file", path()));
+    }
+    bytesRead += n;
+  }
+}
+
+std::shared_ptr<const SegmentMapping> Segment::map(unsigned long end) {
+  auto mapping = std::atomic_load(&m_mapping);
+  if (mapping != nullptr && mapping->length() >= end) {
+    return mapping;
+  }
+
+  std::lock_guard<std::mutex> lock(m_mappingMutex);
+  // another reader might have remapped meanwhile
+  mapping = std::atomic_load(&m_mapping);
+  if (mapping != nullptr && mapping->length() >= end) {
+    return mapping;
+  }
+  // the old mapping stays valid for the readers still holding it
+  const size_t length = std::max<size_t>(
+      {end, m_flushedSize, MIN_MAPPING_SIZE,
+       mapping != nullptr ? 2 * mapping->length() : 0});
+  mapping = std::make_shared<const SegmentMapping>(m_fd, length, path());
+  std::atomic_store(&m_mapping, mapping);
+  return mapping;
+}
+
+void Segment::truncate(unsigned long size) {
+  if (::ftruncate(m_fd, size) != 0) {
+    throw SaaviException(errorString("failed to truncate file", path()));
+  }
+  std::atomic_store(&m_mapping, std::shared_ptr<const SegmentMapping>());
+  m_pending.clear();
+  m_size = size;
+  m_flushedSize = size;
+}
+
+void Segment::sync() {
+  if (::fdatasync(m_fd) != 0) {
+    throw SaaviException(errorString("failed to sync file", path()));
+  }
+}
+
+void Segment::rename(const std::string &newPath) {
+  // renames are serialised by the caller, only readers of the path race
+  const std::string oldPath = path();
+  if (std::rename(oldPath.c_str(), newPath.c_str()) != 0) {
+    throw SaaviException(errorString("failed to rename file", oldPath));
+  }
+  std::lock_guard<std::mutex> lock(m_pathMutex);
+  m_path = newPath;
+}
+
+void syncDirectory(const std::string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    throw SaaviException(errorString("failed to open directory", path));
+  }
+  int ret = ::fsync(fd);
+  ::close(fd);
+  if (ret != 0) {
+    throw SaaviException(errorString("failed to sync directory", path));
+  }
+}
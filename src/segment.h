@@ -0,0 +1,116 @@
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "record.h"
+
+// A read only memory mapping of a segment file. The mapped bytes stay
+// readable for as long as a reference to the mapping is held, even after the
+// segment has been remapped or its file deleted.
+class SegmentMapping {
+  char *m_data;
+  size_t m_length;
+
+ public:
+  // map the first length bytes of the file, which may extend past its
+  // current end as long as only the bytes within the file are read
+  SegmentMapping(int fd, size_t length, const std::string &path);
+  ~SegmentMapping();
+  SegmentMapping(const SegmentMapping &) = delete;
+  SegmentMapping &operator=(const SegmentMapping &) = delete;
+
+  const char *data() const { return m_data; }
+  size_t length() const { return m_length; }
+};
+
+// A single file of the log. Records are only ever appended to the active
+// segment; once it grows past the configured size it is sealed and never
+// written to again, until compaction replaces it.
+class Segment {
+  const uint32_t m_id;
+  // renamed by compaction while readers name it in their errors
+  std::string m_path;
+  mutable std::mutex m_pathMutex;
+  int m_fd;
+  FileHeader m_header;
+  // size of the segment including the appended data not yet written out
+  std::atomic<unsigned long> m_size;
+  // data appended but not yet written to the file and where it goes. The
+  // appends and flushes are serialised by the caller, but readers check the
+  // flushed size without holding the writer's lock.
+  std::string m_pending;
+  std::atomic<unsigned long> m_flushedSize;
+  // bytes of the records the index still points to
+  std::atomic<unsigned long> m_liveBytes{0};
+  // the latest mapping of the file, replaced by a larger one when a read
+  // goes past its end. Loaded and stored atomically, the mutex only
+  // serialises the remaps.
+  std::shared_ptr<const SegmentMapping> m_mapping;
+  std::mutex m_mappingMutex;
+
+  Segment(uint32_t id, const std::string &path, int fd,
+          const FileHeader &header, unsigned long size);
+
+ public:
+  // create a new segment file with the given header
+  static std::shared_ptr<Segment> create(const std::string &path, uint32_t id,
+                                         const FileHeader &header);
+  // open an existing segment file
+  static std::shared_ptr<Segment> open(const std::string &path, uint32_t id);
+  ~Segment();
+  Segment(const Segment &) = delete;
+  Segment &operator=(const Segment &) = delete;
+
+  uint32_t id() const { return m_id; }
+  std::string path() const {
+    std::lock_guard<std::mutex> lock(m_pathMutex);
+    return m_path;
+  }
+  int fd() const { return m_fd; }
+  const FileHeader &header() const { return m_header; }
+  unsigned long size() const { return m_size; }
+
+  unsigned long liveBytes() const { return m_liveBytes; }
+  void addLiveBytes(long bytes) { m_liveBytes += bytes; }
+  // bytes taken up by records that are no longer referenced
+  unsigned long deadBytes() const {
+    return m_size - FILE_HEADER_SIZE - m_liveBytes;
+  }
+
+  // bytes written to the file so far, the rest is still pending
+  unsigned long flushedSize() const { return m_flushedSize; }
+  size_t pendingBytes() const { return m_pending.length(); }
+
+  // append the data at the end of the segment. The data is buffered and
+  // only written to the file once enough of it has accumulated or when
+  // flush() is called.
+  void append(const char *data, size_t length);
+  void append(const std::string &data) { append(data.data(), data.length()); }
+  // write all the pending data to the file. If that fails the pending data
+  // is dropped and the segment ends where it was last flushed, so the
+  // caller has to forget the records it appended since.
+  void flush();
+  // read length bytes at offset into out, which must have been flushed
+  void read(unsigned long offset, size_t length, std::string &out) const;
+  // a mapping of the file covering at least the first end bytes, which must
+  // have been flushed. The file is remapped as it grows.
+  std::shared_ptr<const SegmentMapping> map(unsigned long end);
+  // drop everything after the given size
+  void truncate(unsigned long size);
+  // make the data flushed so far durable. This doesn't flush the pending
+  // data, so that it can be called without holding the lock the appends
+  // are made under.
+  void sync();
+  // atomically rename the segment file, replacing any file at newPath
+  void rename(const std::string &newPath);
+};
+
+// fsync a directory so that renames and deletions in it are durable
+void syncDirectory(const std::string &path);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef SHARDED_LOCK_H
+#define SHARDED_LOCK_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <shared_mutex>
+
+// A reader-writer lock for read mostly data. Every reader thread only ever
+// takes the shared lock of its own slot, so readers on different cores don't
+// fight over a single cache line. Writers take every slot exclusively, which
+// makes them more expensive - use it only where writes are rare.
+class ShardedSharedMutex {
+  static constexpr size_t NUM_SLOTS = 16;
+
+  struct alignas(64) Slot {
+    std::shared_mutex mutex;
+  };
+  std::array<Slot, NUM_SLOTS> slots;
+
+  // slot of the calling thread, assigned round robin on first use
+  static size_t threadSlot() {
+    static std::atomic<size_t> nextSlot{0};
+    thread_local const size_t slot = nextSlot++ % NUM_SLOTS;
+    return slot;
+  }
+
+ public:
+  void lock() {
+    for (auto &slot : slots) {
+      slot.mutex.lock();
+    }
+  }
+  void unlock() {
+    for (auto &slot : slots) {
+      slot.mutex.unlock();
+    }
+  }
+
+  void lock_shared() { slots[threadSlot()].mutex.lock_shared(); }
+  void unlock_shared() { slots[threadSlot()].mutex.unlock_shared(); }
+};
+
+#endif
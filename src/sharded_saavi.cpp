@@ -0,0 +1,338 @@
+#include "sharded_saavi.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+#include "record.h"
+#include "saavi_exception.h"
+
+namespace {
+
+/*
+ * Layout file (all integers little-endian):
+ *   magic "SAAVISHD" (8) | version (4) | shard count (4) | crc32c (4)
+ */
+constexpr char LAYOUT_MAGIC[8] = {'S', 'A', 'A', 'V', 'I', 'S', 'H', 'D'};
+constexpr uint32_t LAYOUT_VERSION = 1;
+constexpr size_t LAYOUT_SIZE = 20;
+
+std::filesystem::path directoryOf(const std::string &filename) {
+  auto directory = std::filesystem::path(filename).parent_path();
+  return directory.empty() ? std::filesystem::path(".") : directory;
+}
+
+std::string shardFilename(const std::string &filename, size_t shard) {
+  char suffix[16];
+  snprintf(suffix, sizeof(suffix), ".shard%03zu", shard);
+  return filename + suffix;
+}
+
+// the number of shards in the layout file, 0 if there is none
+size_t readLayout(const std::string &filename) {
+  std::ifstream in(filename, std::ios::in | std::ios::binary);
+  if (!in.is_open()) {
+    return 0;
+  }
+  const std::string data((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+  if (data.length() != LAYOUT_SIZE ||
+      std::memcmp(data.data(), LAYOUT_MAGIC, sizeof(LAYOUT_MAGIC)) != 0 ||
+      crc32c(data.data(), LAYOUT_SIZE - 4) !=
+          decodeFixed32(&data[LAYOUT_SIZE - 4])) {
+    throw SaaviException("'" + filename + "' is not a sharded store");
+  }
+  if (decodeFixed32(&data[8]) > LAYOUT_VERSION) {
+    throw SaaviException("unsupported layout version in '" + filename + "'");
+  }
+  return decodeFixed32(&data[12]);
+}
+
+// atomically create the layout file
+void writeLayout(const std::string &filename, size_t numShards) {
+  char data[LAYOUT_SIZE];
+  std::memcpy(data, LAYOUT_MAGIC, sizeof(LAYOUT_MAGIC));
+  encodeFixed32(&data[8], LAYOUT_VERSION);
+  encodeFixed32(&data[12], static_cast<uint32_t>(numShards));
+  encodeFixed32(&data[16], crc32c(data, LAYOUT_SIZE - 4));
+
+  const std::string tmpPath = filename + ".tmp";
+  int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                  0644);
+  if (fd < 0) {
+    throw SaaviException("failed to create file '" + tmpPath +
+                         "' : " + strerror(errno));
+  }
+  const bool failed =
+      ::write(fd, data, LAYOUT_SIZE) != static_cast<ssize_t>(LAYOUT_SIZE) ||
+      ::fdatasync(fd) != 0;
+  ::close(fd);
+  if (failed || std::rename(tmpPath.c_str(), filename.c_str()) != 0) {
+    throw SaaviException("failed to write file '" + filename + "'");
+  }
+  syncDirectory(directoryOf(filename).string());
+}
+
+void addCompactionStats(CompactionStats &total,
+                        const CompactionStats &stats) {
+  total.runs += stats.runs;
+  total.failures += stats.failures;
+  total.segmentsCompacted += stats.segmentsCompacted;
+  total.bytesRead += stats.bytesRead;
+  total.bytesWritten += stats.bytesWritten;
+  total.recordsKept += stats.recordsKept;
+  total.recordsDropped += stats.recordsDropped;
+  total.tombstonesDropped += stats.tombstonesDropped;
+  total.throttledTime += stats.throttledTime;
+  total.lastRunDuration = std::max(total.lastRunDuration,
+                                   stats.lastRunDuration);
+  total.blobFilesCollected += stats.blobFilesCollected;
+  total.blobBytesMoved += stats.blobBytesMoved;
+  total.blobBytesReclaimed += stats.blobBytesReclaimed;
+}
+
+void addLatencies(LatencyStats &total, const LatencyStats &stats) {
+  if (stats.count == 0) {
+    return;
+  }
+  total.mean = (total.mean * total.count + stats.mean * stats.count) /
+               (total.count + stats.count);
+  total.count += stats.count;
+  total.p50 = std::max(total.p50, stats.p50);
+  total.p99 = std::max(total.p99, stats.p99);
+  total.p999 = std::max(total.p999, stats.p999);
+  total.max = std::max(total.max, stats.max);
+}
+
+}  // namespace
+
+ShardedScanIterator::ShardedScanIterator(std::vector<ScanIterator> scans)
+    : m_scans(std::move(scans)) {
+  for (size_t i = 0; i < m_scans.size(); i++) {
+    if (m_scans[i] != FileIteratorEnd{}) {
+      m_heap.push_back(i);
+    }
+  }
+  std::make_heap(m_heap.begin(), m_heap.end(),
+                 [this](size_t a, size_t b) { return greater(a, b); });
+}
+
+ShardedScanIterator &ShardedScanIterator::operator++() {
+  // the shards have disjoint keys, so the scan with the smallest key just
+  // moves on
+  auto compare = [this](size_t a, size_t b) { return greater(a, b); };
+  std::pop_heap(m_heap.begin(), m_heap.end(), compare);
+  const size_t scan = m_heap.back();
+  m_heap.pop_back();
+  ++m_scans[scan];
+  if (m_scans[scan] != FileIteratorEnd{}) {
+    m_heap.push_back(scan);
+    std::push_heap(m_heap.begin(), m_heap.end(), compare);
+  }
+  return *this;
+}
+
+ShardedSaavi::ShardedSaavi(const std::string &filename, size_t numShards,
+                           const SaaviOptions &options)
+    : filename(filename) {
+  const size_t existing = readLayout(filename);
+  if (existing == 0 && numShards == 0) {
+    throw SaaviException("the number of shards is needed to create '" +
+                         filename + "'");
+  }
+  if (existing != 0 && numShards != 0 && existing != numShards) {
+    throw SaaviException("'" + filename + "' has " +
+                         std::to_string(existing) + " shards, not " +
+                         std::to_string(numShards));
+  }
+
+  const size_t count = existing != 0 ? existing : numShards;
+  for (size_t shard = 0; shard < count; shard++) {
+    shards.emplace_back(new Saavi(shardFilename(filename, shard), options));
+  }
+  if (existing == 0) {
+    // the store only exists once all of its shards do
+    writeLayout(filename, count);
+  }
+}
+
+void ShardedSaavi::Destroy(const std::string &filename) {
+  const std::string prefix =
+      std::filesystem::path(filename).filename().string() + ".shard";
+  for (const auto &file :
+       std::filesystem::directory_iterator(directoryOf(filename))) {
+    const std::string name = file.path().filename().string();
+    if (name.length() > prefix.length() &&
+        name.compare(0, prefix.length(), prefix) == 0 &&
+        std::all_of(name.begin() + prefix.length(), name.end(), ::isdigit)) {
+      Saavi::Destroy(file.path().string());
+    }
+  }
+  std::filesystem::remove(filename);
+  std::filesystem::remove(filename + ".tmp");
+}
+
+size_t ShardedSaavi::shardOf(const std::string &key) const {
+  return crc32c(key.data(), key.length()) % shards.size();
+}
+
+Saavi &ShardedSaavi::shardFor(const std::string &key) const {
+  return *shards[shardOf(key)];
+}
+
+void ShardedSaavi::Put(const std::string &key, const std::string &value) {
+  shardFor(key).Put(key, value);
+}
+
+const std::string ShardedSaavi::Get(const std::string &key) {
+  return shardFor(key).Get(key);
+}
+
+bool ShardedSaavi::Get(const std::string &key, PinnedValue &value) {
+  return shardFor(key).Get(key, value);
+}
+
+const std::vector<std::string> ShardedSaavi::MultiGet(
+    const std::vector<std::string> &keys) {
+  std::vector<PinnedValue> values;
+  MultiGet(keys, values);
+  std::vector<std::string> result;
+  result.reserve(values.size());
+  for (const auto &value : values) {
+    result.push_back(value.ToString());
+  }
+  return result;
+}
+
+std::vector<bool> ShardedSaavi::MultiGet(const std::vector<std::string> &keys,
+                                         std::vector<PinnedValue> &values) {
+  // split the keys by shard, remembering where each one came from
+  std::vector<std::vector<std::string>> shardKeys(shards.size());
+  std::vector<std::vector<size_t>> positions(shards.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    const size_t shard = shardOf(keys[i]);
+    shardKeys[shard].push_back(keys[i]);
+    positions[shard].push_back(i);
+  }
+
+  values.assign(keys.size(), PinnedValue());
+  std::vector<bool> found(keys.size(), false);
+  std::vector<PinnedValue> shardValues;
+  for (size_t shard = 0; shard < shards.size(); shard++) {
+    if (shardKeys[shard].empty()) {
+      continue;
+    }
+    const std::vector<bool> shardFound =
+        shards[shard]->MultiGet(shardKeys[shard], shardValues);
+    for (size_t i = 0; i < positions[shard].size(); i++) {
+      values[positions[shard][i]] = std::move(shardValues[i]);
+      found[positions[shard][i]] = shardFound[i];
+    }
+  }
+  return found;
+}
+
+void ShardedSaavi::Delete(const std::string &key) { shardFor(key).Delete(key); }
+
+void ShardedSaavi::Merge(const std::string &key, const std::string &operand) {
+  shardFor(key).Merge(key, operand);
+}
+
+void ShardedSaavi::Write(const WriteBatch &batch) {
+  // split the batch by shard
+  std::vector<WriteBatch> batches(shards.size());
+  RecordHeader header;
+  for (size_t position = 0; position < batch.rep.length();
+       position += header.recordSize()) {
+    RecordHeader::decode(&batch.rep[position], header);
+    const std::string key =
+        batch.rep.substr(position + RECORD_HEADER_SIZE, header.keyLength);
+    WriteBatch &shardBatch = batches[shardOf(key)];
+    if (header.flags & RECORD_FLAG_DELETION) {
+      shardBatch.Delete(key);
+    } else {
+      shardBatch.Put(key, batch.rep.substr(position + RECORD_HEADER_SIZE +
+                                               header.keyLength,
+                                           header.valueLength));
+    }
+  }
+  for (size_t shard = 0; shard < shards.size(); shard++) {
+    shards[shard]->Write(batches[shard]);
+  }
+}
+
+ShardedScanIterator ShardedSaavi::Scan(const std::string &start,
+                                       const std::string &end) {
+  std::vector<ScanIterator> scans;
+  for (auto &shard : shards) {
+    scans.push_back(shard->Scan(start, end));
+  }
+  return ShardedScanIterator(std::move(scans));
+}
+
+ShardedScanIterator ShardedSaavi::ScanPrefix(const std::string &prefix) {
+  std::vector<ScanIterator> scans;
+  for (auto &shard : shards) {
+    scans.push_back(shard->ScanPrefix(prefix));
+  }
+  return ShardedScanIterator(std::move(scans));
+}
+
+void ShardedSaavi::Compact() {
+  for (auto &shard : shards) {
+    shard->Compact();
+  }
+}
+
+CompactionStats ShardedSaavi::GetCompactionStats() {
+  CompactionStats total;
+  for (auto &shard : shards) {
+    addCompactionStats(total, shard->GetCompactionStats());
+  }
+  return total;
+}
+
+SaaviStats ShardedSaavi::GetStats() {
+  SaaviStats total;
+  for (auto &shard : shards) {
+    const SaaviStats stats = shard->GetStats();
+    total.gets += stats.gets;
+    total.getHits += stats.getHits;
+    total.puts += stats.puts;
+    total.deletes += stats.deletes;
+    total.merges += stats.merges;
+    total.batches += stats.batches;
+    total.batchOperations += stats.batchOperations;
+    total.scans += stats.scans;
+    total.bytesWritten += stats.bytesWritten;
+    total.bytesRead += stats.bytesRead;
+    addLatencies(total.getLatency, stats.getLatency);
+    addLatencies(total.multiGetLatency, stats.multiGetLatency);
+    addLatencies(total.putLatency, stats.putLatency);
+    addLatencies(total.deleteLatency, stats.deleteLatency);
+    addLatencies(total.writeLatency, stats.writeLatency);
+    addLatencies(total.mergeLatency, stats.mergeLatency);
+    total.keys += stats.keys;
+    total.indexMemory += stats.indexMemory;
+    total.logBytes += stats.logBytes;
+    total.logLiveBytes += stats.logLiveBytes;
+    total.blobBytes += stats.blobBytes;
+    total.blobLiveBytes += stats.blobLiveBytes;
+    // the shards are opened one after the other
+    total.recoveryDuration += stats.recoveryDuration;
+    addCompactionStats(total.compaction, stats.compaction);
+    total.cache.hits += stats.cache.hits;
+    total.cache.misses += stats.cache.misses;
+    total.cache.evictions += stats.cache.evictions;
+    total.cache.usedBytes += stats.cache.usedBytes;
+    total.cache.capacity += stats.cache.capacity;
+  }
+  return total;
+}
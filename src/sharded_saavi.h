@@ -0,0 +1,94 @@
+#ifndef SHARDED_SAAVI_H
+#define SHARDED_SAAVI_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "saavi.h"
+
+// Iterates over the live entries of a key range of all the shards in key
+// order, by merging the scans of the shards
+class ShardedScanIterator {
+ public:
+  explicit ShardedScanIterator(std::vector<ScanIterator> scans);
+
+  const std::pair<std::string, std::string> &operator*() const {
+    return *m_scans[m_heap.front()];
+  }
+
+  ShardedScanIterator &operator++();
+
+  bool operator!=(FileIteratorEnd) const { return !m_heap.empty(); }
+
+ private:
+  std::vector<ScanIterator> m_scans;
+  // min heap of the scans that have entries left, by their current key
+  std::vector<size_t> m_heap;
+  bool greater(size_t a, size_t b) const {
+    return (*m_scans[a]).first > (*m_scans[b]).first;
+  }
+};
+
+// A store split into a fixed number of independent Saavi instances, each
+// with its own log, index and writer, so that writes to different shards
+// run in parallel. Every key belongs to a single shard, picked by the
+// crc32c of the key, so single key operations only touch that shard.
+//
+// The shard count is chosen when the store is created and recorded in the
+// layout file, which is the file named by filename; the shards are kept in
+// filename.shardNNN. As the hash of a key never changes, a key is always in
+// the same shard and the store never has to be rebalanced.
+class ShardedSaavi {
+  std::string filename;
+  std::vector<std::unique_ptr<Saavi>> shards;
+
+  size_t shardOf(const std::string &key) const;
+  Saavi &shardFor(const std::string &key) const;
+
+ public:
+  // Open the store if it exists or else create it with numShards shards. A
+  // numShards of 0 opens an existing store with whatever number of shards
+  // it has, any other number has to match it.
+  ShardedSaavi(const std::string &filename, size_t numShards,
+               const SaaviOptions &options = SaaviOptions());
+
+  // Remove the layout file and all the shards
+  static void Destroy(const std::string &filename);
+
+  size_t NumShards() const { return shards.size(); }
+  // the store holding the keys of the shard
+  Saavi &Shard(size_t shard) { return *shards.at(shard); }
+
+  void Put(const std::string &key, const std::string &value);
+  const std::string Get(const std::string &key);
+  bool Get(const std::string &key, PinnedValue &value);
+  // Retrieve the values of the keys with a single MultiGet per shard
+  const std::vector<std::string> MultiGet(
+      const std::vector<std::string> &keys);
+  std::vector<bool> MultiGet(const std::vector<std::string> &keys,
+                             std::vector<PinnedValue> &values);
+  void Delete(const std::string &key);
+  void Merge(const std::string &key, const std::string &operand);
+  // Apply the operations of the batch. The operations of each shard are
+  // applied atomically, but not those of different shards together.
+  void Write(const WriteBatch &batch);
+
+  // Iterate over the entries with keys in [start, end) in key order. An
+  // empty end scans upto the last key.
+  ShardedScanIterator Scan(const std::string &start, const std::string &end);
+  ShardedScanIterator ScanPrefix(const std::string &prefix);
+  auto end() const { return FileIteratorEnd{}; }
+
+  // Compact every shard right away
+  void Compact();
+  // the compaction stats summed over the shards
+  CompactionStats GetCompactionStats();
+  // the stats summed over the shards. The latency percentiles are those of
+  // the slowest shard, an upper bound of the ones of the whole.
+  SaaviStats GetStats();
+};
+
+#endif
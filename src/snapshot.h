@@ -0,0 +1,33 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <cstdint>
+
+class Saavi;
+
+// A point in time view of a store, taken with Saavi::GetSnapshot. Reads made
+// against a snapshot see every write made before it was taken and none made
+// after. Taking one is cheap - it only notes down the sequence number of the
+// last write - but while it is alive the store has to keep the older versions
+// of the keys overwritten or deleted since, so drop it once done with it. A
+// snapshot must not outlive its store.
+class Snapshot {
+  Saavi *saavi;
+  uint64_t sequence;
+
+  Snapshot(Saavi *saavi, uint64_t sequence)
+      : saavi(saavi), sequence(sequence) {}
+
+ public:
+  // releases the snapshot
+  ~Snapshot();
+  Snapshot(const Snapshot &) = delete;
+  Snapshot &operator=(const Snapshot &) = delete;
+
+  // sequence number of the last write the snapshot sees
+  uint64_t Sequence() const { return sequence; }
+
+  friend class Saavi;
+};
+
+#endif
@@ -0,0 +1,316 @@
+#include "sorted_run.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "compression.h"
+#include "record.h"
+#include "saavi_exception.h"
+
+namespace {
+
+// an entry of a block, decoded in place
+struct BlockEntry {
+  std::string_view key;
+  std::string_view value;
+  bool deleted;
+  // offset of the entry after this one
+  size_t next;
+};
+
+bool decodeEntry(const std::string &block, size_t position,
+                 BlockEntry &entry) {
+  if (block.length() - position < RUN_ENTRY_HEADER_SIZE) {
+    return false;
+  }
+  const char *data = block.data() + position;
+  const uint32_t keyLength = decodeFixed32(data);
+  const uint32_t valueLength = decodeFixed32(data + 4);
+  const size_t entrySize =
+      RUN_ENTRY_HEADER_SIZE + uint64_t(keyLength) + valueLength;
+  if (block.length() - position < entrySize) {
+    return false;
+  }
+  entry.key = std::string_view(data + RUN_ENTRY_HEADER_SIZE, keyLength);
+  entry.value = std::string_view(data + RUN_ENTRY_HEADER_SIZE + keyLength,
+                                 valueLength);
+  entry.deleted = data[8] == RUN_ENTRY_DELETION;
+  entry.next = position + entrySize;
+  return true;
+}
+
+}  // namespace
+
+SortedRun::SortedRun(std::shared_ptr<Segment> file) : m_file(std::move(file)) {}
+
+std::shared_ptr<SortedRun> SortedRun::open(const std::string &path,
+                                           uint32_t id) {
+  std::shared_ptr<SortedRun> run(new SortedRun(Segment::open(path, id)));
+  const std::string corrupt = "corrupt sorted run '" + path + "'";
+  const unsigned long fileSize = run->fileSize();
+  if ((run->m_file->header().flags & FILE_FLAG_SORTED_RUN) == 0 ||
+      fileSize < FILE_HEADER_SIZE + RUN_FOOTER_SIZE) {
+    throw SaaviException(corrupt);
+  }
+
+  std::string footer;
+  run->m_file->read(fileSize - RUN_FOOTER_SIZE, RUN_FOOTER_SIZE, footer);
+  const uint64_t indexOffset = decodeFixed64(&footer[0]);
+  const uint64_t indexSize = decodeFixed64(&footer[8]);
+  const uint64_t filterOffset = decodeFixed64(&footer[16]);
+  const uint64_t filterSize = decodeFixed64(&footer[24]);
+  if (indexOffset < FILE_HEADER_SIZE ||
+      filterOffset != indexOffset + indexSize ||
+      filterOffset + filterSize != fileSize - RUN_FOOTER_SIZE) {
+    throw SaaviException(corrupt);
+  }
+  run->m_entries = decodeFixed64(&footer[32]);
+
+  // the index and the filter are read and checksummed together
+  std::string meta;
+  run->m_file->read(indexOffset, indexSize + filterSize, meta);
+  uint32_t crc = crc32c(meta.data(), meta.length());
+  crc = crc32c(footer.data(), 40, crc);
+  if (crc != decodeFixed32(&footer[40])) {
+    throw SaaviException(corrupt);
+  }
+
+  size_t position = 8;
+  if (indexSize < position) {
+    throw SaaviException(corrupt);
+  }
+  const uint32_t numBlocks = decodeFixed32(&meta[0]);
+  const uint32_t firstKeyLength = decodeFixed32(&meta[4]);
+  if (numBlocks == 0 || indexSize - position < firstKeyLength) {
+    throw SaaviException(corrupt);
+  }
+  run->m_smallest.assign(&meta[position], firstKeyLength);
+  position += firstKeyLength;
+  run->m_blocks.reserve(numBlocks);
+  for (uint32_t i = 0; i < numBlocks; i++) {
+    if (indexSize - position < 16) {
+      throw SaaviException(corrupt);
+    }
+    BlockHandle block;
+    block.offset = decodeFixed64(&meta[position]);
+    block.size = decodeFixed32(&meta[position + 8]);
+    const uint32_t keyLength = decodeFixed32(&meta[position + 12]);
+    position += 16;
+    if (indexSize - position < keyLength ||
+        block.offset + block.size + 4 > indexOffset) {
+      throw SaaviException(corrupt);
+    }
+    block.lastKey.assign(&meta[position], keyLength);
+    position += keyLength;
+    run->m_blocks.push_back(std::move(block));
+  }
+  run->m_filter = BloomFilter(meta.substr(indexSize));
+  return run;
+}
+
+size_t SortedRun::indexMemoryUsage() const {
+  size_t bytes = m_blocks.capacity() * sizeof(BlockHandle) +
+                 m_smallest.capacity();
+  for (const auto &block : m_blocks) {
+    // only keys too long for the small string buffer are allocated
+    if (block.lastKey.capacity() > 15) {
+      bytes += block.lastKey.capacity() + 1;
+    }
+  }
+  return bytes;
+}
+
+size_t SortedRun::findBlock(std::string_view key) const {
+  return std::lower_bound(m_blocks.begin(), m_blocks.end(), key,
+                          [](const BlockHandle &block, std::string_view key) {
+                            return block.lastKey < key;
+                          }) -
+         m_blocks.begin();
+}
+
+std::shared_ptr<const std::string> SortedRun::readBlock(size_t index) const {
+  const BlockHandle &handle = m_blocks[index];
+  auto block = std::make_shared<std::string>();
+  m_file->read(handle.offset, handle.size + 4, *block);
+  if (crc32c(block->data(), handle.size) !=
+      decodeFixed32(block->data() + handle.size)) {
+    throw SaaviException("corrupt block in sorted run '" + path() + "'");
+  }
+  if (m_file->header().version < 3) {
+    block->resize(handle.size);
+    return block;
+  }
+
+  // the codec is the last byte before the checksum
+  if (handle.size == 0) {
+    throw SaaviException("corrupt block in sorted run '" + path() + "'");
+  }
+  const auto codec = static_cast<Compression>((*block)[handle.size - 1]);
+  if (codec == Compression::None) {
+    block->resize(handle.size - 1);
+    return block;
+  }
+  auto entries = std::make_shared<std::string>();
+  decompress(codec, std::string_view(*block).substr(0, handle.size - 1),
+             *entries);
+  return entries;
+}
+
+SortedRun::Lookup SortedRun::get(std::string_view key,
+                                 std::shared_ptr<const std::string> &block,
+                                 std::string_view &value) const {
+  if (!covers(key) || !m_filter.mayContain(key)) {
+    return Lookup::NotFound;
+  }
+  const size_t index = findBlock(key);
+  if (index == m_blocks.size()) {
+    return Lookup::NotFound;
+  }
+
+  auto data = readBlock(index);
+  BlockEntry entry;
+  for (size_t position = 0; decodeEntry(*data, position, entry);
+       position = entry.next) {
+    if (entry.key < key) {
+      continue;
+    }
+    if (entry.key > key) {
+      break;
+    }
+    if (entry.deleted) {
+      return Lookup::Deleted;
+    }
+    value = entry.value;
+    block = std::move(data);
+    return Lookup::Found;
+  }
+  return Lookup::NotFound;
+}
+
+SortedRunIterator::SortedRunIterator(std::shared_ptr<const SortedRun> run)
+    : m_run(std::move(run)) {}
+
+void SortedRunIterator::seekToFirst() {
+  m_block = 0;
+  loadBlock();
+}
+
+void SortedRunIterator::loadBlock() {
+  m_position = 0;
+  if (m_block >= m_run->numBlocks()) {
+    m_data.reset();
+    m_valid = false;
+    return;
+  }
+  m_data = m_run->readBlock(m_block);
+  readEntry();
+}
+
+void SortedRunIterator::readEntry() {
+  BlockEntry entry;
+  if (!decodeEntry(*m_data, m_position, entry)) {
+    // the end of the block
+    m_block++;
+    loadBlock();
+    return;
+  }
+  m_key = entry.key;
+  m_value = entry.value;
+  m_deleted = entry.deleted;
+  m_valid = true;
+}
+
+void SortedRunIterator::seek(std::string_view key) {
+  m_block = m_run->findBlock(key);
+  loadBlock();
+  while (m_valid && m_key < key) {
+    next();
+  }
+}
+
+void SortedRunIterator::next() {
+  m_position += RUN_ENTRY_HEADER_SIZE + m_key.length() + m_value.length();
+  readEntry();
+}
+
+SortedRunWriter::SortedRunWriter(const std::string &path, uint32_t id,
+                                 int bitsPerKey, Compression compression)
+    : m_bitsPerKey(bitsPerKey), m_compression(compression) {
+  FileHeader header;
+  header.flags = FILE_FLAG_SORTED_RUN;
+  m_file = Segment::create(path, id, header);
+}
+
+void SortedRunWriter::add(std::string_view key, std::string_view value,
+                          bool deleted) {
+  if (m_hashes.empty()) {
+    m_firstKey.assign(key);
+  }
+  const size_t start = m_block.length();
+  m_block.resize(start + RUN_ENTRY_HEADER_SIZE);
+  encodeFixed32(&m_block[start], static_cast<uint32_t>(key.length()));
+  encodeFixed32(&m_block[start + 4], static_cast<uint32_t>(value.length()));
+  m_block[start + 8] =
+      static_cast<char>(deleted ? RUN_ENTRY_DELETION : RUN_ENTRY_VALUE);
+  m_block.append(key);
+  m_block.append(value);
+  m_lastKey.assign(key);
+  m_hashes.push_back(BloomFilter::hash(key));
+
+  if (m_block.length() >= RUN_BLOCK_SIZE) {
+    finishBlock();
+  }
+}
+
+void SortedRunWriter::finishBlock() {
+  if (m_block.empty()) {
+    return;
+  }
+  std::string compressed;
+  Compression codec = Compression::None;
+  if (compress(m_compression, m_block, compressed)) {
+    m_block.swap(compressed);
+    codec = m_compression;
+  }
+  m_block.push_back(static_cast<char>(codec));
+
+  char buf[16];
+  encodeFixed64(buf, m_file->size());
+  encodeFixed32(buf + 8, static_cast<uint32_t>(m_block.length()));
+  encodeFixed32(buf + 12, static_cast<uint32_t>(m_lastKey.length()));
+  m_index.append(buf, sizeof(buf));
+  m_index.append(m_lastKey);
+  m_numBlocks++;
+
+  encodeFixed32(buf, crc32c(m_block.data(), m_block.length()));
+  m_block.append(buf, 4);
+  m_file->append(m_block);
+  m_block.clear();
+}
+
+std::shared_ptr<SortedRun> SortedRunWriter::finish() {
+  finishBlock();
+
+  std::string meta(8, '\0');
+  encodeFixed32(&meta[0], m_numBlocks);
+  encodeFixed32(&meta[4], static_cast<uint32_t>(m_firstKey.length()));
+  meta.append(m_firstKey);
+  meta.append(m_index);
+  const uint64_t indexSize = meta.length();
+  meta.append(BloomFilter::build(m_hashes, m_bitsPerKey));
+
+  char footer[RUN_FOOTER_SIZE] = {};
+  const uint64_t indexOffset = m_file->size();
+  encodeFixed64(footer, indexOffset);
+  encodeFixed64(footer + 8, indexSize);
+  encodeFixed64(footer + 16, indexOffset + indexSize);
+  encodeFixed64(footer + 24, meta.length() - indexSize);
+  encodeFixed64(footer + 32, m_hashes.size());
+  uint32_t crc = crc32c(meta.data(), meta.length());
+  encodeFixed32(footer + 40, crc32c(footer, 40, crc));
+  m_file->append(meta);
+  m_file->append(footer, RUN_FOOTER_SIZE);
+  m_file->flush();
+  m_file->sync();
+  return SortedRun::open(m_file->path(), m_file->id());
+}
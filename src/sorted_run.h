@@ -0,0 +1,176 @@
+#ifndef SORTED_RUN_H
+#define SORTED_RUN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bloom_filter.h"
+#include "saavi_options.h"
+#include "segment.h"
+
+/*
+ * On-disk layout of a sorted run, the immutable file the LSM engine writes
+ * its memtable and compaction output to.
+ *
+ * A run starts with the same 32 byte file header as a data file, with
+ * FILE_FLAG_SORTED_RUN set in its flags, followed by the data blocks, the
+ * index, the Bloom filter and a fixed size footer. All integers are stored
+ * little-endian.
+ *
+ * Data block (about RUN_BLOCK_SIZE bytes of entries in key order):
+ *   entries : key length (4) | value length (4) | type (1) | key | value
+ *   codec (1) | crc32c of the entries and the codec (4)
+ *
+ * The entries of a block are stored compressed with the codec, unless it is
+ * Compression::None. The size of a block in the index covers the entries
+ * as stored and the codec. Runs before format version 3 have no codec.
+ *
+ * Index:
+ *   block count (4) | first key length (4) | first key of the run
+ *   blocks : offset (8) | size (4) | last key length (4) | last key
+ *
+ * Footer (48 bytes):
+ *   index offset (8) | index size (8) | filter offset (8) |
+ *   filter size (8) | entry count (8) |
+ *   crc32c of the index, the filter and the footer before it (4) |
+ *   reserved (4)
+ *
+ * Only the index and the filter are kept in memory once a run is opened, so
+ * the memory a run takes up grows with its number of blocks rather than its
+ * number of keys.
+ */
+
+constexpr uint32_t FILE_FLAG_SORTED_RUN = 1 << 0;
+constexpr size_t RUN_BLOCK_SIZE = 4096;
+constexpr size_t RUN_ENTRY_HEADER_SIZE = 9;
+constexpr size_t RUN_FOOTER_SIZE = 48;
+
+// type of an entry in a sorted run
+enum RunEntryType : uint8_t {
+  RUN_ENTRY_VALUE = 0,
+  // the key was deleted - shadows the older runs until compaction drops it
+  RUN_ENTRY_DELETION = 1,
+};
+
+class SortedRun {
+  struct BlockHandle {
+    std::string lastKey;
+    uint64_t offset;
+    uint32_t size;
+  };
+
+  std::shared_ptr<Segment> m_file;
+  std::vector<BlockHandle> m_blocks;
+  std::string m_smallest;
+  BloomFilter m_filter;
+  uint64_t m_entries{0};
+
+  explicit SortedRun(std::shared_ptr<Segment> file);
+
+ public:
+  // open a complete run file, throws if it is not one
+  static std::shared_ptr<SortedRun> open(const std::string &path, uint32_t id);
+  SortedRun(const SortedRun &) = delete;
+  SortedRun &operator=(const SortedRun &) = delete;
+
+  enum class Lookup { NotFound, Found, Deleted };
+
+  uint32_t id() const { return m_file->id(); }
+  std::string path() const { return m_file->path(); }
+  unsigned long fileSize() const { return m_file->size(); }
+  uint64_t entries() const { return m_entries; }
+  const std::string &smallest() const { return m_smallest; }
+  const std::string &largest() const { return m_blocks.back().lastKey; }
+  size_t numBlocks() const { return m_blocks.size(); }
+  // bytes taken up in memory by the index and the filter
+  size_t indexMemoryUsage() const;
+  size_t filterMemoryUsage() const { return m_filter.memoryUsage(); }
+
+  // whether the key falls into the key range of the run
+  bool covers(std::string_view key) const {
+    return key >= m_smallest && key <= largest();
+  }
+  // whether any key in [smallest, largest] may be in the run
+  bool overlaps(std::string_view smallest, std::string_view largest) const {
+    return !(largest < m_smallest || smallest > this->largest());
+  }
+
+  // look the key up, reading at most a single block. If found the value
+  // points into block.
+  Lookup get(std::string_view key, std::shared_ptr<const std::string> &block,
+             std::string_view &value) const;
+
+  // the index of the first block whose last key is not less than key,
+  // numBlocks() if there is none
+  size_t findBlock(std::string_view key) const;
+  // read, verify and decompress the entries of a block
+  std::shared_ptr<const std::string> readBlock(size_t index) const;
+};
+
+// Iterates over the entries of a run in key order, one block at a time
+class SortedRunIterator {
+  std::shared_ptr<const SortedRun> m_run;
+  size_t m_block{0};
+  std::shared_ptr<const std::string> m_data;
+  size_t m_position{0};
+  std::string_view m_key;
+  std::string_view m_value;
+  bool m_deleted{false};
+  bool m_valid{false};
+
+  // load the block at m_block and position on its first entry
+  void loadBlock();
+  // decode the entry at m_position, moving to the next block at the end
+  void readEntry();
+
+ public:
+  // the iterator is not valid until positioned with one of the seeks
+  explicit SortedRunIterator(std::shared_ptr<const SortedRun> run);
+
+  void seekToFirst();
+  // move to the first entry with a key not less than key
+  void seek(std::string_view key);
+  bool valid() const { return m_valid; }
+  void next();
+
+  // the current entry - valid until the iterator moves
+  std::string_view key() const { return m_key; }
+  std::string_view value() const { return m_value; }
+  bool deleted() const { return m_deleted; }
+};
+
+// Writes the entries given in key order into a new run file
+class SortedRunWriter {
+  std::shared_ptr<Segment> m_file;
+  int m_bitsPerKey;
+  Compression m_compression;
+  std::string m_block;
+  std::string m_index;
+  std::string m_firstKey;
+  std::string m_lastKey;
+  uint32_t m_numBlocks{0};
+  std::vector<uint64_t> m_hashes;
+
+  // write out the current block and add it to the index
+  void finishBlock();
+
+ public:
+  SortedRunWriter(const std::string &path, uint32_t id, int bitsPerKey,
+                  Compression compression = Compression::None);
+
+  // keys must be added in strictly increasing order
+  void add(std::string_view key, std::string_view value, bool deleted);
+  uint64_t entries() const { return m_hashes.size(); }
+  // approximate size of the run written so far
+  unsigned long size() const { return m_file->size() + m_block.length(); }
+
+  // write the index, the filter and the footer, make the file durable and
+  // open it as a run. At least one entry must have been added.
+  std::shared_ptr<SortedRun> finish();
+};
+
+#endif
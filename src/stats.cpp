@@ -0,0 +1,205 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
+StatsRecorder::StatsRecorder(bool timed) {
+  if (timed) {
+    histograms.reset(new Histogram[NUM_STRIPES * NUM_OF_TIMED_OPERATIONS]);
+  }
+}
+
+void StatsRecorder::recordLatency(TimedOperation operation, uint64_t nanos) {
+  Histogram &histogram =
+      histograms[threadSlot() * NUM_OF_TIMED_OPERATIONS +
+                 static_cast<size_t>(operation)];
+  histogram.counts[LatencyHistogram::bucketOf(nanos)].fetch_add(
+      1, std::memory_order_relaxed);
+  histogram.sum.fetch_add(nanos, std::memory_order_relaxed);
+  uint64_t max = histogram.max.load(std::memory_order_relaxed);
+  while (nanos > max && !histogram.max.compare_exchange_weak(
+                            max, nanos, std::memory_order_relaxed)) {
+  }
+}
+
+LatencyStats StatsRecorder::latencies(TimedOperation operation) const {
+  LatencyStats stats;
+  if (!timed()) {
+    return stats;
+  }
+  LatencyHistogram merged;
+  std::vector<uint64_t> counts(LatencyHistogram::NUM_OF_BUCKETS);
+  for (size_t s = 0; s < NUM_STRIPES; s++) {
+    const Histogram &histogram =
+        histograms[s * NUM_OF_TIMED_OPERATIONS +
+                   static_cast<size_t>(operation)];
+    for (size_t i = 0; i < counts.size(); i++) {
+      counts[i] = histogram.counts[i].load(std::memory_order_relaxed);
+    }
+    merged.add(counts.data(), histogram.sum.load(std::memory_order_relaxed),
+               histogram.max.load(std::memory_order_relaxed));
+  }
+  stats.count = merged.count();
+  if (stats.count == 0) {
+    return stats;
+  }
+  stats.mean = merged.mean();
+  stats.max = merged.max();
+  stats.p50 = merged.percentile(50);
+  stats.p99 = merged.percentile(99);
+  stats.p999 = merged.percentile(99.9);
+  return stats;
+}
+
+void StatsRecorder::collect(SaaviStats &stats) const {
+  uint64_t tickers[NUM_OF_TICKERS] = {};
+  for (const Stripe &stripe : stripes) {
+    for (size_t t = 0; t < NUM_OF_TICKERS; t++) {
+      tickers[t] += stripe.tickers[t].load(std::memory_order_relaxed);
+    }
+  }
+  auto ticker = [&tickers](Ticker t) {
+    return tickers[static_cast<size_t>(t)];
+  };
+  stats.gets = ticker(Ticker::Gets);
+  stats.getHits = ticker(Ticker::GetHits);
+  stats.puts = ticker(Ticker::Puts);
+  stats.deletes = ticker(Ticker::Deletes);
+  stats.batches = ticker(Ticker::Batches);
+  stats.batchOperations = ticker(Ticker::BatchOperations);
+  stats.scans = ticker(Ticker::Scans);
+  stats.bytesWritten = ticker(Ticker::BytesWritten);
+  stats.bytesRead = ticker(Ticker::BytesRead);
+  stats.merges = ticker(Ticker::Merges);
+
+  stats.getLatency = latencies(TimedOperation::Get);
+  stats.multiGetLatency = latencies(TimedOperation::MultiGet);
+  stats.putLatency = latencies(TimedOperation::Put);
+  stats.deleteLatency = latencies(TimedOperation::Delete);
+  stats.writeLatency = latencies(TimedOperation::Write);
+  stats.mergeLatency = latencies(TimedOperation::Merge);
+}
+
+namespace {
+
+// writes the metrics, each with its HELP and TYPE lines
+class PrometheusWriter {
+  std::ostringstream out;
+  const std::string &prefix;
+
+  void header(const std::string &name, const char *type, const char *help) {
+    out << "# HELP " << prefix << "_" << name << " " << help << "\n"
+        << "# TYPE " << prefix << "_" << name << " " << type << "\n";
+  }
+
+ public:
+  explicit PrometheusWriter(const std::string &prefix) : prefix(prefix) {}
+
+  template <typename T>
+  void metric(const std::string &name, const char *type, const char *help,
+              T value) {
+    header(name, type, help);
+    out << prefix << "_" << name << " " << value << "\n";
+  }
+
+  void counter(const std::string &name, const char *help, uint64_t value) {
+    metric(name + "_total", "counter", help, value);
+  }
+
+  template <typename T>
+  void gauge(const std::string &name, const char *help, T value) {
+    metric(name, "gauge", help, value);
+  }
+
+  // the latencies of the operations as a summary in seconds
+  void latencies(
+      const std::pair<const char *, const LatencyStats *> (&operations)[6]) {
+    const std::string name = "operation_latency_seconds";
+    header(name, "summary", "Latencies of the operations.");
+    for (const auto &operation : operations) {
+      const LatencyStats &stats = *operation.second;
+      const std::string labels =
+          std::string("operation=\"") + operation.first + "\"";
+      const std::pair<const char *, uint64_t> quantiles[] = {
+          {"0.5", stats.p50}, {"0.99", stats.p99}, {"0.999", stats.p999}};
+      for (const auto &quantile : quantiles) {
+        out << prefix << "_" << name << "{" << labels << ",quantile=\""
+            << quantile.first << "\"} " << quantile.second / 1e9 << "\n";
+      }
+      out << prefix << "_" << name << "_sum{" << labels << "} "
+          << stats.mean * stats.count / 1e9 << "\n"
+          << prefix << "_" << name << "_count{" << labels << "} "
+          << stats.count << "\n";
+    }
+  }
+
+  std::string str() const { return out.str(); }
+};
+
+}  // namespace
+
+std::string StatsToPrometheus(const SaaviStats &stats,
+                              const std::string &prefix) {
+  PrometheusWriter writer(prefix);
+  writer.counter("gets", "Keys looked up.", stats.gets);
+  writer.counter("get_hits", "Keys looked up that were found.",
+                 stats.getHits);
+  writer.counter("puts", "Keys written by Put.", stats.puts);
+  writer.counter("deletes", "Keys deleted by Delete.", stats.deletes);
+  writer.counter("merges", "Operands written by Merge.", stats.merges);
+  writer.counter("batches", "Batches written.", stats.batches);
+  writer.counter("batch_operations", "Operations of the batches written.",
+                 stats.batchOperations);
+  writer.counter("scans", "Scans started.", stats.scans);
+  writer.counter("written_bytes", "Bytes of the keys and values written.",
+                 stats.bytesWritten);
+  writer.counter("read_bytes", "Bytes of the values read.", stats.bytesRead);
+  writer.latencies({{"get", &stats.getLatency},
+                    {"multiget", &stats.multiGetLatency},
+                    {"put", &stats.putLatency},
+                    {"delete", &stats.deleteLatency},
+                    {"write", &stats.writeLatency},
+                    {"merge", &stats.mergeLatency}});
+
+  writer.gauge("keys", "Keys in the index.", stats.keys);
+  writer.gauge("index_memory_bytes", "Memory taken up by the index.",
+               stats.indexMemory);
+  writer.gauge("log_bytes", "Bytes of the log on disk.", stats.logBytes);
+  writer.gauge("log_live_bytes", "Bytes of the live records of the log.",
+               stats.logLiveBytes);
+  writer.gauge("blob_bytes", "Bytes of the blob files on disk.",
+               stats.blobBytes);
+  writer.gauge("blob_live_bytes", "Bytes of the live blobs.",
+               stats.blobLiveBytes);
+  writer.gauge("recovery_duration_seconds", "Time it took to open the store.",
+               stats.recoveryDuration.count() / 1e6);
+
+  const CompactionStats &compaction = stats.compaction;
+  writer.counter("compaction_runs", "Compaction runs.", compaction.runs);
+  writer.counter("compaction_failures", "Compaction runs that failed.",
+                 compaction.failures);
+  writer.counter("compaction_read_bytes", "Bytes read by compaction.",
+                 compaction.bytesRead);
+  writer.counter("compaction_written_bytes", "Bytes written by compaction.",
+                 compaction.bytesWritten);
+  writer.counter("compaction_dropped_records",
+                 "Overwritten and deleted records reclaimed.",
+                 compaction.recordsDropped);
+  writer.counter("blob_files_collected", "Blob files garbage collected.",
+                 compaction.blobFilesCollected);
+  writer.counter("blob_moved_bytes",
+                 "Bytes of live blobs moved by garbage collection.",
+                 compaction.blobBytesMoved);
+
+  const CacheStats &cache = stats.cache;
+  writer.counter("cache_hits", "Value cache hits.", cache.hits);
+  writer.counter("cache_misses", "Value cache misses.", cache.misses);
+  writer.counter("cache_evictions", "Value cache evictions.",
+                 cache.evictions);
+  writer.gauge("cache_used_bytes", "Bytes taken up by the cached values.",
+               cache.usedBytes);
+  writer.gauge("cache_capacity_bytes", "Capacity of the value cache.",
+               cache.capacity);
+  return writer.str();
+}
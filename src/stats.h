@@ -0,0 +1,116 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "histogram.h"
+#include "saavi_options.h"
+
+// the counters of a store
+enum class Ticker {
+  Gets,
+  GetHits,
+  Puts,
+  Deletes,
+  Batches,
+  BatchOperations,
+  Scans,
+  BytesWritten,
+  BytesRead,
+  Merges,
+};
+constexpr size_t NUM_OF_TICKERS = 10;
+
+// the operations that are timed
+enum class TimedOperation { Get, MultiGet, Put, Delete, Write, Merge };
+constexpr size_t NUM_OF_TIMED_OPERATIONS = 6;
+
+// Counts the operations of a store and times them if asked to. Every
+// thread only ever counts into the stripe of its own slot, on cache lines of
+// its own, so threads on different cores don't bounce the counters between
+// their caches. Reading the statistics adds up the stripes.
+//
+// The latencies go into the buckets of LatencyHistogram, counted atomically
+// per stripe and added up into a LatencyHistogram when read.
+class StatsRecorder {
+ public:
+  explicit StatsRecorder(bool timed);
+
+  void count(Ticker ticker, uint64_t n = 1) {
+    stripe().tickers[static_cast<size_t>(ticker)].fetch_add(
+        n, std::memory_order_relaxed);
+  }
+
+  bool timed() const { return histograms != nullptr; }
+  void recordLatency(TimedOperation operation, uint64_t nanos);
+
+  // add up the stripes into the statistics
+  void collect(SaaviStats &stats) const;
+
+ private:
+  static constexpr size_t NUM_STRIPES = 16;
+
+  struct alignas(64) Stripe {
+    std::atomic<uint64_t> tickers[NUM_OF_TICKERS]{};
+  };
+  struct alignas(64) Histogram {
+    std::atomic<uint64_t> counts[LatencyHistogram::NUM_OF_BUCKETS]{};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> max{0};
+  };
+
+  std::array<Stripe, NUM_STRIPES> stripes;
+  // NUM_OF_TIMED_OPERATIONS histograms per stripe, nullptr unless timed
+  std::unique_ptr<Histogram[]> histograms;
+
+  // slot of the calling thread, assigned round robin on first use
+  static size_t threadSlot() {
+    static std::atomic<size_t> nextSlot{0};
+    thread_local const size_t slot = nextSlot++ % NUM_STRIPES;
+    return slot;
+  }
+  Stripe &stripe() { return stripes[threadSlot()]; }
+  LatencyStats latencies(TimedOperation operation) const;
+};
+
+// Times an operation from construction to destruction if the recorder,
+// which may be nullptr, times operations
+class StatsTimer {
+  StatsRecorder *recorder;
+  TimedOperation operation;
+  std::chrono::steady_clock::time_point start;
+
+ public:
+  StatsTimer(StatsRecorder *recorder, TimedOperation operation)
+      : recorder(recorder != nullptr && recorder->timed() ? recorder
+                                                          : nullptr),
+        operation(operation) {
+    if (this->recorder != nullptr) {
+      start = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~StatsTimer() {
+    if (recorder != nullptr) {
+      recorder->recordLatency(
+          operation, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - start)
+                         .count());
+    }
+  }
+
+  StatsTimer(const StatsTimer &) = delete;
+  StatsTimer &operator=(const StatsTimer &) = delete;
+};
+
+// The statistics in the Prometheus text exposition format, with every
+// metric name starting with the prefix
+std::string StatsToPrometheus(const SaaviStats &stats,
+                              const std::string &prefix = "saavi");
+
+#endif
@@ -0,0 +1,144 @@
+#include "value_cache.h"
+
+namespace {
+
+// rough memory overhead of an entry beyond its key and value - the map
+// node, the clock slot and the shared value
+const size_t ENTRY_OVERHEAD = 96;
+
+}  // namespace
+
+ValueCache::ValueCache(size_t capacity)
+    : shardCapacity(capacity / NUM_SHARDS) {}
+
+size_t ValueCache::charge(size_t keyLength, size_t valueLength) {
+  return keyLength + valueLength + ENTRY_OVERHEAD;
+}
+
+void ValueCache::remove(Shard &shard, EntryMap::iterator it) {
+  const Entry &entry = it->second;
+  shard.usedBytes -= charge(it->first.length(), entry.value->length());
+
+  // fill the hole in the clock with its last entry
+  const size_t position = entry.position;
+  if (position != shard.clock.size() - 1) {
+    shard.clock[position] = shard.clock.back();
+    shard.clock[position]->second.position = position;
+  }
+  shard.clock.pop_back();
+  shard.entries.erase(it);
+}
+
+void ValueCache::evict(Shard &shard, size_t bytes) {
+  while (shard.usedBytes + bytes > shardCapacity && !shard.clock.empty()) {
+    if (shard.hand >= shard.clock.size()) {
+      shard.hand = 0;
+    }
+    Entry &entry = shard.clock[shard.hand]->second;
+    if (entry.referenced) {
+      // used since the hand last came by - give it another round
+      entry.referenced = false;
+      shard.hand++;
+      continue;
+    }
+    remove(shard, shard.entries.find(shard.clock[shard.hand]->first));
+    shard.evictions++;
+  }
+}
+
+std::shared_ptr<const std::string> ValueCache::get(const std::string &key) {
+  Shard &shard = shardFor(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.entries.find(key);
+  if (it == shard.entries.end()) {
+    shard.misses++;
+    return nullptr;
+  }
+
+  shard.hits++;
+  it->second.referenced = true;
+  return it->second.value;
+}
+
+void ValueCache::insert(const std::string &key,
+                        std::shared_ptr<const std::string> value,
+                        uint64_t sequence) {
+  const size_t bytes = charge(key.length(), value->length());
+  if (bytes > shardCapacity) {
+    // would push everything else out
+    return;
+  }
+
+  Shard &shard = shardFor(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.entries.find(key);
+  if (it != shard.entries.end()) {
+    if (it->second.sequence >= sequence) {
+      return;
+    }
+    remove(shard, it);
+  }
+
+  evict(shard, bytes);
+  it = shard.entries
+           .emplace(key, Entry{std::move(value), sequence, shard.clock.size(),
+                               false})
+           .first;
+  shard.clock.push_back(&*it);
+  shard.usedBytes += bytes;
+}
+
+void ValueCache::update(const std::string &key, std::string_view value,
+                        uint64_t sequence) {
+  Shard &shard = shardFor(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.entries.find(key);
+  if (it == shard.entries.end()) {
+    // only keys that are being read are worth caching
+    return;
+  }
+
+  const size_t bytes = charge(key.length(), value.length());
+  if (bytes > shardCapacity) {
+    remove(shard, it);
+    return;
+  }
+
+  Entry &entry = it->second;
+  shard.usedBytes -= charge(key.length(), entry.value->length());
+  entry.value = std::make_shared<const std::string>(value);
+  entry.sequence = sequence;
+  shard.usedBytes += bytes;
+  evict(shard, 0);
+}
+
+void ValueCache::invalidate(const std::string &key) {
+  Shard &shard = shardFor(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.entries.find(key);
+  if (it != shard.entries.end()) {
+    remove(shard, it);
+  }
+}
+
+void ValueCache::erase(const std::string &key, uint64_t sequence) {
+  Shard &shard = shardFor(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.entries.find(key);
+  if (it != shard.entries.end() && it->second.sequence == sequence) {
+    remove(shard, it);
+  }
+}
+
+CacheStats ValueCache::getStats() {
+  CacheStats stats;
+  stats.capacity = shardCapacity * NUM_SHARDS;
+  for (auto &shard : shards) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    stats.hits += shard.hits;
+    stats.misses += shard.misses;
+    stats.evictions += shard.evictions;
+    stats.usedBytes += shard.usedBytes;
+  }
+  return stats;
+}
@@ -0,0 +1,83 @@
+#ifndef VALUE_CACHE_H
+#define VALUE_CACHE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "saavi_options.h"
+
+// A size bounded cache of recently read values, kept in front of the data
+// files. The keys are spread over independently locked shards, each of which
+// evicts with the CLOCK algorithm - a hit only sets a bit on the entry, and
+// eviction sweeps a hand over the entries, giving every entry that was hit
+// since the last sweep a second chance.
+//
+// Every entry remembers the sequence number of the record it was read from,
+// so that a value read before a concurrent write can never replace the
+// value of that write.
+class ValueCache {
+  static constexpr size_t NUM_SHARDS = 16;
+
+  struct Entry {
+    std::shared_ptr<const std::string> value;
+    uint64_t sequence;
+    // position of the entry in the clock
+    size_t position;
+    bool referenced;
+  };
+  using EntryMap = std::unordered_map<std::string, Entry>;
+
+  struct alignas(64) Shard {
+    std::mutex mutex;
+    EntryMap entries;
+    // the clock - the entries in the order the hand visits them
+    std::vector<EntryMap::value_type *> clock;
+    size_t hand{0};
+    size_t usedBytes{0};
+    uint64_t hits{0};
+    uint64_t misses{0};
+    uint64_t evictions{0};
+  };
+  std::array<Shard, NUM_SHARDS> shards;
+  // capacity of each shard in bytes
+  const size_t shardCapacity;
+
+  Shard &shardFor(const std::string &key) {
+    return shards[std::hash<std::string>{}(key) % NUM_SHARDS];
+  }
+  // bytes accounted against the capacity for an entry
+  static size_t charge(size_t keyLength, size_t valueLength);
+  // remove an entry from the shard
+  static void remove(Shard &shard, EntryMap::iterator it);
+  // evict entries until another bytes fit into the shard
+  void evict(Shard &shard, size_t bytes);
+
+ public:
+  explicit ValueCache(size_t capacity);
+
+  // the cached value of the key, or nullptr on a miss
+  std::shared_ptr<const std::string> get(const std::string &key);
+  // cache a value read from the record with the given sequence number,
+  // unless a newer value is already cached
+  void insert(const std::string &key,
+              std::shared_ptr<const std::string> value, uint64_t sequence);
+  // replace the value of a cached key with a newly written one
+  void update(const std::string &key, std::string_view value,
+              uint64_t sequence);
+  // drop the key, which has just been deleted
+  void invalidate(const std::string &key);
+  // drop the key if it still caches the value of the given record
+  void erase(const std::string &key, uint64_t sequence);
+
+  CacheStats getStats();
+};
+
+#endif
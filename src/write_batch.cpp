@@ -0,0 +1,36 @@
+#include "write_batch.h"
+
+#include <limits>
+
+#include "record.h"
+#include "saavi_exception.h"
+
+void WriteBatch::Put(const std::string &key, const std::string &value) {
+  if (key.empty()) {
+    throw SaaviException("invalid key - key cannot be empty");
+  }
+  if (key.length() > std::numeric_limits<uint32_t>::max() ||
+      value.length() > std::numeric_limits<uint32_t>::max()) {
+    throw SaaviException("invalid entry - key or value is too long");
+  }
+
+  appendRecord(rep, 0, key, value);
+  count++;
+}
+
+void WriteBatch::Delete(const std::string &key) {
+  if (key.empty()) {
+    throw SaaviException("invalid key - key cannot be empty");
+  }
+  if (key.length() > std::numeric_limits<uint32_t>::max()) {
+    throw SaaviException("invalid key - key is too long");
+  }
+
+  appendRecord(rep, RECORD_FLAG_DELETION, key, "");
+  count++;
+}
+
+void WriteBatch::Clear() {
+  rep.clear();
+  count = 0;
+}
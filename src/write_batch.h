@@ -0,0 +1,32 @@
+#ifndef WRITE_BATCH_H
+#define WRITE_BATCH_H
+
+#include <cstddef>
+#include <string>
+
+// Collects Put and Delete operations to be applied atomically with a single
+// Saavi::Write. The operations are encoded as records into one contiguous
+// buffer as they are added; Write only has to stamp them with their sequence
+// numbers before appending the whole buffer to the log in one go.
+class WriteBatch {
+  std::string rep;
+  size_t count{0};
+
+  friend class Saavi;
+  friend class ShardedSaavi;
+
+ public:
+  // Set the key to the value when the batch is written
+  void Put(const std::string &key, const std::string &value);
+  // Delete the key when the batch is written
+  void Delete(const std::string &key);
+  // Remove all the operations from the batch
+  void Clear();
+
+  // number of operations in the batch
+  size_t Count() const { return count; }
+  // size of the encoded operations
+  size_t ApproximateSize() const { return rep.length(); }
+};
+
+#endif
@@ -0,0 +1,195 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "saavi.h"
+#include "saavi_exception.h"
+
+// GetAsync and PutAsync must give the same results whether they go through
+// io_uring or run synchronously, which a queue depth of 0 forces
+class AsyncTest : public ::testing::TestWithParam<unsigned> {
+ protected:
+  std::string kvsFileName;
+  std::unique_ptr<Saavi> saavi;
+  SaaviOptions options;
+
+  // counts the callbacks that are still to run
+  std::mutex mutex;
+  std::condition_variable condition;
+  int pending{0};
+
+  void SetUp() override {
+    kvsFileName = "AsyncTest" + std::to_string(GetParam()) + ".db";
+    options.asyncQueueDepth = GetParam();
+    options.durability = DurabilityMode::FsyncPerWrite;
+    options.segmentSize = 4096;
+    options.backgroundCompaction = false;
+  }
+
+  void TearDown() override {
+    saavi.reset();
+    if (!::testing::Test::HasFailure()) {
+      Saavi::Destroy(kvsFileName);
+    }
+  }
+
+  void open() {
+    ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName, options)));
+  }
+
+  void started() {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending++;
+  }
+
+  void finished() {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending--;
+    condition.notify_all();
+  }
+
+  void waitForAll() {
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [this] { return pending == 0; });
+  }
+
+  void putAll(int numOfKeys) {
+    for (int i = 0; i < numOfKeys; i++) {
+      started();
+      saavi->PutAsync("Key" + std::to_string(i), "Value" + std::to_string(i),
+                      [this](std::exception_ptr error) {
+                        EXPECT_EQ(error, nullptr);
+                        finished();
+                      });
+    }
+    waitForAll();
+  }
+
+  void verifyAll(int numOfKeys) {
+    std::vector<std::string> values(numOfKeys);
+    for (int i = 0; i < numOfKeys; i++) {
+      started();
+      saavi->GetAsync("Key" + std::to_string(i),
+                      [this, &values, i](std::exception_ptr error, bool found,
+                                         PinnedValue value) {
+                        EXPECT_EQ(error, nullptr);
+                        EXPECT_TRUE(found);
+                        values[i] = value.ToString();
+                        finished();
+                      });
+    }
+    waitForAll();
+    for (int i = 0; i < numOfKeys; i++) {
+      EXPECT_EQ(values[i], "Value" + std::to_string(i));
+    }
+  }
+};
+
+TEST_P(AsyncTest, TestGetPut) {
+  open();
+  putAll(500);
+  verifyAll(500);
+
+  // the writes are durable and visible to the blocking calls as well
+  saavi.reset();
+  open();
+  EXPECT_EQ(saavi->Get("Key42"), "Value42");
+  verifyAll(500);
+
+  started();
+  saavi->GetAsync("Missing", [this](std::exception_ptr error, bool found,
+                                    PinnedValue value) {
+    EXPECT_EQ(error, nullptr);
+    EXPECT_FALSE(found);
+    EXPECT_TRUE(value.empty());
+    finished();
+  });
+  // errors are passed to the callback rather than thrown
+  started();
+  saavi->GetAsync("", [this](std::exception_ptr error, bool found,
+                             PinnedValue) {
+    EXPECT_NE(error, nullptr);
+    EXPECT_FALSE(found);
+    EXPECT_THROW(std::rethrow_exception(error), SaaviException);
+    finished();
+  });
+  waitForAll();
+}
+
+TEST_P(AsyncTest, TestManyInFlight) {
+  // far more operations than the ring has room for
+  options.asyncQueueDepth = std::min(GetParam(), 1u);
+  options.durability = DurabilityMode::GroupCommit;
+  open();
+  putAll(2000);
+  verifyAll(2000);
+}
+
+TEST_P(AsyncTest, TestLatencies) {
+#ifndef SAAVI_WITH_STATS
+  GTEST_SKIP() << "statistics are left out of the build";
+#endif
+  // the operations are timed until their callbacks run
+  options.statistics = StatsLevel::Latencies;
+  options.durability = DurabilityMode::GroupCommit;
+  open();
+  putAll(300);
+  verifyAll(300);
+  const SaaviStats stats = saavi->GetStats();
+  EXPECT_EQ(stats.putLatency.count, 300u);
+  EXPECT_EQ(stats.getLatency.count, 300u);
+  EXPECT_GT(stats.putLatency.max, 0u);
+}
+
+TEST_P(AsyncTest, TestNestedCalls) {
+  // callbacks can issue further operations
+  options.cacheCapacity = 1 << 20;
+  open();
+  putAll(10);
+  started();
+  saavi->GetAsync("Key1", [this](std::exception_ptr, bool, PinnedValue) {
+    started();
+    saavi->PutAsync("Key1", "Nested", [this](std::exception_ptr error) {
+      EXPECT_EQ(error, nullptr);
+      started();
+      saavi->GetAsync("Key1", [this](std::exception_ptr, bool found,
+                                     PinnedValue value) {
+        EXPECT_TRUE(found);
+        EXPECT_EQ(value.view(), "Nested");
+        finished();
+      });
+      finished();
+    });
+    finished();
+  });
+  waitForAll();
+  EXPECT_EQ(saavi->Get("Key1"), "Nested");
+}
+
+INSTANTIATE_TEST_SUITE_P(AsyncTests, AsyncTest, ::testing::Values(0u, 64u));
+
+TEST(AsyncLsmTest, TestFallback) {
+  SaaviOptions options;
+  options.engine = StorageEngine::Lsm;
+  {
+    Saavi saavi("AsyncLsmTest.db", options);
+    bool put = false;
+    saavi.PutAsync("Key", "Value", [&put](std::exception_ptr error) {
+      put = error == nullptr;
+    });
+    // the lsm engine runs the operations synchronously
+    EXPECT_TRUE(put);
+    std::string value;
+    saavi.GetAsync("Key", [&value](std::exception_ptr, bool,
+                                   PinnedValue pinned) {
+      value = pinned.ToString();
+    });
+    EXPECT_EQ(value, "Value");
+  }
+  Saavi::Destroy("AsyncLsmTest.db");
+}
@@ -1,10 +1,13 @@
 #include <gtest/gtest.h>
 
 #include <filesystem>
+#include <fstream>
 #include <memory>
 #include <vector>
 
+#include "record.h"
 #include "saavi.h"
+#include "saavi_exception.h"
 
 class BasicOperations : public ::testing::Test {
  protected:
@@ -27,10 +30,13 @@ class BasicOperations : public ::testing::Test {
 
   // TearDown called after after test
   void TearDown() override {
+    // close the kvs before removing its files
+    saavi.reset();
     if (!::testing::Test::HasFailure()) {
-      // delete the kvs file on success or skipped
-      ASSERT_TRUE(std::filesystem::remove(kvsFileName))
-          << "Failed to remove file '" + kvsFileName + "'";
+      // delete the kvs files on success or skipped
+      ASSERT_TRUE(std::filesystem::exists(kvsFileName))
+          << "File '" + kvsFileName + "' doesn't exist";
+      Saavi::Destroy(kvsFileName);
     }
   }
 
@@ -62,15 +68,27 @@ TEST_F(BasicOperations, TestPut) {
   // Now check if the file has all the entries by reading it directly. Note that
   // this needs to be updated if the encoding of entries changes.
   std::ifstream file;
-  file.open(kvsFileName);
+  file.open(kvsFileName, std::ios::in | std::ios::binary);
   ASSERT_TRUE(file.is_open())
       << "Failed to open '" + kvsFileName + "' : " << strerror(errno);
 
+  // skip the file header
+  char fileHeader[FILE_HEADER_SIZE];
+  ASSERT_TRUE(file.read(fileHeader, FILE_HEADER_SIZE));
+  FileHeader header;
+  ASSERT_TRUE(FileHeader::decode(fileHeader, header));
+  EXPECT_EQ(header.version, FORMAT_VERSION);
+
   int i = 0;
-  std::string entry;
-  while (std::getline(file, entry)) {
-    EXPECT_EQ(entry,
-              "Key" + std::to_string(i) + "," + "Value" + std::to_string(i));
+  char recordHeader[RECORD_HEADER_SIZE];
+  while (file.read(recordHeader, RECORD_HEADER_SIZE)) {
+    RecordHeader record;
+    RecordHeader::decode(recordHeader, record);
+    std::string body(record.keyLength + record.valueLength, '\0');
+    ASSERT_TRUE(file.read(&body[0], body.length()));
+    EXPECT_EQ(body.substr(0, record.keyLength), "Key" + std::to_string(i));
+    EXPECT_EQ(body.substr(record.keyLength), "Value" + std::to_string(i));
+    EXPECT_EQ(record.sequence, i + 1);
     i++;
   }
 
@@ -108,6 +126,9 @@ TEST_F(BasicOperations, TestDelete) {
   saavi->Delete("Key1");
   saavi->Delete("Key9");
   saavi->Put("Key2", "Value222");
+  // deleting keys that aren't there changes nothing
+  saavi->Delete("Key1");
+  saavi->Delete("Missing");
 
   // Update expected values
   expectedEntries.erase("Key1");
@@ -118,6 +139,40 @@ TEST_F(BasicOperations, TestDelete) {
   verifyEntries();
 }
 
+TEST_F(BasicOperations, TestEmptyValue) {
+  populateEntries();
+
+  // an empty value is a value, only a delete removes the key
+  PinnedValue value;
+  saavi->Put("Key1", "");
+  ASSERT_TRUE(saavi->Get("Key1", value));
+  EXPECT_TRUE(value.view().empty());
+  saavi->Delete("Key2");
+  EXPECT_FALSE(saavi->Get("Key2", value));
+  WriteBatch batch;
+  batch.Put("Key3", "");
+  batch.Delete("Key4");
+  saavi->Write(batch);
+  EXPECT_TRUE(saavi->Get("Key3", value));
+  EXPECT_FALSE(saavi->Get("Key4", value));
+
+  // the same after replaying the log and after loading the hint file
+  ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName)));
+  for (int round = 0; round < 2; round++) {
+    EXPECT_TRUE(saavi->Get("Key1", value));
+    EXPECT_TRUE(value.view().empty());
+    EXPECT_FALSE(saavi->Get("Key2", value));
+    EXPECT_TRUE(saavi->Get("Key3", value));
+    EXPECT_FALSE(saavi->Get("Key4", value));
+    size_t numOfKeys = 0;
+    for (auto it = saavi->begin(); it != saavi->end(); ++it) {
+      numOfKeys++;
+    }
+    EXPECT_EQ(numOfKeys, numOfEntries - 2);
+    ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName)));
+  }
+}
+
 TEST_F(BasicOperations, TestIterator) {
   // begin() should equal to end() when the file is empty
   EXPECT_FALSE(saavi->begin() != saavi->end());
@@ -155,3 +210,100 @@ TEST_F(BasicOperations, TestIterator) {
       << "Number of entries returned by the iterator doesn't match the "
          "expected count";
 }
+
+TEST_F(BasicOperations, TestArbitraryBytes) {
+  // keys and values are no longer limited to a csv friendly subset
+  const std::string key = "key with spaces,commas\nand newlines";
+  const std::string value = std::string("binary\0value\n,", 15);
+  saavi->Put(key, value);
+  saavi->Put("Key1", "multi\nline\nvalue");
+  EXPECT_EQ(saavi->Get(key), value);
+  EXPECT_EQ(saavi->Get("Key1"), "multi\nline\nvalue");
+
+  // empty keys are rejected
+  EXPECT_THROW(saavi->Put("", "value"), SaaviException);
+}
+
+TEST_F(BasicOperations, TestReopen) {
+  populateEntries();
+  saavi->Put("Key3", "Value33");
+  saavi->Delete("Key4");
+  expectedEntries["Key3"] = "Value33";
+  expectedEntries.erase("Key4");
+
+  // rebuild the index from the file and verify
+  ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName)));
+  verifyEntries();
+
+  // sequence numbers continue from where the log ended
+  saavi->Put("Key5", "Value55");
+  expectedEntries["Key5"] = "Value55";
+  ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName)));
+  verifyEntries();
+}
+
+TEST_F(BasicOperations, TestWriteBatch) {
+  populateEntries();
+
+  WriteBatch batch;
+  batch.Put("Key1", "Value11");
+  batch.Delete("Key2");
+  batch.Put("Key10", "Value10");
+  batch.Put("Key1", "Value111");
+  EXPECT_EQ(batch.Count(), 4);
+  saavi->Write(batch);
+
+  // later operations in a batch win over earlier ones
+  expectedEntries["Key1"] = "Value111";
+  expectedEntries.erase("Key2");
+  verifyEntries();
+  EXPECT_EQ(saavi->Get("Key10"), "Value10");
+
+  // an empty batch is a no-op
+  batch.Clear();
+  EXPECT_EQ(batch.Count(), 0);
+  saavi->Write(batch);
+
+  // the batch is recovered from the log
+  ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName)));
+  std::filesystem::remove(kvsFileName + ".hint");
+  ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName)));
+  verifyEntries();
+  EXPECT_EQ(saavi->Get("Key10"), "Value10");
+}
+
+TEST_F(BasicOperations, TestPinnedGet) {
+  populateEntries();
+
+  PinnedValue value;
+  for (const auto &entry : expectedEntries) {
+    ASSERT_TRUE(saavi->Get(entry.first, value));
+    EXPECT_EQ(value.view(), entry.second);
+  }
+  EXPECT_FALSE(saavi->Get("NonExistentKey", value));
+  EXPECT_TRUE(value.empty());
+
+  // a pinned value stays readable after the key is overwritten
+  ASSERT_TRUE(saavi->Get("Key1", value));
+  saavi->Put("Key1", "Value11");
+  EXPECT_EQ(value.view(), expectedEntries["Key1"]);
+
+  // deleted keys are not present
+  saavi->Delete("Key2");
+  EXPECT_FALSE(saavi->Get("Key2", value));
+
+  // values larger than the initial mapping make the file get remapped
+  const std::string largeValue(3 << 20, 'v');
+  saavi->Put("LargeKey", largeValue);
+  ASSERT_TRUE(saavi->Get("LargeKey", value));
+  EXPECT_EQ(value.view(), largeValue);
+
+  // the same values are returned when reading without the mapping
+  SaaviOptions options;
+  options.mmapReads = false;
+  ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName, options)));
+  ASSERT_TRUE(saavi->Get("LargeKey", value));
+  EXPECT_EQ(value.view(), largeValue);
+  ASSERT_TRUE(saavi->Get("Key1", value));
+  EXPECT_EQ(value.view(), "Value11");
+}
@@ -1,20 +1,35 @@
+#include <malloc.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
 #include <chrono>
+#include <condition_variable>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
 
+#include "key_generators.h"
 #include "saavi.h"
+#include "sharded_saavi.h"
+#include "workloads.h"
 
 const int DEFAULT_NUM_OF_LOOPS = 1000000;
 const int DEFAULT_MAX_ENTRY_ID = 1000000;
 
-// A naive benchmarking tool
+// Benchmarks of every feature, one at a time
 class SaaviBenchmark {
   int maxEntryId;
   int numOfLoops;
 
   const std::string filename = "/tmp/benchmark.db";
+  const std::string openBenchmarkFilename = "/tmp/benchmark_open.db";
 
   // randomness generating member variables
   std::default_random_engine generator;
@@ -35,7 +50,7 @@ class SaaviBenchmark {
              "s";
     } else if (elapsedMicroSeconds > std::chrono::milliseconds{1}) {
       return std::to_string(std::chrono::duration_cast<
-                                std::chrono::duration<double, std::micro>>(
+                                std::chrono::duration<double, std::milli>>(
                                 elapsedMicroSeconds)
                                 .count()) +
              "ms";
@@ -77,6 +92,266 @@ class SaaviBenchmark {
     printResults("Put", elapsedMicroSeconds);
   }
 
+  // time taken to open a database of the given number of keys
+  std::chrono::duration<double, std::micro> timeOpen(
+      const SaaviOptions &options = SaaviOptions()) const {
+    auto start = std::chrono::steady_clock::now();
+    std::unique_ptr<Saavi> saavi(new Saavi(openBenchmarkFilename, options));
+    return std::chrono::steady_clock::now() - start;
+  }
+
+  void benchmarkOpen() {
+    const std::string header = "Open Benchmark Results";
+    std::cout << header << "\n" << std::string(header.length(), '-') << "\n";
+
+    for (int numOfKeys = std::max(numOfLoops / 100, 1); numOfKeys <= numOfLoops;
+         numOfKeys *= 10) {
+      Saavi::Destroy(openBenchmarkFilename);
+      {
+        // populate the database, a clean close writes the hint file
+        std::unique_ptr<Saavi> saavi(new Saavi(openBenchmarkFilename));
+        for (int i = 0; i < numOfKeys; i++) {
+          saavi->Put("Key" + std::to_string(i), "Value" + std::to_string(i));
+        }
+      }
+
+      auto withHint = timeOpen();
+      // without the hint file the whole log is replayed
+      std::filesystem::remove(openBenchmarkFilename + ".hint");
+      auto withoutHint = timeOpen();
+
+      std::cout << "Time to open a database with " << numOfKeys
+                << " keys = " << formatTime(withHint) << " with hint file, "
+                << formatTime(withoutHint) << " without hint file\n";
+    }
+    std::cout << "\n";
+    Saavi::Destroy(openBenchmarkFilename);
+  }
+
+  // time taken to read the whole file sequentially, for reference
+  static std::chrono::duration<double, std::micro> timeSequentialRead(
+      const std::string &path) {
+    auto start = std::chrono::steady_clock::now();
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    std::unique_ptr<char[]> buffer(new char[SCAN_BLOCK_SIZE]);
+    while (file.read(buffer.get(), SCAN_BLOCK_SIZE) || file.gcount() > 0) {
+    }
+    return std::chrono::steady_clock::now() - start;
+  }
+
+  static double throughput(uintmax_t bytes,
+                           std::chrono::duration<double, std::micro> elapsed) {
+    return (bytes / (1024.0 * 1024.0)) /
+           std::chrono::duration_cast<std::chrono::duration<double>>(elapsed)
+               .count();
+  }
+
+  void benchmarkRecovery() {
+    const std::string header = "Recovery Benchmark Results";
+    std::cout << header << "\n" << std::string(header.length(), '-') << "\n";
+
+    Saavi::Destroy(openBenchmarkFilename);
+    {
+      // populate the database with ~100 byte values
+      std::unique_ptr<Saavi> saavi(new Saavi(openBenchmarkFilename));
+      const std::string value(100, 'v');
+      for (int i = 0; i < numOfLoops; i++) {
+        saavi->Put("Key" + std::to_string(generateRandom()), value);
+      }
+    }
+    // recover from the log alone
+    std::filesystem::remove(openBenchmarkFilename + ".hint");
+    const auto fileSize = std::filesystem::file_size(openBenchmarkFilename);
+
+    // warm the page cache so both runs read from the same place
+    timeSequentialRead(openBenchmarkFilename);
+    auto sequentialRead = timeSequentialRead(openBenchmarkFilename);
+    auto recovery = timeOpen();
+    // the scan alone, without building the index
+    auto start = std::chrono::steady_clock::now();
+    RecordScanner scanner(openBenchmarkFilename);
+    while (scanner.next()) {
+    }
+    std::chrono::duration<double, std::micro> scan =
+        std::chrono::steady_clock::now() - start;
+    std::filesystem::remove(openBenchmarkFilename + ".hint");
+
+    std::cout << "Recovered " << numOfLoops << " records (" << fileSize
+              << " bytes) in " << formatTime(recovery) << " = "
+              << throughput(fileSize, recovery) << " MB/s\n";
+    std::cout << "Scanned and checksummed the records in " << formatTime(scan)
+              << " = " << throughput(fileSize, scan) << " MB/s\n";
+    std::cout << "Sequential read of the same file = "
+              << formatTime(sequentialRead) << " = "
+              << throughput(fileSize, sequentialRead) << " MB/s\n\n";
+    Saavi::Destroy(openBenchmarkFilename);
+  }
+
+  void benchmarkBlobs() {
+    const std::string header = "Blob File Benchmark Results";
+    std::cout << header << "\n" << std::string(header.length(), '-') << "\n";
+
+    // 64 KB values, three quarters of which are overwritten in every round,
+    // with compaction and blob garbage collection reclaiming the space as
+    // it goes
+    const int numOfKeys = 256;
+    const int rounds = 8;
+    for (size_t blobThreshold : {size_t(0), size_t(16 << 10)}) {
+      SaaviOptions options;
+      options.durability = DurabilityMode::None;
+      options.backgroundCompaction = false;
+      options.segmentSize = 4 << 20;
+      options.blobThreshold = blobThreshold;
+      options.blobFileSize = 4 << 20;
+      Saavi::Destroy(openBenchmarkFilename);
+
+      uint64_t valueBytes = 0;
+      int puts = 0;
+      CompactionStats stats;
+      auto start = std::chrono::steady_clock::now();
+      {
+        std::unique_ptr<Saavi> saavi(new Saavi(openBenchmarkFilename, options));
+        for (int round = 0; round < rounds; round++) {
+          const std::string value(64 << 10, static_cast<char>('a' + round));
+          for (int i = 0; i < numOfKeys; i++) {
+            if (round > 0 && (i + round) % 4 == 0) {
+              continue;
+            }
+            saavi->Put("Key" + std::to_string(i), value);
+            valueBytes += value.length();
+            puts++;
+          }
+          saavi->Compact();
+        }
+        stats = saavi->GetCompactionStats();
+      }
+      std::chrono::duration<double, std::micro> putTime =
+          std::chrono::steady_clock::now() - start;
+
+      // recover from the log alone
+      std::filesystem::remove(openBenchmarkFilename + ".hint");
+      auto recovery = timeOpen(options);
+      std::filesystem::remove(openBenchmarkFilename + ".hint");
+
+      const uint64_t rewritten = stats.bytesWritten + stats.blobBytesMoved;
+      std::cout << (blobThreshold == 0 ? "values in the log" : "blob files")
+                << " : write amplification "
+                << 1.0 + static_cast<double>(rewritten) / valueBytes << ", "
+                << puts / (putTime.count() / 1000000)
+                << " Put operations per second, recovered in "
+                << formatTime(recovery) << "\n";
+    }
+    std::cout << "\n";
+    Saavi::Destroy(openBenchmarkFilename);
+  }
+
+  void benchmarkDurability() {
+    const std::string header = "Durability Benchmark Results";
+    std::cout << header << "\n" << std::string(header.length(), '-') << "\n";
+
+    // syncing every write is slow, so keep the number of puts reasonable
+    const int numOfThreads = 4;
+    const int numOfPuts = std::min(numOfLoops, 20000) / numOfThreads;
+    const std::pair<DurabilityMode, std::string> modes[] = {
+        {DurabilityMode::None, "none"},
+        {DurabilityMode::FlushPerWrite, "flush-per-write"},
+        {DurabilityMode::FsyncPerWrite, "fsync-per-write"},
+        {DurabilityMode::GroupCommit, "group-commit"}};
+
+    for (const auto &mode : modes) {
+      Saavi::Destroy(openBenchmarkFilename);
+      SaaviOptions options;
+      options.durability = mode.first;
+      std::unique_ptr<Saavi> saavi(new Saavi(openBenchmarkFilename, options));
+
+      // every thread records the latency of each of its puts
+      std::vector<std::vector<std::chrono::duration<double, std::micro>>>
+          latencies(numOfThreads);
+      std::vector<std::thread> writers;
+      auto start = std::chrono::steady_clock::now();
+      for (int t = 0; t < numOfThreads; t++) {
+        writers.emplace_back([&, t] {
+          for (int i = 0; i < numOfPuts; i++) {
+            auto key = "Key" + std::to_string(t) + "-" + std::to_string(i);
+            auto opStart = std::chrono::steady_clock::now();
+            saavi->Put(key, "Value" + std::to_string(i));
+            latencies[t].push_back(std::chrono::steady_clock::now() -
+                                   opStart);
+          }
+        });
+      }
+      for (auto &writer : writers) {
+        writer.join();
+      }
+      std::chrono::duration<double, std::micro> elapsed =
+          std::chrono::steady_clock::now() - start;
+
+      std::vector<std::chrono::duration<double, std::micro>> all;
+      for (const auto &threadLatencies : latencies) {
+        all.insert(all.end(), threadLatencies.begin(), threadLatencies.end());
+      }
+      std::sort(all.begin(), all.end());
+      std::cout << mode.second << " : "
+                << (numOfPuts * numOfThreads) /
+                       (elapsed.count() / 1000000)
+                << " Put operations per second, p99 latency = "
+                << formatTime(all[all.size() * 99 / 100]) << "\n";
+    }
+    std::cout << "\n";
+    Saavi::Destroy(openBenchmarkFilename);
+  }
+
+  void benchmarkBatch() {
+    const std::string header = "WriteBatch Benchmark Results";
+    std::cout << header << "\n" << std::string(header.length(), '-') << "\n";
+
+    const int batchSize = 1000;
+    const std::pair<DurabilityMode, std::string> modes[] = {
+        {DurabilityMode::FlushPerWrite, "flush-per-write"},
+        {DurabilityMode::FsyncPerWrite, "fsync-per-write"}};
+    for (const auto &mode : modes) {
+      // syncing every write is slow, so keep the number of records reasonable
+      const int numOfRecords = mode.first == DurabilityMode::FsyncPerWrite
+                                   ? std::min(numOfLoops, 20000)
+                                   : numOfLoops;
+      SaaviOptions options;
+      options.durability = mode.first;
+
+      for (int useBatch = 0; useBatch <= 1; useBatch++) {
+        Saavi::Destroy(openBenchmarkFilename);
+        std::unique_ptr<Saavi> saavi(
+            new Saavi(openBenchmarkFilename, options));
+
+        auto start = std::chrono::steady_clock::now();
+        WriteBatch batch;
+        for (int i = 0; i < numOfRecords; i++) {
+          auto key = "Key" + std::to_string(i);
+          auto value = "Value" + std::to_string(i);
+          if (!useBatch) {
+            saavi->Put(key, value);
+            continue;
+          }
+          batch.Put(key, value);
+          if (batch.Count() == batchSize) {
+            saavi->Write(batch);
+            batch.Clear();
+          }
+        }
+        saavi->Write(batch);
+        std::chrono::duration<double, std::micro> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        std::cout << mode.second << ", "
+                  << (useBatch ? "WriteBatch of " + std::to_string(batchSize)
+                               : std::string("Put one at a time"))
+                  << " : " << numOfRecords / (elapsed.count() / 1000000)
+                  << " records per second\n";
+      }
+    }
+    std::cout << "\n";
+    Saavi::Destroy(openBenchmarkFilename);
+  }
+
   void benchmarkGet() {
     std::unique_ptr<Saavi> saavi(new Saavi(filename));
 
@@ -95,6 +370,453 @@ class SaaviBenchmark {
     printResults("Get", elapsedMicroSeconds);
   }
 
+  void benchmarkPinnedGet() {
+    const std::string header = "Read Path Benchmark Results";
+    std::cout << header << "\n" << std::string(header.length(), '-') << "\n";
+
+    for (bool mmapReads : {false, true}) {
+      SaaviOptions options;
+      options.mmapReads = mmapReads;
+      std::unique_ptr<Saavi> saavi(new Saavi(filename, options));
+
+      for (bool pinned : {false, true}) {
+        // look up the same keys in every run
+        std::default_random_engine keyGenerator(0);
+        auto keys = distribution;
+        PinnedValue value;
+        size_t bytesRead = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < numOfLoops; i++) {
+          auto key = "Key" + std::to_string(keys(keyGenerator));
+          if (pinned) {
+            saavi->Get(key, value);
+            bytesRead += value.size();
+          } else {
+            bytesRead += saavi->Get(key).length();
+          }
+        }
+        std::chrono::duration<double, std::micro> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        std::cout << (mmapReads ? "mmap" : "pread") << ", "
+                  << (pinned ? "PinnedValue" : "std::string") << " : "
+                  << numOfLoops / (elapsed.count() / 1000000)
+                  << " Get operations per second (" << bytesRead
+                  << " bytes)\n";
+      }
+    }
+    std::cout << "\n";
+  }
+
+  void benchmarkCache() {
+    const std::string header = "Value Cache Benchmark Results";
+    std::cout << header << "\n" << std::string(header.length(), '-') << "\n";
+
+    // populate the database with ~100 byte values
+    const int numOfKeys = numOfLoops;
+    const std::string value(100, 'v');
+    Saavi::Destroy(openBenchmarkFilename);
+    {
+      std::unique_ptr<Saavi> saavi(new Saavi(openBenchmarkFilename));
+      for (int i = 0; i < numOfKeys; i++) {
+        saavi->Put("Key" + std::to_string(i), value);
+      }
+    }
+    const auto dataSize = std::filesystem::file_size(openBenchmarkFilename);
+
+    // read the keys with a skewed, Zipfian, popularity
+    ZipfianGenerator zipfian(numOfKeys);
+    for (bool mmapReads : {false, true}) {
+      for (int percent : {0, 1, 5, 20}) {
+        SaaviOptions options;
+        options.cacheCapacity = dataSize * percent / 100;
+        options.mmapReads = mmapReads;
+        std::unique_ptr<Saavi> saavi(
+            new Saavi(openBenchmarkFilename, options));
+
+        std::default_random_engine keyGenerator(0);
+        PinnedValue pinned;
+        // warm up the cache before measuring
+        for (int i = 0; i < numOfLoops; i++) {
+          saavi->Get("Key" + std::to_string(zipfian(keyGenerator)), pinned);
+        }
+        const auto warmStats = saavi->GetCacheStats();
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < numOfLoops; i++) {
+          saavi->Get("Key" + std::to_string(zipfian(keyGenerator)), pinned);
+        }
+        std::chrono::duration<double, std::micro> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        const auto stats = saavi->GetCacheStats();
+        const uint64_t hits = stats.hits - warmStats.hits;
+        const uint64_t lookups = hits + stats.misses - warmStats.misses;
+        std::cout << (mmapReads ? "mmap" : "pread") << ", cache of "
+                  << percent << "% of the data : "
+                  << numOfLoops / (elapsed.count() / 1000000)
+                  << " Get operations per second, hit ratio = "
+                  << (lookups > 0 ? 100.0 * hits / lookups : 0.0)
+                  << "%\n";
+      }
+    }
+    std::cout << "\n";
+    Saavi::Destroy(openBenchmarkFilename);
+  }
+
+  void benchmarkConcurrentGet() {
+    const std::string header = "Concurrent Get Benchmark Results";
+    std::cout << header << "\n" << std::string(header.length(), '-') << "\n";
+
+    std::unique_ptr<Saavi> saavi(new Saavi(filename));
+    const unsigned maxThreads =
+        std::max(4u, std::thread::hardware_concurrency());
+    // percentage of the operations that are puts
+    for (int writePercent : {0, 10}) {
+      for (unsigned numOfThreads = 1; numOfThreads <= maxThreads;
+           numOfThreads *= 2) {
+        const int numOfOps = numOfLoops / numOfThreads;
+        std::vector<std::thread> workers;
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned t = 0; t < numOfThreads; t++) {
+          workers.emplace_back([&, t] {
+            // every thread has its own generator
+            std::default_random_engine threadGenerator(t);
+            auto keys = distribution;
+            std::uniform_int_distribution<int> percent(0, 99);
+            for (int i = 0; i < numOfOps; i++) {
+              auto key = "Key" + std::to_string(keys(threadGenerator));
+              if (percent(threadGenerator) < writePercent) {
+                saavi->Put(key, "Value" + std::to_string(i));
+              } else {
+                saavi->Get(key);
+              }
+            }
+          });
+        }
+        for (auto &worker : workers) {
+          worker.join();
+        }
+        std::chrono::duration<double, std::micro> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        std::cout << (writePercent == 0 ? "read only" : "90% read, 10% put")
+                  << ", " << numOfThreads << " threads : "
+                  << (numOfOps * numOfThreads) / (elapsed.count() / 1000000)
+                  << " operations per second\n";
+      }
+    }
+    std::cout << "\n";
+  }
+
+  void benchmarkAsyncGet() {
+    const std::string header = "Async Get Benchmark Results";
+    std::cout << header << "\n" << std::string(header.length(), '-') << "\n";
+
+    // reads of values that aren't in the page cache, by the blocking Get
+    // and by GetAsync with an increasing number of reads in flight
+    for (unsigned depth : {0u, 1u, 4u, 16u, 64u, 256u}) {
+      SaaviOptions options;
+      options.asyncQueueDepth = depth;
+      options.mmapReads = false;
+      std::unique_ptr<Saavi> saavi(new Saavi(filename, options));
+      sync();
+      std::ofstream("/proc/sys/vm/drop_caches") << "1";
+
+      std::default_random_engine keyGenerator(0);
+      auto keys = distribution;
+      std::mutex mutex;
+      std::condition_variable done;
+      int pending = 0;
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < numOfLoops; i++) {
+        auto key = "Key" + std::to_string(keys(keyGenerator));
+        if (depth == 0) {
+          PinnedValue value;
+          saavi->Get(key, value);
+          continue;
+        }
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          pending++;
+        }
+        saavi->GetAsync(key, [&](std::exception_ptr, bool, PinnedValue) {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (--pending == 0) {
+            done.notify_all();
+          }
+        });
+      }
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return pending == 0; });
+      }
+      std::chrono::duration<double, std::micro> elapsed =
+          std::chrono::steady_clock::now() - start;
+
+      std::cout << (depth == 0 ? std::string("blocking Get")
+                               : "GetAsync, queue depth " +
+                                     std::to_string(depth))
+                << " : " << numOfLoops / (elapsed.count() / 1000000)
+                << " Get operations per second\n";
+    }
+    std::cout << "\n";
+  }
+
+  void benchmarkMultiGet() {
+    const std::string header = "MultiGet Benchmark Results";
+    std::cout << header << "\n" << std::string(header.length(), '-') << "\n";
+
+    // batches of keys whose values aren't in the page cache, fetched by
+    // calling Get for each key and with a single MultiGet. The page cache is
+    // dropped before each batch, outside the timed part.
+    const int numOfBatches = 100;
+    for (bool mmapReads : {false, true}) {
+      SaaviOptions options;
+      options.mmapReads = mmapReads;
+      std::unique_ptr<Saavi> saavi(new Saavi(filename, options));
+      ::sync();
+      for (size_t batchSize : {1, 10, 50, 100, 500}) {
+        std::chrono::duration<double, std::micro> elapsed[2];
+        for (bool multiGet : {false, true}) {
+          std::default_random_engine keyGenerator(batchSize);
+          auto keys = distribution;
+          std::vector<std::string> batch(batchSize);
+          std::vector<PinnedValue> values;
+          PinnedValue value;
+          elapsed[multiGet] = elapsed[multiGet].zero();
+          for (int i = 0; i < numOfBatches; i++) {
+            for (auto &key : batch) {
+              key = "Key" + std::to_string(keys(keyGenerator));
+            }
+            std::ofstream("/proc/sys/vm/drop_caches") << "1";
+            auto start = std::chrono::steady_clock::now();
+            if (multiGet) {
+              saavi->MultiGet(batch, values);
+            } else {
+              for (const auto &key : batch) {
+                saavi->Get(key, value);
+              }
+            }
+            elapsed[multiGet] += std::chrono::steady_clock::now() - start;
+          }
+        }
+
+        const double numOfKeys = numOfBatches * batchSize;
+        std::cout << (mmapReads ? "mmap" : "pread") << ", batches of "
+                  << batchSize << " keys : "
+                  << numOfKeys / (elapsed[0].count() / 1000000)
+                  << " keys per second with Get, "
+                  << numOfKeys / (elapsed[1].count() / 1000000)
+                  << " with MultiGet\n";
+      }
+    }
+    std::cout << "\n";
+  }
+
+  void benchmarkShardedPut() {
+    const std::string header = "Sharded Put Benchmark Results";
+    std::cout << header << "\n" << std::string(header.length(), '-') << "\n";
+
+    // a writer thread per shard, each putting random keys
+    const unsigned maxShards =
+        std::max(4u, std::thread::hardware_concurrency());
+    for (unsigned numOfShards = 1; numOfShards <= maxShards;
+         numOfShards *= 2) {
+      ShardedSaavi::Destroy(openBenchmarkFilename);
+      ShardedSaavi saavi(openBenchmarkFilename, numOfShards);
+      const int numOfOps = numOfLoops / numOfShards;
+      std::vector<std::thread> writers;
+      auto start = std::chrono::steady_clock::now();
+      for (unsigned t = 0; t < numOfShards; t++) {
+        writers.emplace_back([&, t] {
+          std::default_random_engine threadGenerator(t);
+          auto keys = distribution;
+          for (int i = 0; i < numOfOps; i++) {
+            saavi.Put("Key" + std::to_string(keys(threadGenerator)),
+                      "Value" + std::to_string(i));
+          }
+        });
+      }
+      for (auto &writer : writers) {
+        writer.join();
+      }
+      std::chrono::duration<double, std::micro> elapsed =
+          std::chrono::steady_clock::now() - start;
+      std::cout << numOfShards << " shards, " << numOfShards
+                << " threads : "
+                << (numOfOps * numOfShards) / (elapsed.count() / 1000000)
+                << " Put operations per second\n";
+    }
+    std::cout << "\n";
+    ShardedSaavi::Destroy(openBenchmarkFilename);
+  }
+
+  void benchmarkIterate() {
+    const std::string header = "Iterate Benchmark Results";
+    std::cout << header << "\n" << std::string(header.length(), '-') << "\n";
+
+    // drop the file from the page cache so that the iteration reads it
+    std::unique_ptr<Saavi> saavi(new Saavi(filename));
+    sync();
+    std::ofstream("/proc/sys/vm/drop_caches") << "1";
+
+    const size_t before = mallinfo2().uordblks;
+    size_t peakMemory = 0;
+    unsigned long numOfEntries = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (auto it = saavi->begin(); it != saavi->end(); ++it) {
+      if (++numOfEntries % 1024 == 0) {
+        peakMemory = std::max(peakMemory, mallinfo2().uordblks - before);
+      }
+    }
+    std::chrono::duration<double, std::micro> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cout << numOfEntries << " entries iterated in " << formatTime(elapsed)
+              << ", " << numOfEntries / (elapsed.count() / 1000000)
+              << " entries per second, " << peakMemory / 1024
+              << " KB of memory at most\n\n";
+  }
+
+  void benchmarkEngines() {
+    const std::string header = "Storage Engine Benchmark Results";
+    std::cout << header << "\n" << std::string(header.length(), '-') << "\n";
+
+    const std::string value(100, 'v');
+    for (auto engine : {StorageEngine::Log, StorageEngine::Lsm}) {
+      const std::string name = engine == StorageEngine::Log ? "log" : "lsm";
+      SaaviOptions options;
+      options.engine = engine;
+      options.durability = DurabilityMode::None;
+      Saavi::Destroy(openBenchmarkFilename);
+
+      // keys written in a random order
+      std::default_random_engine keyGenerator(0);
+      auto keys = distribution;
+      auto start = std::chrono::steady_clock::now();
+      {
+        std::unique_ptr<Saavi> saavi(
+            new Saavi(openBenchmarkFilename, options));
+        for (int i = 0; i < numOfLoops; i++) {
+          saavi->Put("Key" + std::to_string(keys(keyGenerator)), value);
+        }
+        saavi->Compact();
+      }
+      std::chrono::duration<double, std::micro> putTime =
+          std::chrono::steady_clock::now() - start;
+
+      // memory held by a freshly opened store is what grows with the keys
+      const size_t before = mallinfo2().uordblks;
+      std::unique_ptr<Saavi> saavi(new Saavi(openBenchmarkFilename, options));
+      const size_t memory = mallinfo2().uordblks - before;
+
+      PinnedValue pinned;
+      start = std::chrono::steady_clock::now();
+      for (int i = 0; i < numOfLoops; i++) {
+        saavi->Get("Key" + std::to_string(keys(keyGenerator)), pinned);
+      }
+      std::chrono::duration<double, std::micro> getTime =
+          std::chrono::steady_clock::now() - start;
+
+      std::cout << name << " : "
+                << numOfLoops / (putTime.count() / 1000000)
+                << " Put operations per second, "
+                << numOfLoops / (getTime.count() / 1000000)
+                << " Get operations per second, " << memory / 1024
+                << " KB of memory after open";
+      if (engine == StorageEngine::Lsm) {
+        const auto stats = saavi->GetLsmStats();
+        std::cout << " (index " << stats.indexMemory / 1024 << " KB, filters "
+                  << stats.filterMemory / 1024 << " KB)";
+      }
+      std::cout << "\n";
+    }
+    std::cout << "\n";
+    Saavi::Destroy(openBenchmarkFilename);
+  }
+
+  void benchmarkCompression() {
+    const std::string header = "Compression Benchmark Results";
+    std::cout << header << "\n" << std::string(header.length(), '-') << "\n";
+
+    // JSON like values, which compress well in bulk but less so one by one
+    auto jsonValue = [](long i) {
+      return "{\"id\": " + std::to_string(i) + ", \"name\": \"user" +
+             std::to_string(i % 997) + "\", \"email\": \"user" +
+             std::to_string(i % 997) +
+             "@example.com\", \"tags\": [\"alpha\", \"beta\"], "
+             "\"address\": {\"street\": \"" +
+             std::to_string(i % 500) +
+             " Main Street\", \"city\": \"Springfield\", "
+             "\"country\": \"Freedonia\"}, \"preferences\": "
+             "{\"newsletter\": true, \"notifications\": false, "
+             "\"theme\": \"dark\"}, \"active\": true, \"score\": " +
+             std::to_string(i * 7 % 1000) + "}";
+    };
+    auto diskUsage = [this] {
+      const auto path = std::filesystem::path(openBenchmarkFilename);
+      uintmax_t bytes = 0;
+      for (const auto &file :
+           std::filesystem::directory_iterator(path.parent_path())) {
+        if (file.path().filename().string().rfind(
+                path.filename().string(), 0) == 0) {
+          bytes += file.file_size();
+        }
+      }
+      return bytes;
+    };
+
+    for (auto engine : {StorageEngine::Log, StorageEngine::Lsm}) {
+      for (auto codec :
+           {Compression::None, Compression::Lz, Compression::Zlib}) {
+        const char *names[] = {"none", "lz", "zlib"};
+        SaaviOptions options;
+        options.engine = engine;
+        options.compression = codec;
+        options.durability = DurabilityMode::None;
+        Saavi::Destroy(openBenchmarkFilename);
+
+        std::default_random_engine keyGenerator(0);
+        auto keys = distribution;
+        uintmax_t rawBytes = 0;
+        auto start = std::chrono::steady_clock::now();
+        {
+          std::unique_ptr<Saavi> saavi(
+              new Saavi(openBenchmarkFilename, options));
+          for (int i = 0; i < numOfLoops; i++) {
+            const long id = keys(keyGenerator);
+            const std::string value = jsonValue(id);
+            saavi->Put("Key" + std::to_string(id), value);
+            rawBytes += value.length();
+          }
+          saavi->Compact();
+        }
+        std::chrono::duration<double, std::micro> putTime =
+            std::chrono::steady_clock::now() - start;
+        const uintmax_t bytes = diskUsage();
+
+        std::unique_ptr<Saavi> saavi(new Saavi(openBenchmarkFilename, options));
+        PinnedValue pinned;
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < numOfLoops; i++) {
+          saavi->Get("Key" + std::to_string(keys(keyGenerator)), pinned);
+        }
+        std::chrono::duration<double, std::micro> getTime =
+            std::chrono::steady_clock::now() - start;
+
+        std::cout << (engine == StorageEngine::Log ? "log" : "lsm") << ", "
+                  << names[static_cast<int>(codec)] << " : "
+                  << bytes / 1024 << " KB on disk for " << rawBytes / 1024
+                  << " KB of values written, "
+                  << numOfLoops / (putTime.count() / 1000000)
+                  << " Put operations per second, "
+                  << numOfLoops / (getTime.count() / 1000000)
+                  << " Get operations per second\n";
+      }
+    }
+    std::cout << "\n";
+    Saavi::Destroy(openBenchmarkFilename);
+  }
+
  public:
   SaaviBenchmark(int maxEntryId, int numOfLoops)
       : maxEntryId(maxEntryId), numOfLoops(numOfLoops) {
@@ -105,20 +827,123 @@ class SaaviBenchmark {
   }
 
   ~SaaviBenchmark() {
-    // remove the file once benchmark is complete
-    std::filesystem::remove(filename);
+    // remove the files once benchmark is complete
+    Saavi::Destroy(filename);
   }
 
   void run() {
     benchmarkPut();
     benchmarkGet();
+    benchmarkPinnedGet();
+    benchmarkIterate();
+    benchmarkCache();
+    benchmarkConcurrentGet();
+    benchmarkAsyncGet();
+    benchmarkMultiGet();
+    benchmarkShardedPut();
+    benchmarkEngines();
+    benchmarkCompression();
+    benchmarkBlobs();
+    benchmarkOpen();
+    benchmarkRecovery();
+    benchmarkDurability();
+    benchmarkBatch();
   }
 };
 
+namespace {
+
+void usage(const char *program) {
+  std::cerr
+      << "usage: " << program << " [options]\n"
+      << "  runs the YCSB style workloads on a preloaded store\n"
+      << "  --workloads=ABCDEF    the workloads to run, in order\n"
+      << "  --distribution=NAME   uniform, zipfian or latest keys instead of\n"
+      << "                        the ones of each workload\n"
+      << "  --records=N           number of keys preloaded\n"
+      << "  --operations=N        number of operations of every workload\n"
+      << "  --threads=N[,N...]    the thread counts every workload runs with\n"
+      << "  --value-size=N        bytes of every value\n"
+      << "  --engine=log|lsm      the storage engine\n"
+      << "  --json=FILE           where the results go as JSON, - for the\n"
+      << "                        standard output\n"
+      << "usage: " << program << " --classic[=loops] | loops\n"
+      << "  runs the single threaded benchmarks of every feature\n";
+}
+
+std::vector<unsigned> parseThreads(const std::string &list) {
+  std::vector<unsigned> threads;
+  std::stringstream in(list);
+  std::string count;
+  while (std::getline(in, count, ',')) {
+    threads.push_back(std::max(1, std::stoi(count)));
+  }
+  return threads;
+}
+
+}  // namespace
+
 int main(int argc, char **argv) {
-  // tool run as bm [number of loops]
-  SaaviBenchmark bm{DEFAULT_MAX_ENTRY_ID,
-                    (argc == 2) ? std::stoi(argv[1]) : DEFAULT_NUM_OF_LOOPS};
-  bm.run();
+  // tool run as bm [number of loops], for the benchmarks of every feature
+  if (argc == 2 && std::isdigit(static_cast<unsigned char>(argv[1][0]))) {
+    SaaviBenchmark bm{DEFAULT_MAX_ENTRY_ID, std::stoi(argv[1])};
+    bm.run();
+    return 0;
+  }
+
+  WorkloadSuiteOptions options;
+  options.threads = {1};
+  if (std::thread::hardware_concurrency() > 1) {
+    options.threads.push_back(std::thread::hardware_concurrency());
+  }
+  try {
+    for (int i = 1; i < argc; i++) {
+      const std::string arg = argv[i];
+      const size_t equals = arg.find('=');
+      const std::string name = arg.substr(0, equals);
+      const std::string value =
+          equals == std::string::npos ? "" : arg.substr(equals + 1);
+      if (name == "--classic") {
+        SaaviBenchmark bm{DEFAULT_MAX_ENTRY_ID,
+                          value.empty() ? DEFAULT_NUM_OF_LOOPS
+                                        : std::stoi(value)};
+        bm.run();
+        return 0;
+      } else if (name == "--workloads") {
+        options.workloads = value;
+      } else if (name == "--distribution" && value == "uniform") {
+        options.distribution = KeyDistribution::Uniform;
+      } else if (name == "--distribution" && value == "zipfian") {
+        options.distribution = KeyDistribution::Zipfian;
+      } else if (name == "--distribution" && value == "latest") {
+        options.distribution = KeyDistribution::Latest;
+      } else if (name == "--records") {
+        options.records = std::stoull(value);
+      } else if (name == "--operations") {
+        options.operations = std::stoull(value);
+      } else if (name == "--threads") {
+        options.threads = parseThreads(value);
+      } else if (name == "--value-size") {
+        options.valueSize = std::stoull(value);
+      } else if (name == "--engine" && (value == "log" || value == "lsm")) {
+        options.engine =
+            value == "lsm" ? StorageEngine::Lsm : StorageEngine::Log;
+      } else if (name == "--json" && !value.empty()) {
+        options.jsonFilename = value;
+      } else {
+        usage(argv[0]);
+        return 1;
+      }
+    }
+  } catch (std::exception &e) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (options.threads.empty()) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  runWorkloadSuite(options);
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,291 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "saavi.h"
+#include "saavi_exception.h"
+
+namespace {
+
+// a large value that differs from key to key and from round to round
+std::string largeValue(int i, int round, size_t length = 8192) {
+  std::string value = "Value" + std::to_string(i) + "-" +
+                      std::to_string(round) + "-";
+  while (value.length() < length) {
+    value += std::to_string(value.length() * (i + 1) + round);
+  }
+  value.resize(length);
+  return value;
+}
+
+}  // namespace
+
+// Large values in blob files, read with and without the memory mapping
+class BlobTest : public ::testing::TestWithParam<bool> {
+ protected:
+  std::string kvsFileName;
+  std::unique_ptr<Saavi> saavi;
+  SaaviOptions options;
+  std::map<std::string, std::string> expectedEntries;
+
+  void SetUp() override {
+    kvsFileName =
+        std::string(::testing::UnitTest::GetInstance()
+                        ->current_test_info()
+                        ->name()) +
+        ".db";
+    // the test name of a parameterized test contains a '/'
+    std::replace(kvsFileName.begin(), kvsFileName.end(), '/', '_');
+    options.mmapReads = GetParam();
+    options.orderedIndex = true;
+    options.backgroundCompaction = false;
+    options.segmentSize = 16 << 10;
+    options.blobThreshold = 1024;
+    options.blobFileSize = 64 << 10;
+  }
+
+  void TearDown() override {
+    saavi.reset();
+    if (!::testing::Test::HasFailure()) {
+      Saavi::Destroy(kvsFileName);
+    }
+  }
+
+  void open() {
+    ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName, options)));
+  }
+
+  // bytes of the blob files and of the log on disk
+  uintmax_t diskUsage(bool blobFiles) const {
+    const std::string blobPrefix = kvsFileName + ".blob.";
+    uintmax_t bytes = 0;
+    for (const auto &file : std::filesystem::directory_iterator(".")) {
+      const std::string name = file.path().filename().string();
+      if (name.compare(0, kvsFileName.length(), kvsFileName) != 0 ||
+          name == kvsFileName + ".hint") {
+        continue;
+      }
+      if ((name.compare(0, blobPrefix.length(), blobPrefix) == 0) ==
+          blobFiles) {
+        bytes += file.file_size();
+      }
+    }
+    return bytes;
+  }
+
+  void populate(int numOfKeys, int round) {
+    for (int i = 0; i < numOfKeys; i++) {
+      const std::string key = "Key" + std::to_string(i);
+      // every fourth value is small enough to stay in the log
+      const std::string value = i % 4 == 0
+                                    ? "Small" + std::to_string(i)
+                                    : largeValue(i, round);
+      saavi->Put(key, value);
+      expectedEntries[key] = value;
+    }
+  }
+
+  void verify() {
+    for (const auto &entry : expectedEntries) {
+      PinnedValue value;
+      ASSERT_TRUE(saavi->Get(entry.first, value)) << entry.first;
+      EXPECT_EQ(value.view(), entry.second);
+    }
+
+    std::map<std::string, std::string> scanned;
+    for (auto it = saavi->Scan("", ""); it != saavi->end(); ++it) {
+      scanned.insert(*it);
+    }
+    EXPECT_EQ(scanned, expectedEntries);
+
+    std::map<std::string, std::string> iterated;
+    for (auto it = saavi->begin(); it != saavi->end(); ++it) {
+      EXPECT_TRUE(iterated.insert(*it).second) << (*it).first;
+    }
+    EXPECT_EQ(iterated, expectedEntries);
+  }
+};
+
+TEST_P(BlobTest, TestOperations) {
+  open();
+  populate(200, 0);
+  // large values in batches go to blob files as well
+  WriteBatch batch;
+  for (int i = 0; i < 20; i++) {
+    const std::string key = "Batch" + std::to_string(i);
+    batch.Put(key, largeValue(i, 1));
+    expectedEntries[key] = largeValue(i, 1);
+  }
+  batch.Delete("Key1");
+  expectedEntries.erase("Key1");
+  saavi->Write(batch);
+  saavi->Delete("Key2");
+  expectedEntries.erase("Key2");
+  EXPECT_EQ(saavi->Get("Key1"), "");
+  verify();
+
+  // the log only holds pointers to the large values
+  EXPECT_GT(diskUsage(true), 150u * 8192);
+  EXPECT_LT(diskUsage(false), 64u << 10);
+
+  // an invalid key fails before its blob is written
+  const uintmax_t blobBytes = diskUsage(true);
+  EXPECT_THROW(saavi->Put("", largeValue(0, 1)), SaaviException);
+  EXPECT_EQ(diskUsage(true), blobBytes);
+
+  std::string value;
+  saavi->GetAsync("Key3", [&value](std::exception_ptr error, bool found,
+                                   PinnedValue pinned) {
+    EXPECT_EQ(error, nullptr);
+    EXPECT_TRUE(found);
+    value = pinned.ToString();
+  });
+  saavi.reset();
+  EXPECT_EQ(value, expectedEntries["Key3"]);
+
+  // reopen with the hint file and by replaying the log
+  open();
+  verify();
+  saavi.reset();
+  std::filesystem::remove(kvsFileName + ".hint");
+  open();
+  verify();
+
+  // values written with compression and without stay readable
+  saavi.reset();
+  options.compression = Compression::Lz;
+  open();
+  populate(100, 2);
+  verify();
+  saavi.reset();
+  std::filesystem::remove(kvsFileName + ".hint");
+  open();
+  verify();
+}
+
+TEST_P(BlobTest, TestCompactionSkipsBlobs) {
+  open();
+  populate(200, 0);
+  // overwrite only the small values, so compaction has work to do
+  for (int round = 1; round < 20; round++) {
+    for (int i = 0; i < 200; i += 4) {
+      const std::string key = "Key" + std::to_string(i);
+      expectedEntries[key] = "Small" + std::to_string(round);
+      saavi->Put(key, expectedEntries[key]);
+    }
+  }
+  const uintmax_t blobBytes = diskUsage(true);
+  saavi->Compact();
+  verify();
+
+  // compaction copied the pointers but none of the blobs
+  const CompactionStats stats = saavi->GetCompactionStats();
+  EXPECT_EQ(stats.runs, 1u);
+  EXPECT_LT(stats.bytesWritten, blobBytes / 20);
+  EXPECT_EQ(stats.blobBytesMoved, 0u);
+  EXPECT_EQ(diskUsage(true), blobBytes);
+}
+
+TEST_P(BlobTest, TestGarbageCollection) {
+  open();
+  populate(200, 0);
+  const uintmax_t blobBytes = diskUsage(true);
+  // overwrite most of the large values, which leaves the older blob files
+  // mostly dead
+  for (int round = 1; round < 4; round++) {
+    for (int i = 0; i < 200; i++) {
+      if (i % 4 != 0 && i % 10 != 0) {
+        const std::string key = "Key" + std::to_string(i);
+        expectedEntries[key] = largeValue(i, round);
+        saavi->Put(key, expectedEntries[key]);
+      }
+    }
+  }
+  EXPECT_GT(diskUsage(true), 3 * blobBytes);
+
+  saavi->Compact();
+  const CompactionStats stats = saavi->GetCompactionStats();
+  EXPECT_GT(stats.blobFilesCollected, 0u);
+  EXPECT_GT(stats.blobBytesMoved, 0u);
+  EXPECT_GT(stats.blobBytesReclaimed, 0u);
+  EXPECT_LT(diskUsage(true), 2 * blobBytes);
+  verify();
+
+  // the moved blobs are found again after reopening, with the hint file
+  // and without it
+  saavi.reset();
+  open();
+  verify();
+  saavi.reset();
+  std::filesystem::remove(kvsFileName + ".hint");
+  open();
+  verify();
+}
+
+TEST_P(BlobTest, TestSnapshot) {
+  open();
+  populate(100, 0);
+  auto snapshot = saavi->GetSnapshot();
+  const auto seen = expectedEntries;
+  for (int round = 1; round < 4; round++) {
+    populate(100, round);
+  }
+
+  // the blob files the snapshot still sees are kept around
+  saavi->Compact();
+  EXPECT_EQ(saavi->GetCompactionStats().blobFilesCollected, 0u);
+  for (const auto &entry : seen) {
+    EXPECT_EQ(saavi->Get(entry.first, *snapshot), entry.second);
+  }
+  verify();
+
+  // and go once it's released
+  snapshot.reset();
+  saavi->Compact();
+  EXPECT_GT(saavi->GetCompactionStats().blobFilesCollected, 0u);
+  verify();
+}
+
+TEST_P(BlobTest, TestConcurrentCollection) {
+  options.backgroundCompaction = true;
+  options.compactionInterval = std::chrono::milliseconds(1);
+  options.cacheCapacity = 64 << 10;
+  open();
+  populate(50, 0);
+
+  // readers must always find a value while its blob is moved around
+  std::atomic<bool> done{false};
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 2; t++) {
+    readers.emplace_back([this, &done, t] {
+      for (int i = t; !done; i = (i + 7) % 50) {
+        PinnedValue value;
+        EXPECT_TRUE(saavi->Get("Key" + std::to_string(i), value));
+        EXPECT_EQ(value.view().compare(0, 5, "Value") == 0, i % 4 != 0);
+      }
+    });
+  }
+  for (int round = 1; round < 20; round++) {
+    for (int i = 0; i < 50; i++) {
+      if (i % 4 != 0 && i % 3 != 0) {
+        const std::string key = "Key" + std::to_string(i);
+        expectedEntries[key] = largeValue(i, round);
+        saavi->Put(key, expectedEntries[key]);
+      }
+    }
+  }
+  done = true;
+  for (auto &reader : readers) {
+    reader.join();
+  }
+  verify();
+}
+
+INSTANTIATE_TEST_SUITE_P(Reads, BlobTest, ::testing::Bool());
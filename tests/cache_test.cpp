@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+
+#include "saavi.h"
+#include "value_cache.h"
+
+// Tests for the cache of recently read values
+class CacheTest : public ::testing::Test {
+ protected:
+  const std::string kvsFileName = "CacheTest.db";
+  std::unique_ptr<Saavi> saavi;
+  SaaviOptions options;
+
+  void SetUp() override { options.cacheCapacity = 1 << 20; }
+
+  void TearDown() override {
+    saavi.reset();
+    if (!::testing::Test::HasFailure()) {
+      Saavi::Destroy(kvsFileName);
+    }
+  }
+
+  void open() { ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName, options))); }
+};
+
+TEST_F(CacheTest, TestHitsAndMisses) {
+  open();
+  saavi->Put("Key1", "Value1");
+  saavi->Put("Key2", "Value2");
+
+  // the first read misses and fills the cache, the rest hit
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ(saavi->Get("Key1"), "Value1");
+  }
+  auto stats = saavi->GetCacheStats();
+  EXPECT_EQ(stats.misses, 1);
+  EXPECT_EQ(stats.hits, 2);
+  EXPECT_GT(stats.usedBytes, 0);
+  EXPECT_EQ(stats.capacity, options.cacheCapacity);
+
+  // writes update the cached values
+  saavi->Put("Key1", "Value11");
+  EXPECT_EQ(saavi->Get("Key1"), "Value11");
+  WriteBatch batch;
+  batch.Put("Key1", "Value111");
+  batch.Put("Key2", "Value22");
+  saavi->Write(batch);
+  EXPECT_EQ(saavi->Get("Key1"), "Value111");
+  EXPECT_EQ(saavi->Get("Key2"), "Value22");
+  saavi->Delete("Key1");
+  EXPECT_EQ(saavi->Get("Key1"), "");
+  PinnedValue value;
+  EXPECT_FALSE(saavi->Get("Key1", value));
+  EXPECT_EQ(saavi->GetCacheStats().hits, 4);
+
+  // without a capacity there is no cache
+  options.cacheCapacity = 0;
+  open();
+  EXPECT_EQ(saavi->Get("Key2"), "Value22");
+  stats = saavi->GetCacheStats();
+  EXPECT_EQ(stats.hits + stats.misses, 0);
+}
+
+TEST_F(CacheTest, TestEviction) {
+  const size_t capacity = 64 << 10;
+  ValueCache cache(capacity);
+  const std::string value(100, 'v');
+  for (int round = 0; round < 3; round++) {
+    for (int i = 0; i < 10000; i++) {
+      auto key = "Key" + std::to_string(i);
+      if (cache.get(key) == nullptr) {
+        cache.insert(key, std::make_shared<const std::string>(value), 1);
+      }
+      // keep a small set of keys hot
+      cache.get("Key" + std::to_string(i % 16));
+    }
+  }
+
+  auto stats = cache.getStats();
+  EXPECT_LE(stats.usedBytes, capacity);
+  EXPECT_GT(stats.evictions, 0);
+  // the hot keys survive the sweeps of the clock
+  for (int i = 0; i < 16; i++) {
+    EXPECT_NE(cache.get("Key" + std::to_string(i)), nullptr);
+  }
+
+  // an older value never replaces a newer one
+  cache.insert("Key0", std::make_shared<const std::string>("new"), 5);
+  cache.insert("Key0", std::make_shared<const std::string>("old"), 4);
+  EXPECT_EQ(*cache.get("Key0"), "new");
+  cache.erase("Key0", 4);
+  EXPECT_NE(cache.get("Key0"), nullptr);
+  cache.erase("Key0", 5);
+  EXPECT_EQ(cache.get("Key0"), nullptr);
+}
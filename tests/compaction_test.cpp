@@ -0,0 +1,265 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+
+#include "saavi.h"
+#include "saavi_exception.h"
+
+// Tests for the segmented log - rollover and compaction of the segments
+class CompactionTest : public ::testing::Test {
+ protected:
+  std::string kvsFileName;
+  std::unique_ptr<Saavi> saavi;
+  SaaviOptions options;
+  // map of expected values in the kvs
+  std::unordered_map<std::string, std::string> expectedEntries;
+
+  void SetUp() override {
+    kvsFileName =
+        std::string(
+            ::testing::UnitTest::GetInstance()->current_test_info()->name()) +
+        ".db";
+    // tiny segments so that the tests roll over often
+    options.segmentSize = 512;
+    options.backgroundCompaction = false;
+  }
+
+  void TearDown() override {
+    saavi.reset();
+    if (!::testing::Test::HasFailure()) {
+      Saavi::Destroy(kvsFileName);
+      EXPECT_EQ(countSegmentFiles(), 0);
+    }
+  }
+
+  void open() { ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName, options))); }
+
+  // number of sealed segment files on disk
+  int countSegmentFiles() const {
+    int count = 0;
+    for (const auto &file : std::filesystem::directory_iterator(".")) {
+      const std::string name = file.path().filename().string();
+      count += name.compare(0, kvsFileName.length() + 1, kvsFileName + ".") ==
+                   0 &&
+               isdigit(name.back());
+    }
+    return count;
+  }
+
+  // overwrite a set of keys many times and delete a few of them
+  void populateEntries(int rounds = 10) {
+    for (int round = 0; round < rounds; round++) {
+      for (int i = 0; i < 10; i++) {
+        auto key = "Key" + std::to_string(i);
+        auto value = "Value" + std::to_string(i) + "-" + std::to_string(round);
+        saavi->Put(key, value);
+        expectedEntries[key] = value;
+      }
+    }
+    saavi->Delete("Key3");
+    saavi->Delete("Key7");
+    expectedEntries.erase("Key3");
+    expectedEntries.erase("Key7");
+  }
+
+  void verifyEntries() {
+    for (int i = 0; i < 10; i++) {
+      auto key = "Key" + std::to_string(i);
+      auto entry = expectedEntries.find(key);
+      const std::string value =
+          (entry != expectedEntries.end()) ? entry->second : "";
+      EXPECT_EQ(saavi->Get(key), value);
+    }
+  }
+};
+
+TEST_F(CompactionTest, TestRollover) {
+  open();
+  populateEntries();
+  EXPECT_GT(countSegmentFiles(), 1);
+  verifyEntries();
+
+  // the index is rebuilt across all the segments
+  open();
+  verifyEntries();
+  std::filesystem::remove(kvsFileName + ".hint");
+  open();
+  verifyEntries();
+}
+
+TEST_F(CompactionTest, TestCompaction) {
+  open();
+  populateEntries();
+  // push the deletes out of the active segment
+  for (int i = 0; i < 20; i++) {
+    saavi->Put("Key1", "Value1-" + std::to_string(i));
+  }
+  expectedEntries["Key1"] = "Value1-19";
+  ASSERT_NO_THROW(saavi->Compact());
+
+  // all the sealed segments are merged into one
+  EXPECT_EQ(countSegmentFiles(), 1);
+  auto stats = saavi->GetCompactionStats();
+  EXPECT_EQ(stats.runs, 1);
+  EXPECT_EQ(stats.failures, 0);
+  EXPECT_GT(stats.recordsDropped, 0);
+  EXPECT_GT(stats.tombstonesDropped, 0);
+  EXPECT_LT(stats.bytesWritten, stats.bytesRead);
+  verifyEntries();
+
+  // iteration only sees the live entries
+  size_t numOfEntries = 0;
+  for (auto it = saavi->begin(); it != saavi->end(); ++it) {
+    EXPECT_EQ((*it).second, expectedEntries[(*it).first]);
+    numOfEntries++;
+  }
+  EXPECT_EQ(numOfEntries, expectedEntries.size());
+
+  // writes keep working after a compaction
+  saavi->Put("Key1", "Value11");
+  expectedEntries["Key1"] = "Value11";
+  verifyEntries();
+
+  // reopen with the hint written by the compaction and without it
+  open();
+  verifyEntries();
+  std::filesystem::remove(kvsFileName + ".hint");
+  open();
+  verifyEntries();
+}
+
+TEST_F(CompactionTest, TestPinnedValueAcrossCompaction) {
+  open();
+  populateEntries();
+
+  // a pinned value keeps the mapping of its segment alive after compaction
+  // deletes the segment file
+  const auto &expected = *expectedEntries.begin();
+  PinnedValue value;
+  ASSERT_TRUE(saavi->Get(expected.first, value));
+  ASSERT_NO_THROW(saavi->Compact());
+  EXPECT_EQ(value.view(), expected.second);
+  verifyEntries();
+}
+
+TEST_F(CompactionTest, TestIteratorAcrossCompaction) {
+  open();
+  const int numOfKeys = 2000;
+  for (int i = 0; i < numOfKeys; i++) {
+    saavi->Put("Key" + std::to_string(i), "Value" + std::to_string(i));
+  }
+
+  // every key present throughout the iteration is returned exactly once,
+  // with its value from before or after the changes made meanwhile
+  std::unordered_map<std::string, int> seen;
+  for (auto it = saavi->begin(); it != saavi->end(); ++it) {
+    const auto &entry = *it;
+    const std::string suffix = entry.first.substr(3);
+    EXPECT_TRUE(entry.second == "Value" + suffix ||
+                entry.second == "NewValue" + suffix)
+        << entry.first;
+    if (seen[entry.first]++ == 0 && seen.size() == 1) {
+      for (int i = 0; i < numOfKeys; i++) {
+        saavi->Put("Key" + std::to_string(i), "NewValue" + std::to_string(i));
+      }
+      ASSERT_NO_THROW(saavi->Compact());
+    }
+  }
+  EXPECT_EQ(seen.size(), numOfKeys);
+  for (const auto &key : seen) {
+    EXPECT_EQ(key.second, 1) << key.first;
+  }
+}
+
+TEST_F(CompactionTest, TestInterruptedCompaction) {
+  open();
+  populateEntries();
+  saavi.reset();
+
+  // keep a copy of the inputs to simulate a crash right after the merged
+  // segment was renamed into place
+  std::vector<std::filesystem::path> inputs;
+  for (const auto &file : std::filesystem::directory_iterator(".")) {
+    const std::string name = file.path().filename().string();
+    if (name.compare(0, kvsFileName.length() + 1, kvsFileName + ".") == 0 &&
+        isdigit(name.back())) {
+      inputs.push_back(file.path());
+      std::filesystem::copy_file(file.path(), name + ".saved");
+    }
+  }
+  ASSERT_GT(inputs.size(), 1);
+
+  open();
+  saavi->Compact();
+  saavi.reset();
+  std::filesystem::remove(kvsFileName + ".hint");
+  for (const auto &input : inputs) {
+    if (!std::filesystem::exists(input)) {
+      std::filesystem::rename(input.filename().string() + ".saved", input);
+    } else {
+      std::filesystem::remove(input.filename().string() + ".saved");
+    }
+  }
+
+  // the stale inputs are dropped on open and deleted keys stay deleted
+  open();
+  EXPECT_EQ(countSegmentFiles(), 1);
+  verifyEntries();
+}
+
+TEST_F(CompactionTest, TestFailedHintWrite) {
+  open();
+  populateEntries();
+  // the hint can't be written while its temporary file is a directory
+  const std::string tmpHint = kvsFileName + ".hint.tmp";
+  std::filesystem::create_directory(tmpHint);
+  EXPECT_THROW(saavi->Compact(), SaaviException);
+  std::filesystem::remove(tmpHint);
+  verifyEntries();
+
+  // so it is written on close, not taken to be current
+  std::filesystem::remove(kvsFileName + ".hint");
+  saavi.reset();
+  EXPECT_TRUE(std::filesystem::exists(kvsFileName + ".hint"));
+  open();
+  verifyEntries();
+}
+
+TEST_F(CompactionTest, TestBackgroundCompaction) {
+  options.backgroundCompaction = true;
+  options.compactionInterval = std::chrono::milliseconds(1);
+  open();
+
+  // keep writing until the background thread has compacted a few times
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (saavi->GetCompactionStats().runs < 3 &&
+         std::chrono::steady_clock::now() < deadline) {
+    populateEntries(1);
+    verifyEntries();
+  }
+  EXPECT_GE(saavi->GetCompactionStats().runs, 3);
+  EXPECT_EQ(saavi->GetCompactionStats().failures, 0);
+  verifyEntries();
+
+  open();
+  verifyEntries();
+}
+
+TEST_F(CompactionTest, TestThrottledCompaction) {
+  options.compactionBytesPerSecond = 64 * 1024;
+  open();
+  populateEntries(50);
+  saavi->Compact();
+
+  auto stats = saavi->GetCompactionStats();
+  EXPECT_GT(stats.throttledTime.count(), 0);
+  // reading at the throttled rate takes at least bytesRead / rate seconds
+  EXPECT_GE(stats.lastRunDuration.count(),
+            stats.bytesRead * 1000000 / options.compactionBytesPerSecond);
+  verifyEntries();
+}
@@ -0,0 +1,254 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "compression.h"
+#include "saavi.h"
+#include "saavi_exception.h"
+
+namespace {
+
+// a value in the shape of the JSON documents saavi is often used for
+std::string jsonValue(int i) {
+  return "{\"id\": " + std::to_string(i) +
+         ", \"name\": \"user" + std::to_string(i % 97) +
+         "\", \"email\": \"user" + std::to_string(i % 97) +
+         "@example.com\", \"tags\": [\"alpha\", \"beta\", \"gamma\"], "
+         "\"active\": " + (i % 2 ? "true" : "false") +
+         ", \"score\": " + std::to_string(i * 7 % 1000) + "}";
+}
+
+std::string randomBytes(size_t length, unsigned seed) {
+  std::default_random_engine generator(seed);
+  std::uniform_int_distribution<int> bytes(0, 255);
+  std::string data(length, '\0');
+  for (auto &c : data) {
+    c = static_cast<char>(bytes(generator));
+  }
+  return data;
+}
+
+}  // namespace
+
+class CodecTest : public ::testing::TestWithParam<Compression> {
+ protected:
+  void SetUp() override {
+    if (!compressionSupported(GetParam())) {
+      GTEST_SKIP() << "not supported by this build";
+    }
+  }
+
+  void roundTrip(const std::string &data, bool compressible) {
+    std::string compressed = "prefix";
+    ASSERT_EQ(compress(GetParam(), data, compressed), compressible);
+    if (!compressible) {
+      EXPECT_EQ(compressed, "prefix");
+      return;
+    }
+    EXPECT_LT(compressed.length(), data.length() + 6);
+    std::string decompressed = "prefix";
+    decompress(GetParam(), compressed.substr(6), decompressed);
+    EXPECT_EQ(decompressed.substr(6), data);
+  }
+};
+
+TEST_P(CodecTest, TestRoundTrip) {
+  roundTrip("", false);
+  roundTrip("abc", false);
+  roundTrip(jsonValue(1), true);
+  roundTrip(std::string(100000, 'a'), true);
+  // long literal runs and long matches both spill out of the token
+  std::string mixed = randomBytes(1000, 1);
+  mixed += mixed + std::string(5000, 'x') + randomBytes(300, 2);
+  roundTrip(mixed, true);
+  // random data doesn't compress
+  roundTrip(randomBytes(4096, 3), false);
+
+  std::string text;
+  for (int i = 0; i < 1000; i++) {
+    text += jsonValue(i);
+  }
+  roundTrip(text, true);
+}
+
+TEST_P(CodecTest, TestCorruptData) {
+  std::string text;
+  for (int i = 0; i < 100; i++) {
+    text += jsonValue(i);
+  }
+  std::string compressed;
+  ASSERT_TRUE(compress(GetParam(), text, compressed));
+
+  std::string out;
+  // truncated data never decompresses into the full length
+  for (size_t length : {size_t(0), size_t(1), compressed.length() / 2,
+                        compressed.length() - 1}) {
+    EXPECT_THROW(decompress(GetParam(), compressed.substr(0, length), out),
+                 SaaviException);
+  }
+  // nor does data claiming to be much longer than it is
+  compressed[0] = '\xff';
+  compressed[1] = '\xff';
+  EXPECT_THROW(decompress(GetParam(), compressed, out), SaaviException);
+  EXPECT_THROW(decompress(static_cast<Compression>(42), compressed, out),
+               SaaviException);
+}
+
+INSTANTIATE_TEST_SUITE_P(Codecs, CodecTest,
+                         ::testing::Values(Compression::Lz,
+                                           Compression::Zlib));
+
+// A store must behave the same with every codec and engine, the values just
+// take up less space on disk
+class CompressionTest
+    : public ::testing::TestWithParam<std::tuple<StorageEngine, Compression>> {
+ protected:
+  std::string kvsFileName;
+  std::unique_ptr<Saavi> saavi;
+  SaaviOptions options;
+  std::map<std::string, std::string> expectedEntries;
+
+  void SetUp() override {
+    if (!compressionSupported(std::get<1>(GetParam()))) {
+      GTEST_SKIP() << "not supported by this build";
+    }
+    kvsFileName = "CompressionTest" +
+                  std::to_string(static_cast<int>(std::get<0>(GetParam()))) +
+                  std::to_string(static_cast<int>(std::get<1>(GetParam()))) +
+                  ".db";
+    options.engine = std::get<0>(GetParam());
+    options.compression = std::get<1>(GetParam());
+    options.orderedIndex = true;
+    options.backgroundCompaction = false;
+    options.segmentSize = 64 << 10;
+    options.memtableSize = 16 << 10;
+    options.levelBaseSize = 64 << 10;
+    options.compressionMinSize = 64;
+  }
+
+  void TearDown() override {
+    saavi.reset();
+    if (!::testing::Test::HasFailure()) {
+      Saavi::Destroy(kvsFileName);
+    }
+  }
+
+  void open() {
+    ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName, options)));
+  }
+
+  uintmax_t diskUsage() const {
+    uintmax_t bytes = 0;
+    for (const auto &file : std::filesystem::directory_iterator(".")) {
+      if (file.path().filename().string().compare(0, kvsFileName.length(),
+                                                  kvsFileName) == 0) {
+        bytes += file.file_size();
+      }
+    }
+    return bytes;
+  }
+
+  void populate(int numOfKeys) {
+    for (int i = 0; i < numOfKeys; i++) {
+      const std::string key = "Key" + std::to_string(i);
+      // a few short values that are never compressed
+      const std::string value =
+          i % 10 == 0 ? "short" + std::to_string(i) : jsonValue(i);
+      saavi->Put(key, value);
+      expectedEntries[key] = value;
+    }
+    WriteBatch batch;
+    for (int i = 0; i < 50; i++) {
+      const std::string key = "Batch" + std::to_string(i);
+      batch.Put(key, jsonValue(i));
+      expectedEntries[key] = jsonValue(i);
+    }
+    batch.Delete("Key1");
+    expectedEntries.erase("Key1");
+    saavi->Write(batch);
+  }
+
+  void verify() {
+    for (const auto &entry : expectedEntries) {
+      PinnedValue value;
+      ASSERT_TRUE(saavi->Get(entry.first, value)) << entry.first;
+      EXPECT_EQ(value.view(), entry.second);
+    }
+    EXPECT_EQ(saavi->Get("Key1"), "");
+
+    std::map<std::string, std::string> scanned;
+    for (auto it = saavi->Scan("", ""); it != saavi->end(); ++it) {
+      scanned.insert(*it);
+    }
+    EXPECT_EQ(scanned, expectedEntries);
+
+    if (options.engine == StorageEngine::Log) {
+      std::map<std::string, std::string> iterated;
+      for (auto it = saavi->begin(); it != saavi->end(); ++it) {
+        iterated.insert(*it);
+      }
+      EXPECT_EQ(iterated, expectedEntries);
+    }
+  }
+};
+
+TEST_P(CompressionTest, TestOperations) {
+  open();
+  populate(2000);
+  verify();
+  saavi->Compact();
+  verify();
+
+  // the data stays readable whatever codec the store is opened with next
+  saavi.reset();
+  options.compression = Compression::None;
+  options.mmapReads = false;
+  open();
+  verify();
+  for (int i = 2; i < 100; i++) {
+    saavi->Put("Key" + std::to_string(i), "new" + jsonValue(i));
+    expectedEntries["Key" + std::to_string(i)] = "new" + jsonValue(i);
+  }
+  saavi->Compact();
+  verify();
+}
+
+TEST_P(CompressionTest, TestRatio) {
+  const Compression codec = options.compression;
+  open();
+  populate(2000);
+  saavi->Compact();
+  saavi.reset();
+  const uintmax_t compressedBytes = diskUsage();
+
+  // the same data without compression
+  Saavi::Destroy(kvsFileName);
+  options.compression = Compression::None;
+  open();
+  populate(2000);
+  saavi->Compact();
+  saavi.reset();
+  const uintmax_t rawBytes = diskUsage();
+  if (codec == Compression::None) {
+    EXPECT_EQ(compressedBytes, rawBytes);
+  } else if (options.engine == StorageEngine::Log) {
+    // values this short only compress a little on their own
+    EXPECT_LT(compressedBytes, rawBytes);
+  } else {
+    // while whole blocks of them compress well
+    EXPECT_LT(compressedBytes, rawBytes / 2);
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Compressions, CompressionTest,
+    ::testing::Combine(::testing::Values(StorageEngine::Log,
+                                         StorageEngine::Lsm),
+                       ::testing::Values(Compression::None, Compression::Lz,
+                                         Compression::Zlib)));
@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "saavi.h"
+
+// Readers run alongside the writer and the background compaction and must
+// always see a complete value of a key
+class ConcurrencyTest : public ::testing::Test {
+ protected:
+  const std::string kvsFileName = "ConcurrencyTest.db";
+  std::unique_ptr<Saavi> saavi;
+  SaaviOptions options;
+
+  void SetUp() override {
+    // small segments so that rollovers and compactions happen during the test
+    options.segmentSize = 4096;
+    options.compactionInterval = std::chrono::milliseconds(1);
+    options.compactionDeadRatio = 0.1;
+    ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName, options)));
+  }
+
+  void TearDown() override {
+    saavi.reset();
+    if (!::testing::Test::HasFailure()) {
+      Saavi::Destroy(kvsFileName);
+    }
+  }
+};
+
+TEST_F(ConcurrencyTest, TestReadersWithWriter) {
+  const int numOfKeys = 100;
+  const int numOfRounds = 20;
+  for (int i = 0; i < numOfKeys; i++) {
+    saavi->Put("Key" + std::to_string(i), "Value" + std::to_string(i) + "-0");
+  }
+
+  std::atomic<bool> done{false};
+  std::atomic<int> badReads{0};
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; t++) {
+    readers.emplace_back([&, t] {
+      int i = t;
+      while (!done) {
+        const std::string prefix = "Value" + std::to_string(i) + "-";
+        const std::string value = saavi->Get("Key" + std::to_string(i));
+        if (value.compare(0, prefix.length(), prefix) != 0) {
+          badReads++;
+        }
+        i = (i + 1) % numOfKeys;
+      }
+    });
+  }
+
+  // overwrite every key a few times so that most of the log is dead
+  for (int round = 1; round <= numOfRounds; round++) {
+    for (int i = 0; i < numOfKeys; i++) {
+      saavi->Put("Key" + std::to_string(i),
+                 "Value" + std::to_string(i) + "-" + std::to_string(round));
+    }
+  }
+  saavi->Compact();
+  done = true;
+  for (auto &reader : readers) {
+    reader.join();
+  }
+
+  EXPECT_EQ(badReads, 0);
+  EXPECT_GT(saavi->GetCompactionStats().runs, 0u);
+  for (int i = 0; i < numOfKeys; i++) {
+    EXPECT_EQ(saavi->Get("Key" + std::to_string(i)),
+              "Value" + std::to_string(i) + "-" + std::to_string(numOfRounds));
+  }
+}
@@ -0,0 +1,115 @@
+#include <gtest/gtest.h>
+#include <sys/resource.h>
+
+#include <csignal>
+#include <filesystem>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "saavi.h"
+#include "saavi_exception.h"
+
+// Every durability mode must give the same results, they only differ in when
+// the writes reach the disk
+class DurabilityTest : public ::testing::TestWithParam<DurabilityMode> {
+ protected:
+  std::string kvsFileName;
+  std::unique_ptr<Saavi> saavi;
+  SaaviOptions options;
+
+  void SetUp() override {
+    kvsFileName = "DurabilityTest" +
+                  std::to_string(static_cast<int>(GetParam())) + ".db";
+    options.durability = GetParam();
+    options.groupCommitInterval = std::chrono::microseconds(200);
+    ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName, options)));
+  }
+
+  void TearDown() override {
+    saavi.reset();
+    if (!::testing::Test::HasFailure()) {
+      Saavi::Destroy(kvsFileName);
+    }
+  }
+};
+
+TEST_P(DurabilityTest, TestReadYourWrites) {
+  // buffered writes must be visible right away
+  for (int i = 0; i < 100; i++) {
+    saavi->Put("Key" + std::to_string(i), "Value" + std::to_string(i));
+    EXPECT_EQ(saavi->Get("Key" + std::to_string(i)),
+              "Value" + std::to_string(i));
+  }
+  int numOfEntries = 0;
+  for (auto it = saavi->begin(); it != saavi->end(); ++it) {
+    numOfEntries++;
+  }
+  EXPECT_EQ(numOfEntries, 100);
+}
+
+TEST_P(DurabilityTest, TestConcurrentWriters) {
+  const int numOfThreads = 4;
+  const int numOfPuts = 200;
+  std::vector<std::thread> writers;
+  for (int t = 0; t < numOfThreads; t++) {
+    writers.emplace_back([this, t] {
+      for (int i = 0; i < numOfPuts; i++) {
+        auto suffix = std::to_string(t) + "-" + std::to_string(i);
+        saavi->Put("Key" + suffix, "Value" + suffix);
+      }
+    });
+  }
+  for (auto &writer : writers) {
+    writer.join();
+  }
+
+  // everything is on disk after a clean close
+  ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName, options)));
+  std::filesystem::remove(kvsFileName + ".hint");
+  ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName, options)));
+  for (int t = 0; t < numOfThreads; t++) {
+    for (int i = 0; i < numOfPuts; i++) {
+      auto suffix = std::to_string(t) + "-" + std::to_string(i);
+      EXPECT_EQ(saavi->Get("Key" + suffix), "Value" + suffix);
+    }
+  }
+}
+
+TEST_P(DurabilityTest, TestFailedWrite) {
+  saavi->Put("Key0", "Value0");
+  EXPECT_EQ(saavi->Get("Key0"), "Value0");
+
+  // the file can't grow any more, so whatever writes out the buffered
+  // records fails and they are forgotten
+  rlimit limit;
+  ASSERT_EQ(getrlimit(RLIMIT_FSIZE, &limit), 0);
+  const rlimit original = limit;
+  limit.rlim_cur = std::filesystem::file_size(kvsFileName) + 8;
+  auto handler = std::signal(SIGXFSZ, SIG_IGN);
+  ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &limit), 0);
+  EXPECT_THROW(
+      {
+        saavi->Put("Key1", "Value1");
+        saavi->Put("Key2", std::string(2 << 20, 'v'));
+      },
+      SaaviException);
+  ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &original), 0);
+  std::signal(SIGXFSZ, handler);
+
+  EXPECT_EQ(saavi->Get("Key0"), "Value0");
+  EXPECT_EQ(saavi->Get("Key1"), "");
+  EXPECT_EQ(saavi->Get("Key2"), "");
+  saavi->Put("Key3", "Value3");
+  saavi.reset();
+  ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName, options)));
+  EXPECT_EQ(saavi->Get("Key0"), "Value0");
+  EXPECT_EQ(saavi->Get("Key1"), "");
+  EXPECT_EQ(saavi->Get("Key3"), "Value3");
+}
+
+INSTANTIATE_TEST_SUITE_P(DurabilityModes, DurabilityTest,
+                         ::testing::Values(DurabilityMode::None,
+                                           DurabilityMode::FlushPerWrite,
+                                           DurabilityMode::FsyncPerWrite,
+                                           DurabilityMode::GroupCommit));
@@ -0,0 +1,142 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <unordered_map>
+
+#include "flat_index.h"
+#include "record.h"
+
+namespace {
+
+IndexEntry entryFor(const std::string &key, uint64_t sequence) {
+  return IndexEntry{static_cast<uint32_t>(sequence % 7),
+                    static_cast<unsigned long>(sequence * 100),
+                    RECORD_HEADER_SIZE + key.length() + sequence % 1000,
+                    sequence};
+}
+
+void expectSameEntry(const IndexEntry &actual, const IndexEntry &expected) {
+  EXPECT_EQ(actual.segmentId, expected.segmentId);
+  EXPECT_EQ(actual.offset, expected.offset);
+  EXPECT_EQ(actual.size, expected.size);
+  EXPECT_EQ(actual.sequence, expected.sequence);
+}
+
+}  // namespace
+
+TEST(FlatIndexTest, TestOperations) {
+  FlatIndex index;
+  IndexEntry entry;
+  EXPECT_FALSE(index.get("Key1", entry));
+  EXPECT_FALSE(index.erase("Key1"));
+
+  EXPECT_FALSE(index.put("Key1", entryFor("Key1", 1)));
+  ASSERT_TRUE(index.get("Key1", entry));
+  expectSameEntry(entry, entryFor("Key1", 1));
+
+  // replacing a key hands back the old entry
+  IndexEntry previous;
+  EXPECT_TRUE(index.put("Key1", entryFor("Key1", 2), &previous));
+  expectSameEntry(previous, entryFor("Key1", 1));
+  EXPECT_EQ(index.size(), 1);
+
+  // keys longer than a single byte length prefix and arbitrary bytes
+  const std::string longKey(300, 'k');
+  const std::string binaryKey("K\0e\ny", 5);
+  index.put(longKey, entryFor(longKey, 3));
+  index.put(binaryKey, entryFor(binaryKey, 4));
+  ASSERT_TRUE(index.get(longKey, entry));
+  expectSameEntry(entry, entryFor(longKey, 3));
+  ASSERT_TRUE(index.get(binaryKey, entry));
+  EXPECT_FALSE(index.get(std::string("K\0e", 3), entry));
+
+  EXPECT_TRUE(index.erase("Key1"));
+  EXPECT_FALSE(index.get("Key1", entry));
+  EXPECT_EQ(index.size(), 2);
+
+  index.clear();
+  EXPECT_EQ(index.size(), 0);
+  EXPECT_FALSE(index.get(longKey, entry));
+}
+
+TEST(FlatIndexTest, TestAgainstUnorderedMap) {
+  // random puts and erases over a small key space, so that the table grows,
+  // fills up with erased slots and gets rehashed
+  FlatIndex index;
+  std::unordered_map<std::string, IndexEntry> expected;
+  std::default_random_engine generator(42);
+  std::uniform_int_distribution<int> keys(0, 20000);
+  std::uniform_int_distribution<int> operations(0, 3);
+  for (uint64_t sequence = 1; sequence <= 200000; sequence++) {
+    const std::string key = "Key" + std::to_string(keys(generator));
+    if (operations(generator) == 0) {
+      EXPECT_EQ(index.erase(key), expected.erase(key) == 1);
+    } else {
+      const IndexEntry entry = entryFor(key, sequence);
+      EXPECT_EQ(index.put(key, entry), expected.count(key) == 1);
+      expected[key] = entry;
+    }
+  }
+
+  EXPECT_EQ(index.size(), expected.size());
+  for (const auto &entry : expected) {
+    IndexEntry actual;
+    ASSERT_TRUE(index.get(entry.first, actual)) << entry.first;
+    expectSameEntry(actual, entry.second);
+  }
+
+  size_t visited = 0;
+  index.forEach([&](std::string_view key, const IndexEntry &entry) {
+    auto it = expected.find(std::string(key));
+    ASSERT_NE(it, expected.end());
+    expectSameEntry(entry, it->second);
+    visited++;
+  });
+  EXPECT_EQ(visited, expected.size());
+}
+
+TEST(FlatIndexTest, TestForEachFrom) {
+  FlatIndex index;
+  for (uint64_t sequence = 1; sequence <= 1000; sequence++) {
+    const std::string key = "Key" + std::to_string(sequence);
+    index.put(key, entryFor(key, sequence));
+  }
+
+  // a walk in steps of 64 keys visits every key once
+  std::unordered_map<std::string, int> visits;
+  const uint64_t layout = index.layout();
+  size_t position = 0;
+  size_t steps = 0;
+  while (position < index.slotCount()) {
+    size_t visited = 0;
+    position = index.forEachFrom(
+        position, 64, [&](std::string_view key, const IndexEntry &) {
+          visits[std::string(key)]++;
+          visited++;
+        });
+    EXPECT_LE(visited, 64u);
+    steps++;
+  }
+  EXPECT_EQ(steps, (1000 + 63) / 64);
+  EXPECT_EQ(visits.size(), 1000u);
+  for (const auto &visit : visits) {
+    EXPECT_EQ(visit.second, 1) << visit.first;
+  }
+
+  // replacing and erasing keys leaves them in their slots, growing the
+  // table moves them
+  index.put("Key1", entryFor("Key1", 1001));
+  index.erase("Key2");
+  EXPECT_EQ(index.layout(), layout);
+  for (uint64_t sequence = 1001; sequence <= 2000; sequence++) {
+    const std::string key = "Key" + std::to_string(sequence);
+    index.put(key, entryFor(key, sequence));
+  }
+  EXPECT_NE(index.layout(), layout);
+  EXPECT_EQ(index.forEachFrom(index.slotCount(), 1,
+                              [](std::string_view, const IndexEntry &) {
+                                FAIL();
+                              }),
+            index.slotCount());
+}
@@ -0,0 +1,258 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <memory>
+
+#include "hint_file.h"
+#include "record.h"
+#include "saavi.h"
+#include "saavi_exception.h"
+
+// Tests for the on-disk format - upgrading old files and recovering from
+// torn or corrupt records.
+class FormatTest : public ::testing::Test {
+ protected:
+  std::string kvsFileName;
+
+  void SetUp() override {
+    kvsFileName =
+        std::string(
+            ::testing::UnitTest::GetInstance()->current_test_info()->name()) +
+        ".db";
+  }
+
+  void TearDown() override {
+    if (!::testing::Test::HasFailure()) {
+      // not every test creates the kvs file
+      Saavi::Destroy(kvsFileName);
+    }
+  }
+
+  void appendToFile(const std::string &data) {
+    std::ofstream file(kvsFileName,
+                       std::ios::out | std::ios::app | std::ios::binary);
+    file << data;
+  }
+};
+
+TEST_F(FormatTest, TestRecordEncoding) {
+  std::string buf;
+  encodeRecord(buf, 0, 42, "key", "value");
+  ASSERT_EQ(buf.length(), RECORD_HEADER_SIZE + 8);
+
+  RecordHeader header;
+  RecordHeader::decode(buf.data(), header);
+  EXPECT_EQ(header.keyLength, 3);
+  EXPECT_EQ(header.valueLength, 5);
+  EXPECT_EQ(header.sequence, 42);
+  EXPECT_TRUE(verifyRecord(header, buf.data()));
+
+  // flipping any byte after the crc must be detected
+  buf[RECORD_HEADER_SIZE + 1] ^= 0x1;
+  EXPECT_FALSE(verifyRecord(header, buf.data()));
+
+  // known crc32c check value
+  EXPECT_EQ(crc32c("123456789", 9), 0xE3069283);
+}
+
+TEST_F(FormatTest, TestLegacyUpgrade) {
+  // write a file in the old csv format
+  appendToFile("Key1,Value1\nKey2,Value2\nKey1,Value11\nKey3,\n");
+
+  std::unique_ptr<Saavi> saavi;
+  ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName)));
+  EXPECT_EQ(saavi->Get("Key1"), "Value11");
+  EXPECT_EQ(saavi->Get("Key2"), "Value2");
+  EXPECT_EQ(saavi->Get("Key3"), "");
+
+  // the file is now in the new format
+  std::ifstream file(kvsFileName, std::ios::in | std::ios::binary);
+  char buf[FILE_HEADER_SIZE];
+  ASSERT_TRUE(file.read(buf, FILE_HEADER_SIZE));
+  FileHeader header;
+  EXPECT_TRUE(FileHeader::decode(buf, header));
+
+  // and new entries are appended in the new format
+  saavi->Put("Key4", "Value4");
+  ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName)));
+  EXPECT_EQ(saavi->Get("Key1"), "Value11");
+  EXPECT_EQ(saavi->Get("Key4"), "Value4");
+}
+
+TEST_F(FormatTest, TestTornTail) {
+  std::unique_ptr<Saavi> saavi(new Saavi(kvsFileName));
+  saavi->Put("Key1", "Value1");
+  saavi->Put("Key2", "Value2");
+  saavi.reset();
+
+  // simulate a crash in the middle of appending a record
+  std::string record;
+  encodeRecord(record, 0, 3, "Key1", "Value11");
+  appendToFile(record.substr(0, record.length() - 3));
+
+  ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName)));
+  EXPECT_EQ(saavi->Get("Key1"), "Value1");
+  EXPECT_EQ(saavi->Get("Key2"), "Value2");
+
+  // new entries land after the last valid record
+  saavi->Put("Key3", "Value3");
+  ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName)));
+  EXPECT_EQ(saavi->Get("Key1"), "Value1");
+  EXPECT_EQ(saavi->Get("Key3"), "Value3");
+}
+
+TEST_F(FormatTest, TestCorruptTail) {
+  std::unique_ptr<Saavi> saavi(new Saavi(kvsFileName));
+  saavi->Put("Key1", "Value1");
+  saavi.reset();
+
+  // a complete record with a bad checksum is not applied
+  std::string record;
+  encodeRecord(record, 0, 2, "Key1", "Value11");
+  record[record.length() - 1] ^= 0x1;
+  appendToFile(record);
+
+  ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName)));
+  EXPECT_EQ(saavi->Get("Key1"), "Value1");
+}
+
+TEST_F(FormatTest, TestCorruptRecord) {
+  std::unique_ptr<Saavi> saavi(new Saavi(kvsFileName));
+  saavi->Put("Key1", "Value1");
+  saavi.reset();
+  std::filesystem::remove(kvsFileName + ".hint");
+
+  // a bad record followed by intact ones is corruption in the middle of the
+  // log, which fails the open rather than losing the records after it
+  std::string record;
+  encodeRecord(record, 0, 2, "Key1", "Value11");
+  record[record.length() - 1] ^= 0x1;
+  encodeRecord(record, 0, 3, "Key2", "Value2");
+  appendToFile(record);
+  const auto size = std::filesystem::file_size(kvsFileName);
+  EXPECT_THROW(saavi.reset(new Saavi(kvsFileName)), SaaviException);
+  EXPECT_EQ(std::filesystem::file_size(kvsFileName), size);
+
+  // garbage after a bad record is still a torn tail
+  std::filesystem::resize_file(kvsFileName, size - 8);
+  appendToFile(std::string(64, '\0'));
+  ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName)));
+  EXPECT_EQ(saavi->Get("Key1"), "Value1");
+  EXPECT_EQ(saavi->Get("Key2"), "");
+}
+
+TEST_F(FormatTest, TestHintFile) {
+  std::unique_ptr<Saavi> saavi(new Saavi(kvsFileName));
+  saavi->Put("Key1", "Value1");
+  saavi->Put("Key2", "Value2");
+  saavi->Put("Key1", "Value11");
+  saavi->Delete("Key2");
+  saavi.reset();
+
+  // a clean close leaves a hint file behind
+  ASSERT_TRUE(std::filesystem::exists(kvsFileName + ".hint"));
+
+  // records appended after the hint was written are replayed from the log
+  std::string record;
+  encodeRecord(record, 0, 5, "Key3", "Value3");
+  encodeRecord(record, 0, 6, "Key1", "Value111");
+  appendToFile(record);
+
+  ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName)));
+  EXPECT_EQ(saavi->Get("Key1"), "Value111");
+  EXPECT_EQ(saavi->Get("Key2"), "");
+  EXPECT_EQ(saavi->Get("Key3"), "Value3");
+
+  // sequence numbers continue after the replayed tail
+  saavi->Put("Key4", "Value4");
+  saavi.reset();
+  ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName)));
+  EXPECT_EQ(saavi->Get("Key4"), "Value4");
+  EXPECT_EQ(saavi->Get("Key1"), "Value111");
+}
+
+TEST_F(FormatTest, TestHintFileSizes) {
+  // record sizes past 4GiB survive the hint file
+  const std::string hint = kvsFileName + ".hint";
+  const uint64_t size = (uint64_t(1) << 32) + 5;
+  {
+    HintFileWriter writer(hint, {HintSegment{0, size + 100, 1}});
+    writer.add(HintEntry{"Key1", 0, 100, size, 7});
+    writer.addChain(HintChain{"Key2", {IndexEntry{0, 50, size, 3}}});
+    writer.finish(HintHeader());
+  }
+  EXPECT_FALSE(std::filesystem::exists(hint + ".tmp"));
+
+  HintFileReader reader;
+  ASSERT_TRUE(reader.open(hint));
+  HintEntry entry;
+  ASSERT_TRUE(reader.next(entry));
+  EXPECT_EQ(entry.key, "Key1");
+  EXPECT_EQ(entry.size, size);
+  EXPECT_EQ(entry.offset, 100);
+  EXPECT_EQ(entry.sequence, 7);
+  EXPECT_FALSE(reader.next(entry));
+  HintBlob blob;
+  EXPECT_FALSE(reader.nextBlob(blob));
+  HintChain chain;
+  ASSERT_TRUE(reader.nextChain(chain));
+  EXPECT_EQ(chain.key, "Key2");
+  ASSERT_EQ(chain.entries.size(), 1);
+  EXPECT_EQ(chain.entries[0].size, size);
+  EXPECT_EQ(chain.entries[0].offset, 50);
+  EXPECT_EQ(chain.entries[0].sequence, 3);
+  std::filesystem::remove(hint);
+}
+
+TEST_F(FormatTest, TestStaleHintFile) {
+  std::unique_ptr<Saavi> saavi(new Saavi(kvsFileName));
+  saavi->Put("Key1", "Value1");
+  saavi->Put("Key2", "Value2");
+  saavi.reset();
+
+  // replace the data file underneath the hint file
+  const std::string hint = kvsFileName + ".hint";
+  std::filesystem::rename(hint, hint + ".old");
+  Saavi::Destroy(kvsFileName);
+  saavi.reset(new Saavi(kvsFileName));
+  saavi->Put("Key3", "Value3");
+  saavi->Put("Key4", "Value4");
+  saavi->Put("Key5", "Value5");
+  saavi.reset();
+  std::filesystem::rename(hint + ".old", hint);
+
+  // the hint doesn't match the data file and must be ignored
+  ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName)));
+  EXPECT_EQ(saavi->Get("Key1"), "");
+  EXPECT_EQ(saavi->Get("Key3"), "Value3");
+  EXPECT_EQ(saavi->Get("Key5"), "Value5");
+}
+
+TEST_F(FormatTest, TestTornBatch) {
+  std::unique_ptr<Saavi> saavi(new Saavi(kvsFileName));
+  saavi->Put("Key1", "Value1");
+  WriteBatch batch;
+  batch.Put("Key1", "Value11");
+  batch.Put("Key2", "Value2");
+  batch.Put("Key3", "Value3");
+  saavi->Write(batch);
+  saavi.reset();
+
+  // lose the end of the batch as if the process crashed while writing it
+  std::filesystem::remove(kvsFileName + ".hint");
+  std::filesystem::resize_file(kvsFileName,
+                               std::filesystem::file_size(kvsFileName) - 4);
+
+  // none of the batch is applied, even the records that are complete
+  ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName)));
+  EXPECT_EQ(saavi->Get("Key1"), "Value1");
+  EXPECT_EQ(saavi->Get("Key2"), "");
+  EXPECT_EQ(saavi->Get("Key3"), "");
+
+  // and the torn batch is dropped from the log
+  saavi->Put("Key4", "Value4");
+  ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName)));
+  EXPECT_EQ(saavi->Get("Key4"), "Value4");
+  EXPECT_EQ(saavi->Get("Key2"), "");
+}
@@ -0,0 +1,108 @@
+#include <malloc.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "flat_index.h"
+#include "record.h"
+
+const int DEFAULT_NUM_OF_KEYS = 1000000;
+
+// Compares the memory used per key and the lookup rate of the flat index
+// with the std::unordered_map it replaced
+class IndexBenchmark {
+  int numOfKeys;
+  std::vector<std::string> keys;
+  // keys in a random order for the lookups
+  std::vector<std::string> lookups;
+
+  static size_t allocatedBytes() { return mallinfo2().uordblks; }
+
+  template <typename Index, typename Put, typename Get>
+  void run(const std::string &name, Put put, Get get) {
+    const size_t before = allocatedBytes();
+    std::unique_ptr<Index> index(new Index());
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < keys.size(); i++) {
+      put(*index, keys[i],
+          IndexEntry{1, i * 64, RECORD_HEADER_SIZE + keys[i].length() + 40,
+                     i + 1});
+    }
+    std::chrono::duration<double> insertTime =
+        std::chrono::steady_clock::now() - start;
+    const double bytesPerKey =
+        static_cast<double>(allocatedBytes() - before) / keys.size();
+
+    size_t found = 0;
+    start = std::chrono::steady_clock::now();
+    for (const auto &key : lookups) {
+      found += get(*index, key);
+    }
+    std::chrono::duration<double> lookupTime =
+        std::chrono::steady_clock::now() - start;
+
+    std::cout << name << " : " << bytesPerKey << " bytes per key, "
+              << keys.size() / insertTime.count() << " inserts per second, "
+              << lookups.size() / lookupTime.count()
+              << " lookups per second (" << found << " found)\n";
+  }
+
+ public:
+  explicit IndexBenchmark(int numOfKeys) : numOfKeys(numOfKeys) {
+    std::default_random_engine generator(0);
+    std::uniform_int_distribution<uint64_t> distribution;
+    for (int i = 0; i < numOfKeys; i++) {
+      keys.push_back("user" + std::to_string(distribution(generator)));
+    }
+    // half the lookups are for keys that are not present
+    lookups = keys;
+    for (int i = 0; i < numOfKeys; i++) {
+      lookups.push_back("user" + std::to_string(distribution(generator)) +
+                        "x");
+    }
+    std::shuffle(lookups.begin(), lookups.end(), generator);
+  }
+
+  void run() {
+    const std::string header = "Index Benchmark Results";
+    std::cout << header << "\n" << std::string(header.length(), '-') << "\n";
+    size_t keyBytes = 0;
+    for (const auto &key : keys) {
+      keyBytes += key.length();
+    }
+    std::cout << numOfKeys << " keys of " << keyBytes / keys.size()
+              << " bytes on average\n";
+
+    using Map = std::unordered_map<std::string, IndexEntry>;
+    run<Map>(
+        "std::unordered_map",
+        [](Map &map, const std::string &key, const IndexEntry &entry) {
+          map[key] = entry;
+        },
+        [](const Map &map, const std::string &key) {
+          return map.find(key) != map.end();
+        });
+    run<FlatIndex>(
+        "FlatIndex",
+        [](FlatIndex &index, const std::string &key, const IndexEntry &entry) {
+          index.put(key, entry);
+        },
+        [](const FlatIndex &index, const std::string &key) {
+          IndexEntry entry;
+          return index.get(key, entry);
+        });
+  }
+};
+
+int main(int argc, char **argv) {
+  // tool run as bm [number of keys]
+  IndexBenchmark bm{(argc == 2) ? std::stoi(argv[1]) : DEFAULT_NUM_OF_KEYS};
+  bm.run();
+  return 0;
+}
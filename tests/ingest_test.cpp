@@ -0,0 +1,344 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "external_sort.h"
+#include "ingest_reader.h"
+#include "merge_operator.h"
+#include "record.h"
+#include "saavi.h"
+#include "saavi_exception.h"
+
+// Tests for loading records in bulk with IngestExternal
+class IngestTest : public ::testing::Test {
+ protected:
+  const std::string kvsFileName = "IngestTest.db";
+  std::unique_ptr<Saavi> saavi;
+  SaaviOptions options;
+  // the latest value of every key ingested or written
+  std::map<std::string, std::string> expectedEntries;
+
+  void SetUp() override {
+    options.orderedIndex = true;
+    options.backgroundCompaction = false;
+  }
+
+  void TearDown() override {
+    saavi.reset();
+    if (!::testing::Test::HasFailure()) {
+      Saavi::Destroy(kvsFileName);
+      // the runs are removed along with the sorter
+      for (const auto &file : std::filesystem::directory_iterator(".")) {
+        EXPECT_EQ(file.path().filename().string().find(".sort."),
+                  std::string::npos);
+      }
+    }
+  }
+
+  void open() { ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName, options))); }
+
+  // write the records to an input file in the given format
+  static void writeInput(
+      const std::string &path, IngestFormat format,
+      const std::vector<std::pair<std::string, std::string>> &records) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    for (const auto &record : records) {
+      if (format == IngestFormat::Csv) {
+        out << record.first << ',' << record.second << '\n';
+        continue;
+      }
+      char lengths[8];
+      encodeFixed32(lengths, record.first.length());
+      encodeFixed32(lengths + 4, record.second.length());
+      out.write(lengths, 8);
+      out << record.first << record.second;
+    }
+  }
+
+  // shuffled records of numOfKeys keys, with duplicates, also noted down
+  // as expected
+  std::vector<std::pair<std::string, std::string>> generate(int numOfKeys,
+                                                            int seed = 0) {
+    std::vector<std::pair<std::string, std::string>> records;
+    std::default_random_engine generator(seed);
+    std::uniform_int_distribution<int> keys(0, numOfKeys - 1);
+    for (int i = 0; i < numOfKeys * 2; i++) {
+      const std::string key = "Key" + std::to_string(keys(generator));
+      const std::string value =
+          "Value" + std::to_string(i) + std::string(i % 50, 'v');
+      records.emplace_back(key, value);
+      expectedEntries[key] = value;
+    }
+    return records;
+  }
+
+  void verify() {
+    for (const auto &entry : expectedEntries) {
+      ASSERT_EQ(saavi->Get(entry.first), entry.second) << entry.first;
+    }
+    // the ordered index has every key
+    auto expected = expectedEntries.begin();
+    for (auto it = saavi->Scan("", ""); it != saavi->end(); ++it) {
+      ASSERT_NE(expected, expectedEntries.end());
+      EXPECT_EQ((*it).first, expected->first);
+      EXPECT_EQ((*it).second, expected->second);
+      ++expected;
+    }
+    EXPECT_EQ(expected, expectedEntries.end());
+  }
+};
+
+TEST_F(IngestTest, TestCsv) {
+  open();
+  writeInput("IngestTest.csv", IngestFormat::Csv,
+             {{"Key2", "Value2"},
+              {"Key1", "Value,1"},
+              {"Key3", ""},
+              {"Key2", "Value2-2"}});
+  // the last line may have no line break, and CRLF line breaks are fine
+  std::ofstream("IngestTest.csv", std::ios::app)
+      << "\r\nKey4,Value4\r\nKey5,Value5";
+  expectedEntries = {{"Key1", "Value,1"},
+                     {"Key2", "Value2-2"},
+                     {"Key3", ""},
+                     {"Key4", "Value4"},
+                     {"Key5", "Value5"}};
+
+  const IngestStats stats = saavi->IngestExternal({"IngestTest.csv"});
+  EXPECT_EQ(stats.recordsRead, 6u);
+  EXPECT_EQ(stats.duplicatesDropped, 1u);
+  EXPECT_EQ(stats.recordsIngested, 5u);
+  EXPECT_EQ(stats.runs, 0u);
+  EXPECT_GT(stats.bytesWritten, 0u);
+  verify();
+
+  // and it's all still there after reopening, from the hint and by replay
+  saavi.reset();
+  open();
+  verify();
+  saavi.reset();
+  std::filesystem::remove(kvsFileName + ".hint");
+  open();
+  verify();
+  std::filesystem::remove("IngestTest.csv");
+}
+
+TEST_F(IngestTest, TestExternalSort) {
+  // runs of a few KB, spilled and merged by several threads
+  writeInput("IngestTest1.bin", IngestFormat::Binary, generate(5000, 1));
+  writeInput("IngestTest2.bin", IngestFormat::Binary, generate(5000, 2));
+  open();
+  IngestOptions ingestOptions;
+  ingestOptions.format = IngestFormat::Binary;
+  ingestOptions.sortMemory = 64 << 10;
+  ingestOptions.threads = 4;
+  const IngestStats stats = saavi->IngestExternal(
+      {"IngestTest1.bin", "IngestTest2.bin"}, ingestOptions);
+  EXPECT_EQ(stats.recordsRead, 20000u);
+  EXPECT_GT(stats.runs, 10u);
+  EXPECT_EQ(stats.recordsIngested, expectedEntries.size());
+  EXPECT_EQ(stats.recordsRead - stats.duplicatesDropped,
+            stats.recordsIngested);
+  verify();
+
+  saavi.reset();
+  std::filesystem::remove(kvsFileName + ".hint");
+  open();
+  verify();
+  std::filesystem::remove("IngestTest1.bin");
+  std::filesystem::remove("IngestTest2.bin");
+}
+
+TEST_F(IngestTest, TestExistingStore) {
+  options.segmentSize = 4096;
+  open();
+  for (int i = 0; i < 1000; i++) {
+    const std::string key = "Key" + std::to_string(i);
+    saavi->Put(key, "Old" + std::to_string(i));
+    expectedEntries[key] = "Old" + std::to_string(i);
+  }
+  saavi->Delete("Key0");
+  expectedEntries.erase("Key0");
+
+  // the ingested records replace the values the keys had
+  writeInput("IngestTest.csv", IngestFormat::Csv, generate(2000));
+  saavi->IngestExternal({"IngestTest.csv"});
+  verify();
+
+  // writes after the ingestion win over it, also on replay
+  saavi->Put("Key1", "New1");
+  expectedEntries["Key1"] = "New1";
+  saavi->Delete("Key2");
+  expectedEntries.erase("Key2");
+  verify();
+  saavi.reset();
+  std::filesystem::remove(kvsFileName + ".hint");
+  open();
+  verify();
+
+  // and compaction keeps what was ingested
+  saavi->Compact();
+  verify();
+  saavi.reset();
+  open();
+  verify();
+  std::filesystem::remove("IngestTest.csv");
+}
+
+TEST_F(IngestTest, TestConcurrentWrites) {
+  writeInput("IngestTest.csv", IngestFormat::Csv, generate(20000));
+  options.mergeOperator = AppendMergeOperator();
+  open();
+  // writes made while the ingestion runs win over it wherever they land,
+  // and operands merged meanwhile stack on what it ingested
+  std::atomic<bool> done{false};
+  std::thread writer([this, &done] {
+    for (int i = 0; !done; i++) {
+      const std::string key = "Key" + std::to_string(i % 20000);
+      if (i % 3 == 0) {
+        saavi->Delete(key);
+      } else if (i % 3 == 1) {
+        saavi->Put(key, "Written");
+      } else {
+        saavi->Merge(key, "Merged");
+      }
+    }
+  });
+  IngestOptions ingestOptions;
+  ingestOptions.sortMemory = 256 << 10;
+  saavi->IngestExternal({"IngestTest.csv"}, ingestOptions);
+  done = true;
+  writer.join();
+
+  // what's there now must be there after replaying the log
+  std::map<std::string, std::string> entries;
+  for (auto it = saavi->Scan("", ""); it != saavi->end(); ++it) {
+    entries[(*it).first] = (*it).second;
+  }
+  saavi.reset();
+  std::filesystem::remove(kvsFileName + ".hint");
+  open();
+  expectedEntries = entries;
+  verify();
+  std::filesystem::remove("IngestTest.csv");
+}
+
+TEST_F(IngestTest, TestInvalidInputs) {
+  open();
+  saavi->Put("Key1", "Value1");
+  expectedEntries["Key1"] = "Value1";
+
+  // a bad input fails the ingestion before anything is written
+  std::ofstream("IngestTest.csv") << "Key2,Value2\nKey3\n";
+  EXPECT_THROW(saavi->IngestExternal({"IngestTest.csv"}), SaaviException);
+  std::ofstream("IngestTest.csv") << "Key2,Value2\n,Value3\n";
+  EXPECT_THROW(saavi->IngestExternal({"IngestTest.csv"}), SaaviException);
+  // a record cut short
+  std::ofstream("IngestTest.bin")
+      << std::string("\x04\0\0\0\x10\0\0\0Key2", 12);
+  IngestOptions binary;
+  binary.format = IngestFormat::Binary;
+  EXPECT_THROW(saavi->IngestExternal({"IngestTest.bin"}, binary),
+               SaaviException);
+  EXPECT_THROW(saavi->IngestExternal({"IngestTest.missing"}), SaaviException);
+  verify();
+
+  // nothing to ingest leaves the store alone
+  std::ofstream("IngestTest.csv", std::ios::trunc);
+  EXPECT_EQ(saavi->IngestExternal({"IngestTest.csv"}).recordsIngested, 0u);
+  verify();
+  std::filesystem::remove("IngestTest.csv");
+  std::filesystem::remove("IngestTest.bin");
+
+  options.engine = StorageEngine::Lsm;
+  {
+    Saavi lsm("IngestTestLsm.db", options);
+    EXPECT_THROW(lsm.IngestExternal({"IngestTest.csv"}), SaaviException);
+  }
+  Saavi::Destroy("IngestTestLsm.db");
+}
+
+TEST(ExternalSorterTest, TestSort) {
+  // the same pairs come out sorted whether they are spilled or not
+  for (size_t runSize : {size_t(1) << 30, size_t(1) << 10}) {
+    ExternalSorter sorter("ExternalSorterTest.", runSize, 2);
+    std::map<std::string, std::string> expected;
+    std::default_random_engine generator(0);
+    std::uniform_int_distribution<int> keys(0, 999);
+    for (int i = 0; i < 5000; i++) {
+      const std::string key = std::to_string(keys(generator));
+      sorter.add(key, std::to_string(i));
+      expected[key] = std::to_string(i);
+    }
+    sorter.finish();
+    EXPECT_EQ(sorter.runs() > 0, runSize < 1024 * 1024);
+    auto it = expected.begin();
+    while (sorter.next()) {
+      ASSERT_NE(it, expected.end());
+      EXPECT_EQ(sorter.key(), it->first);
+      EXPECT_EQ(sorter.value(), it->second);
+      ++it;
+    }
+    EXPECT_EQ(it, expected.end());
+    EXPECT_EQ(sorter.duplicates(), 5000 - expected.size());
+  }
+}
+
+TEST(IngestReaderTest, TestRead) {
+  // the pairs of both formats, with a value larger than a read
+  const std::vector<std::pair<std::string, std::string>> pairs = {
+      {"Key1", "Value,1"},
+      {"Key2", ""},
+      {"Key3", std::string(IngestReader::READ_SIZE + 100, 'v')}};
+  std::ofstream("IngestReaderTest.csv")
+      << "Key1,Value,1\r\n\nKey2,\nKey3," << pairs[2].second;
+  {
+    std::ofstream out("IngestReaderTest.bin", std::ios::binary);
+    for (const auto &pair : pairs) {
+      char lengths[8];
+      encodeFixed32(lengths, pair.first.length());
+      encodeFixed32(lengths + 4, pair.second.length());
+      out.write(lengths, 8);
+      out << pair.first << pair.second;
+    }
+  }
+  for (const auto &input :
+       {std::make_pair("IngestReaderTest.csv", IngestFormat::Csv),
+        std::make_pair("IngestReaderTest.bin", IngestFormat::Binary)}) {
+    IngestReader reader(input.first, input.second);
+    std::string_view key;
+    std::string_view value;
+    for (const auto &pair : pairs) {
+      ASSERT_TRUE(reader.next(key, value)) << input.first;
+      EXPECT_EQ(key, pair.first);
+      EXPECT_EQ(value, pair.second);
+    }
+    EXPECT_FALSE(reader.next(key, value));
+  }
+
+  // a line that isn't a pair is reported with its number
+  std::ofstream("IngestReaderTest.csv") << "Key1,Value1\n\nKey3\n";
+  IngestReader reader("IngestReaderTest.csv", IngestFormat::Csv);
+  std::string_view key;
+  std::string_view value;
+  EXPECT_TRUE(reader.next(key, value));
+  try {
+    reader.next(key, value);
+    ADD_FAILURE() << "the line without a comma was read";
+  } catch (const SaaviException &e) {
+    EXPECT_NE(std::string(e.what()).find("line 3"), std::string::npos)
+        << e.what();
+  }
+  EXPECT_THROW(IngestReader("IngestReaderTest.missing", IngestFormat::Csv),
+               SaaviException);
+  std::filesystem::remove("IngestReaderTest.csv");
+  std::filesystem::remove("IngestReaderTest.bin");
+}
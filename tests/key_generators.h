@@ -0,0 +1,83 @@
+#ifndef KEY_GENERATORS_H
+#define KEY_GENERATORS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+
+// Generates item numbers in [0, items) following a Zipfian distribution,
+// where item 0 is the most popular one. Uses the algorithm from "Quickly
+// Generating Billion-Record Synthetic Databases" by Gray et al., as YCSB
+// does - the constants are computed once, so generating is O(1).
+class ZipfianGenerator {
+  uint64_t items;
+  double theta;
+  double zetan;
+  double alpha;
+  double eta;
+  std::uniform_real_distribution<double> uniform{0.0, 1.0};
+
+  static double zeta(uint64_t n, double theta) {
+    double sum = 0;
+    for (uint64_t i = 1; i <= n; i++) {
+      sum += 1 / std::pow(static_cast<double>(i), theta);
+    }
+    return sum;
+  }
+
+ public:
+  // the default skew is the one used by YCSB
+  explicit ZipfianGenerator(uint64_t items, double theta = 0.99)
+      : items(items), theta(theta), zetan(zeta(items, theta)) {
+    alpha = 1 / (1 - theta);
+    eta = (1 - std::pow(2.0 / items, 1 - theta)) /
+          (1 - zeta(2, theta) / zetan);
+  }
+
+  template <typename Engine>
+  uint64_t operator()(Engine &engine) {
+    const double u = uniform(engine);
+    const double uz = u * zetan;
+    if (uz < 1) {
+      return 0;
+    }
+    if (uz < 1 + std::pow(0.5, theta)) {
+      return 1;
+    }
+    return static_cast<uint64_t>(items * std::pow(eta * u - eta + 1, alpha)) %
+           items;
+  }
+};
+
+// Generates item numbers in [0, latest] skewed towards the most recently
+// inserted ones, like YCSB's "latest" distribution: latest itself is the
+// most popular item, the one inserted before it the next most popular and
+// so on. The skew is computed for the given number of items once, so items
+// further back than that are never generated.
+class LatestGenerator {
+  ZipfianGenerator zipfian;
+
+ public:
+  explicit LatestGenerator(uint64_t items) : zipfian(items) {}
+
+  template <typename Engine>
+  uint64_t operator()(Engine &engine, uint64_t latest) {
+    return latest - std::min(zipfian(engine), latest);
+  }
+};
+
+// FNV-1a hash of the item number, which YCSB uses to turn item numbers
+// into keys so that neither the popular items nor the inserted ones are
+// next to each other in key order
+inline uint64_t fnvHash64(uint64_t value) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (int i = 0; i < 8; i++) {
+    hash ^= value & 0xff;
+    hash *= 0x100000001b3ULL;
+    value >>= 8;
+  }
+  return hash;
+}
+
+#endif
@@ -0,0 +1,261 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bloom_filter.h"
+#include "saavi.h"
+#include "saavi_exception.h"
+
+TEST(BloomFilterTest, TestFalsePositiveRate) {
+  std::vector<uint64_t> hashes;
+  for (int i = 0; i < 10000; i++) {
+    hashes.push_back(BloomFilter::hash("Key" + std::to_string(i)));
+  }
+  BloomFilter filter(BloomFilter::build(hashes, 10));
+
+  // no false negatives, and about 1% false positives at 10 bits per key
+  int falsePositives = 0;
+  for (int i = 0; i < 10000; i++) {
+    EXPECT_TRUE(filter.mayContain("Key" + std::to_string(i)));
+    falsePositives += filter.mayContain("Other" + std::to_string(i));
+  }
+  EXPECT_LT(falsePositives, 200);
+  EXPECT_FALSE(BloomFilter(BloomFilter::build({}, 10)).mayContain("Key"));
+}
+
+// The lsm engine behind the same API as the log
+class LsmTest : public ::testing::Test {
+ protected:
+  std::string kvsFileName;
+  std::unique_ptr<Saavi> saavi;
+  SaaviOptions options;
+  std::map<std::string, std::string> expectedEntries;
+
+  void SetUp() override {
+    kvsFileName =
+        std::string(
+            ::testing::UnitTest::GetInstance()->current_test_info()->name()) +
+        ".db";
+    // tiny memtables and levels so that the tests flush and compact often
+    options.engine = StorageEngine::Lsm;
+    options.memtableSize = 4096;
+    options.levelBaseSize = 16384;
+    options.backgroundCompaction = false;
+  }
+
+  void TearDown() override {
+    saavi.reset();
+    if (!::testing::Test::HasFailure()) {
+      Saavi::Destroy(kvsFileName);
+      EXPECT_EQ(countRunFiles(), 0);
+    }
+  }
+
+  void open() { ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName, options))); }
+
+  int countRunFiles() const {
+    const std::string prefix = kvsFileName + ".run.";
+    int count = 0;
+    for (const auto &file : std::filesystem::directory_iterator(".")) {
+      count += file.path().filename().string().compare(0, prefix.length(),
+                                                       prefix) == 0;
+    }
+    return count;
+  }
+
+  // random puts, deletes and batches over a small key space
+  void populateEntries(int numOfWrites, unsigned seed) {
+    std::default_random_engine generator(seed);
+    std::uniform_int_distribution<int> keys(0, 999);
+    std::uniform_int_distribution<int> operations(0, 9);
+    for (int i = 0; i < numOfWrites; i++) {
+      const std::string key = "Key" + std::to_string(keys(generator));
+      const int operation = operations(generator);
+      if (operation == 0) {
+        saavi->Delete(key);
+        expectedEntries.erase(key);
+      } else if (operation == 1) {
+        WriteBatch batch;
+        const std::string other = "Key" + std::to_string(keys(generator));
+        batch.Put(key, "Batch" + std::to_string(i));
+        batch.Delete(other);
+        saavi->Write(batch);
+        expectedEntries[key] = "Batch" + std::to_string(i);
+        expectedEntries.erase(other);
+      } else {
+        const std::string value = "Value" + std::to_string(i);
+        saavi->Put(key, value);
+        expectedEntries[key] = value;
+      }
+    }
+  }
+
+  void verifyEntries() {
+    for (int i = 0; i < 1000; i++) {
+      const std::string key = "Key" + std::to_string(i);
+      auto entry = expectedEntries.find(key);
+      PinnedValue value;
+      ASSERT_EQ(saavi->Get(key, value), entry != expectedEntries.end()) << key;
+      if (entry != expectedEntries.end()) {
+        EXPECT_EQ(value.view(), entry->second);
+      }
+    }
+
+    std::map<std::string, std::string> scanned;
+    for (auto it = saavi->Scan("", ""); it != saavi->end(); ++it) {
+      scanned.insert(*it);
+    }
+    EXPECT_EQ(scanned, expectedEntries);
+  }
+};
+
+TEST_F(LsmTest, TestAgainstMap) {
+  open();
+  for (unsigned round = 0; round < 5; round++) {
+    populateEntries(2000, round);
+    verifyEntries();
+  }
+  EXPECT_GT(countRunFiles(), 1);
+
+  // the memtable is replayed from the log, the runs come from the manifest
+  open();
+  verifyEntries();
+
+  // merge the runs down into the levels
+  ASSERT_NO_THROW(saavi->Compact());
+  auto stats = saavi->GetCompactionStats();
+  EXPECT_GT(stats.runs, 0);
+  EXPECT_EQ(stats.failures, 0);
+  EXPECT_GT(stats.recordsDropped, 0);
+  auto lsmStats = saavi->GetLsmStats();
+  EXPECT_LT(lsmStats.runsPerLevel[0], options.level0Runs);
+  EXPECT_EQ(lsmStats.memtableBytes, 0);
+  EXPECT_GT(lsmStats.filterMemory, 0);
+  verifyEntries();
+
+  // empty values are values, in the memtable and in the runs
+  saavi->Put("Key1", "");
+  expectedEntries["Key1"] = "";
+  verifyEntries();
+  ASSERT_NO_THROW(saavi->Compact());
+  verifyEntries();
+
+  populateEntries(2000, 42);
+  verifyEntries();
+  std::map<std::string, std::string> scanned;
+  for (auto it = saavi->ScanPrefix("Key99"); it != saavi->end(); ++it) {
+    scanned.insert(*it);
+  }
+  const std::map<std::string, std::string> expectedPrefix(
+      expectedEntries.lower_bound("Key99"),
+      expectedEntries.lower_bound("Key9:"));
+  EXPECT_EQ(scanned, expectedPrefix);
+  open();
+  verifyEntries();
+}
+
+TEST_F(LsmTest, TestLeftoverRuns) {
+  open();
+  populateEntries(2000, 1);
+  saavi.reset();
+
+  // a run that never made it into the manifest is dropped on open
+  std::ofstream(kvsFileName + ".run.999999") << "partial";
+  open();
+  EXPECT_FALSE(std::filesystem::exists(kvsFileName + ".run.999999"));
+  verifyEntries();
+}
+
+TEST_F(LsmTest, TestImmutableLog) {
+  options.memtableSize = 1 << 20;
+  open();
+  populateEntries(2000, 1);
+  saavi.reset();
+
+  // a crash right after the memtable became immutable leaves its log
+  // behind, and maybe no log of the new memtable yet
+  std::filesystem::rename(kvsFileName, kvsFileName + ".imm");
+  open();
+  EXPECT_FALSE(std::filesystem::exists(kvsFileName + ".imm"));
+  verifyEntries();
+
+  // the log of the new memtable holds the later writes
+  populateEntries(2000, 2);
+  saavi.reset();
+  std::filesystem::rename(kvsFileName, kvsFileName + ".old");
+  open();
+  populateEntries(2000, 3);
+  saavi.reset();
+  std::filesystem::rename(kvsFileName + ".old", kvsFileName + ".imm");
+  open();
+  EXPECT_FALSE(std::filesystem::exists(kvsFileName + ".imm"));
+  verifyEntries();
+}
+
+TEST_F(LsmTest, TestEngineMismatch) {
+  open();
+  saavi->Put("Key1", "Value1");
+  saavi.reset();
+
+  // each engine refuses the files of the other
+  SaaviOptions logOptions;
+  EXPECT_THROW(Saavi(kvsFileName, logOptions), SaaviException);
+  Saavi::Destroy(kvsFileName);
+  {
+    Saavi log(kvsFileName, logOptions);
+    log.Put("Key1", "Value1");
+  }
+  EXPECT_THROW(Saavi(kvsFileName, options), SaaviException);
+  Saavi::Destroy(kvsFileName);
+}
+
+TEST_F(LsmTest, TestReadersWithBackgroundCompaction) {
+  options.backgroundCompaction = true;
+  options.compactionInterval = std::chrono::milliseconds(1);
+  open();
+
+  // every key is written once, so a reader must find the key if it was
+  // written before the read started
+  const int numOfKeys = 20000;
+  std::atomic<int> written{0};
+  std::atomic<bool> done{false};
+  std::atomic<int> badReads{0};
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 2; t++) {
+    readers.emplace_back([&, t] {
+      std::default_random_engine generator(t);
+      while (!done) {
+        const int limit = written;
+        if (limit == 0) {
+          continue;
+        }
+        const int i = std::uniform_int_distribution<int>(0, limit - 1)(
+            generator);
+        if (saavi->Get("Key" + std::to_string(i)) !=
+            "Value" + std::to_string(i)) {
+          badReads++;
+        }
+      }
+    });
+  }
+  for (int i = 0; i < numOfKeys; i++) {
+    saavi->Put("Key" + std::to_string(i), "Value" + std::to_string(i));
+    written = i + 1;
+  }
+  done = true;
+  for (auto &reader : readers) {
+    reader.join();
+  }
+
+  EXPECT_EQ(badReads, 0);
+  EXPECT_GT(saavi->GetCompactionStats().runs, 0);
+  EXPECT_EQ(saavi->GetCompactionStats().failures, 0);
+}
@@ -0,0 +1,287 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "merge_operator.h"
+#include "saavi.h"
+#include "saavi_exception.h"
+
+// Merge operands folded on reads and by compaction
+class MergeTest : public ::testing::Test {
+ protected:
+  std::string kvsFileName;
+  std::unique_ptr<Saavi> saavi;
+  SaaviOptions options;
+  std::map<std::string, std::string> expectedEntries;
+
+  void SetUp() override {
+    kvsFileName =
+        std::string(
+            ::testing::UnitTest::GetInstance()->current_test_info()->name()) +
+        ".db";
+    // tiny segments so that chains span several of them
+    options.segmentSize = 512;
+    options.backgroundCompaction = false;
+    options.orderedIndex = true;
+    options.mergeOperator = CounterMergeOperator();
+    open();
+  }
+
+  void TearDown() override {
+    saavi.reset();
+    if (!::testing::Test::HasFailure()) {
+      Saavi::Destroy(kvsFileName);
+    }
+  }
+
+  void open() { ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName, options))); }
+
+  void reopen() {
+    saavi.reset();
+    open();
+  }
+
+  // add to the counters of numOfKeys keys, rounds times
+  void count(int numOfKeys, int rounds) {
+    for (int round = 0; round < rounds; round++) {
+      for (int i = 0; i < numOfKeys; i++) {
+        const std::string key = "Key" + std::to_string(i);
+        saavi->Merge(key, std::to_string(i + 1));
+        const long total =
+            std::stol(expectedEntries.count(key) ? expectedEntries[key]
+                                                 : "0") +
+            i + 1;
+        expectedEntries[key] = std::to_string(total);
+      }
+    }
+  }
+
+  // roll the active segment over with a value larger than a segment
+  void seal() {
+    saavi->Put("Filler", std::string(options.segmentSize, 'f'));
+    expectedEntries["Filler"] = std::string(options.segmentSize, 'f');
+  }
+
+  void verify() {
+    for (const auto &entry : expectedEntries) {
+      ASSERT_EQ(saavi->Get(entry.first), entry.second) << entry.first;
+    }
+    std::map<std::string, std::string> scanned;
+    for (auto it = saavi->Scan("", ""); it != saavi->end(); ++it) {
+      scanned[(*it).first] = (*it).second;
+    }
+    EXPECT_EQ(scanned, expectedEntries);
+    std::map<std::string, std::string> iterated;
+    for (auto it = saavi->begin(); it != saavi->end(); ++it) {
+      EXPECT_TRUE(iterated.insert(*it).second) << (*it).first;
+    }
+    EXPECT_EQ(iterated, expectedEntries);
+  }
+};
+
+TEST(MergeOperatorTest, TestOperators) {
+  auto counter = CounterMergeOperator();
+  std::string result;
+  const std::string_view existing = "40";
+  EXPECT_TRUE(counter->Merge("Key", &existing, {"1", "-3", "4"}, result));
+  EXPECT_EQ(result, "42");
+  EXPECT_TRUE(counter->Merge("Key", nullptr, {"7"}, result));
+  EXPECT_EQ(result, "7");
+  // values that aren't integers, or overflow, don't fold
+  EXPECT_FALSE(counter->Merge("Key", nullptr, {"1x"}, result));
+  const std::string_view text = "abc";
+  EXPECT_FALSE(counter->Merge("Key", &text, {"1"}, result));
+  EXPECT_FALSE(
+      counter->Merge("Key", nullptr, {"9223372036854775807", "1"}, result));
+
+  auto append = AppendMergeOperator();
+  const std::string_view list = "a";
+  EXPECT_TRUE(append->Merge("Key", &list, {"b", "c"}, result));
+  EXPECT_EQ(result, "a,b,c");
+  EXPECT_TRUE(append->Merge("Key", nullptr, {"b", "c"}, result));
+  EXPECT_EQ(result, "b,c");
+}
+
+TEST_F(MergeTest, TestMerge) {
+  // merging into a missing key, a value and a deleted key
+  saavi->Merge("Key1", "5");
+  saavi->Merge("Key1", "3");
+  EXPECT_EQ(saavi->Get("Key1"), "8");
+  saavi->Put("Key2", "10");
+  saavi->Merge("Key2", "-4");
+  EXPECT_EQ(saavi->Get("Key2"), "6");
+  // the cached fold is carried on from
+  saavi->Merge("Key2", "1");
+  EXPECT_EQ(saavi->Get("Key2"), "7");
+  saavi->Delete("Key2");
+  EXPECT_EQ(saavi->Get("Key2"), "");
+  saavi->Merge("Key2", "2");
+  EXPECT_EQ(saavi->Get("Key2"), "2");
+  // a put replaces the operands
+  saavi->Put("Key1", "100");
+  saavi->Merge("Key1", "1");
+  expectedEntries = {{"Key1", "101"}, {"Key2", "2"}};
+  verify();
+  EXPECT_EQ(saavi->MultiGet({"Key1", "Key2", "Key3"}),
+            std::vector<std::string>({"101", "2", ""}));
+
+  // operands that don't fold fail the read
+  saavi->Merge("Key3", "x");
+  EXPECT_THROW(saavi->Get("Key3"), SaaviException);
+  saavi->Delete("Key3");
+
+  EXPECT_EQ(saavi->GetStats().merges, 7u);
+}
+
+TEST_F(MergeTest, TestReopen) {
+  count(50, 20);
+  verify();
+  // the chains come back from the hint file and by replaying the log
+  reopen();
+  verify();
+  count(50, 2);
+  saavi.reset();
+  std::filesystem::remove(kvsFileName + ".hint");
+  open();
+  verify();
+}
+
+TEST_F(MergeTest, TestCompaction) {
+  saavi->Put("Key0", "1000");
+  expectedEntries["Key0"] = "1000";
+  count(50, 20);
+  // the operands of every key and the value they stack on go into a single
+  // record, once they are all in sealed segments
+  seal();
+  saavi->Compact();
+  EXPECT_EQ(saavi->GetCompactionStats().recordsDropped, 50u * 20 + 1 - 50);
+  verify();
+  count(50, 3);
+  verify();
+  reopen();
+  verify();
+
+  // once folded for good, values read without the operator
+  seal();
+  saavi->Compact();
+  verify();
+  options.mergeOperator.reset();
+  reopen();
+  verify();
+  EXPECT_THROW(saavi->Merge("Key0", "1"), SaaviException);
+}
+
+TEST_F(MergeTest, TestUnfoldable) {
+  saavi->Put("Bad", "5");
+  saavi->Merge("Bad", "2");
+  saavi->Merge("Bad", "x");
+  count(50, 5);
+
+  // compaction leaves the operands that don't fold as they are and goes on
+  // with the rest
+  seal();
+  ASSERT_NO_THROW(saavi->Compact());
+  EXPECT_EQ(saavi->GetCompactionStats().failures, 0u);
+  EXPECT_THROW(saavi->Get("Bad"), SaaviException);
+  for (const auto &entry : expectedEntries) {
+    EXPECT_EQ(saavi->Get(entry.first), entry.second) << entry.first;
+  }
+
+  // and they are still there after reopening and compacting again
+  reopen();
+  seal();
+  ASSERT_NO_THROW(saavi->Compact());
+  EXPECT_THROW(saavi->Get("Bad"), SaaviException);
+  saavi.reset();
+  std::filesystem::remove(kvsFileName + ".hint");
+  open();
+  EXPECT_THROW(saavi->Get("Bad"), SaaviException);
+
+  // until the key is replaced
+  saavi->Put("Bad", "7");
+  saavi->Merge("Bad", "1");
+  expectedEntries["Bad"] = "8";
+  seal();
+  saavi->Compact();
+  verify();
+}
+
+TEST_F(MergeTest, TestSnapshots) {
+  saavi->Put("Counter", "1");
+  saavi->Merge("Counter", "1");
+  auto first = saavi->GetSnapshot();
+  saavi->Merge("Counter", "10");
+  EXPECT_EQ(saavi->Get("Counter"), "12");
+  auto second = saavi->GetSnapshot();
+  saavi->Put("Counter", "0");
+  saavi->Merge("Counter", "5");
+  auto third = saavi->GetSnapshot();
+  saavi->Delete("Counter");
+
+  // compaction keeps what the snapshots see
+  count(50, 5);
+  saavi->Compact();
+  EXPECT_EQ(saavi->Get("Counter", *first), "2");
+  EXPECT_EQ(saavi->Get("Counter", *second), "12");
+  EXPECT_EQ(saavi->Get("Counter", *third), "5");
+  EXPECT_EQ(saavi->Get("Counter"), "");
+  first.reset();
+  second.reset();
+  third.reset();
+  saavi->Compact();
+  verify();
+}
+
+TEST_F(MergeTest, TestConcurrentMerges) {
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([this] {
+      for (int i = 0; i < 2000; i++) {
+        saavi->Merge("Key" + std::to_string(i % 10), "1");
+        if (i % 100 == 0) {
+          saavi->Get("Key" + std::to_string(i % 10));
+        }
+      }
+    });
+  }
+  std::thread compactor([this] {
+    for (int i = 0; i < 5; i++) {
+      saavi->Compact();
+    }
+  });
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  compactor.join();
+  for (int i = 0; i < 10; i++) {
+    expectedEntries["Key" + std::to_string(i)] = "800";
+  }
+  verify();
+  reopen();
+  verify();
+}
+
+TEST_F(MergeTest, TestUnsupported) {
+  // values in blob files
+  options.blobThreshold = 16;
+  reopen();
+  saavi->Put("Key1", std::string(32, 'v'));
+  EXPECT_THROW(saavi->Merge("Key1", "1"), SaaviException);
+
+  options.mergeOperator.reset();
+  reopen();
+  EXPECT_THROW(saavi->Merge("Key2", "1"), SaaviException);
+
+  options.engine = StorageEngine::Lsm;
+  options.mergeOperator = CounterMergeOperator();
+  {
+    Saavi lsm("MergeTestLsm.db", options);
+    EXPECT_THROW(lsm.Merge("Key1", "1"), SaaviException);
+  }
+  Saavi::Destroy("MergeTestLsm.db");
+}
@@ -0,0 +1,162 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "saavi.h"
+#include "saavi_exception.h"
+#include "sharded_saavi.h"
+
+// MultiGet must return what Get returns for every key, however the reads
+// are done - through the mapping or by reading, on io_uring or not
+class MultiGetTest
+    : public ::testing::TestWithParam<std::tuple<bool, unsigned>> {
+ protected:
+  std::string kvsFileName;
+  std::unique_ptr<Saavi> saavi;
+  SaaviOptions options;
+
+  void SetUp() override {
+    kvsFileName = "MultiGetTest" +
+                  std::to_string(std::get<0>(GetParam())) +
+                  std::to_string(std::get<1>(GetParam())) + ".db";
+    options.mmapReads = std::get<0>(GetParam());
+    options.asyncQueueDepth = std::get<1>(GetParam());
+    options.durability = DurabilityMode::None;
+    options.segmentSize = 64 << 10;
+    options.backgroundCompaction = false;
+    options.blobThreshold = 4096;
+  }
+
+  void TearDown() override {
+    saavi.reset();
+    if (!::testing::Test::HasFailure()) {
+      Saavi::Destroy(kvsFileName);
+    }
+  }
+
+  void open() {
+    ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName, options)));
+  }
+
+  void populate(int numOfKeys) {
+    for (int i = 0; i < numOfKeys; i++) {
+      std::string value = "Value" + std::to_string(i);
+      if (i % 50 == 0) {
+        // a few values go to blob files
+        value.resize(8192, 'b');
+      } else if (i % 7 == 0) {
+        value.clear();
+      }
+      saavi->Put("Key" + std::to_string(i), value);
+    }
+    for (int i = 1; i < numOfKeys; i += 10) {
+      saavi->Delete("Key" + std::to_string(i));
+    }
+  }
+
+  void verify(const std::vector<std::string> &keys) {
+    std::vector<PinnedValue> values;
+    const std::vector<bool> found = saavi->MultiGet(keys, values);
+    ASSERT_EQ(found.size(), keys.size());
+    ASSERT_EQ(values.size(), keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+      PinnedValue expected;
+      EXPECT_EQ(found[i], saavi->Get(keys[i], expected)) << keys[i];
+      EXPECT_EQ(values[i].view(), expected.view()) << keys[i];
+    }
+
+    const std::vector<std::string> copies = saavi->MultiGet(keys);
+    ASSERT_EQ(copies.size(), keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+      EXPECT_EQ(copies[i], values[i].view());
+    }
+  }
+};
+
+TEST_P(MultiGetTest, TestMultiGet) {
+  open();
+  populate(2000);
+
+  // keys in every order, with duplicates and missing ones in between
+  std::vector<std::string> keys;
+  for (int i = 1999; i >= 0; i -= 3) {
+    keys.push_back("Key" + std::to_string(i));
+    if (i % 11 == 0) {
+      keys.push_back("Missing" + std::to_string(i));
+      keys.push_back("Key" + std::to_string(i));
+    }
+  }
+  verify(keys);
+  verify({"Key3"});
+  verify({});
+
+  // the same after reopening, and after compaction
+  saavi.reset();
+  open();
+  verify(keys);
+  saavi->Compact();
+  verify(keys);
+
+  EXPECT_THROW(saavi->MultiGet({"Key1", ""}), SaaviException);
+}
+
+TEST_P(MultiGetTest, TestWithCache) {
+  options.cacheCapacity = 1 << 20;
+  open();
+  populate(500);
+  std::vector<std::string> keys;
+  for (int i = 0; i < 500; i++) {
+    keys.push_back("Key" + std::to_string(i * 7 % 500));
+  }
+  // the second time round the values come from the cache
+  verify(keys);
+  verify(keys);
+  EXPECT_GT(saavi->GetCacheStats().hits, 0u);
+
+  // and are replaced by the writes
+  saavi->Put("Key7", "NewValue");
+  saavi->Delete("Key14");
+  EXPECT_EQ(saavi->MultiGet({"Key7", "Key14"}),
+            std::vector<std::string>({"NewValue", ""}));
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Reads, MultiGetTest,
+    ::testing::Combine(::testing::Bool(), ::testing::Values(0u, 64u)));
+
+TEST(MultiGetLsmTest, TestMultiGet) {
+  SaaviOptions options;
+  options.engine = StorageEngine::Lsm;
+  {
+    Saavi saavi("MultiGetLsmTest.db", options);
+    saavi.Put("Key1", "Value1");
+    saavi.Put("Key2", "Value2");
+    std::vector<PinnedValue> values;
+    const std::vector<bool> found =
+        saavi.MultiGet({"Key2", "Key3", "Key1"}, values);
+    EXPECT_EQ(found, std::vector<bool>({true, false, true}));
+    EXPECT_EQ(values[0].view(), "Value2");
+    EXPECT_EQ(values[2].view(), "Value1");
+  }
+  Saavi::Destroy("MultiGetLsmTest.db");
+}
+
+TEST(MultiGetShardedTest, TestMultiGet) {
+  {
+    ShardedSaavi saavi("MultiGetShardedTest.db", 4);
+    std::vector<std::string> keys;
+    std::vector<std::string> expected;
+    for (int i = 0; i < 100; i++) {
+      saavi.Put("Key" + std::to_string(i), "Value" + std::to_string(i));
+      keys.push_back("Key" + std::to_string(99 - i));
+      expected.push_back("Value" + std::to_string(99 - i));
+    }
+    keys.push_back("Missing");
+    expected.push_back("");
+    EXPECT_EQ(saavi.MultiGet(keys), expected);
+  }
+  ShardedSaavi::Destroy("MultiGetShardedTest.db");
+}
@@ -0,0 +1,155 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "ordered_index.h"
+#include "saavi.h"
+#include "saavi_exception.h"
+
+TEST(OrderedIndexTest, TestAgainstSet) {
+  // enough keys for a tree a few levels deep, with erases emptying leaves
+  OrderedIndex index;
+  std::set<std::string> expected;
+  std::default_random_engine generator(7);
+  std::uniform_int_distribution<int> keys(0, 30000);
+  std::uniform_int_distribution<int> operations(0, 2);
+  for (int i = 0; i < 100000; i++) {
+    const std::string key = "Key" + std::to_string(keys(generator));
+    if (operations(generator) == 0) {
+      EXPECT_EQ(index.erase(key), expected.erase(key) == 1);
+    } else {
+      EXPECT_EQ(index.insert(key), expected.insert(key).second);
+    }
+  }
+  EXPECT_EQ(index.size(), expected.size());
+
+  // everything in order
+  std::vector<std::string> scanned;
+  index.scan("", "", expected.size() + 1, scanned);
+  EXPECT_EQ(scanned,
+            std::vector<std::string>(expected.begin(), expected.end()));
+
+  // ranges, with and without the bounds present
+  const std::vector<std::pair<std::string, std::string>> ranges = {
+      {"Key1", "Key2"}, {"Key25", "Key26"}, {"Key99999", ""}, {"A", "B"}};
+  for (const auto &range : ranges) {
+    scanned.clear();
+    index.scan(range.first, range.second, expected.size(), scanned);
+    auto end = range.second.empty() ? expected.end()
+                                    : expected.lower_bound(range.second);
+    EXPECT_EQ(scanned, std::vector<std::string>(
+                           expected.lower_bound(range.first), end));
+  }
+
+  // a limited scan stops early
+  scanned.clear();
+  index.scan("Key1", "", 10, scanned);
+  EXPECT_EQ(scanned.size(), 10);
+
+  // erasing every key leaves an empty tree
+  for (const auto &key : expected) {
+    EXPECT_TRUE(index.erase(key));
+  }
+  EXPECT_EQ(index.size(), 0);
+  scanned.clear();
+  index.scan("", "", 10, scanned);
+  EXPECT_TRUE(scanned.empty());
+}
+
+// Range and prefix scans through Saavi
+class ScanTest : public ::testing::Test {
+ protected:
+  const std::string kvsFileName = "ScanTest.db";
+  std::unique_ptr<Saavi> saavi;
+  SaaviOptions options;
+
+  void SetUp() override {
+    options.orderedIndex = true;
+    options.segmentSize = 4096;
+    options.backgroundCompaction = false;
+    open();
+  }
+
+  void TearDown() override {
+    saavi.reset();
+    if (!::testing::Test::HasFailure()) {
+      Saavi::Destroy(kvsFileName);
+    }
+  }
+
+  void open() { ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName, options))); }
+
+  template <typename Iterator>
+  std::vector<std::pair<std::string, std::string>> collect(Iterator it) {
+    std::vector<std::pair<std::string, std::string>> entries;
+    for (; it != saavi->end(); ++it) {
+      entries.push_back(*it);
+    }
+    return entries;
+  }
+
+  // time bucketed keys - the day followed by the event
+  static std::string eventKey(int day, int event) {
+    return "2024-01-" + std::string(day < 10 ? "0" : "") +
+           std::to_string(day) + "/event" + std::to_string(1000 + event);
+  }
+
+  // the entries expected for the days in the range
+  static std::vector<std::pair<std::string, std::string>> expectedEntries(
+      int firstDay, int lastDay) {
+    std::vector<std::pair<std::string, std::string>> entries;
+    for (int day = firstDay; day <= lastDay; day++) {
+      for (int event = 0; event < 100; event++) {
+        if (event % 10 == 3) {
+          // deleted
+          continue;
+        }
+        entries.emplace_back(eventKey(day, event),
+                             "Value" + std::to_string(event));
+      }
+    }
+    return entries;
+  }
+};
+
+TEST_F(ScanTest, TestScan) {
+  // write the keys out of order, with overwrites and deletes
+  for (int event = 99; event >= 0; event--) {
+    for (int day = 1; day <= 20; day++) {
+      const std::string key = eventKey(day, event);
+      saavi->Put(key, "Stale");
+      saavi->Put(key, "Value" + std::to_string(event));
+      if (event % 10 == 3) {
+        saavi->Delete(key);
+      }
+    }
+  }
+  saavi->Put("2023-12-31/event", "Before");
+  saavi->Put("2024-02-01/event", "After");
+
+  EXPECT_EQ(collect(saavi->Scan("2024-01-05", "2024-01-08")),
+            expectedEntries(5, 7));
+  EXPECT_EQ(collect(saavi->ScanPrefix("2024-01-1")), expectedEntries(10, 19));
+  EXPECT_EQ(collect(saavi->ScanPrefix("2024-01")), expectedEntries(1, 20));
+  EXPECT_TRUE(collect(saavi->Scan("2025", "")).empty());
+  EXPECT_TRUE(collect(saavi->ScanPrefix("2024-01-10/x")).empty());
+  EXPECT_EQ(collect(saavi->Scan("", "")).size(),
+            expectedEntries(1, 20).size() + 2);
+
+  // the ordered index is rebuilt on open and survives compaction
+  saavi->Compact();
+  EXPECT_EQ(collect(saavi->ScanPrefix("2024-01-1")), expectedEntries(10, 19));
+  open();
+  EXPECT_EQ(collect(saavi->ScanPrefix("2024-01-1")), expectedEntries(10, 19));
+  saavi->Put("2024-01-15/event1003", "Value3");
+  EXPECT_EQ(collect(saavi->ScanPrefix("2024-01-15/event1003")).size(), 1);
+
+  // without the ordered index there is nothing to scan with
+  options.orderedIndex = false;
+  open();
+  EXPECT_THROW(saavi->Scan("2024-01-05", "2024-01-08"), SaaviException);
+}
@@ -0,0 +1,199 @@
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "histogram.h"
+#include "resp_server.h"
+#include "saavi.h"
+#include "saavi_exception.h"
+
+const int DEFAULT_NUM_OF_KEYS = 100000;
+const int VALUE_SIZE = 100;
+// percentage of the requests that are GETs, the rest are SETs
+const int GET_PERCENT = 90;
+
+// A loopback load generator for the RESP server. Every client thread keeps
+// a connection busy with a window of pipelined requests - it sends depth
+// requests at once and waits for all of their replies before sending the
+// next ones - and records the time each window took. The server runs in
+// the same process, over TCP and over a Unix socket.
+class ServerBenchmark {
+  const std::string filename = "/tmp/server_benchmark.db";
+  const std::string socketPath = "/tmp/server_benchmark.sock";
+  int numOfKeys;
+  std::unique_ptr<Saavi> saavi;
+
+  static int connectTo(uint16_t port, const std::string &path) {
+    int fd;
+    int status;
+    if (port != 0) {
+      fd = socket(AF_INET, SOCK_STREAM, 0);
+      sockaddr_in in{};
+      in.sin_family = AF_INET;
+      in.sin_port = htons(port);
+      in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      status = connect(fd, reinterpret_cast<sockaddr *>(&in), sizeof(in));
+      const int on = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    } else {
+      fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      sockaddr_un un{};
+      un.sun_family = AF_UNIX;
+      strcpy(un.sun_path, path.c_str());
+      status = connect(fd, reinterpret_cast<sockaddr *>(&un), sizeof(un));
+    }
+    if (status < 0) {
+      throw SaaviException(std::string("failed to connect : ") +
+                           strerror(errno));
+    }
+    return fd;
+  }
+
+  static std::string encode(const std::vector<std::string> &args) {
+    std::string request = "*" + std::to_string(args.size()) + "\r\n";
+    for (const auto &arg : args) {
+      request += "$" + std::to_string(arg.size()) + "\r\n" + arg + "\r\n";
+    }
+    return request;
+  }
+
+  // reads the replies of n requests, each a status line or a bulk string,
+  // which is all that GET and SET answer with
+  static void readReplies(int fd, std::string &buffer, int n) {
+    size_t pos = 0;
+    while (n > 0) {
+      const size_t end = buffer.find("\r\n", pos);
+      if (end != std::string::npos) {
+        size_t next = end + 2;
+        if (buffer[pos] == '$' && buffer[pos + 1] != '-') {
+          next += std::stoul(buffer.substr(pos + 1, end - pos - 1)) + 2;
+        }
+        if (next <= buffer.size()) {
+          pos = next;
+          n--;
+          continue;
+        }
+      }
+      char data[64 << 10];
+      const ssize_t bytes = ::read(fd, data, sizeof(data));
+      if (bytes <= 0) {
+        throw SaaviException("connection closed by the server");
+      }
+      buffer.append(data, bytes);
+    }
+    buffer.erase(0, pos);
+  }
+
+  void client(uint16_t port, int depth, int numOfWindows, int seed,
+              LatencyHistogram &histogram) {
+    const int fd = connectTo(port, socketPath);
+    std::default_random_engine generator(seed);
+    std::uniform_int_distribution<int> keys(0, numOfKeys - 1);
+    std::uniform_int_distribution<int> percent(0, 99);
+    const std::string value(VALUE_SIZE, 'v');
+    std::string requests;
+    std::string buffer;
+    for (int w = 0; w < numOfWindows; w++) {
+      requests.clear();
+      for (int i = 0; i < depth; i++) {
+        const std::string key = "Key" + std::to_string(keys(generator));
+        requests += percent(generator) < GET_PERCENT
+                        ? encode({"GET", key})
+                        : encode({"SET", key, value});
+      }
+      const auto start = std::chrono::steady_clock::now();
+      size_t sent = 0;
+      while (sent < requests.size()) {
+        const ssize_t bytes = ::send(fd, requests.data() + sent,
+                                     requests.size() - sent, MSG_NOSIGNAL);
+        if (bytes <= 0) {
+          throw SaaviException("connection closed by the server");
+        }
+        sent += bytes;
+      }
+      readReplies(fd, buffer, depth);
+      histogram.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now() - start)
+                           .count());
+    }
+    ::close(fd);
+  }
+
+  void run(const std::string &transport, uint16_t port, int numOfClients,
+           int depth) {
+    // about as many requests for every depth
+    const int numOfWindows = std::max(1, 200000 / (numOfClients * depth));
+    std::vector<LatencyHistogram> histograms(numOfClients);
+    std::vector<std::thread> threads;
+    const auto start = std::chrono::steady_clock::now();
+    for (int c = 0; c < numOfClients; c++) {
+      threads.emplace_back(&ServerBenchmark::client, this, port, depth,
+                           numOfWindows, c, std::ref(histograms[c]));
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+    const std::chrono::duration<double> duration =
+        std::chrono::steady_clock::now() - start;
+    LatencyHistogram histogram;
+    for (const auto &h : histograms) {
+      histogram.merge(h);
+    }
+    const double requests =
+        static_cast<double>(numOfClients) * numOfWindows * depth;
+    std::cout << transport << " clients " << numOfClients << " depth "
+              << depth << " : " << requests / duration.count()
+              << " requests per second, window latency p50 "
+              << histogram.percentile(50) / 1000.0 << "us p99 "
+              << histogram.percentile(99) / 1000.0 << "us max "
+              << histogram.max() / 1000.0 << "us\n";
+  }
+
+ public:
+  explicit ServerBenchmark(int numOfKeys) : numOfKeys(numOfKeys) {
+    Saavi::Destroy(filename);
+    SaaviOptions options;
+    options.orderedIndex = true;
+    saavi.reset(new Saavi(filename, options));
+    const std::string value(VALUE_SIZE, 'v');
+    for (int i = 0; i < numOfKeys; i++) {
+      saavi->Put("Key" + std::to_string(i), value);
+    }
+  }
+
+  ~ServerBenchmark() {
+    saavi.reset();
+    Saavi::Destroy(filename);
+  }
+
+  void run(unsigned numOfThreads) {
+    const int numOfClients = 4;
+    for (const std::string transport : {"tcp", "unix"}) {
+      RespServer server(*saavi,
+                        transport == "tcp" ? "127.0.0.1:0"
+                                           : "unix:" + socketPath,
+                        numOfThreads);
+      for (int depth : {1, 4, 16, 64, 256}) {
+        run(transport, server.Port(), numOfClients, depth);
+      }
+    }
+  }
+};
+
+int main(int argc, char **argv) {
+  // tool run as bm [number of keys] [server threads]
+  ServerBenchmark bm{argc >= 2 ? std::stoi(argv[1]) : DEFAULT_NUM_OF_KEYS};
+  bm.run(argc >= 3 ? std::stoul(argv[2]) : 0);
+  return 0;
+}
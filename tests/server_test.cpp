@@ -0,0 +1,329 @@
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "resp_server.h"
+#include "saavi.h"
+#include "saavi_exception.h"
+
+namespace {
+
+// A blocking client that sends raw requests and reads back whole replies
+class RespClient {
+  int fd;
+  std::string buffer;
+
+  // read until the buffer has at least n bytes
+  bool fill(size_t n) {
+    while (buffer.size() < n) {
+      char data[4096];
+      const ssize_t bytes = ::read(fd, data, sizeof(data));
+      if (bytes <= 0) {
+        return false;
+      }
+      buffer.append(data, bytes);
+    }
+    return true;
+  }
+
+  // the length of the reply at pos of the buffer, reading more as needed,
+  // 0 if the connection is closed before it arrives
+  size_t replyLength(size_t pos) {
+    size_t end;
+    while ((end = buffer.find("\r\n", pos)) == std::string::npos) {
+      if (!fill(buffer.size() + 1)) {
+        return 0;
+      }
+    }
+    const char type = buffer[pos];
+    size_t next = end + 2;
+    if (type == '+' || type == '-') {
+      return next - pos;
+    }
+    const long n = std::stol(buffer.substr(pos + 1, end - pos - 1));
+    if (type == '$' && n >= 0) {
+      next += n + 2;
+      if (!fill(next)) {
+        return 0;
+      }
+    } else if (type == '*') {
+      for (long i = 0; i < n; i++) {
+        const size_t length = replyLength(next);
+        if (length == 0) {
+          return 0;
+        }
+        next += length;
+      }
+    }
+    return next - pos;
+  }
+
+ public:
+  explicit RespClient(uint16_t port) {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in in{};
+    in.sin_family = AF_INET;
+    in.sin_port = htons(port);
+    in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    EXPECT_EQ(connect(fd, reinterpret_cast<sockaddr *>(&in), sizeof(in)), 0);
+  }
+
+  explicit RespClient(const std::string &path) {
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un un{};
+    un.sun_family = AF_UNIX;
+    strcpy(un.sun_path, path.c_str());
+    EXPECT_EQ(connect(fd, reinterpret_cast<sockaddr *>(&un), sizeof(un)), 0);
+  }
+
+  ~RespClient() { ::close(fd); }
+
+  void send(const std::string &data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+      const ssize_t bytes =
+          ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+      ASSERT_GT(bytes, 0);
+      sent += bytes;
+    }
+  }
+
+  // the next reply as it was sent, empty if the connection was closed
+  std::string reply() {
+    const size_t length = replyLength(0);
+    const std::string reply = buffer.substr(0, length);
+    buffer.erase(0, length);
+    return reply;
+  }
+
+  // send a command as a multi bulk request and read its reply
+  std::string command(const std::vector<std::string> &args) {
+    send(encode(args));
+    return reply();
+  }
+
+  static std::string encode(const std::vector<std::string> &args) {
+    std::string request = "*" + std::to_string(args.size()) + "\r\n";
+    for (const auto &arg : args) {
+      request += "$" + std::to_string(arg.size()) + "\r\n" + arg + "\r\n";
+    }
+    return request;
+  }
+
+  // true if the server closed the connection
+  bool closed() { return !fill(buffer.size() + 1); }
+};
+
+std::string bulk(const std::string &value) {
+  return "$" + std::to_string(value.size()) + "\r\n" + value + "\r\n";
+}
+
+}  // namespace
+
+// Tests for serving a store over RESP
+class ServerTest : public ::testing::Test {
+ protected:
+  const std::string kvsFileName = "ServerTest.db";
+  std::unique_ptr<Saavi> saavi;
+  std::unique_ptr<RespServer> server;
+
+  void SetUp() override {
+    SaaviOptions options;
+    options.orderedIndex = true;
+    saavi.reset(new Saavi(kvsFileName, options));
+    ASSERT_NO_THROW(server.reset(new RespServer(*saavi, "127.0.0.1:0", 2)));
+    ASSERT_NE(server->Port(), 0);
+  }
+
+  void TearDown() override {
+    server.reset();
+    saavi.reset();
+    if (!::testing::Test::HasFailure()) {
+      Saavi::Destroy(kvsFileName);
+    }
+  }
+};
+
+TEST_F(ServerTest, TestCommands) {
+  RespClient client(server->Port());
+  EXPECT_EQ(client.command({"PING"}), "+PONG\r\n");
+  EXPECT_EQ(client.command({"ping", "hello"}), bulk("hello"));
+  EXPECT_EQ(client.command({"SET", "Key1", "Value1"}), "+OK\r\n");
+  EXPECT_EQ(client.command({"set", "Key2", ""}), "+OK\r\n");
+  EXPECT_EQ(client.command({"GET", "Key1"}), bulk("Value1"));
+  EXPECT_EQ(client.command({"GET", "Key2"}), bulk(""));
+  EXPECT_EQ(client.command({"GET", "Key3"}), "$-1\r\n");
+  EXPECT_EQ(saavi->Get("Key1"), "Value1");
+
+  EXPECT_EQ(client.command({"MGET", "Key1", "Key3", "Key2"}),
+            "*3\r\n" + bulk("Value1") + "$-1\r\n" + bulk(""));
+  EXPECT_EQ(client.command({"DEL", "Key1", "Key3"}), ":1\r\n");
+  EXPECT_EQ(client.command({"GET", "Key1"}), "$-1\r\n");
+  EXPECT_EQ(saavi->Get("Key1"), "");
+
+  // errors leave the connection open
+  EXPECT_EQ(client.command({"GET"}),
+            "-ERR wrong number of arguments for 'GET' command\r\n");
+  EXPECT_EQ(client.command({"FLUSHALL"}),
+            "-ERR unknown command 'FLUSHALL'\r\n");
+  EXPECT_EQ(client.command({"COMMAND"}), "*0\r\n");
+
+  EXPECT_EQ(client.command({"QUIT"}), "+OK\r\n");
+  EXPECT_TRUE(client.closed());
+}
+
+TEST_F(ServerTest, TestPipelining) {
+  // every command sent at once is answered in order
+  const int numOfCommands = 10000;
+  std::string requests;
+  for (int i = 0; i < numOfCommands; i++) {
+    requests += RespClient::encode(
+        {"SET", "Key" + std::to_string(i), "Value" + std::to_string(i)});
+    requests += RespClient::encode({"GET", "Key" + std::to_string(i)});
+  }
+  RespClient client(server->Port());
+  std::thread sender([&client, &requests] { client.send(requests); });
+  for (int i = 0; i < numOfCommands; i++) {
+    ASSERT_EQ(client.reply(), "+OK\r\n");
+    ASSERT_EQ(client.reply(), bulk("Value" + std::to_string(i)));
+  }
+  sender.join();
+
+  // including commands split across reads
+  const std::string request = RespClient::encode({"GET", "Key1"});
+  for (char c : request) {
+    client.send(std::string(1, c));
+  }
+  EXPECT_EQ(client.reply(), bulk("Value1"));
+}
+
+TEST_F(ServerTest, TestInlineCommands) {
+  RespClient client(server->Port());
+  client.send("SET Key1 Value1\r\nGET  Key1\nPING\r\n\r\nGET Key2\r\n");
+  EXPECT_EQ(client.reply(), "+OK\r\n");
+  EXPECT_EQ(client.reply(), bulk("Value1"));
+  EXPECT_EQ(client.reply(), "+PONG\r\n");
+  EXPECT_EQ(client.reply(), "$-1\r\n");
+}
+
+TEST_F(ServerTest, TestLargeValues) {
+  RespClient client(server->Port());
+  const std::string value(8 << 20, 'v');
+  EXPECT_EQ(client.command({"SET", "Key1", value}), "+OK\r\n");
+  EXPECT_EQ(client.command({"SET", "Key2", value + "2"}), "+OK\r\n");
+  // more than a connection is allowed to have waiting to be sent
+  EXPECT_EQ(client.command({"MGET", "Key1", "Key2"}),
+            "*2\r\n" + bulk(value) + bulk(value + "2"));
+}
+
+TEST_F(ServerTest, TestScan) {
+  for (int i = 0; i < 100; i++) {
+    saavi->Put("Key" + std::to_string(i), "Value");
+    saavi->Put("Other" + std::to_string(i), "Value");
+  }
+  RespClient client(server->Port());
+
+  // walk every key with a pattern, a few at a time
+  std::vector<std::string> keys;
+  std::string cursor = "0";
+  do {
+    const std::string reply =
+        client.command({"SCAN", cursor, "MATCH", "Key*", "COUNT", "7"});
+    ASSERT_EQ(reply.compare(0, 5, "*2\r\n$"), 0);
+    // the cursor and then the array of keys
+    size_t pos = reply.find("\r\n", 4) + 2;
+    const size_t end = reply.find("\r\n", pos);
+    cursor = reply.substr(pos, end - pos);
+    pos = end + 2;
+    const long count = std::stol(reply.substr(pos + 1));
+    EXPECT_LE(count, 7);
+    pos = reply.find("\r\n", pos) + 2;
+    for (long i = 0; i < count; i++) {
+      pos = reply.find("\r\n", pos) + 2;
+      const size_t keyEnd = reply.find("\r\n", pos);
+      keys.push_back(reply.substr(pos, keyEnd - pos));
+      pos = keyEnd + 2;
+    }
+  } while (cursor != "0");
+
+  std::vector<std::string> expected;
+  for (auto it = saavi->Scan("Key", "Kez"); it != saavi->end(); ++it) {
+    expected.push_back((*it).first);
+  }
+  EXPECT_EQ(expected.size(), 100u);
+  EXPECT_EQ(keys, expected);
+
+  EXPECT_EQ(client.command({"SCAN", "0", "MATCH", "Key1?", "COUNT", "1000"}),
+            client.command({"SCAN", "0", "MATCH", "Key1?", "COUNT", "1000"}));
+  EXPECT_EQ(client.command({"SCAN", "xyz"}), "-ERR invalid cursor\r\n");
+}
+
+TEST_F(ServerTest, TestProtocolErrors) {
+  // a malformed request is answered with an error and the connection closed
+  for (const std::string request :
+       {"*1\r\n+PING\r\n", "*x\r\n", "*1\r\n$4\r\nPINGxx\r\n",
+        "*1\r\n$-5\r\n"}) {
+    RespClient client(server->Port());
+    client.send(request);
+    EXPECT_EQ(client.reply().compare(0, 20, "-ERR Protocol error:"), 0)
+        << request;
+    EXPECT_TRUE(client.closed());
+  }
+  // after answering the commands before it
+  RespClient client(server->Port());
+  client.send("PING\r\n*1\r\n+PING\r\n");
+  EXPECT_EQ(client.reply(), "+PONG\r\n");
+  EXPECT_EQ(client.reply().compare(0, 20, "-ERR Protocol error:"), 0);
+}
+
+TEST_F(ServerTest, TestConcurrentClients) {
+  const int numOfThreads = 8;
+  const int numOfOps = 500;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < numOfThreads; t++) {
+    threads.emplace_back([this, t] {
+      RespClient client(server->Port());
+      for (int i = 0; i < numOfOps; i++) {
+        const std::string key = "Key" + std::to_string(t * numOfOps + i);
+        EXPECT_EQ(client.command({"SET", key, key}), "+OK\r\n");
+        EXPECT_EQ(client.command({"GET", key}), bulk(key));
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(saavi->Get("Key0"), "Key0");
+  EXPECT_EQ(saavi->Get("Key3999"), "Key3999");
+
+  // stopping closes the connections still open
+  RespClient client(server->Port());
+  EXPECT_EQ(client.command({"PING"}), "+PONG\r\n");
+  server->Stop();
+  EXPECT_TRUE(client.closed());
+}
+
+TEST_F(ServerTest, TestUnixSocket) {
+  const std::string path = "ServerTest.sock";
+  {
+    RespServer unixServer(*saavi, "unix:" + path, 1);
+    EXPECT_EQ(unixServer.Port(), 0);
+    RespClient client(path);
+    EXPECT_EQ(client.command({"SET", "Key1", "Value1"}), "+OK\r\n");
+    EXPECT_EQ(client.command({"GET", "Key1"}), bulk("Value1"));
+  }
+  // the socket is removed once the server stops
+  EXPECT_NE(access(path.c_str(), F_OK), 0);
+
+  EXPECT_THROW(RespServer invalid(*saavi, "localhost", 1), SaaviException);
+  EXPECT_THROW(RespServer invalid(*saavi, "unix:", 1), SaaviException);
+}
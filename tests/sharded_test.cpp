@@ -0,0 +1,169 @@
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "saavi_exception.h"
+#include "sharded_saavi.h"
+
+// A store hash partitioned over several Saavi instances
+class ShardedTest : public ::testing::Test {
+ protected:
+  std::string kvsFileName;
+  std::unique_ptr<ShardedSaavi> saavi;
+  SaaviOptions options;
+  std::map<std::string, std::string> expectedEntries;
+
+  void SetUp() override {
+    kvsFileName =
+        std::string(
+            ::testing::UnitTest::GetInstance()->current_test_info()->name()) +
+        ".db";
+    options.orderedIndex = true;
+    options.backgroundCompaction = false;
+  }
+
+  void TearDown() override {
+    saavi.reset();
+    if (!::testing::Test::HasFailure()) {
+      ShardedSaavi::Destroy(kvsFileName);
+      EXPECT_EQ(countFiles(), 0);
+    }
+  }
+
+  void open(size_t numShards) {
+    ASSERT_NO_THROW(
+        saavi.reset(new ShardedSaavi(kvsFileName, numShards, options)));
+  }
+
+  int countFiles() const {
+    int count = 0;
+    for (const auto &file : std::filesystem::directory_iterator(".")) {
+      count += file.path().filename().string().compare(
+                   0, kvsFileName.length(), kvsFileName) == 0;
+    }
+    return count;
+  }
+
+  void populateEntries(int numOfWrites, unsigned seed) {
+    std::default_random_engine generator(seed);
+    std::uniform_int_distribution<int> keys(0, 499);
+    for (int i = 0; i < numOfWrites; i++) {
+      const std::string key = "Key" + std::to_string(keys(generator));
+      if (i % 7 == 0) {
+        saavi->Delete(key);
+        expectedEntries.erase(key);
+      } else {
+        saavi->Put(key, "Value" + std::to_string(i));
+        expectedEntries[key] = "Value" + std::to_string(i);
+      }
+    }
+  }
+
+  void verifyEntries() {
+    for (int i = 0; i < 500; i++) {
+      const std::string key = "Key" + std::to_string(i);
+      auto entry = expectedEntries.find(key);
+      PinnedValue value;
+      ASSERT_EQ(saavi->Get(key, value), entry != expectedEntries.end());
+      if (entry != expectedEntries.end()) {
+        EXPECT_EQ(value.view(), entry->second);
+      }
+    }
+
+    // the scans of the shards are merged back into key order
+    std::vector<std::pair<std::string, std::string>> scanned;
+    for (auto it = saavi->Scan("", ""); it != saavi->end(); ++it) {
+      scanned.push_back(*it);
+    }
+    const std::vector<std::pair<std::string, std::string>> expected(
+        expectedEntries.begin(), expectedEntries.end());
+    EXPECT_EQ(scanned, expected);
+  }
+};
+
+TEST_F(ShardedTest, TestOperations) {
+  open(4);
+  EXPECT_EQ(saavi->NumShards(), 4);
+  populateEntries(2000, 1);
+  verifyEntries();
+
+  // every shard got some of the keys
+  for (size_t shard = 0; shard < saavi->NumShards(); shard++) {
+    EXPECT_TRUE(saavi->Shard(shard).Scan("", "") != saavi->end());
+  }
+
+  // a batch is split over the shards
+  WriteBatch batch;
+  for (int i = 0; i < 20; i++) {
+    batch.Put("Batch" + std::to_string(i), "Value" + std::to_string(i));
+    expectedEntries["Batch" + std::to_string(i)] = "Value" + std::to_string(i);
+  }
+  batch.Delete("Key1");
+  expectedEntries.erase("Key1");
+  saavi->Write(batch);
+  verifyEntries();
+
+  std::map<std::string, std::string> scanned;
+  for (auto it = saavi->ScanPrefix("Batch1"); it != saavi->end(); ++it) {
+    scanned.insert(*it);
+  }
+  EXPECT_EQ(scanned.size(), 11);
+
+  ASSERT_NO_THROW(saavi->Compact());
+  EXPECT_EQ(saavi->GetCompactionStats().failures, 0);
+  verifyEntries();
+}
+
+TEST_F(ShardedTest, TestFixedShardCount) {
+  open(3);
+  populateEntries(1000, 2);
+
+  // the shard count comes from the layout once the store exists
+  open(0);
+  EXPECT_EQ(saavi->NumShards(), 3);
+  verifyEntries();
+  saavi.reset();
+  EXPECT_THROW(ShardedSaavi(kvsFileName, 4, options), SaaviException);
+  open(3);
+  verifyEntries();
+
+  // a store can't be created without a shard count
+  EXPECT_THROW(ShardedSaavi(kvsFileName + ".other", 0, options),
+               SaaviException);
+  // and a file that isn't a layout is refused
+  std::ofstream(kvsFileName + ".other") << "garbage";
+  EXPECT_THROW(ShardedSaavi(kvsFileName + ".other", 2, options),
+               SaaviException);
+  std::filesystem::remove(kvsFileName + ".other");
+}
+
+TEST_F(ShardedTest, TestConcurrentWriters) {
+  open(4);
+  std::vector<std::thread> writers;
+  for (int t = 0; t < 4; t++) {
+    writers.emplace_back([this, t] {
+      for (int i = 0; i < 1000; i++) {
+        const std::string key = "Key" + std::to_string(t) + "-" +
+                                std::to_string(i);
+        saavi->Put(key, "Value" + std::to_string(i));
+      }
+    });
+  }
+  for (auto &writer : writers) {
+    writer.join();
+  }
+  for (int t = 0; t < 4; t++) {
+    for (int i = 0; i < 1000; i++) {
+      const std::string key = "Key" + std::to_string(t) + "-" +
+                              std::to_string(i);
+      EXPECT_EQ(saavi->Get(key), "Value" + std::to_string(i));
+    }
+  }
+}
@@ -0,0 +1,227 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "saavi.h"
+#include "saavi_exception.h"
+
+// Reads against snapshots of the log
+class SnapshotTest : public ::testing::Test {
+ protected:
+  std::string kvsFileName;
+  std::unique_ptr<Saavi> saavi;
+  SaaviOptions options;
+
+  void SetUp() override {
+    kvsFileName =
+        std::string(
+            ::testing::UnitTest::GetInstance()->current_test_info()->name()) +
+        ".db";
+    // tiny segments so that compaction has something to merge
+    options.segmentSize = 512;
+    options.backgroundCompaction = false;
+    open();
+  }
+
+  void TearDown() override {
+    saavi.reset();
+    if (!::testing::Test::HasFailure()) {
+      Saavi::Destroy(kvsFileName);
+    }
+  }
+
+  void open() { ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName, options))); }
+
+  // the entries seen by iterating the snapshot
+  std::map<std::string, std::string> iterate(
+      std::shared_ptr<const Snapshot> snapshot) {
+    std::map<std::string, std::string> entries;
+    for (auto it = saavi->begin(snapshot); it != saavi->end(); ++it) {
+      EXPECT_TRUE(entries.insert(*it).second) << (*it).first;
+    }
+    return entries;
+  }
+
+  // change every key of the given ones in a different way
+  void changeEntries(std::map<std::string, std::string> &entries, int round) {
+    int i = 0;
+    for (auto it = entries.begin(); it != entries.end(); i++) {
+      if (i % 3 == 0) {
+        saavi->Delete(it->first);
+        it = entries.erase(it);
+        continue;
+      }
+      it->second = "Value" + std::to_string(i) + "-" + std::to_string(round);
+      saavi->Put(it->first, it->second);
+      ++it;
+    }
+    for (int j = 0; j < 10; j++) {
+      const std::string key = "New" + std::to_string(round) + "-" +
+                              std::to_string(j);
+      entries[key] = "Value";
+      saavi->Put(key, "Value");
+    }
+  }
+};
+
+TEST_F(SnapshotTest, TestGet) {
+  saavi->Put("Key1", "Value1");
+  saavi->Put("Key2", "Value2");
+  saavi->Put("Key3", "Value3");
+  auto snapshot = saavi->GetSnapshot();
+
+  saavi->Put("Key1", "Value11");
+  saavi->Delete("Key2");
+  saavi->Put("Key4", "Value4");
+  WriteBatch batch;
+  batch.Put("Key3", "Value33");
+  batch.Delete("Key1");
+  saavi->Write(batch);
+
+  // the snapshot sees the store as it was
+  EXPECT_EQ(saavi->Get("Key1", *snapshot), "Value1");
+  EXPECT_EQ(saavi->Get("Key2", *snapshot), "Value2");
+  EXPECT_EQ(saavi->Get("Key3", *snapshot), "Value3");
+  PinnedValue value;
+  EXPECT_FALSE(saavi->Get("Key4", value, *snapshot));
+
+  // and the latest reads see the changes
+  EXPECT_FALSE(saavi->Get("Key1", value));
+  EXPECT_FALSE(saavi->Get("Key2", value));
+  EXPECT_EQ(saavi->Get("Key3"), "Value33");
+  EXPECT_EQ(saavi->Get("Key4"), "Value4");
+
+  // a later snapshot sees the later writes
+  auto later = saavi->GetSnapshot();
+  saavi->Put("Key2", "Value222");
+  EXPECT_FALSE(saavi->Get("Key2", value, *later));
+  EXPECT_EQ(saavi->Get("Key2", *snapshot), "Value2");
+  EXPECT_EQ(saavi->Get("Key3", *later), "Value33");
+
+  // snapshots only work with the store they were taken of
+  Saavi other(kvsFileName + ".other");
+  EXPECT_THROW(other.Get("Key1", *snapshot), SaaviException);
+  Saavi::Destroy(kvsFileName + ".other");
+}
+
+TEST_F(SnapshotTest, TestIterator) {
+  std::map<std::string, std::string> entries;
+  for (int i = 0; i < 100; i++) {
+    entries["Key" + std::to_string(i)] = "Value" + std::to_string(i);
+    saavi->Put("Key" + std::to_string(i), "Value" + std::to_string(i));
+  }
+
+  std::vector<std::pair<std::shared_ptr<const Snapshot>,
+                        std::map<std::string, std::string>>>
+      views;
+  for (int round = 0; round < 3; round++) {
+    views.emplace_back(saavi->GetSnapshot(), entries);
+    changeEntries(entries, round);
+  }
+  for (const auto &view : views) {
+    EXPECT_EQ(iterate(view.first), view.second);
+  }
+
+  // changes made during an iteration are not seen by it
+  auto snapshot = saavi->GetSnapshot();
+  std::map<std::string, std::string> seen;
+  for (auto it = saavi->begin(snapshot); it != saavi->end(); ++it) {
+    if (seen.empty()) {
+      auto changed = entries;
+      changeEntries(changed, 3);
+    }
+    seen.insert(*it);
+  }
+  EXPECT_EQ(seen, entries);
+}
+
+TEST_F(SnapshotTest, TestCompaction) {
+  std::map<std::string, std::string> entries;
+  for (int i = 0; i < 100; i++) {
+    entries["Key" + std::to_string(i)] = "Value" + std::to_string(i);
+    saavi->Put("Key" + std::to_string(i), "Value" + std::to_string(i));
+  }
+  auto snapshot = saavi->GetSnapshot();
+  const auto expected = entries;
+  changeEntries(entries, 0);
+  changeEntries(entries, 1);
+
+  // compaction keeps what the snapshot sees
+  ASSERT_NO_THROW(saavi->Compact());
+  EXPECT_EQ(iterate(snapshot), expected);
+  for (const auto &entry : expected) {
+    EXPECT_EQ(saavi->Get(entry.first, *snapshot), entry.second);
+  }
+  EXPECT_EQ(iterate(nullptr), entries);
+  const auto keptBytes = saavi->GetCompactionStats().bytesWritten;
+
+  // and drops it once the snapshot is gone
+  snapshot.reset();
+  saavi->Put("Key1", "Value1-2");
+  entries["Key1"] = "Value1-2";
+  ASSERT_NO_THROW(saavi->Compact());
+  EXPECT_LT(saavi->GetCompactionStats().bytesWritten - keptBytes, keptBytes);
+  EXPECT_EQ(iterate(nullptr), entries);
+
+  // the versions kept for the snapshot never come back, even when the
+  // whole log is replayed
+  snapshot = saavi->GetSnapshot();
+  changeEntries(entries, 2);
+  ASSERT_NO_THROW(saavi->Compact());
+  snapshot.reset();
+  saavi.reset();
+  std::filesystem::remove(kvsFileName + ".hint");
+  open();
+  EXPECT_EQ(iterate(nullptr), entries);
+}
+
+TEST_F(SnapshotTest, TestConcurrentWriters) {
+  for (int i = 0; i < 100; i++) {
+    saavi->Put("Key" + std::to_string(i), "0");
+  }
+
+  // every write of the writer sets all the keys to the same value, so any
+  // snapshot must see a single value across the keys
+  std::atomic<bool> done{false};
+  std::thread writer([&] {
+    for (int round = 1; !done; round++) {
+      WriteBatch batch;
+      for (int i = 0; i < 100; i++) {
+        batch.Put("Key" + std::to_string(i), std::to_string(round));
+      }
+      saavi->Write(batch);
+      if (round % 10 == 0) {
+        saavi->Compact();
+      }
+    }
+  });
+  int badViews = 0;
+  for (int i = 0; i < 200; i++) {
+    auto snapshot = saavi->GetSnapshot();
+    const std::string value = saavi->Get("Key0", *snapshot);
+    auto entries = iterate(snapshot);
+    badViews += entries.size() != 100;
+    for (const auto &entry : entries) {
+      badViews += entry.second != value;
+    }
+  }
+  done = true;
+  writer.join();
+  EXPECT_EQ(badViews, 0);
+}
+
+TEST(SnapshotLsmTest, TestUnsupported) {
+  SaaviOptions options;
+  options.engine = StorageEngine::Lsm;
+  {
+    Saavi saavi("SnapshotLsm.db", options);
+    EXPECT_THROW(saavi.GetSnapshot(), SaaviException);
+  }
+  Saavi::Destroy("SnapshotLsm.db");
+}
@@ -0,0 +1,212 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "saavi.h"
+#include "sharded_saavi.h"
+#include "stats.h"
+
+// Tests for the statistics of a store
+class StatsTest : public ::testing::Test {
+ protected:
+  const std::string kvsFileName = "StatsTest.db";
+  std::unique_ptr<Saavi> saavi;
+  SaaviOptions options;
+
+  void SetUp() override {
+#ifndef SAAVI_WITH_STATS
+    GTEST_SKIP() << "statistics are left out of the build";
+#endif
+    options.orderedIndex = true;
+    options.backgroundCompaction = false;
+  }
+
+  void TearDown() override {
+    saavi.reset();
+    if (!::testing::Test::HasFailure()) {
+      Saavi::Destroy(kvsFileName);
+    }
+  }
+
+  void open() { ASSERT_NO_THROW(saavi.reset(new Saavi(kvsFileName, options))); }
+
+  // a few operations of every kind
+  void run() {
+    saavi->Put("Key1", "Value1");
+    saavi->Put("Key2", "Value2");
+    saavi->Delete("Key2");
+    WriteBatch batch;
+    batch.Put("Key3", "Value3");
+    batch.Put("Key4", "Value4");
+    batch.Delete("Key1");
+    saavi->Write(batch);
+    EXPECT_EQ(saavi->Get("Key3"), "Value3");
+    EXPECT_EQ(saavi->Get("Key1"), "");
+    EXPECT_EQ(saavi->MultiGet({"Key3", "Key4", "Key5"}),
+              std::vector<std::string>({"Value3", "Value4", ""}));
+    for (auto it = saavi->Scan("", ""); it != saavi->end(); ++it) {
+    }
+  }
+};
+
+TEST_F(StatsTest, TestCounters) {
+  open();
+  run();
+  const SaaviStats stats = saavi->GetStats();
+  EXPECT_EQ(stats.gets, 5u);
+  EXPECT_EQ(stats.getHits, 3u);
+  EXPECT_EQ(stats.bytesRead, 18u);
+  EXPECT_EQ(stats.puts, 2u);
+  EXPECT_EQ(stats.deletes, 1u);
+  EXPECT_EQ(stats.batches, 1u);
+  EXPECT_EQ(stats.batchOperations, 3u);
+  EXPECT_EQ(stats.scans, 1u);
+  // Key1Value1, Key2Value2, Key2 and the keys and values of the batch
+  EXPECT_EQ(stats.bytesWritten, 10u + 10 + 4 + 10 + 10 + 4);
+  // only counted by default
+  EXPECT_EQ(stats.getLatency.count, 0u);
+
+  // the state of the store is always there
+  EXPECT_EQ(stats.keys, 2u);
+  EXPECT_GT(stats.indexMemory, 0u);
+  EXPECT_GT(stats.logLiveBytes, 0u);
+  EXPECT_GT(stats.logBytes, stats.logLiveBytes);
+  EXPECT_EQ(stats.blobBytes, 0u);
+  EXPECT_GT(stats.recoveryDuration.count(), 0);
+
+  // and it's all there for Prometheus
+  const std::string text = StatsToPrometheus(stats);
+  EXPECT_NE(text.find("# TYPE saavi_gets_total counter\nsaavi_gets_total 5\n"),
+            std::string::npos);
+  EXPECT_NE(text.find("saavi_keys 2\n"), std::string::npos);
+  EXPECT_NE(text.find("saavi_operation_latency_seconds_count{operation="
+                      "\"get\"} 0\n"),
+            std::string::npos);
+  EXPECT_NE(StatsToPrometheus(stats, "db").find("db_puts_total 2\n"),
+            std::string::npos);
+}
+
+TEST_F(StatsTest, TestLatencies) {
+  options.statistics = StatsLevel::Latencies;
+  open();
+  run();
+  const SaaviStats stats = saavi->GetStats();
+  EXPECT_EQ(stats.getLatency.count, 2u);
+  EXPECT_EQ(stats.multiGetLatency.count, 1u);
+  EXPECT_EQ(stats.putLatency.count, 2u);
+  EXPECT_EQ(stats.deleteLatency.count, 1u);
+  EXPECT_EQ(stats.writeLatency.count, 1u);
+  for (const auto &latencies :
+       {stats.getLatency, stats.multiGetLatency, stats.putLatency,
+        stats.deleteLatency, stats.writeLatency}) {
+    EXPECT_GT(latencies.p50, 0u);
+    EXPECT_LE(latencies.p50, latencies.p99);
+    EXPECT_LE(latencies.p99, latencies.p999);
+    EXPECT_LE(latencies.p999, latencies.max);
+    EXPECT_GT(latencies.mean, 0);
+    EXPECT_LE(latencies.mean, latencies.max);
+  }
+}
+
+TEST_F(StatsTest, TestDisabled) {
+  options.statistics = StatsLevel::None;
+  open();
+  run();
+  const SaaviStats stats = saavi->GetStats();
+  EXPECT_EQ(stats.gets, 0u);
+  EXPECT_EQ(stats.puts, 0u);
+  EXPECT_EQ(stats.getLatency.count, 0u);
+  EXPECT_EQ(stats.keys, 2u);
+}
+
+TEST_F(StatsTest, TestConcurrentCounters) {
+  options.statistics = StatsLevel::Latencies;
+  open();
+  const int numOfThreads = 8;
+  const int numOfOps = 1000;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < numOfThreads; t++) {
+    threads.emplace_back([this, t] {
+      for (int i = 0; i < numOfOps; i++) {
+        const std::string key = "Key" + std::to_string(t * numOfOps + i);
+        saavi->Put(key, "Value");
+        EXPECT_EQ(saavi->Get(key), "Value");
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  const SaaviStats stats = saavi->GetStats();
+  EXPECT_EQ(stats.puts, static_cast<uint64_t>(numOfThreads * numOfOps));
+  EXPECT_EQ(stats.getHits, static_cast<uint64_t>(numOfThreads * numOfOps));
+  EXPECT_EQ(stats.putLatency.count,
+            static_cast<uint64_t>(numOfThreads * numOfOps));
+}
+
+TEST_F(StatsTest, TestEngines) {
+  options.engine = StorageEngine::Lsm;
+  open();
+  run();
+  SaaviStats stats = saavi->GetStats();
+  EXPECT_EQ(stats.gets, 5u);
+  EXPECT_EQ(stats.puts, 2u);
+  saavi.reset();
+
+  {
+    ShardedSaavi sharded("StatsTestSharded.db", 4);
+    for (int i = 0; i < 100; i++) {
+      sharded.Put("Key" + std::to_string(i), "Value");
+    }
+    stats = sharded.GetStats();
+    EXPECT_EQ(stats.puts, 100u);
+    EXPECT_EQ(stats.keys, 100u);
+  }
+  ShardedSaavi::Destroy("StatsTestSharded.db");
+}
+
+// every value is counted in a bucket that ends no further than 1/32 above it
+TEST(LatencyHistogramTest, TestBuckets) {
+  size_t previous = 0;
+  for (uint64_t value = 0; value < (uint64_t(1) << 40);
+       value = value * 9 / 8 + 1) {
+    const size_t bucket = LatencyHistogram::bucketOf(value);
+    EXPECT_GE(bucket, previous);
+    EXPECT_LT(bucket, LatencyHistogram::NUM_OF_BUCKETS);
+    const uint64_t highest = LatencyHistogram::highestValueOf(bucket);
+    EXPECT_GE(highest, value);
+    EXPECT_LE(highest - value, value / 32);
+    if (bucket > 0) {
+      EXPECT_LT(LatencyHistogram::highestValueOf(bucket - 1), value);
+    }
+    previous = bucket;
+  }
+  EXPECT_EQ(LatencyHistogram::bucketOf(UINT64_MAX),
+            LatencyHistogram::NUM_OF_BUCKETS - 1);
+}
+
+// histograms counted apart add up to the one counting everything
+TEST(LatencyHistogramTest, TestMerge) {
+  LatencyHistogram all;
+  LatencyHistogram parts[2];
+  for (uint64_t value = 1; value <= 10000; value++) {
+    all.record(value * 7);
+    parts[value % 2].record(value * 7);
+  }
+  LatencyHistogram merged;
+  merged.merge(parts[0]);
+  merged.merge(parts[1]);
+  for (const LatencyHistogram *histogram : {&all, &merged}) {
+    EXPECT_EQ(histogram->count(), 10000u);
+    EXPECT_EQ(histogram->min(), 7u);
+    EXPECT_EQ(histogram->max(), 70000u);
+    EXPECT_DOUBLE_EQ(histogram->mean(), 7 * 5000.5);
+    EXPECT_EQ(histogram->percentile(100), 70000u);
+    const uint64_t p50 = histogram->percentile(50);
+    EXPECT_GE(p50, 35000u);
+    EXPECT_LE(p50, 35000u + 35000u / 32);
+  }
+}
@@ -1,3 +1,4 @@
+#include <cstring>
 #include <filesystem>
 
 #include "gtest/gtest.h"
@@ -15,8 +16,9 @@ class SaaviEnvironment : public ::testing::Environment {
           (std::filesystem::temp_directory_path() / "saaviTest-XXXXXX")
               .string();
       char tmpDirTemplateBuf[80];
-      strlcpy(tmpDirTemplateBuf, tmpDirTemplate.c_str(),
-              tmpDirTemplate.length() + 1);
+      strncpy(tmpDirTemplateBuf, tmpDirTemplate.c_str(),
+              sizeof(tmpDirTemplateBuf) - 1);
+      tmpDirTemplateBuf[sizeof(tmpDirTemplateBuf) - 1] = '\0';
       workDirectory = mkdtemp(tmpDirTemplateBuf);
 
       // Set current directory to workDirectory
@@ -0,0 +1,424 @@
+#include "workloads.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include "histogram.h"
+#include "key_generators.h"
+#include "saavi.h"
+
+namespace {
+
+enum Operation { READ, UPDATE, INSERT, SCAN, READ_MODIFY_WRITE };
+constexpr int NUM_OF_OPERATIONS = 5;
+const char *const OPERATION_NAMES[NUM_OF_OPERATIONS] = {
+    "read", "update", "insert", "scan", "read-modify-write"};
+
+// scans read between 1 and this many entries, as with YCSB
+constexpr unsigned MAX_SCAN_LENGTH = 100;
+
+// the core YCSB workloads - the percentage of every operation and how the
+// keys are picked
+struct Workload {
+  char name;
+  int percent[NUM_OF_OPERATIONS];
+  KeyDistribution distribution;
+  const char *description;
+};
+
+const Workload WORKLOADS[] = {
+    {'A', {50, 50, 0, 0, 0}, KeyDistribution::Zipfian,
+     "50% read, 50% update"},
+    {'B', {95, 5, 0, 0, 0}, KeyDistribution::Zipfian, "95% read, 5% update"},
+    {'C', {100, 0, 0, 0, 0}, KeyDistribution::Zipfian, "100% read"},
+    {'D', {95, 0, 5, 0, 0}, KeyDistribution::Latest, "95% read, 5% insert"},
+    {'E', {0, 0, 5, 95, 0}, KeyDistribution::Zipfian, "95% scan, 5% insert"},
+    {'F', {50, 0, 0, 0, 50}, KeyDistribution::Zipfian,
+     "50% read, 50% read-modify-write"},
+};
+
+const char *distributionName(KeyDistribution distribution) {
+  switch (distribution) {
+    case KeyDistribution::Uniform:
+      return "uniform";
+    case KeyDistribution::Zipfian:
+      return "zipfian";
+    case KeyDistribution::Latest:
+      return "latest";
+    default:
+      return "default";
+  }
+}
+
+// keys are hashed item numbers, so that neither the popular items nor the
+// inserted ones are next to each other in key order
+std::string keyOf(uint64_t item) {
+  return "user" + std::to_string(fnvHash64(item));
+}
+
+// the operations of one phase - the load or a workload run with a number
+// of threads - and their latencies
+struct PhaseResult {
+  std::string name;
+  std::string description;
+  unsigned threads{0};
+  uint64_t operations{0};
+  std::chrono::duration<double> elapsed{0};
+  std::vector<LatencyHistogram> latencies{NUM_OF_OPERATIONS};
+};
+
+// the items inserted so far are [0, inserted), of which the ones up to
+// latest are known to be in the store
+struct Items {
+  std::atomic<uint64_t> inserted{0};
+  std::atomic<uint64_t> latest{0};
+
+  void acknowledge(uint64_t item) {
+    uint64_t current = latest.load();
+    while (current < item && !latest.compare_exchange_weak(current, item)) {
+    }
+  }
+};
+
+// a value of the given size that differs from write to write
+class ValueGenerator {
+  std::string value;
+  uint64_t writes{0};
+
+ public:
+  ValueGenerator(size_t size, unsigned seed) : value(size, '\0') {
+    std::default_random_engine engine(seed);
+    std::uniform_int_distribution<int> printable('!', '~');
+    for (auto &c : value) {
+      c = static_cast<char>(printable(engine));
+    }
+  }
+
+  const std::string &next() {
+    const std::string id = std::to_string(writes++);
+    value.replace(0, std::min(id.length(), value.length()), id, 0,
+                  std::min(id.length(), value.length()));
+    return value;
+  }
+};
+
+std::string formatNanos(uint64_t nanos) {
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(1);
+  if (nanos >= 1000000000) {
+    out << nanos / 1e9 << "s";
+  } else if (nanos >= 1000000) {
+    out << nanos / 1e6 << "ms";
+  } else {
+    out << nanos / 1e3 << "us";
+  }
+  return out.str();
+}
+
+class WorkloadSuite {
+  const WorkloadSuiteOptions &options;
+  std::unique_ptr<Saavi> saavi;
+  Items items;
+  std::vector<PhaseResult> results;
+  std::vector<std::pair<std::string, std::chrono::duration<double>>> opens;
+  bool report;
+
+  // runs body(thread, ops, histograms, engine) on every thread, with ops
+  // operations per thread, and times the whole
+  template <typename Body>
+  PhaseResult runPhase(unsigned numOfThreads, Body body) {
+    PhaseResult result;
+    result.threads = numOfThreads;
+    std::vector<std::vector<LatencyHistogram>> latencies(
+        numOfThreads, std::vector<LatencyHistogram>(NUM_OF_OPERATIONS));
+    std::vector<std::thread> workers;
+    const auto start = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < numOfThreads; t++) {
+      const uint64_t numOfOps = options.operations / numOfThreads +
+                                (t < options.operations % numOfThreads);
+      workers.emplace_back([&, t, numOfOps] {
+        std::default_random_engine engine(t + 1);
+        body(t, numOfOps, latencies[t], engine);
+      });
+    }
+    for (auto &worker : workers) {
+      worker.join();
+    }
+    result.elapsed = std::chrono::steady_clock::now() - start;
+    for (const auto &threadLatencies : latencies) {
+      for (int op = 0; op < NUM_OF_OPERATIONS; op++) {
+        result.latencies[op].merge(threadLatencies[op]);
+        result.operations += threadLatencies[op].count();
+      }
+    }
+    return result;
+  }
+
+  void insert(ValueGenerator &values, LatencyHistogram &latencies) {
+    const uint64_t item = items.inserted++;
+    const auto start = std::chrono::steady_clock::now();
+    saavi->Put(keyOf(item), values.next());
+    latencies.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - start)
+                         .count());
+    items.acknowledge(item);
+  }
+
+  void load() {
+    // the load is split among as many threads as the workloads use at most
+    const unsigned numOfThreads =
+        *std::max_element(options.threads.begin(), options.threads.end());
+    PhaseResult result = runPhase(
+        numOfThreads, [&](unsigned t, uint64_t, auto &latencies, auto &) {
+          ValueGenerator values(options.valueSize, t);
+          for (uint64_t i = t; i < options.records; i += numOfThreads) {
+            insert(values, latencies[INSERT]);
+          }
+        });
+    result.name = "load";
+    result.description = "100% insert";
+    printResult(result);
+    results.push_back(std::move(result));
+  }
+
+  void run(const Workload &workload, unsigned numOfThreads) {
+    const KeyDistribution distribution =
+        options.distribution == KeyDistribution::Default
+            ? workload.distribution
+            : options.distribution;
+    // the skew is computed for the keys there are when the run starts
+    const uint64_t numOfItems = std::max<uint64_t>(items.latest + 1, 2);
+    const ZipfianGenerator zipfian(numOfItems);
+    const LatestGenerator latest(numOfItems);
+
+    PhaseResult result = runPhase(numOfThreads, [&](unsigned t,
+                                                    uint64_t numOfOps,
+                                                    auto &latencies,
+                                                    auto &engine) {
+      ZipfianGenerator zipfianItems = zipfian;
+      LatestGenerator latestItems = latest;
+      std::uniform_int_distribution<int> percent(0, 99);
+      std::uniform_int_distribution<unsigned> scanLength(1, MAX_SCAN_LENGTH);
+      ValueGenerator values(options.valueSize, t + numOfThreads);
+      PinnedValue value;
+
+      // a key of the ones known to be in the store
+      auto nextKey = [&] {
+        const uint64_t last = items.latest;
+        switch (distribution) {
+          case KeyDistribution::Uniform:
+            return keyOf(
+                std::uniform_int_distribution<uint64_t>(0, last)(engine));
+          case KeyDistribution::Latest:
+            return keyOf(latestItems(engine, last));
+          default:
+            return keyOf(std::min(zipfianItems(engine), last));
+        }
+      };
+
+      for (uint64_t i = 0; i < numOfOps; i++) {
+        int op = 0;
+        for (int p = percent(engine); p >= workload.percent[op];
+             p -= workload.percent[op++]) {
+        }
+        if (op == INSERT) {
+          insert(values, latencies[INSERT]);
+          continue;
+        }
+
+        const std::string key = nextKey();
+        const auto start = std::chrono::steady_clock::now();
+        switch (op) {
+          case READ:
+            saavi->Get(key, value);
+            break;
+          case UPDATE:
+            saavi->Put(key, values.next());
+            break;
+          case SCAN: {
+            const unsigned length = scanLength(engine);
+            unsigned scanned = 0;
+            for (auto it = saavi->Scan(key, "");
+                 it != saavi->end() && scanned < length; ++it) {
+              scanned++;
+            }
+            break;
+          }
+          case READ_MODIFY_WRITE:
+            saavi->Get(key, value);
+            saavi->Put(key, values.next());
+            break;
+        }
+        latencies[op].record(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count());
+      }
+    });
+    result.name = std::string(1, workload.name);
+    result.description = std::string(workload.description) + ", " +
+                         distributionName(distribution);
+    printResult(result);
+    results.push_back(std::move(result));
+  }
+
+  // time taken to open the store as left by the workloads, with the hint
+  // file the close wrote and by replaying the log
+  void open(const SaaviOptions &saaviOptions) {
+    saavi.reset();
+    auto timeOpen = [&] {
+      const auto start = std::chrono::steady_clock::now();
+      std::unique_ptr<Saavi> reopened(
+          new Saavi(options.filename, saaviOptions));
+      return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                           start);
+    };
+    if (options.engine == StorageEngine::Lsm) {
+      opens.emplace_back("open", timeOpen());
+    } else {
+      opens.emplace_back("open with hint file", timeOpen());
+      std::filesystem::remove(options.filename + ".hint");
+      opens.emplace_back("open by replaying the log", timeOpen());
+    }
+    if (report) {
+      const std::string header = "Open Benchmark Results";
+      std::cout << header << "\n"
+                << std::string(header.length(), '-') << "\n";
+      for (const auto &open : opens) {
+        std::cout << open.first << " with " << items.inserted << " keys : "
+                  << formatNanos(std::chrono::duration_cast<
+                                     std::chrono::nanoseconds>(open.second)
+                                     .count())
+                  << "\n";
+      }
+      std::cout << "\n";
+    }
+  }
+
+  void printResult(const PhaseResult &result) const {
+    if (!report) {
+      return;
+    }
+    std::cout << result.name << " (" << result.description << "), "
+              << result.threads << " threads : "
+              << result.operations / result.elapsed.count()
+              << " operations per second\n";
+    for (int op = 0; op < NUM_OF_OPERATIONS; op++) {
+      const LatencyHistogram &latencies = result.latencies[op];
+      if (latencies.count() == 0) {
+        continue;
+      }
+      std::cout << "  " << OPERATION_NAMES[op]
+                << " : p50 = " << formatNanos(latencies.percentile(50))
+                << ", p99 = " << formatNanos(latencies.percentile(99))
+                << ", p999 = " << formatNanos(latencies.percentile(99.9))
+                << ", max = " << formatNanos(latencies.max()) << "\n";
+    }
+  }
+
+  void writeJson(std::ostream &out) const {
+    out << "{\n  \"config\": {\"engine\": \""
+        << (options.engine == StorageEngine::Lsm ? "lsm" : "log")
+        << "\", \"records\": " << options.records
+        << ", \"operations\": " << options.operations
+        << ", \"value_size\": " << options.valueSize
+        << ", \"distribution\": \"" << distributionName(options.distribution)
+        << "\", \"hardware_threads\": " << std::thread::hardware_concurrency()
+        << "},\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+      const PhaseResult &result = results[i];
+      out << (i > 0 ? "," : "") << "\n    {\"workload\": \"" << result.name
+          << "\", \"description\": \"" << result.description
+          << "\", \"threads\": " << result.threads
+          << ", \"operations\": " << result.operations
+          << ", \"seconds\": " << result.elapsed.count()
+          << ", \"ops_per_second\": "
+          << result.operations / result.elapsed.count()
+          << ",\n     \"latency_ns\": {";
+      bool first = true;
+      for (int op = 0; op < NUM_OF_OPERATIONS; op++) {
+        const LatencyHistogram &latencies = result.latencies[op];
+        if (latencies.count() == 0) {
+          continue;
+        }
+        out << (first ? "" : ",") << "\n       \"" << OPERATION_NAMES[op]
+            << "\": {\"count\": " << latencies.count()
+            << ", \"mean\": " << latencies.mean()
+            << ", \"min\": " << latencies.min()
+            << ", \"p50\": " << latencies.percentile(50)
+            << ", \"p99\": " << latencies.percentile(99)
+            << ", \"p999\": " << latencies.percentile(99.9)
+            << ", \"max\": " << latencies.max() << "}";
+        first = false;
+      }
+      out << "}}";
+    }
+    out << "\n  ],\n  \"open\": [";
+    for (size_t i = 0; i < opens.size(); i++) {
+      out << (i > 0 ? "," : "") << "\n    {\"name\": \"" << opens[i].first
+          << "\", \"keys\": " << items.inserted
+          << ", \"seconds\": " << opens[i].second.count() << "}";
+    }
+    out << "\n  ]\n}\n";
+  }
+
+ public:
+  explicit WorkloadSuite(const WorkloadSuiteOptions &options)
+      : options(options), report(options.jsonFilename != "-") {}
+
+  void run() {
+    SaaviOptions saaviOptions;
+    saaviOptions.engine = options.engine;
+    // workload E scans
+    saaviOptions.orderedIndex =
+        options.workloads.find('E') != std::string::npos;
+    Saavi::Destroy(options.filename);
+    saavi.reset(new Saavi(options.filename, saaviOptions));
+
+    if (report) {
+      const std::string header = "Workload Benchmark Results";
+      std::cout << header << "\n"
+                << std::string(header.length(), '-') << "\n";
+    }
+    load();
+    for (char name : options.workloads) {
+      const Workload *workload = std::find_if(
+          std::begin(WORKLOADS), std::end(WORKLOADS),
+          [name](const Workload &w) { return w.name == name; });
+      if (workload == std::end(WORKLOADS)) {
+        continue;
+      }
+      for (unsigned numOfThreads : options.threads) {
+        run(*workload, numOfThreads);
+      }
+    }
+    if (report) {
+      std::cout << "\n";
+    }
+    open(saaviOptions);
+    Saavi::Destroy(options.filename);
+
+    if (!report) {
+      writeJson(std::cout);
+      return;
+    }
+    std::ofstream json(options.jsonFilename);
+    writeJson(json);
+    std::cout << "Results written to " << options.jsonFilename << "\n";
+  }
+};
+
+}  // namespace
+
+void runWorkloadSuite(const WorkloadSuiteOptions &options) {
+  WorkloadSuite(options).run();
+}
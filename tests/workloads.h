@@ -0,0 +1,44 @@
+#ifndef WORKLOADS_H
+#define WORKLOADS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "saavi_options.h"
+
+// how the keys of the operations are picked
+enum class KeyDistribution {
+  // the one the workload itself uses
+  Default,
+  Uniform,
+  // a few keys are much more popular than the rest
+  Zipfian,
+  // the most recently inserted keys are the most popular
+  Latest,
+};
+
+// A run of the YCSB style workload suite. The store is preloaded with
+// records keys, then each workload runs on it, in the given order, once
+// for every thread count. The inserts of a workload stay for the ones
+// after it, as they do with YCSB.
+struct WorkloadSuiteOptions {
+  // the workloads to run, out of "ABCDEF"
+  std::string workloads{"ABCDEF"};
+  KeyDistribution distribution{KeyDistribution::Default};
+  // number of keys loaded before the workloads run
+  uint64_t records{100000};
+  // number of operations of every workload, split among the threads
+  uint64_t operations{100000};
+  std::vector<unsigned> threads{1};
+  size_t valueSize{1000};
+  StorageEngine engine{StorageEngine::Log};
+  std::string filename{"/tmp/workloads.db"};
+  // where the results are written as JSON, "-" writes them to the standard
+  // output instead of the readable report
+  std::string jsonFilename{"saavi_benchmark.json"};
+};
+
+void runWorkloadSuite(const WorkloadSuiteOptions &options);
+
+#endif